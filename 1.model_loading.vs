@@ -1,16 +1,36 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+layout (location = 1) in vec2 aNormal; // octahedral encoded, see vertex_format.h
 layout (location = 2) in vec2 aTexCoords;
 
 out vec2 TexCoords;
+out vec3 Normal;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// shared blocks, see uniform_buffer.h (std140 offsets are fixed, so declaring the leading members is enough)
+layout (std140) uniform FrameUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+layout (std140) uniform ObjectUniforms
+{
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+// inverse of VertexPacker::octEncode
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
 
 void main()
 {
     TexCoords = aTexCoords;    
+    Normal = mat3(normalMatrix) * octDecode(aNormal);
     gl_Position = projection * view * model * vec4(aPos, 1.0);
-}
\ No newline at end of file
+}
@@ -0,0 +1,876 @@
+// Headless benchmarks and self-checks of the renderer's CPU-side systems. Needs no window or GL context.
+//
+//   opengl-bench             runs every section
+//   opengl-bench culling     runs the named sections only
+//
+// Every section checks its results against a simple reference first; the exit code is non-zero if any check fails.
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "block_compressor.h"
+#include "bvh.h"
+#include "frustum_culling.h"
+#include "light_clusters.h"
+#include "mesh_simplifier.h"
+#include "mip_filter.h"
+#include "render_graph.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(condition)                                                              \
+    do                                                                                \
+    {                                                                                 \
+        if (!(condition))                                                             \
+        {                                                                             \
+            printf("[bench] FAILED %s:%d: %s\n", __FILE__, __LINE__, #condition);     \
+            failures++;                                                               \
+        }                                                                             \
+    } while (0)
+
+// average milliseconds per call of fn over at least minMs of wall time
+static double timeMs(const std::function<void()> &fn, double minMs = 200.0)
+{
+    fn(); // warm up
+    int iterations = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    do
+    {
+        fn();
+        iterations++;
+        elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < minMs);
+    return elapsed / iterations;
+}
+
+// random boxes in a cube of the given half size
+static std::vector<Bounds> randomBounds(size_t count, float halfSize, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> position(-halfSize, halfSize), size(0.1f, 3.0f);
+    std::vector<Bounds> bounds(count);
+    for (Bounds &b : bounds)
+    {
+        glm::vec3 center(position(rng), position(rng), position(rng));
+        glm::vec3 extent(size(rng), size(rng), size(rng));
+        b = Bounds::fromMinMax(center - extent, center + extent);
+    }
+    return bounds;
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// frustum culling (frustum_culling.h)
+// ---------------------------------------------------------------------------------------------------------------
+static void benchCulling()
+{
+    printf("[bench] culling: %d objects per batch\n", FRUSTUM_CULLING_WIDTH);
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.2f, 0.3f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = Frustum::fromMatrix(projection * view);
+
+    // batched test agrees with the scalar reference, including empty bounds and a count that isn't a batch multiple
+    {
+        std::vector<Bounds> bounds = randomBounds(10003, 120.0f, 1);
+        for (size_t i = 0; i < bounds.size(); i += 97)
+            bounds[i] = Bounds();
+        CullingSet set;
+        for (const Bounds &b : bounds)
+            set.add(b);
+        std::vector<uint32_t> visible;
+        set.cull(frustum, visible);
+        size_t mismatches = 0, expected = 0, next = 0;
+        for (size_t i = 0; i < bounds.size(); i++)
+        {
+            bool inside = frustum.intersects(bounds[i]);
+            bool reported = next < visible.size() && visible[next] == i;
+            next += reported;
+            expected += inside;
+            mismatches += inside != reported;
+        }
+        CHECK(mismatches == 0);
+        CHECK(next == visible.size());
+        CHECK(set.stats.tested == bounds.size() && set.stats.visible == expected && set.stats.culled == bounds.size() - expected);
+    }
+
+    // known cases: in front of the camera, behind it, beyond the far plane, straddling a side plane
+    {
+        glm::mat4 lookDownZ = projection * glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        Frustum f = Frustum::fromMatrix(lookDownZ);
+        CHECK(f.intersects(Bounds::fromMinMax(glm::vec3(-1.0f, -1.0f, -11.0f), glm::vec3(1.0f, 1.0f, -9.0f))));
+        CHECK(!f.intersects(Bounds::fromMinMax(glm::vec3(-1.0f, -1.0f, 9.0f), glm::vec3(1.0f, 1.0f, 11.0f))));
+        CHECK(!f.intersects(Bounds::fromMinMax(glm::vec3(-1.0f, -1.0f, -111.0f), glm::vec3(1.0f, 1.0f, -109.0f))));
+        CHECK(f.intersects(Bounds::fromMinMax(glm::vec3(3.0f, -1.0f, -11.0f), glm::vec3(30.0f, 1.0f, -9.0f))));
+        CHECK(!f.intersects(Bounds()));
+    }
+
+    // transformed and merged bounds still contain the original volumes
+    {
+        Bounds box = Bounds::fromMinMax(glm::vec3(-1.0f, -2.0f, -0.5f), glm::vec3(1.0f, 2.0f, 0.5f));
+        glm::mat4 model = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(5.0f, 0.0f, -3.0f)), 0.7f, glm::vec3(0.3f, 1.0f, 0.2f));
+        Bounds moved = box.transformed(model);
+        bool contained = true;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            glm::vec3 local(corner & 1 ? 1.0f : -1.0f, corner & 2 ? 2.0f : -2.0f, corner & 4 ? 0.5f : -0.5f);
+            glm::vec3 p = glm::vec3(model * glm::vec4(local, 1.0f));
+            glm::vec3 d = glm::abs(p - moved.center) - moved.extent;
+            contained = contained && d.x <= 1e-4f && d.y <= 1e-4f && d.z <= 1e-4f && glm::length(p - moved.center) <= moved.radius + 1e-4f;
+        }
+        CHECK(contained);
+        Bounds other = Bounds::fromMinMax(glm::vec3(4.0f), glm::vec3(6.0f));
+        Bounds both = box.merged(other);
+        CHECK(glm::length(other.max() - both.center) <= both.radius + 1e-4f && glm::length(box.min() - both.center) <= both.radius + 1e-4f);
+    }
+
+    // throughput
+    printf("[bench] %10s %12s %12s %14s %10s\n", "objects", "batched ms", "scalar ms", "Mobjects/s", "visible");
+    for (size_t count : {1000, 10000, 100000, 1000000})
+    {
+        std::vector<Bounds> bounds = randomBounds(count, 200.0f, 2);
+        CullingSet set;
+        for (const Bounds &b : bounds)
+            set.add(b);
+        std::vector<uint32_t> visible;
+        visible.reserve(count);
+        double batchedMs = timeMs([&]() {
+            visible.clear();
+            set.cull(frustum, visible);
+        });
+        size_t scalarVisible = 0;
+        double scalarMs = timeMs([&]() {
+            scalarVisible = 0;
+            for (const Bounds &b : bounds)
+                scalarVisible += frustum.intersects(b);
+        });
+        CHECK(scalarVisible == visible.size());
+        printf("[bench] %10zu %12.4f %12.4f %14.1f %10zu\n", count, batchedMs, scalarMs, count / batchedMs / 1000.0, visible.size());
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// BVH (bvh.h)
+// ---------------------------------------------------------------------------------------------------------------
+static void benchBvh()
+{
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 800.0f / 600.0f, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(1.0f, 0.2f, 0.3f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum = Frustum::fromMatrix(projection * view);
+
+    printf("[bench] bvh: %u hardware threads\n", std::thread::hardware_concurrency());
+    printf("[bench] %10s %10s %10s %10s %10s %12s %12s %12s %10s\n", "objects", "build ms", "par. ms", "refit ms", "SAH ratio", "query ms", "flat ms", "1k rays ms", "visible");
+    for (size_t count : {10000, 1000000})
+    {
+        // denser than the culling scene so the frustum sees a few percent of the objects
+        float halfSize = 40.0f * std::cbrt(count / 10000.0f);
+        std::vector<Bounds> bounds = randomBounds(count, halfSize, 3);
+
+        Bvh bvh;
+        double buildMs = timeMs([&]() { bvh.build(bounds); }, 100.0);
+        float serialCost = bvh.sahCost();
+        Bvh parallel;
+        double parallelMs = timeMs([&]() { parallel.build(bounds, &ThreadPool::shared()); }, 100.0);
+        CHECK(parallel.size() == bvh.size());
+        CHECK(std::fabs(parallel.sahCost() - serialCost) <= serialCost * 1e-3f);
+
+        // frustum query matches the brute force test
+        std::vector<uint32_t> visible;
+        bvh.query(frustum, visible);
+        std::sort(visible.begin(), visible.end());
+        std::vector<uint32_t> expected;
+        for (uint32_t i = 0; i < count; i++)
+            if (frustum.intersects(bounds[i]))
+                expected.push_back(i);
+        CHECK(visible == expected);
+
+        double queryMs = timeMs([&]() {
+            visible.clear();
+            bvh.query(frustum, visible);
+        });
+        CullingSet flat;
+        for (const Bounds &b : bounds)
+            flat.add(b);
+        double flatMs = timeMs([&]() {
+            visible.clear();
+            flat.cull(frustum, visible);
+        });
+
+        // rays from the centre in random directions; nearest box hit matches brute force
+        std::mt19937 rng(4);
+        std::normal_distribution<float> gaussian;
+        std::vector<Ray> rays(1000);
+        for (Ray &ray : rays)
+        {
+            ray.origin = glm::vec3(0.0f);
+            ray.direction = glm::normalize(glm::vec3(gaussian(rng), gaussian(rng), gaussian(rng)));
+        }
+        auto boxHit = [&](const Ray &ray, uint32_t object, float maxT) {
+            glm::vec3 inverseDirection(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+            return ray.intersectBox(bounds[object].min(), bounds[object].max(), inverseDirection, maxT);
+        };
+        size_t rayMismatches = 0;
+        for (size_t r = 0; r < 50; r++)
+        {
+            float t = FLT_MAX, expectedT = FLT_MAX;
+            bvh.intersect(rays[r], [&](uint32_t object, float maxT) { return boxHit(rays[r], object, maxT); }, &t);
+            for (uint32_t i = 0; i < count; i++)
+                expectedT = std::min(expectedT, boxHit(rays[r], i, FLT_MAX));
+            rayMismatches += std::fabs(t - expectedT) > 1e-4f * std::max(1.0f, expectedT);
+        }
+        CHECK(rayMismatches == 0);
+        double raysMs = timeMs([&]() {
+            for (const Ray &ray : rays)
+                bvh.intersect(ray, [&](uint32_t object, float maxT) { return boxHit(ray, object, maxT); });
+        });
+
+        // move 10% of the objects a little and refit
+        std::uniform_real_distribution<float> jitter(-1.0f, 1.0f);
+        std::vector<Bounds> moved = bounds;
+        for (size_t i = 0; i < count; i += 10)
+        {
+            glm::vec3 offset(jitter(rng), jitter(rng), jitter(rng));
+            moved[i].center += offset;
+        }
+        double refitMs = timeMs([&]() {
+            for (size_t i = 0; i < count; i += 10)
+                bvh.update((uint32_t)i, moved[i]);
+            bvh.refit();
+        }, 100.0);
+        visible.clear();
+        bvh.query(frustum, visible);
+        std::sort(visible.begin(), visible.end());
+        expected.clear();
+        for (uint32_t i = 0; i < count; i++)
+            if (frustum.intersects(moved[i]))
+                expected.push_back(i);
+        CHECK(visible == expected);
+
+        printf("[bench] %10zu %10.2f %10.2f %10.3f %10.3f %12.4f %12.4f %12.3f %10zu\n", count, buildMs, parallelMs, refitMs,
+               bvh.sahCost() / serialCost, queryMs, flatMs, raysMs, expected.size());
+    }
+
+    // ray vs triangle: a unit quad at z = -5 placed with a transform
+    {
+        glm::vec3 quad[4] = {glm::vec3(-1.0f, -1.0f, 0.0f), glm::vec3(1.0f, -1.0f, 0.0f), glm::vec3(1.0f, 1.0f, 0.0f), glm::vec3(-1.0f, 1.0f, 0.0f)};
+        uint32_t indices[6] = {0, 1, 2, 0, 2, 3};
+        glm::mat4 model = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -5.0f)), glm::vec3(2.0f));
+        Ray ray = {glm::vec3(0.5f, 1.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)};
+        uint32_t triangle = ~0u;
+        float t = ray.intersectTriangles(quad, indices, 6, model, &triangle);
+        CHECK(std::fabs(t - 5.0f) < 1e-4f && triangle == 1);
+        Ray miss = {glm::vec3(3.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)};
+        CHECK(miss.intersectTriangles(quad, indices, 6, model) == FLT_MAX);
+        // the screen centre ray looks straight down the view direction
+        Ray centre = Ray::fromScreen(400.0f, 300.0f, 800.0f, 600.0f, glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f)), projection);
+        CHECK(glm::length(centre.direction - glm::vec3(0.0f, 0.0f, -1.0f)) < 1e-4f);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// LOD generation and selection (mesh_simplifier.h)
+// ---------------------------------------------------------------------------------------------------------------
+struct BenchVertex {
+    glm::vec3 Position;
+    glm::vec3 Normal;
+    glm::vec2 TexCoords;
+};
+
+// a uv sphere with its uv seam at u = 0/1 and one vertex per column at the poles, like most exported spheres
+static void uvSphere(unsigned int columns, unsigned int rows, std::vector<BenchVertex> &vertices, std::vector<unsigned int> &indices)
+{
+    const float pi = 3.14159265f;
+    for (unsigned int y = 0; y <= rows; y++)
+        for (unsigned int x = 0; x <= columns; x++)
+        {
+            float u = (float)x / columns, v = (float)y / rows;
+            glm::vec3 n(std::cos(u * 2.0f * pi) * std::sin(v * pi), std::cos(v * pi), std::sin(u * 2.0f * pi) * std::sin(v * pi));
+            vertices.push_back({n, n, glm::vec2(u, v)});
+        }
+    for (unsigned int y = 0; y < rows; y++)
+        for (unsigned int x = 0; x < columns; x++)
+        {
+            unsigned int a = y * (columns + 1) + x, b = a + 1, c = a + columns + 1, d = c + 1;
+            if (y > 0)
+                indices.insert(indices.end(), {a, b, c});
+            if (y + 1 < rows)
+                indices.insert(indices.end(), {b, d, c});
+        }
+}
+
+static void benchLod()
+{
+    // sphere, indexed and as an unwelded triangle soup (one vertex per corner, as some importers deliver it)
+    std::vector<BenchVertex> sphere, soup;
+    std::vector<unsigned int> sphereIndices, soupIndices;
+    uvSphere(256, 128, sphere, sphereIndices);
+    for (unsigned int index : sphereIndices)
+    {
+        soupIndices.push_back((unsigned int)soup.size());
+        soup.push_back(sphere[index]);
+    }
+
+    printf("[bench] %-8s %8s %10s %12s %10s\n", "mesh", "level", "triangles", "error", "ms");
+    struct Case {
+        const char *name;
+        const std::vector<BenchVertex> *vertices;
+        const std::vector<unsigned int> *indices;
+    };
+    std::vector<SimplifiedLod> sphereLods;
+    for (const Case &test : {Case{"sphere", &sphere, &sphereIndices}, Case{"soup", &soup, &soupIndices}})
+    {
+        std::vector<SimplifiedLod> lods;
+        double ms = timeMs([&]() { lods = MeshSimplifier::buildLods(test.vertices->data(), test.vertices->size(), *test.indices); }, 100.0);
+        CHECK(lods.size() == MAX_MESH_LODS - 1);
+        size_t previous = test.indices->size() / 3;
+        float previousError = 0.0f;
+        printf("[bench] %-8s %8d %10zu %12s %10.2f\n", test.name, 0, previous, "-", ms);
+        for (size_t level = 0; level < lods.size(); level++)
+        {
+            const SimplifiedLod &lod = lods[level];
+            size_t triangles = lod.indices.size() / 3;
+            printf("[bench] %-8s %8zu %10zu %12.6f\n", test.name, level + 1, triangles, lod.error);
+            CHECK(triangles < previous * 0.75f && triangles > previous * 0.25f);
+            CHECK(lod.error >= previousError && lod.error <= 0.05f);
+            size_t outOfRange = 0, acrossSeam = 0, offSurface = 0;
+            for (size_t i = 0; i < lod.indices.size(); i += 3)
+            {
+                float uMin = FLT_MAX, uMax = -FLT_MAX;
+                glm::vec3 centroid(0.0f);
+                for (int k = 0; k < 3; k++)
+                {
+                    unsigned int index = lod.indices[i + k];
+                    if (index >= test.vertices->size())
+                    {
+                        outOfRange++;
+                        continue;
+                    }
+                    const BenchVertex &vertex = (*test.vertices)[index];
+                    uMin = std::min(uMin, vertex.TexCoords.x);
+                    uMax = std::max(uMax, vertex.TexCoords.x);
+                    centroid += vertex.Position / 3.0f;
+                }
+                // a triangle spanning most of the u range wraps around the seam with the wrong uvs
+                acrossSeam += uMax - uMin > 0.5f;
+                // the coarse surface stays within a few times the reported error of the sphere
+                offSurface += 1.0f - glm::length(centroid) > 4.0f * lod.error + 1e-3f;
+            }
+            CHECK(outOfRange == 0);
+            CHECK(acrossSeam == 0);
+            CHECK(offSurface == 0);
+            previous = triangles;
+            previousError = lod.error;
+        }
+        if (test.vertices == &sphere)
+            sphereLods = lods;
+        else
+            CHECK(lods.back().indices.size() <= sphereLods.back().indices.size() * 1.1f);
+    }
+
+    // a flat grid has no curvature to preserve: it collapses to a handful of triangles with no error, and its
+    // border stays where it is
+    {
+        std::vector<BenchVertex> grid;
+        std::vector<unsigned int> gridIndices;
+        const unsigned int size = 64;
+        for (unsigned int y = 0; y <= size; y++)
+            for (unsigned int x = 0; x <= size; x++)
+                grid.push_back({glm::vec3((float)x, 0.0f, (float)y), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec2((float)x / size, (float)y / size)});
+        for (unsigned int y = 0; y < size; y++)
+            for (unsigned int x = 0; x < size; x++)
+            {
+                unsigned int a = y * (size + 1) + x, b = a + 1, c = a + size + 1, d = c + 1;
+                gridIndices.insert(gridIndices.end(), {a, c, b, b, c, d});
+            }
+        std::vector<SimplifiedLod> lods = MeshSimplifier::buildLods(grid.data(), grid.size(), gridIndices, 8);
+        CHECK(!lods.empty());
+        if (!lods.empty())
+        {
+            const SimplifiedLod &last = lods.back();
+            glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+            float area = 0.0f;
+            for (size_t i = 0; i < last.indices.size(); i += 3)
+            {
+                glm::vec3 p0 = grid[last.indices[i]].Position, p1 = grid[last.indices[i + 1]].Position, p2 = grid[last.indices[i + 2]].Position;
+                area += glm::length(glm::cross(p1 - p0, p2 - p0)) * 0.5f;
+                for (const glm::vec3 &p : {p0, p1, p2})
+                {
+                    minimum = glm::min(minimum, p);
+                    maximum = glm::max(maximum, p);
+                }
+            }
+            printf("[bench] %-8s %8zu %10zu %12.6f\n", "grid", lods.size(), last.indices.size() / 3, last.error);
+            CHECK(last.error < 1e-4f);
+            CHECK(minimum == glm::vec3(0.0f) && maximum == glm::vec3((float)size, 0.0f, (float)size));
+            CHECK(std::fabs(area - size * size) < 1e-2f);
+        }
+    }
+
+    // a camera flying away from the sphere and back: the triangles it would submit with and without LODs, and how
+    // often the level switches. Jittering around one distance must not switch every frame.
+    {
+        // a tenth of a pixel, or the sphere would never need its full detail level outside of itself
+        LodSelector selector = LodSelector::perspective(glm::vec3(0.0f), glm::radians(45.0f), 600.0f, 0.1f);
+        auto errorOf = [&](unsigned int level) { return level == 0 ? 0.0f : sphereLods[level - 1].error; };
+        auto trianglesOf = [&](unsigned int level) { return level == 0 ? sphereIndices.size() / 3 : sphereLods[level - 1].indices.size() / 3; };
+        unsigned int count = (unsigned int)sphereLods.size() + 1;
+        size_t fullTriangles = 0, lodTriangles = 0;
+        unsigned int level = 0, switches = 0, frames = 0;
+        for (int frame = 0; frame < 2000; frame++, frames++)
+        {
+            float distance = 1.5f + 98.5f * (frame < 1000 ? frame : 1999 - frame) / 999.0f;
+            glm::vec3 center(0.0f, 0.0f, -distance);
+            unsigned int next = selector.select(count, selector.projectedRadius(center, 1.0f), 1.0f, level, errorOf);
+            switches += next != level;
+            level = next;
+            fullTriangles += trianglesOf(0);
+            lodTriangles += trianglesOf(level);
+        }
+        CHECK(level == 0);
+        CHECK(switches == 2 * (count - 1));
+        unsigned int jitterSwitches = 0;
+        for (int frame = 0; frame < 200; frame++)
+        {
+            // around the distance where level 1 becomes acceptable
+            float switchDistance = errorOf(1) * selector.pixelsPerUnit / selector.pixelError;
+            glm::vec3 center(0.0f, 0.0f, -switchDistance * (frame % 2 ? 1.05f : 0.95f));
+            unsigned int next = selector.select(count, selector.projectedRadius(center, 1.0f), 1.0f, level, errorOf);
+            jitterSwitches += next != level;
+            level = next;
+        }
+        CHECK(jitterSwitches <= 1);
+        printf("[bench] fly-by: %.0f triangles per frame without LODs, %.0f with (%.1fx fewer), %u level switches, %u while jittering\n",
+               (double)fullTriangles / frames, (double)lodTriangles / frames, (double)fullTriangles / lodTriangles, switches, jitterSwitches);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// mip filter (mip_filter.h)
+// ---------------------------------------------------------------------------------------------------------------
+static void benchMips()
+{
+    // a black and white checkerboard averages to linear 0.5: 188 in sRGB, 128 when the bytes are averaged as stored
+    const unsigned char checker[2 * 2 * 4] = {0, 0, 0, 0, 255, 255, 255, 255, 255, 255, 255, 255, 0, 0, 0, 0};
+    unsigned char texel[4];
+    MipFilter::downsample(checker, 2, 2, texel, 4, true);
+    CHECK(texel[0] == 188 && texel[1] == 188 && texel[2] == 188 && texel[3] == 128);
+    MipFilter::downsample(checker, 2, 2, texel, 4, false);
+    CHECK(texel[0] == 128 && texel[3] == 128);
+    // every byte survives a 1x1 "filter" unchanged
+    bool roundTrip = true;
+    for (int value = 0; value < 256; value++)
+    {
+        unsigned char in[3] = {(unsigned char)value, (unsigned char)value, (unsigned char)value}, out[3];
+        MipFilter::downsample(in, 1, 1, out, 3, true);
+        roundTrip = roundTrip && out[0] == value && out[2] == value;
+    }
+    CHECK(roundTrip);
+
+    printf("[bench] %-14s %10s %12s %8s\n", "mips", "simd ms", "reference ms", "MB/s");
+    std::mt19937 rng(7);
+    for (int components = 1; components <= 4; components++)
+    {
+        // odd sizes exercise the clamped edges
+        const int width = 1023, height = 517;
+        std::vector<unsigned char> src((size_t)width * height * components);
+        for (unsigned char &value : src)
+            value = (unsigned char)(rng() & 0xFF);
+        int dstW = MipFilter::levelSize(width), dstH = MipFilter::levelSize(height);
+        std::vector<unsigned char> simd((size_t)dstW * dstH * components), reference(simd.size());
+        for (bool srgb : {false, true})
+        {
+            MipFilter::downsample(src.data(), width, height, simd.data(), components, srgb);
+            MipFilter::downsampleReference(src.data(), width, height, reference.data(), components, srgb);
+            int maxDifference = 0;
+            for (size_t i = 0; i < simd.size(); i++)
+                maxDifference = std::max(maxDifference, std::abs((int)simd[i] - (int)reference[i]));
+            CHECK(maxDifference == 0);
+
+            double simdMs = timeMs([&]() { MipFilter::downsample(src.data(), width, height, simd.data(), components, srgb); }, 100.0);
+            double referenceMs = timeMs([&]() { MipFilter::downsampleReference(src.data(), width, height, reference.data(), components, srgb); }, 100.0);
+            char name[32];
+            snprintf(name, sizeof(name), "%d ch %s", components, srgb ? "srgb" : "linear");
+            printf("[bench] %-14s %10.3f %12.3f %8.0f\n", name, simdMs, referenceMs, src.size() / (simdMs * 1000.0));
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// block compression (block_compressor.h)
+// ---------------------------------------------------------------------------------------------------------------
+// smooth colour gradients with a little noise, alpha running along x and a unit normal map in red and green
+static std::vector<unsigned char> gradientImage(int width, int height, bool normalMap, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<unsigned char> rgba((size_t)width * height * 4);
+    for (int y = 0; y < height; y++)
+        for (int x = 0; x < width; x++)
+        {
+            unsigned char *texel = &rgba[((size_t)y * width + x) * 4];
+            float u = (float)x / width, v = (float)y / height;
+            int noise = (int)(rng() % 7) - 3;
+            if (normalMap)
+            {
+                glm::vec3 n = glm::normalize(glm::vec3(0.4f * std::sin(u * 40.0f), 0.4f * std::cos(v * 30.0f), 1.0f));
+                texel[0] = (unsigned char)std::clamp((int)std::lround((n.x * 0.5f + 0.5f) * 255.0f) + noise, 0, 255);
+                texel[1] = (unsigned char)std::clamp((int)std::lround((n.y * 0.5f + 0.5f) * 255.0f) - noise, 0, 255);
+                texel[2] = (unsigned char)std::lround((n.z * 0.5f + 0.5f) * 255.0f);
+                texel[3] = 255;
+                continue;
+            }
+            texel[0] = (unsigned char)std::clamp((int)(u * 255.0f) + noise, 0, 255);
+            texel[1] = (unsigned char)std::clamp((int)(v * 255.0f) + noise, 0, 255);
+            texel[2] = (unsigned char)std::clamp((int)((1.0f - u) * v * 255.0f) + noise, 0, 255);
+            texel[3] = (unsigned char)(u * 255.0f);
+        }
+    return rgba;
+}
+
+static void benchBlockCompression()
+{
+    // a flat block decodes to within half a 5/6 bit step of its colour, whatever the colour
+    int worstFlat = 0;
+    std::mt19937 rng(11);
+    for (int i = 0; i < 256; i++)
+    {
+        unsigned char in[64], out[64], block[16];
+        unsigned char color[4] = {(unsigned char)(rng() & 0xFF), (unsigned char)(rng() & 0xFF), (unsigned char)(rng() & 0xFF), (unsigned char)(rng() & 0xFF)};
+        for (int t = 0; t < 16; t++)
+            memcpy(in + t * 4, color, 4);
+        BlockCompressor::encodeBlock(BLOCK_BC3, in, block);
+        BlockCompressor::decodeBlock(BLOCK_BC3, block, out);
+        for (int k = 0; k < 64; k++)
+            worstFlat = std::max(worstFlat, std::abs((int)in[k] - (int)out[k]));
+    }
+    CHECK(worstFlat <= 4);
+
+    // opaque images pick BC1, translucent ones BC3, normal maps BC5, and 1/2 channel images stay as they are
+    const unsigned char opaque[4] = {1, 2, 3, 255}, translucent[4] = {1, 2, 3, 254};
+    CHECK(BlockCompressor::choose(opaque, 1, 1, 4, false) == BLOCK_BC1);
+    CHECK(BlockCompressor::choose(translucent, 1, 1, 4, false) == BLOCK_BC3);
+    CHECK(BlockCompressor::choose(opaque, 1, 1, 3, true) == BLOCK_BC5);
+    CHECK(BlockCompressor::choose(opaque, 1, 1, 2, false) == BLOCK_NONE);
+
+    printf("[bench] %-14s %10s %8s %8s\n", "bc", "ms", "Mpx/s", "PSNR dB");
+    // not a multiple of 4 either way, so the edge blocks are covered
+    const int width = 1022, height = 510;
+    size_t texels = (size_t)width * height;
+    const struct {
+        const char *name;
+        BlockFormat format;
+        bool normalMap;
+        int channels;       // compared by PSNR
+        double minimumPsnr;
+    } cases[] = {
+        {"bc1", BLOCK_BC1, false, 3, 38.0},
+        {"bc3", BLOCK_BC3, false, 4, 38.0},
+        {"bc5", BLOCK_BC5, true, 2, 42.0},
+    };
+    for (const auto &c : cases)
+    {
+        std::vector<unsigned char> rgba = gradientImage(width, height, c.normalMap, 3);
+        std::vector<unsigned char> blocks(BlockCompressor::levelSize(c.format, width, height)), decoded(rgba.size());
+        BlockCompressor::compress(rgba.data(), width, height, 4, c.format, blocks.data());
+        BlockCompressor::decompress(blocks.data(), width, height, c.format, decoded.data());
+        double psnr = BlockCompressor::psnr(rgba.data(), decoded.data(), texels, c.channels);
+        CHECK(psnr >= c.minimumPsnr);
+
+        // the threaded encode is the same as encoding the blocks one by one
+        std::vector<unsigned char> serial(blocks.size());
+        unsigned char block[64];
+        int blocksWide = (width + 3) / 4;
+        for (int by = 0; by < (height + 3) / 4; by++)
+            for (int bx = 0; bx < blocksWide; bx++)
+            {
+                for (int t = 0; t < 16; t++)
+                {
+                    int x = std::min(bx * 4 + t % 4, width - 1), y = std::min(by * 4 + t / 4, height - 1);
+                    memcpy(block + t * 4, &rgba[((size_t)y * width + x) * 4], 4);
+                }
+                BlockCompressor::encodeBlock(c.format, block, &serial[((size_t)by * blocksWide + bx) * BlockCompressor::blockBytes(c.format)]);
+            }
+        CHECK(serial == blocks);
+
+        double ms = timeMs([&]() { BlockCompressor::compress(rgba.data(), width, height, 4, c.format, blocks.data()); }, 300.0);
+        printf("[bench] %-14s %10.3f %8.1f %8.2f\n", c.name, ms, texels / (ms * 1000.0), psnr);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// clustered light assignment (light_clusters.h)
+// ---------------------------------------------------------------------------------------------------------------
+// lights scattered over a street sized block in front of the camera
+static std::vector<ClusterLight> randomLights(size_t count, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> x(-40.0f, 40.0f), y(0.0f, 10.0f), z(-90.0f, 10.0f), radius(1.0f, 4.0f), color(0.2f, 1.0f);
+    std::vector<ClusterLight> lights(count);
+    for (ClusterLight &light : lights)
+    {
+        light.position = glm::vec3(x(rng), y(rng), z(rng));
+        light.radius = radius(rng);
+        light.color = glm::vec3(color(rng), color(rng), color(rng));
+    }
+    return lights;
+}
+
+static void benchClusters()
+{
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 1280.0f / 720.0f, 0.1f, 100.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 5.0f, 12.0f), glm::vec3(0.0f, 0.0f, -40.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    LightClusters clusters;
+    clusters.setProjection(projection, 0.1f, 100.0f);
+    printf("[bench] clusters: %dx%dx%d, %d tiles per batch\n", clusters.sizeX(), clusters.sizeY(), clusters.sizeZ(), LIGHT_CLUSTERS_WIDTH);
+
+    std::vector<ClusterLight> lights = randomLights(2000, 5);
+    // one light right at the camera, so the near plane case is covered
+    lights[0].position = glm::vec3(0.0f, 5.0f, 12.0f);
+    clusters.assign(lights, view);
+
+    // the lists are contiguous and sorted, and every entry passes the sphere/box test: no false positives
+    bool contiguous = true, sorted = true, touching = true;
+    uint32_t expectedOffset = 0;
+    for (int c = 0; c < clusters.clusterCount(); c++)
+    {
+        uint32_t offset = clusters.grid[(size_t)c * 2], count = clusters.grid[(size_t)c * 2 + 1];
+        contiguous = contiguous && offset == expectedOffset;
+        expectedOffset = offset + count;
+        glm::vec3 lo, hi;
+        clusters.clusterBounds(c, lo, hi);
+        for (uint32_t n = 0; n < count && expectedOffset <= clusters.indices.size(); n++)
+        {
+            uint32_t light = clusters.indices[offset + n];
+            sorted = sorted && (n == 0 || clusters.indices[offset + n - 1] < light);
+            glm::vec3 center = glm::vec3(view * glm::vec4(lights[light].position, 1.0f));
+            touching = touching && LightClusters::sphereTouchesBox(center, lights[light].radius, lo, hi);
+        }
+    }
+    CHECK(contiguous && expectedOffset == clusters.indices.size());
+    CHECK(sorted);
+    CHECK(touching);
+    CHECK(clusters.stats.indices == clusters.indices.size());
+    CHECK(clusters.stats.visible > 0 && clusters.stats.visible < lights.size());
+
+    // what the shader relies on: a point inside a light's sphere finds the light in the cluster it falls in.
+    // Brute force over every light for random points in the frustum; a hair inside the radius, so a point that
+    // rounds into the neighbouring slice right at a boundary doesn't count.
+    std::mt19937 rng(9);
+    std::uniform_real_distribution<float> unit(-1.0f, 1.0f), depth01(0.0f, 1.0f);
+    glm::mat4 inverseProjection = glm::inverse(projection);
+    int points = 0, missing = 0, referenced = 0;
+    for (int p = 0; p < 20000; p++)
+    {
+        // uniform on screen, exponential in depth like the slices
+        float depth = 0.1f * std::pow(1000.0f, depth01(rng));
+        glm::vec4 direction = inverseProjection * glm::vec4(unit(rng), unit(rng), -1.0f, 1.0f);
+        glm::vec3 viewPoint = glm::vec3(direction) / -direction.z * depth;
+        int cluster = clusters.clusterOf(viewPoint);
+        if (cluster < 0)
+            continue;
+        points++;
+        const uint32_t *first = &clusters.indices[0] + clusters.grid[(size_t)cluster * 2];
+        const uint32_t *last = first + clusters.grid[(size_t)cluster * 2 + 1];
+        for (uint32_t l = 0; l < lights.size(); l++)
+        {
+            glm::vec3 center = glm::vec3(view * glm::vec4(lights[l].position, 1.0f));
+            if (glm::length(viewPoint - center) >= lights[l].radius * 0.999f)
+                continue;
+            referenced++;
+            if (!std::binary_search(first, last, l))
+                missing++;
+        }
+    }
+    CHECK(points > 10000);
+    CHECK(referenced > 1000);
+    CHECK(missing == 0);
+
+    // brute force over every light/cluster pair: the same test without the candidate ranges finds no more than
+    // the clusters' bulge past their tiles (the boxes are a little larger than the frustum pieces they bound)
+    size_t brute = 0;
+    for (int c = 0; c < clusters.clusterCount(); c++)
+    {
+        glm::vec3 lo, hi;
+        clusters.clusterBounds(c, lo, hi);
+        for (const ClusterLight &light : lights)
+            brute += LightClusters::sphereTouchesBox(glm::vec3(view * glm::vec4(light.position, 1.0f)), light.radius, lo, hi);
+    }
+    CHECK(brute >= clusters.indices.size() && brute < clusters.indices.size() * 2);
+
+    printf("[bench] %-14s %10s %10s %10s %10s %8s\n", "clusters", "ms", "ns/light", "visible", "indices", "max");
+    for (size_t count : {(size_t)100, (size_t)1000, (size_t)10000, (size_t)100000})
+    {
+        std::vector<ClusterLight> many = randomLights(count, 17);
+        double ms = timeMs([&]() { clusters.assign(many, view); }, 300.0);
+        char name[32];
+        snprintf(name, sizeof(name), "assign %zu", count);
+        printf("[bench] %-14s %10.3f %10.1f %10u %10zu %8u\n", name, ms, ms * 1e6 / count, clusters.stats.visible, clusters.stats.indices,
+               clusters.stats.maxPerCluster);
+    }
+}
+
+// ---------------------------------------------------------------------------------------------------------------
+// render graph compilation (render_graph.h)
+// ---------------------------------------------------------------------------------------------------------------
+// the frame main.cpp declares headless, as a forward or deferred frame
+static RenderGraph frameGraph(bool deferred)
+{
+    RenderGraph graph;
+    int sceneColor = graph.createTarget("scene colour", {TARGET_RGB8});
+    int sceneDepth = graph.createTarget("scene depth", {TARGET_DEPTH24_STENCIL8});
+    int output = graph.createTarget("output", {TARGET_RGBA8});
+    graph.markOutput(output);
+    int albedoSpecular = graph.createTarget("gAlbedoSpecular", {TARGET_RGBA8});
+    int normal = graph.createTarget("gNormal", {TARGET_RG16});
+    graph.addPass("gbuffer", {}, {albedoSpecular, normal, sceneDepth}, [] {});
+    graph.addPass("deferred lighting", {albedoSpecular, normal, sceneDepth}, {sceneColor}, [] {});
+    graph.addPass("scene", deferred ? std::vector<int>{sceneColor, sceneDepth} : std::vector<int>{}, {sceneColor, sceneDepth}, [] {});
+    graph.addPass("post", {sceneColor}, {output}, [] {});
+    return graph;
+}
+
+// count passes, each reading up to two targets of earlier passes and writing one or two new ones, a few of which
+// are outputs
+static RenderGraph randomGraph(size_t count, unsigned int seed)
+{
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int> format(TARGET_RGB8, TARGET_DEPTH24_STENCIL8), reads(0, 2), writes(1, 2), outputOdds(0, 15);
+    std::uniform_real_distribution<float> scale(0.0f, 1.0f);
+    RenderGraph graph;
+    for (size_t p = 0; p < count; p++)
+    {
+        std::vector<int> in, out;
+        for (int r = reads(rng); r > 0 && !graph.targets.empty(); r--)
+        {
+            int t = std::uniform_int_distribution<int>(0, (int)graph.targets.size() - 1)(rng);
+            if (std::find(in.begin(), in.end(), t) == in.end())
+                in.push_back(t);
+        }
+        for (int w = writes(rng); w > 0; w--)
+        {
+            RenderTargetDesc desc;
+            desc.format = (RenderTargetFormat)format(rng);
+            desc.scale = scale(rng) < 0.3f ? 0.5f : 1.0f;
+            int t = graph.createTarget("random", desc);
+            if (outputOdds(rng) == 0)
+                graph.markOutput(t);
+            out.push_back(t);
+        }
+        graph.addPass("random", in, out, [] {});
+    }
+    return graph;
+}
+
+static void benchGraph()
+{
+    // a deferred frame keeps every pass, and the G-buffer albedo is done before the output is first written
+    RenderGraph deferred = frameGraph(true);
+    CHECK(deferred.compile(1920, 1080));
+    CHECK(deferred.stats.culledPasses == 0 && deferred.order.size() == 4);
+    CHECK(deferred.targets[3].slot == deferred.targets[2].slot);
+    CHECK(deferred.stats.physicalTargets == 4);
+    CHECK(deferred.stats.aliasedBytes == deferred.stats.unaliasedBytes - 1920 * 1080 * 4);
+    deferred.printStats();
+    // a forward frame clears the scene targets, so nothing needs the deferred passes
+    RenderGraph forward = frameGraph(false);
+    CHECK(forward.compile(1920, 1080));
+    CHECK(forward.stats.culledPasses == 2 && forward.order == std::vector<int>({2, 3}));
+    CHECK(forward.targets[3].slot < 0 && forward.targets[4].slot < 0);
+    forward.printStats();
+
+    // an imported target is needed without being marked, and reading what nothing wrote is an error
+    RenderGraph broken;
+    int screen = broken.importTarget("screen", 0);
+    int never = broken.createTarget("never written", {TARGET_RGBA8});
+    broken.addPass("present", {never}, {screen}, [] {});
+    CHECK(!broken.compile(64, 64));
+    CHECK(broken.order.size() == 1);
+
+    // random graphs against the reference: every target is written once, so a pass is needed when it writes an
+    // output or a target some needed pass reads. Aliased targets have the same format and size and lifetimes
+    // that don't overlap.
+    bool culled = true, aliased = true, ordered = true, bounded = true;
+    for (unsigned int seed = 0; seed < 50; seed++)
+    {
+        RenderGraph graph = randomGraph(60, seed);
+        CHECK(graph.compile(1280, 720));
+        std::vector<char> neededTarget(graph.targets.size(), 0), neededPass(graph.passes.size(), 0);
+        for (size_t t = 0; t < graph.targets.size(); t++)
+            neededTarget[t] = graph.targets[t].output;
+        for (size_t p = graph.passes.size(); p-- > 0;)
+        {
+            for (int t : graph.passes[p].writes)
+                neededPass[p] = neededPass[p] || neededTarget[t];
+            if (neededPass[p])
+                for (int t : graph.passes[p].reads)
+                    neededTarget[t] = 1;
+        }
+        for (size_t p = 0; p < graph.passes.size(); p++)
+            culled = culled && graph.passes[p].culled == !neededPass[p];
+        ordered = ordered && std::is_sorted(graph.order.begin(), graph.order.end());
+        for (size_t a = 0; a < graph.targets.size(); a++)
+            for (size_t b = a + 1; b < graph.targets.size(); b++)
+            {
+                const RenderGraph::Target &ta = graph.targets[a], &tb = graph.targets[b];
+                if (ta.slot < 0 || ta.slot != tb.slot)
+                    continue;
+                aliased = aliased && ta.desc.format == tb.desc.format && ta.width == tb.width && ta.height == tb.height &&
+                          (ta.lastPass < tb.firstPass || tb.lastPass < ta.firstPass);
+            }
+        bounded = bounded && graph.stats.peakLiveBytes <= graph.stats.aliasedBytes && graph.stats.aliasedBytes <= graph.stats.unaliasedBytes;
+    }
+    CHECK(culled);
+    CHECK(aliased);
+    CHECK(ordered);
+    CHECK(bounded);
+
+    printf("[bench] %-14s %10s %10s %12s %12s %12s\n", "graph", "ms", "culled", "unaliased MB", "aliased MB", "peak MB");
+    for (size_t count : {(size_t)10, (size_t)100, (size_t)1000})
+    {
+        RenderGraph graph = randomGraph(count, 11);
+        double ms = timeMs([&]() { graph.compile(1920, 1080); }, 200.0);
+        char name[32];
+        snprintf(name, sizeof(name), "compile %zu", count);
+        double mb = 1.0 / (1024.0 * 1024.0);
+        printf("[bench] %-14s %10.4f %10u %12.1f %12.1f %12.1f\n", name, ms, graph.stats.culledPasses, graph.stats.unaliasedBytes * mb,
+               graph.stats.aliasedBytes * mb, graph.stats.peakLiveBytes * mb);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct Section {
+        const char *name;
+        void (*run)();
+    };
+    const Section sections[] = {
+        {"culling", benchCulling},
+        {"bvh", benchBvh},
+        {"lod", benchLod},
+        {"mips", benchMips},
+        {"bc", benchBlockCompression},
+        {"clusters", benchClusters},
+        {"graph", benchGraph},
+    };
+
+    for (const Section &section : sections)
+    {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; i++)
+            selected = selected || strcmp(argv[i], section.name) == 0;
+        if (selected)
+            section.run();
+    }
+
+    if (failures)
+        printf("[bench] %d check(s) failed\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,545 @@
+// CPU micro-benchmarks of the asset and geometry paths that dominate startup. No window or GL context is created,
+// only the CPU halves of the loaders run; inputs are procedural or come from resources/.
+//
+//   opengl-microbench                          runs every section
+//   opengl-microbench decode                   runs the named sections only
+//   opengl-microbench modelcache --model path  loads another model than resources/objects/backpack/backpack.obj
+//
+// Every row reports the time per operation, throughput and the heap allocations (operator new and stb_image's
+// mallocs) per operation. Run from the repository root so resources/ is found.
+
+#include <glad/glad.h>
+
+#include <stdlib.h>
+
+// decoded images are counted as allocations too
+static void *countedMalloc(size_t size);
+static void *countedRealloc(void *pointer, size_t size);
+#define STBI_MALLOC(size) countedMalloc(size)
+#define STBI_REALLOC(pointer, size) countedRealloc(pointer, size)
+#define STBI_FREE(pointer) free(pointer)
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "camera.h"
+#include "mesh_optimizer.h"
+#include "model.h"
+#include "texture_loader.h"
+#include "vertex_format.h"
+
+#include "minimesh.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <functional>
+#include <new>
+#include <string>
+#include <vector>
+
+static std::atomic<uint64_t> allocationCount{0};
+static std::atomic<uint64_t> allocatedBytes{0};
+
+static void *countedMalloc(size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    return malloc(size);
+}
+
+static void *countedRealloc(void *pointer, size_t size)
+{
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    return realloc(pointer, size);
+}
+
+void *operator new(size_t size)
+{
+    void *pointer = countedMalloc(size ? size : 1);
+    if (!pointer)
+        throw std::bad_alloc();
+    return pointer;
+}
+
+void operator delete(void *pointer) noexcept { free(pointer); }
+void operator delete(void *pointer, size_t) noexcept { free(pointer); }
+
+// what one operation does to the counters, averaged over a timed loop of at least minMs
+struct Measurement {
+    double ms = 0.0;
+    double allocations = 0.0;
+    double allocatedKB = 0.0;
+};
+
+static Measurement measure(const std::function<void()> &fn, double minMs = 300.0)
+{
+    fn(); // warm up
+    uint64_t allocationsBefore = allocationCount.load(), bytesBefore = allocatedBytes.load();
+    int iterations = 0;
+    auto start = std::chrono::steady_clock::now();
+    double elapsed = 0.0;
+    do
+    {
+        fn();
+        iterations++;
+        elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    } while (elapsed < minMs);
+    Measurement m;
+    m.ms = elapsed / iterations;
+    m.allocations = (double)(allocationCount.load() - allocationsBefore) / iterations;
+    m.allocatedKB = (double)(allocatedBytes.load() - bytesBefore) / iterations / 1024.0;
+    return m;
+}
+
+// one result row; items and bytes are per operation, either may be 0 to leave the column empty
+static void report(const char *name, const Measurement &m, double items, const char *itemName, double bytes)
+{
+    char itemRate[32] = "", byteRate[32] = "";
+    if (items > 0.0)
+        snprintf(itemRate, sizeof(itemRate), "%.2f M%s/s", items / m.ms / 1000.0, itemName);
+    if (bytes > 0.0)
+        snprintf(byteRate, sizeof(byteRate), "%.1f MB/s", bytes / m.ms / 1000.0);
+    printf("[microbench] %-44s %10.4f ms %18s %12s %10.1f allocs %10.1f KB\n", name, m.ms, itemRate, byteRate, m.allocations, m.allocatedKB);
+}
+
+// a UV sphere as Assimp hands it over after aiProcess_CalcTangentSpace: positions, normals, uvs, tangents and
+// bitangents, one aiFace per triangle. Freed by ~aiMesh.
+static aiMesh *sphereMesh(unsigned int columns, unsigned int rows)
+{
+    aiMesh *mesh = new aiMesh();
+    mesh->mNumVertices = (columns + 1) * (rows + 1);
+    mesh->mVertices = new aiVector3D[mesh->mNumVertices];
+    mesh->mNormals = new aiVector3D[mesh->mNumVertices];
+    mesh->mTangents = new aiVector3D[mesh->mNumVertices];
+    mesh->mBitangents = new aiVector3D[mesh->mNumVertices];
+    mesh->mTextureCoords[0] = new aiVector3D[mesh->mNumVertices];
+    unsigned int v = 0;
+    for (unsigned int y = 0; y <= rows; y++)
+        for (unsigned int x = 0; x <= columns; x++, v++)
+        {
+            float u = (float)x / columns, t = (float)y / rows;
+            float theta = u * 6.2831853f, phi = t * 3.1415927f;
+            glm::vec3 n(std::sin(phi) * std::cos(theta), std::cos(phi), std::sin(phi) * std::sin(theta));
+            glm::vec3 tangent(-std::sin(theta), 0.0f, std::cos(theta));
+            glm::vec3 bitangent = glm::cross(n, tangent);
+            mesh->mVertices[v] = aiVector3D(n.x, n.y, n.z);
+            mesh->mNormals[v] = aiVector3D(n.x, n.y, n.z);
+            mesh->mTangents[v] = aiVector3D(tangent.x, tangent.y, tangent.z);
+            mesh->mBitangents[v] = aiVector3D(bitangent.x, bitangent.y, bitangent.z);
+            mesh->mTextureCoords[0][v] = aiVector3D(u, t, 0.0f);
+        }
+    mesh->mNumFaces = columns * rows * 2;
+    mesh->mFaces = new aiFace[mesh->mNumFaces];
+    unsigned int f = 0;
+    for (unsigned int y = 0; y < rows; y++)
+        for (unsigned int x = 0; x < columns; x++)
+        {
+            unsigned int a = y * (columns + 1) + x, b = a + 1, c = a + columns + 1, d = c + 1;
+            const unsigned int triangles[2][3] = {{a, c, b}, {b, c, d}};
+            for (const auto &triangle : triangles)
+            {
+                aiFace &face = mesh->mFaces[f++];
+                face.mNumIndices = 3;
+                face.mIndices = new unsigned int[3];
+                memcpy(face.mIndices, triangle, sizeof(triangle));
+            }
+        }
+    return mesh;
+}
+
+// Model::processNode / processMesh without the GL upload: extractMesh, the optimizer and vertex packing, over a
+// scene of several meshes
+static void benchImport()
+{
+    const unsigned int meshCount = 8;
+    std::vector<aiMesh *> meshes;
+    size_t sceneVertices = 0, sceneTriangles = 0;
+    for (unsigned int i = 0; i < meshCount; i++)
+    {
+        meshes.push_back(sphereMesh(128 + 32 * i, 64 + 16 * i));
+        sceneVertices += meshes.back()->mNumVertices;
+        sceneTriangles += meshes.back()->mNumFaces;
+    }
+    printf("[microbench] import: %u meshes, %zu vertices, %zu triangles\n", meshCount, sceneVertices, sceneTriangles);
+
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<unsigned char> packed;
+    report("Model::extractMesh (reused buffers)", measure([&] {
+               for (aiMesh *mesh : meshes)
+                   Model::extractMesh(mesh, vertices, indices);
+           }),
+           (double)sceneVertices, "verts", (double)sceneVertices * sizeof(Vertex));
+    report("Model::extractMesh (fresh buffers)", measure([&] {
+               for (aiMesh *mesh : meshes)
+               {
+                   std::vector<Vertex> meshVertices;
+                   std::vector<unsigned int> meshIndices;
+                   Model::extractMesh(mesh, meshVertices, meshIndices);
+               }
+           }),
+           (double)sceneVertices, "verts", (double)sceneVertices * sizeof(Vertex));
+
+    // the CPU work processMesh does per mesh with the default load options, minus texture lookups and upload
+    report("processMesh CPU path (extract+layout+pack)", measure([&] {
+               for (aiMesh *mesh : meshes)
+               {
+                   Model::extractMesh(mesh, vertices, indices);
+                   VertexLayout layout = VertexPacker::chooseLayout(vertices, true, false);
+                   VertexPacker::pack(vertices, layout, packed);
+               }
+           }),
+           (double)sceneVertices, "verts", (double)sceneVertices * sizeof(Vertex));
+
+    Model::extractMesh(meshes[0], vertices, indices);
+    std::vector<unsigned int> optimized;
+    std::vector<Vertex> reordered;
+    report("MeshOptimizer::optimize (mesh 0)", measure([&] {
+               optimized = indices;
+               reordered = vertices;
+               MeshOptimizer::optimize(optimized, reordered);
+           }),
+           (double)vertices.size(), "verts", 0.0);
+
+    for (aiMesh *mesh : meshes)
+        delete mesh;
+}
+
+// TextureFromFile / Model::loadMaterialTextures decode through TextureLoader::decode; every image in
+// resources/textures, with and without the mip chain
+static void benchDecode()
+{
+    std::vector<std::string> files;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator("resources/textures", error))
+        if (entry.is_regular_file() && entry.path().extension() != ".texcache")
+            files.push_back(entry.path().string());
+    std::sort(files.begin(), files.end());
+    if (files.empty())
+    {
+        printf("[microbench] decode: no images in resources/textures, run from the repository root\n");
+        return;
+    }
+    stbi_set_flip_vertically_on_load(true);
+    for (const std::string &file : files)
+    {
+        double fileBytes = (double)std::filesystem::file_size(file, error);
+        DecodedImage probe = TextureLoader::decode(file, false);
+        if (!probe.valid())
+        {
+            printf("[microbench] decode: could not decode %s\n", file.c_str());
+            continue;
+        }
+        double pixels = (double)probe.width * probe.height;
+        printf("[microbench] %s: %dx%d, %d channels, %.0f KB on disk\n", file.c_str(), probe.width, probe.height, probe.components, fileBytes / 1024.0);
+        report("  TextureLoader::decode (file MB/s)", measure([&] { TextureLoader::decode(file, false); }), pixels, "px", fileBytes);
+        report("  TextureLoader::decode + mips (file MB/s)", measure([&] { TextureLoader::decode(file, true); }), pixels, "px", fileBytes);
+    }
+}
+
+// loadTexture and TextureCache bake every image into a texture container on first use (texture_loader.h); what
+// a load costs from the PNG/JPEG (decode and sRGB-correct mips) against mapping the container and reading every
+// level once, as the upload does. Writes the containers next to the images in resources/textures.
+static void benchContainer()
+{
+    std::vector<std::string> files;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator("resources/textures", error))
+        if (entry.is_regular_file() && entry.path().extension() != ".texcache")
+            files.push_back(entry.path().string());
+    std::sort(files.begin(), files.end());
+    if (files.empty())
+    {
+        printf("[microbench] container: no images in resources/textures, run from the repository root\n");
+        return;
+    }
+    std::vector<unsigned char> scratch;
+    for (const std::string &file : files)
+    {
+        // the first flipped decode bakes the container
+        TextureLoader::decode(file, true, 1, true);
+        DecodedImage mapped = TextureLoader::decode(file, true, 1, true);
+        if (!mapped.valid() || !mapped.container)
+        {
+            printf("[microbench] container: could not bake %s\n", file.c_str());
+            continue;
+        }
+        double pixels = (double)mapped.width * mapped.height;
+        double bytes = (double)mapped.byteSize();
+        scratch.resize(mapped.byteSize());
+        printf("[microbench] %s: %dx%d, %d channels, %zu levels, %.0f KB baked\n", file.c_str(), mapped.width, mapped.height, mapped.components, mapped.levelOffsets.size(), bytes / 1024.0);
+        Measurement decode = measure([&] { TextureLoader::decode(file, true, -1, true); });
+        Measurement load = measure([&] {
+            DecodedImage image = TextureLoader::decode(file, true, 1, true);
+            size_t offset = 0;
+            for (size_t level = 0; level < image.levelOffsets.size(); level++)
+            {
+                memcpy(scratch.data() + offset, image.levelData((int)level), image.levelBytes((int)level));
+                offset += image.levelBytes((int)level);
+            }
+        });
+        report("  decode + sRGB mips (texel MB/s)", decode, pixels, "px", bytes);
+        report("  container map + read (texel MB/s)", load, pixels, "px", bytes);
+        printf("[microbench]   container load is %.1fx faster\n", load.ms > 0.0 ? decode.ms / load.ms : 0.0);
+    }
+}
+
+// Model::loadTexture with compressTextures encodes every level with BlockCompressor once, when the container is
+// baked; the encode rate and quality on level 0 of every image in resources/textures (files with "normal" in
+// their name are treated as normal maps)
+static void benchCompress()
+{
+    std::vector<std::string> files;
+    std::error_code error;
+    for (const auto &entry : std::filesystem::directory_iterator("resources/textures", error))
+        if (entry.is_regular_file() && entry.path().extension() != ".texcache")
+            files.push_back(entry.path().string());
+    std::sort(files.begin(), files.end());
+    if (files.empty())
+    {
+        printf("[microbench] compress: no images in resources/textures, run from the repository root\n");
+        return;
+    }
+    static const char *formatNames[] = {"none", "BC1", "BC3", "BC5"};
+    for (const std::string &file : files)
+    {
+        DecodedImage image = TextureLoader::decode(file, false);
+        if (!image.valid())
+        {
+            printf("[microbench] compress: could not decode %s\n", file.c_str());
+            continue;
+        }
+        bool normalMap = std::filesystem::path(file).filename().string().find("normal") != std::string::npos;
+        BlockFormat format = BlockCompressor::choose(image.pixels.data(), image.width, image.height, image.components, normalMap);
+        if (format == BLOCK_NONE)
+        {
+            printf("[microbench] %s: %d channels, left uncompressed\n", file.c_str(), image.components);
+            continue;
+        }
+        size_t texels = (size_t)image.width * image.height;
+        std::vector<unsigned char> blocks(BlockCompressor::levelSize(format, image.width, image.height));
+        std::vector<unsigned char> rgba(texels * 4), decoded(texels * 4);
+        BlockCompressor::compress(image.pixels.data(), image.width, image.height, image.components, format, blocks.data());
+        BlockCompressor::toRgba(image.pixels.data(), texels, image.components, rgba.data());
+        BlockCompressor::decompress(blocks.data(), image.width, image.height, format, decoded.data());
+        int channels = format == BLOCK_BC5 ? 2 : format == BLOCK_BC3 ? 4 : 3;
+        printf("[microbench] %s: %dx%d, %s, %.0f KB -> %.0f KB, PSNR %.2f dB\n", file.c_str(), image.width, image.height, formatNames[format],
+               texels * image.components / 1024.0, blocks.size() / 1024.0, BlockCompressor::psnr(rgba.data(), decoded.data(), texels, channels));
+        Measurement encode = measure([&] { BlockCompressor::compress(image.pixels.data(), image.width, image.height, image.components, format, blocks.data()); });
+        report("  BlockCompressor::compress (texel MB/s)", encode, (double)texels, "px", (double)texels * image.components);
+    }
+}
+
+static std::string modelPath = "resources/objects/backpack/backpack.obj";
+
+// a mesh as Model::processMesh leaves it before the upload, owning what ModelCache::MeshSource points at
+struct ImportedMesh {
+    std::vector<unsigned char> vertices;
+    std::vector<uint16_t> indices;
+    size_t vertexCount = 0;
+    VertexLayout layout;
+    std::vector<MeshRange> ranges;
+    std::vector<MeshLod> lods;
+    std::vector<ModelCache::TextureRef> textures;
+    Bounds bounds;
+};
+
+// Model::processNode and processMesh minus the upload, with the default ModelLoadOptions
+static void importNode(const aiNode *node, const aiScene *scene, std::vector<ModelCacheNode> &nodes, std::vector<ImportedMesh> &meshes)
+{
+    size_t nodeIndex = nodes.size();
+    nodes.push_back({(uint32_t)meshes.size(), 0});
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    for (unsigned int i = 0; i < node->mNumMeshes; i++)
+    {
+        const aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
+        meshes.emplace_back();
+        ImportedMesh &imported = meshes.back();
+        Model::extractMesh(mesh, vertices, indices);
+        Model::materialTextures(scene->mMaterials[mesh->mMaterialIndex], imported.textures);
+        MeshOptimizer::optimize(indices, vertices);
+        imported.layout = VertexPacker::chooseLayout(vertices, mesh->mTextureCoords[0] && mesh->mTangents, mesh->HasBones());
+        Mesh::buildRanges(vertices, indices, MAX_MESH_LODS, imported.ranges, imported.lods);
+        imported.bounds = Bounds::fromPoints(vertices.data(), vertices.size(), sizeof(Vertex));
+        VertexPacker::pack(vertices, imported.layout, imported.vertices);
+        imported.vertexCount = vertices.size();
+        imported.indices.assign(indices.begin(), indices.end());
+    }
+    for (unsigned int i = 0; i < node->mNumChildren; i++)
+        importNode(node->mChildren[i], scene, nodes, meshes);
+    nodes[nodeIndex].meshEnd = (uint32_t)meshes.size();
+}
+
+// Model::loadModel cold, through Assimp, against warm, from the model cache. Both stop where the upload would
+// start and leave the textures out: the cold path imports and builds the packed streams, ranges and LODs, the warm
+// path maps and validates the cache and copies the same out of it, as loadFromCache does. Writes the cache next to
+// the model.
+static void benchModelCache()
+{
+    if (!std::filesystem::exists(modelPath))
+    {
+        printf("[microbench] modelcache: no %s, run from the repository root or pass --model\n", modelPath.c_str());
+        return;
+    }
+    ModelLoadOptions options;
+    std::vector<ModelCacheNode> nodes;
+    std::vector<ImportedMesh> meshes;
+    bool imported = false;
+    // an import can take seconds, so only the warm up and one timed run
+    Measurement cold = measure([&] {
+        nodes.clear();
+        meshes.clear();
+        Assimp::Importer importer;
+        const aiScene *scene = importer.ReadFile(modelPath, MODEL_IMPORT_FLAGS);
+        imported = scene && !(scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE) && scene->mRootNode;
+        if (imported)
+            importNode(scene->mRootNode, scene, nodes, meshes);
+    }, 0.0);
+    if (!imported)
+    {
+        printf("[microbench] modelcache: could not import %s\n", modelPath.c_str());
+        return;
+    }
+
+    std::vector<ModelCache::MeshSource> sources(meshes.size());
+    size_t vertices = 0, streamBytes = 0;
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        sources[i].vertices = meshes[i].vertices.data();
+        sources[i].vertexCount = meshes[i].vertexCount;
+        sources[i].layout = meshes[i].layout;
+        sources[i].indices = meshes[i].indices.data();
+        sources[i].indexCount = meshes[i].indices.size();
+        sources[i].indexSize = sizeof(uint16_t);
+        sources[i].ranges = meshes[i].ranges;
+        sources[i].lods = meshes[i].lods;
+        sources[i].textures = meshes[i].textures;
+        sources[i].bounds = meshes[i].bounds;
+        vertices += meshes[i].vertexCount;
+        streamBytes += meshes[i].vertices.size() + meshes[i].indices.size() * sizeof(uint16_t);
+    }
+    if (!ModelCache::write(modelPath, MODEL_IMPORT_FLAGS, options.processFlags(), sources, nodes, cold.ms))
+    {
+        printf("[microbench] modelcache: could not write %s\n", ModelCache::cachePath(modelPath).c_str());
+        return;
+    }
+
+    bool opened = false;
+    Measurement warm = measure([&] {
+        MappedFile file;
+        opened = ModelCache::open(modelPath, MODEL_IMPORT_FLAGS, options.processFlags(), file);
+        if (!opened)
+            return;
+        const ModelCacheHeader *header = ModelCache::getHeader(file);
+        const ModelCacheTexture *textures = ModelCache::getTextures(file);
+        std::vector<ImportedMesh> cached(header->meshCount);
+        for (uint32_t i = 0; i < header->meshCount; i++)
+        {
+            const ModelCacheMesh &entry = ModelCache::getMeshes(file)[i];
+            ImportedMesh &mesh = cached[i];
+            mesh.layout.flags = entry.vertexLayout;
+            mesh.vertexCount = entry.vertexCount;
+            mesh.vertices.assign(file.data + entry.vertexOffset, file.data + entry.vertexOffset + (size_t)entry.vertexCount * entry.vertexStride);
+            const uint16_t *indices = (const uint16_t *)(file.data + entry.indexOffset);
+            mesh.indices.assign(indices, indices + entry.indexCount);
+            const MeshRange *ranges = ModelCache::getRanges(file) + entry.firstRange;
+            mesh.ranges.assign(ranges, ranges + entry.rangeCount);
+            const MeshLod *lods = ModelCache::getLods(file) + entry.firstLod;
+            mesh.lods.assign(lods, lods + entry.lodCount);
+            for (uint32_t t = entry.firstTexture; t < entry.firstTexture + entry.textureCount; t++)
+                mesh.textures.push_back({ModelCache::getString(file, textures[t].typeOffset), ModelCache::getString(file, textures[t].pathOffset)});
+        }
+    });
+    if (!opened)
+    {
+        printf("[microbench] modelcache: could not open %s\n", ModelCache::cachePath(modelPath).c_str());
+        return;
+    }
+
+    printf("[microbench] %s: %zu meshes, %zu vertices, %.0f KB of streams\n", modelPath.c_str(), meshes.size(), vertices, streamBytes / 1024.0);
+    report("  cold: Assimp import + build streams", cold, (double)vertices, "verts", (double)streamBytes);
+    report("  warm: model cache open + copy", warm, (double)vertices, "verts", (double)streamBytes);
+    printf("[microbench]   warm load is %.1fx faster\n", warm.ms > 0.0 ? cold.ms / warm.ms : 0.0);
+}
+
+// minimesh's RenderMesh::compute_vertex_normals and get_vertex_data on a finely divided cylinder
+static void benchMinimesh()
+{
+    const int segments[] = {24, 1024, 16384};
+    for (int count : segments)
+    {
+        RenderMesh mesh = RenderMesh::cylinder(count);
+        mesh.compute_vertex_normals();
+        std::vector<float> data = mesh.get_vertex_data();
+        double vertices = data.size() / 8.0;
+        printf("[microbench] cylinder(%d): %.0f vertices, %zu indices\n", count, vertices, mesh.indices.size());
+        report("  RenderMesh::compute_vertex_normals", measure([&] { mesh.compute_vertex_normals(); }), vertices, "verts", 0.0);
+        report("  RenderMesh::get_vertex_data", measure([&] { data = mesh.get_vertex_data(); }), vertices, "verts", data.size() * sizeof(float));
+    }
+}
+
+// Camera::updateCameraVectors, through ProcessMouseMovement like the mouse callback
+static void benchCamera()
+{
+    Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
+    const int updates = 100000;
+    float sign = 1.0f;
+    report("Camera::ProcessMouseMovement (x100k)", measure([&] {
+               for (int i = 0; i < updates; i++)
+                   camera.ProcessMouseMovement(0.37f * sign, 0.11f * sign);
+               sign = -sign;
+           }),
+           updates, "updates", 0.0);
+    float sum = 0.0f;
+    report("Camera::GetViewMatrix (x100k)", measure([&] {
+               for (int i = 0; i < updates; i++)
+                   sum += camera.GetViewMatrix()[3][2];
+           }),
+           updates, "matrices", 0.0);
+    if (sum == 12345.0f) // keeps the loop from being optimised away
+        printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    struct Section {
+        const char *name;
+        void (*run)();
+    };
+    const Section sections[] = {
+        {"import", benchImport},
+        {"decode", benchDecode},
+        {"container", benchContainer},
+        {"modelcache", benchModelCache},
+        {"compress", benchCompress},
+        {"minimesh", benchMinimesh},
+        {"camera", benchCamera},
+    };
+
+    int named = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--model") == 0 && i + 1 < argc)
+            modelPath = argv[++i];
+        else
+            named++;
+    }
+    for (const Section &section : sections)
+    {
+        bool selected = named == 0;
+        for (int i = 1; i < argc; i++)
+            selected = selected || (strcmp(argv[i], section.name) == 0 && strcmp(argv[i - 1], "--model") != 0);
+        if (selected)
+            section.run();
+    }
+    return 0;
+}
@@ -0,0 +1,533 @@
+#ifndef BLOCK_COMPRESSOR_H
+#define BLOCK_COMPRESSOR_H
+
+#include "thread_pool.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLOCK_COMPRESSOR_SIMD 1
+#else
+#define BLOCK_COMPRESSOR_SIMD 0
+#endif
+
+// the block compressed formats textures can be stored in; every format encodes 4x4 texel blocks
+enum BlockFormat {
+    BLOCK_NONE = 0,
+    BLOCK_BC1  = 1, // DXT1: RGB, 8 bytes per block (4 bits per texel)
+    BLOCK_BC3  = 2, // DXT5: RGB plus interpolated alpha, 16 bytes per block
+    BLOCK_BC5  = 3, // RGTC2: two independent channels, 16 bytes per block. Used for tangent space normal maps,
+                    // which sample with blue 0: shaders rebuild z as sqrt(1 - x*x - y*y)
+};
+
+// CPU encoder (and reference decoder) for BC1, BC3 and BC5. Pure CPU code, safe from any thread.
+//
+// Colour blocks fit their endpoints along the principal axis of the block's colours, pick every texel's index
+// by its distance to the four palette colours (4 texels per SSE2 iteration), then refit the endpoints to those
+// indices by least squares and keep the refit if it lowers the error. Alpha and BC5 channels use the 8 value
+// mode between the block's extremes. compress() spreads rows of blocks over the shared ThreadPool.
+class BlockCompressor
+{
+public:
+    static size_t blockBytes(BlockFormat format)
+    {
+        return format == BLOCK_BC1 ? 8 : 16;
+    }
+
+    static size_t levelSize(BlockFormat format, int width, int height)
+    {
+        return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+    }
+
+    // BC5 for normal maps, otherwise BC3 when a texel is translucent and BC1 when none is. 1 and 2 channel
+    // images are left uncompressed: as GL_RED/GL_RG they sample differently than any of the formats would.
+    static BlockFormat choose(const unsigned char *pixels, int width, int height, int components, bool normalMap)
+    {
+        if (components < 3)
+            return BLOCK_NONE;
+        if (normalMap)
+            return BLOCK_BC5;
+        if (components == 4)
+            for (size_t i = 3; i < (size_t)width * height * 4; i += 4)
+                if (pixels[i] != 255)
+                    return BLOCK_BC3;
+        return BLOCK_BC1;
+    }
+
+    // compresses a tightly packed width x height image into levelSize(format, width, height) bytes. Blocks that
+    // hang over the right or bottom edge repeat the last column or row.
+    static void compress(const unsigned char *pixels, int width, int height, int components, BlockFormat format, unsigned char *out)
+    {
+        int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+        // 8 rows of blocks per job keeps the scheduling cost small next to the encoding
+        const int bandRows = 8;
+        size_t bands = (size_t)(blocksHigh + bandRows - 1) / bandRows;
+        size_t rowBytes = (size_t)blocksWide * blockBytes(format);
+        auto encodeBand = [&](size_t band) {
+            unsigned char block[64];
+            int lastRow = std::min(blocksHigh, (int)(band + 1) * bandRows);
+            for (int by = (int)band * bandRows; by < lastRow; by++)
+            {
+                for (int bx = 0; bx < blocksWide; bx++)
+                {
+                    loadBlock(pixels, width, height, components, bx * 4, by * 4, block);
+                    encodeBlock(format, block, out + by * rowBytes + bx * blockBytes(format));
+                }
+            }
+        };
+        if (bands > 1)
+            ThreadPool::shared().parallelFor(bands, encodeBand);
+        else
+            encodeBand(0);
+    }
+
+    // the inverse of compress, into RGBA texels; for measuring quality
+    static void decompress(const unsigned char *blocks, int width, int height, BlockFormat format, unsigned char *rgba)
+    {
+        int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+        unsigned char block[64];
+        for (int by = 0; by < blocksHigh; by++)
+        {
+            for (int bx = 0; bx < blocksWide; bx++)
+            {
+                decodeBlock(format, blocks + ((size_t)by * blocksWide + bx) * blockBytes(format), block);
+                for (int y = 0; y < 4 && by * 4 + y < height; y++)
+                    for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+                        memcpy(rgba + ((size_t)(by * 4 + y) * width + bx * 4 + x) * 4, block + (y * 4 + x) * 4, 4);
+            }
+        }
+    }
+
+    // encodes 16 RGBA texels (row by row); BC5 takes its channels from red and green
+    static void encodeBlock(BlockFormat format, const unsigned char *rgba, unsigned char *out)
+    {
+        unsigned char channel[16];
+        if (format == BLOCK_BC1)
+            encodeColor(rgba, out);
+        else if (format == BLOCK_BC3)
+        {
+            extractChannel(rgba, 3, channel);
+            encodeChannel(channel, out);
+            encodeColor(rgba, out + 8);
+        }
+        else
+        {
+            extractChannel(rgba, 0, channel);
+            encodeChannel(channel, out);
+            extractChannel(rgba, 1, channel);
+            encodeChannel(channel, out + 8);
+        }
+    }
+
+    // decodes one block into 16 RGBA texels (BC1 alpha is always 255, BC5 blue 0 and alpha 255)
+    static void decodeBlock(BlockFormat format, const unsigned char *block, unsigned char *rgba)
+    {
+        unsigned char channel[16];
+        if (format == BLOCK_BC1)
+            decodeColor(block, rgba);
+        else if (format == BLOCK_BC3)
+        {
+            decodeColor(block + 8, rgba);
+            decodeChannel(block, channel);
+            for (int i = 0; i < 16; i++)
+                rgba[i * 4 + 3] = channel[i];
+        }
+        else
+        {
+            decodeChannel(block, channel);
+            for (int i = 0; i < 16; i++)
+                rgba[i * 4] = channel[i];
+            decodeChannel(block + 8, channel);
+            for (int i = 0; i < 16; i++)
+            {
+                rgba[i * 4 + 1] = channel[i];
+                rgba[i * 4 + 2] = 0;
+                rgba[i * 4 + 3] = 255;
+            }
+        }
+    }
+
+    // peak signal to noise ratio in dB over the first 'channels' channels of two RGBA images; 99 when identical
+    static double psnr(const unsigned char *a, const unsigned char *b, size_t texels, int channels)
+    {
+        double squared = 0.0;
+        for (size_t i = 0; i < texels; i++)
+            for (int k = 0; k < channels; k++)
+            {
+                double d = (double)a[i * 4 + k] - b[i * 4 + k];
+                squared += d * d;
+            }
+        if (squared == 0.0)
+            return 99.0;
+        double mse = squared / ((double)texels * channels);
+        return 10.0 * std::log10(255.0 * 255.0 / mse);
+    }
+
+    // expands a tightly packed image of 1 to 4 channels to RGBA, the layout psnr() and decompress() use
+    static void toRgba(const unsigned char *pixels, size_t texels, int components, unsigned char *rgba)
+    {
+        for (size_t i = 0; i < texels; i++)
+            loadTexel(pixels + i * components, components, rgba + i * 4);
+    }
+
+private:
+    static void loadTexel(const unsigned char *texel, int components, unsigned char *rgba)
+    {
+        if (components >= 3)
+        {
+            rgba[0] = texel[0];
+            rgba[1] = texel[1];
+            rgba[2] = texel[2];
+        }
+        else
+            rgba[0] = rgba[1] = rgba[2] = texel[0];
+        rgba[3] = components == 4 ? texel[3] : components == 2 ? texel[1] : 255;
+    }
+
+    static void loadBlock(const unsigned char *pixels, int width, int height, int components, int x0, int y0, unsigned char *block)
+    {
+        for (int y = 0; y < 4; y++)
+        {
+            const unsigned char *row = pixels + (size_t)std::min(y0 + y, height - 1) * width * components;
+            for (int x = 0; x < 4; x++)
+                loadTexel(row + (size_t)std::min(x0 + x, width - 1) * components, components, block + (y * 4 + x) * 4);
+        }
+    }
+
+    static void extractChannel(const unsigned char *rgba, int k, unsigned char *channel)
+    {
+        for (int i = 0; i < 16; i++)
+            channel[i] = rgba[i * 4 + k];
+    }
+
+    // --- colour blocks (BC1, and the colour half of BC3) -------------------------------------------------------
+
+    static uint16_t pack565(const float *color)
+    {
+        int r = std::min(31, std::max(0, (int)(color[0] * (31.0f / 255.0f) + 0.5f)));
+        int g = std::min(63, std::max(0, (int)(color[1] * (63.0f / 255.0f) + 0.5f)));
+        int b = std::min(31, std::max(0, (int)(color[2] * (31.0f / 255.0f) + 0.5f)));
+        return (uint16_t)((r << 11) | (g << 5) | b);
+    }
+
+    static void unpack565(uint16_t packed, int *color)
+    {
+        int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+        color[0] = (r << 3) | (r >> 2);
+        color[1] = (g << 2) | (g >> 4);
+        color[2] = (b << 3) | (b >> 2);
+    }
+
+    // the four colours of a block with c0 > c1 (4 colour mode): c0, c1, 2/3 c0 + 1/3 c1, 1/3 c0 + 2/3 c1
+    static void palette(uint16_t c0, uint16_t c1, int palette[4][3])
+    {
+        unpack565(c0, palette[0]);
+        unpack565(c1, palette[1]);
+        for (int k = 0; k < 3; k++)
+        {
+            palette[2][k] = (2 * palette[0][k] + palette[1][k]) / 3;
+            palette[3][k] = (palette[0][k] + 2 * palette[1][k]) / 3;
+        }
+    }
+
+    // picks the nearest palette colour for every texel; returns the summed squared error
+    static int selectIndices(const unsigned char *rgba, const int colors[4][3], unsigned char *indices)
+    {
+        int total = 0;
+#if BLOCK_COMPRESSOR_SIMD
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i rgbMask = _mm_set1_epi32(0x00FFFFFF);
+        __m128i entries[4];
+        for (int p = 0; p < 4; p++)
+            entries[p] = _mm_setr_epi16((short)colors[p][0], (short)colors[p][1], (short)colors[p][2], 0, (short)colors[p][0], (short)colors[p][1], (short)colors[p][2], 0);
+        for (int i = 0; i < 16; i += 4)
+        {
+            // 4 texels as 2 x 2 texels of 16 bit channels, alpha cleared
+            __m128i texels = _mm_and_si128(_mm_loadu_si128((const __m128i *)(rgba + i * 4)), rgbMask);
+            __m128i lo = _mm_unpacklo_epi8(texels, zero), hi = _mm_unpackhi_epi8(texels, zero);
+            __m128i best = _mm_setzero_si128(), bestIndex = _mm_setzero_si128();
+            for (int p = 0; p < 4; p++)
+            {
+                __m128i dlo = _mm_sub_epi16(lo, entries[p]), dhi = _mm_sub_epi16(hi, entries[p]);
+                // madd leaves r*r + g*g and b*b per texel; add the pairs and gather the 4 texels in one register
+                __m128i slo = _mm_madd_epi16(dlo, dlo), shi = _mm_madd_epi16(dhi, dhi);
+                slo = _mm_add_epi32(slo, _mm_shuffle_epi32(slo, _MM_SHUFFLE(2, 3, 0, 1)));
+                shi = _mm_add_epi32(shi, _mm_shuffle_epi32(shi, _MM_SHUFFLE(2, 3, 0, 1)));
+                __m128i distance = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(slo), _mm_castsi128_ps(shi), _MM_SHUFFLE(2, 0, 2, 0)));
+                if (p == 0)
+                {
+                    best = distance;
+                    continue;
+                }
+                __m128i closer = _mm_cmplt_epi32(distance, best);
+                best = _mm_or_si128(_mm_and_si128(closer, distance), _mm_andnot_si128(closer, best));
+                bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(p)), _mm_andnot_si128(closer, bestIndex));
+            }
+            alignas(16) int distances[4], chosen[4];
+            _mm_store_si128((__m128i *)distances, best);
+            _mm_store_si128((__m128i *)chosen, bestIndex);
+            for (int j = 0; j < 4; j++)
+            {
+                indices[i + j] = (unsigned char)chosen[j];
+                total += distances[j];
+            }
+        }
+#else
+        for (int i = 0; i < 16; i++)
+        {
+            int best = 0, bestDistance = 0;
+            for (int p = 0; p < 4; p++)
+            {
+                int distance = 0;
+                for (int k = 0; k < 3; k++)
+                    distance += (rgba[i * 4 + k] - colors[p][k]) * (rgba[i * 4 + k] - colors[p][k]);
+                if (p == 0 || distance < bestDistance)
+                {
+                    best = p;
+                    bestDistance = distance;
+                }
+            }
+            indices[i] = (unsigned char)best;
+            total += bestDistance;
+        }
+#endif
+        return total;
+    }
+
+    // endpoints and indices for the given 565 endpoints, brought into 4 colour order; returns the error
+    static int fitIndices(const unsigned char *rgba, uint16_t &c0, uint16_t &c1, unsigned char *indices)
+    {
+        if (c0 < c1)
+            std::swap(c0, c1);
+        if (c0 == c1)
+        {
+            // a single colour: every texel takes c0, in either mode
+            int color[3];
+            unpack565(c0, color);
+            int total = 0;
+            for (int i = 0; i < 16; i++)
+            {
+                indices[i] = 0;
+                for (int k = 0; k < 3; k++)
+                    total += (rgba[i * 4 + k] - color[k]) * (rgba[i * 4 + k] - color[k]);
+            }
+            return total;
+        }
+        int colors[4][3];
+        palette(c0, c1, colors);
+        return selectIndices(rgba, colors, indices);
+    }
+
+    static void encodeColor(const unsigned char *rgba, unsigned char *out)
+    {
+        // principal axis of the colours: a few power iterations on the covariance, starting along the bounding box
+        float mean[3] = {0.0f, 0.0f, 0.0f}, lo[3] = {255.0f, 255.0f, 255.0f}, hi[3] = {0.0f, 0.0f, 0.0f};
+        for (int i = 0; i < 16; i++)
+            for (int k = 0; k < 3; k++)
+            {
+                float v = rgba[i * 4 + k];
+                mean[k] += v;
+                lo[k] = std::min(lo[k], v);
+                hi[k] = std::max(hi[k], v);
+            }
+        for (int k = 0; k < 3; k++)
+            mean[k] /= 16.0f;
+        float cov[6] = {0.0f};
+        for (int i = 0; i < 16; i++)
+        {
+            float r = rgba[i * 4] - mean[0], g = rgba[i * 4 + 1] - mean[1], b = rgba[i * 4 + 2] - mean[2];
+            cov[0] += r * r;
+            cov[1] += r * g;
+            cov[2] += r * b;
+            cov[3] += g * g;
+            cov[4] += g * b;
+            cov[5] += b * b;
+        }
+        float axis[3] = {hi[0] - lo[0], hi[1] - lo[1], hi[2] - lo[2]};
+        for (int iteration = 0; iteration < 4; iteration++)
+        {
+            float x = axis[0] * cov[0] + axis[1] * cov[1] + axis[2] * cov[2];
+            float y = axis[0] * cov[1] + axis[1] * cov[3] + axis[2] * cov[4];
+            float z = axis[0] * cov[2] + axis[1] * cov[4] + axis[2] * cov[5];
+            float length = std::max(std::fabs(x), std::max(std::fabs(y), std::fabs(z)));
+            if (length < 1e-6f)
+                break;
+            axis[0] = x / length;
+            axis[1] = y / length;
+            axis[2] = z / length;
+        }
+
+        // the texels furthest along the axis in either direction, pulled in by 1/16 of their distance (the
+        // extremes are rarely worth an exact palette entry)
+        float minDot = 1e30f, maxDot = -1e30f;
+        int minTexel = 0, maxTexel = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            float dot = rgba[i * 4] * axis[0] + rgba[i * 4 + 1] * axis[1] + rgba[i * 4 + 2] * axis[2];
+            if (dot < minDot)
+            {
+                minDot = dot;
+                minTexel = i;
+            }
+            if (dot > maxDot)
+            {
+                maxDot = dot;
+                maxTexel = i;
+            }
+        }
+        float e0[3], e1[3];
+        for (int k = 0; k < 3; k++)
+        {
+            float a = rgba[maxTexel * 4 + k], b = rgba[minTexel * 4 + k];
+            float inset = (a - b) / 16.0f;
+            e0[k] = a - inset;
+            e1[k] = b + inset;
+        }
+        uint16_t c0 = pack565(e0), c1 = pack565(e1);
+        unsigned char indices[16];
+        int error = fitIndices(rgba, c0, c1, indices);
+
+        // least squares endpoints for those indices: texel = w * e0 + (1 - w) * e1
+        if (error > 0 && c0 != c1)
+        {
+            static const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+            float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[3] = {0.0f}, bx[3] = {0.0f};
+            for (int i = 0; i < 16; i++)
+            {
+                float w = weights[indices[i]], v = 1.0f - w;
+                aa += w * w;
+                ab += w * v;
+                bb += v * v;
+                for (int k = 0; k < 3; k++)
+                {
+                    ax[k] += w * rgba[i * 4 + k];
+                    bx[k] += v * rgba[i * 4 + k];
+                }
+            }
+            float determinant = aa * bb - ab * ab;
+            if (std::fabs(determinant) > 1e-6f)
+            {
+                float f0[3], f1[3];
+                for (int k = 0; k < 3; k++)
+                {
+                    f0[k] = (ax[k] * bb - bx[k] * ab) / determinant;
+                    f1[k] = (bx[k] * aa - ax[k] * ab) / determinant;
+                }
+                uint16_t r0 = pack565(f0), r1 = pack565(f1);
+                unsigned char refined[16];
+                int refinedError = fitIndices(rgba, r0, r1, refined);
+                if (refinedError < error)
+                {
+                    c0 = r0;
+                    c1 = r1;
+                    memcpy(indices, refined, 16);
+                }
+            }
+        }
+
+        uint32_t bits = 0;
+        for (int i = 0; i < 16; i++)
+            bits |= (uint32_t)indices[i] << (2 * i);
+        out[0] = (unsigned char)(c0 & 0xFF);
+        out[1] = (unsigned char)(c0 >> 8);
+        out[2] = (unsigned char)(c1 & 0xFF);
+        out[3] = (unsigned char)(c1 >> 8);
+        for (int i = 0; i < 4; i++)
+            out[4 + i] = (unsigned char)(bits >> (8 * i));
+    }
+
+    static void decodeColor(const unsigned char *block, unsigned char *rgba)
+    {
+        uint16_t c0 = (uint16_t)(block[0] | block[1] << 8), c1 = (uint16_t)(block[2] | block[3] << 8);
+        int colors[4][3];
+        palette(c0, c1, colors);
+        if (c0 <= c1)
+        {
+            // 3 colour mode: the midpoint, then transparent black (the encoder only gets here with c0 == c1)
+            for (int k = 0; k < 3; k++)
+            {
+                colors[2][k] = (colors[0][k] + colors[1][k]) / 2;
+                colors[3][k] = 0;
+            }
+        }
+        uint32_t bits = (uint32_t)block[4] | (uint32_t)block[5] << 8 | (uint32_t)block[6] << 16 | (uint32_t)block[7] << 24;
+        for (int i = 0; i < 16; i++)
+        {
+            int index = (bits >> (2 * i)) & 3;
+            for (int k = 0; k < 3; k++)
+                rgba[i * 4 + k] = (unsigned char)colors[index][k];
+            rgba[i * 4 + 3] = c0 <= c1 && index == 3 ? 0 : 255;
+        }
+    }
+
+    // --- single channel blocks (BC3 alpha, both halves of BC5) -------------------------------------------------
+
+    // the eight values of a block with a0 > a1: a0, a1 and six steps between them
+    static void channelPalette(int a0, int a1, int values[8])
+    {
+        values[0] = a0;
+        values[1] = a1;
+        if (a0 > a1)
+        {
+            for (int i = 2; i < 8; i++)
+                values[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+        }
+        else
+        {
+            for (int i = 2; i < 6; i++)
+                values[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+            values[6] = 0;
+            values[7] = 255;
+        }
+    }
+
+    static void encodeChannel(const unsigned char *channel, unsigned char *out)
+    {
+        int lo = 255, hi = 0;
+        for (int i = 0; i < 16; i++)
+        {
+            lo = std::min(lo, (int)channel[i]);
+            hi = std::max(hi, (int)channel[i]);
+        }
+        uint64_t bits = 0;
+        if (hi > lo)
+        {
+            int values[8];
+            channelPalette(hi, lo, values);
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0, bestDistance = 256;
+                for (int j = 0; j < 8; j++)
+                {
+                    int distance = std::abs(channel[i] - values[j]);
+                    if (distance < bestDistance)
+                    {
+                        best = j;
+                        bestDistance = distance;
+                    }
+                }
+                bits |= (uint64_t)best << (3 * i);
+            }
+        }
+        out[0] = (unsigned char)hi;
+        out[1] = (unsigned char)lo;
+        for (int i = 0; i < 6; i++)
+            out[2 + i] = (unsigned char)(bits >> (8 * i));
+    }
+
+    static void decodeChannel(const unsigned char *block, unsigned char *channel)
+    {
+        int values[8];
+        channelPalette(block[0], block[1], values);
+        uint64_t bits = 0;
+        for (int i = 0; i < 6; i++)
+            bits |= (uint64_t)block[2 + i] << (8 * i);
+        for (int i = 0; i < 16; i++)
+            channel[i] = (unsigned char)values[(bits >> (3 * i)) & 7];
+    }
+};
+#endif
@@ -0,0 +1,539 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm/glm.hpp>
+
+#include "frustum_culling.h"
+#include "thread_pool.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
+#include <future>
+#include <vector>
+
+// Bounding volume hierarchy over scene objects (anything with world space Bounds), for frustum queries and ray
+// picking. Pure CPU code. Built top-down with binned SAH; objects that move are refit into the existing tree,
+// which is cheap but slowly degrades it, so callers rebuild when sahCost() has grown too far past builtCost().
+
+// a ray with a unit length direction
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+
+    // the ray through a window pixel (origin top left, like GLFW cursor positions)
+    static Ray fromScreen(float x, float y, float width, float height, const glm::mat4 &view, const glm::mat4 &projection)
+    {
+        glm::vec2 ndc(2.0f * x / width - 1.0f, 1.0f - 2.0f * y / height);
+        glm::mat4 inverse = glm::inverse(projection * view);
+        glm::vec4 nearPoint = inverse * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+        glm::vec4 farPoint = inverse * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+        Ray ray;
+        ray.origin = glm::vec3(nearPoint) / nearPoint.w;
+        ray.direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - ray.origin);
+        return ray;
+    }
+
+    // slab test; the entry distance when the ray hits the box before maxT, else FLT_MAX
+    float intersectBox(const glm::vec3 &min, const glm::vec3 &max, const glm::vec3 &inverseDirection, float maxT) const
+    {
+        glm::vec3 t0 = (min - origin) * inverseDirection;
+        glm::vec3 t1 = (max - origin) * inverseDirection;
+        glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+        float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+        float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxT));
+        return enter <= exit ? enter : FLT_MAX;
+    }
+
+    // Moller-Trumbore; the hit distance, or FLT_MAX
+    float intersectTriangle(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2) const
+    {
+        const float epsilon = 1e-8f;
+        glm::vec3 edge1 = p1 - p0, edge2 = p2 - p0;
+        glm::vec3 p = glm::cross(direction, edge2);
+        float determinant = glm::dot(edge1, p);
+        if (std::fabs(determinant) < epsilon)
+            return FLT_MAX;
+        float inverse = 1.0f / determinant;
+        glm::vec3 s = origin - p0;
+        float u = glm::dot(s, p) * inverse;
+        if (u < 0.0f || u > 1.0f)
+            return FLT_MAX;
+        glm::vec3 q = glm::cross(s, edge1);
+        float v = glm::dot(direction, q) * inverse;
+        if (v < 0.0f || u + v > 1.0f)
+            return FLT_MAX;
+        float t = glm::dot(edge2, q) * inverse;
+        return t >= 0.0f ? t : FLT_MAX;
+    }
+
+    // nearest hit against an indexed triangle list (object space positions placed with 'model'); FLT_MAX if none.
+    // The distance is along this (world space) ray. triangle receives the index of the hit triangle.
+    float intersectTriangles(const glm::vec3 *positions, const uint32_t *indices, size_t indexCount, const glm::mat4 &model, uint32_t *triangle = nullptr) const
+    {
+        // test in object space instead of transforming every vertex
+        glm::mat4 toObject = glm::inverse(model);
+        Ray local;
+        local.origin = glm::vec3(toObject * glm::vec4(origin, 1.0f));
+        glm::vec3 direction = glm::vec3(toObject * glm::vec4(this->direction, 0.0f));
+        float scale = glm::length(direction);
+        local.direction = direction / scale;
+        float nearest = FLT_MAX;
+        for (size_t i = 0; i + 2 < indexCount; i += 3)
+        {
+            float t = local.intersectTriangle(positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]]);
+            if (t < nearest)
+            {
+                nearest = t;
+                if (triangle)
+                    *triangle = (uint32_t)(i / 3);
+            }
+        }
+        return nearest == FLT_MAX ? FLT_MAX : nearest / scale;
+    }
+};
+
+struct BvhNode {
+    glm::vec3 min;
+    uint32_t leftOrFirst; // inner node: index of the left child (the right one follows it); leaf: first item
+    glm::vec3 max;
+    uint32_t count;       // number of objects in a leaf, 0 for inner nodes
+};
+
+struct BvhQueryStats {
+    unsigned int nodesVisited = 0;
+    unsigned int objectsTested = 0;
+    unsigned int objectsAccepted = 0; // inside fully contained nodes, so never tested on their own
+    unsigned int visible = 0;
+};
+
+class Bvh
+{
+public:
+    static const unsigned int SAH_BINS = 12;
+    static const unsigned int MAX_LEAF_SIZE = 4;
+    // subtrees with more objects than this are split further on the calling thread before the rest is built on the pool
+    static const unsigned int PARALLEL_SUBTREE_SIZE = 16384;
+
+    BvhQueryStats stats; // of the last frustum query
+
+    // builds over the given object bounds; object i keeps index i. Passing a pool builds subtrees in parallel.
+    void build(const std::vector<Bounds> &bounds, ThreadPool *pool = nullptr)
+    {
+        objects = bounds;
+        size_t count = objects.size();
+        refs.resize(count);
+        for (uint32_t i = 0; i < count; i++)
+        {
+            // empty bounds get an inverted box, so they never grow a node
+            refs[i].min = objects[i].empty() ? glm::vec3(FLT_MAX) : objects[i].min();
+            refs[i].max = objects[i].empty() ? glm::vec3(-FLT_MAX) : objects[i].max();
+            refs[i].object = i;
+        }
+        nodes.assign(std::max<size_t>(2 * count, 1), BvhNode());
+        parents.assign(nodes.size(), 0);
+        nodeCount = 1;
+        nodes[0].leftOrFirst = 0;
+        nodes[0].count = (uint32_t)count;
+        refBounds(0);
+
+        if (!pool)
+            subdivide(0, nullptr);
+        else
+        {
+            // split the top of the tree here, then hand out the remaining subtrees
+            std::vector<uint32_t> subtrees;
+            subdivide(0, &subtrees);
+            std::vector<std::future<void>> jobs;
+            for (uint32_t subtree : subtrees)
+                jobs.push_back(pool->submit([this, subtree] { subdivide(subtree, nullptr); }));
+            for (std::future<void> &job : jobs)
+                job.get();
+        }
+        nodes.resize(nodeCount);
+        parents.resize(nodeCount);
+        items.resize(count);
+        for (size_t i = 0; i < count; i++)
+            items[i] = refs[i].object;
+        std::vector<BuildRef>().swap(refs);
+
+        // leaf of every object, for refits
+        leafOf.assign(count, 0);
+        for (uint32_t n = 0; n < nodeCount; n++)
+            for (uint32_t i = 0; i < nodes[n].count; i++)
+                leafOf[items[nodes[n].leftOrFirst + i]] = n;
+        dirty.assign(nodeCount, 0);
+        built = sahCost();
+    }
+
+    size_t objectCount() const { return objects.size(); }
+    size_t size() const { return nodes.size(); }
+    const BvhNode &node(uint32_t index) const { return nodes[index]; }
+    const Bounds &objectBounds(uint32_t object) const { return objects[object]; }
+
+    // moves an object; the tree is updated by the next refit()
+    void update(uint32_t object, const Bounds &bounds)
+    {
+        objects[object] = bounds;
+        // mark the path to the root, stopping where an earlier update already marked it
+        uint32_t n = leafOf[object];
+        while (!dirty[n])
+        {
+            dirty[n] = 1;
+            if (n == 0)
+                break;
+            n = parents[n];
+        }
+    }
+
+    // refits the boxes of every node above a moved object. Children always have higher indices than their
+    // parent, so one reverse pass over the marked nodes is enough.
+    void refit()
+    {
+        for (uint32_t n = nodeCount; n-- > 0;)
+        {
+            if (!dirty[n])
+                continue;
+            dirty[n] = 0;
+            BvhNode &node = nodes[n];
+            if (node.count)
+                updateBounds(n);
+            else
+            {
+                const BvhNode &left = nodes[node.leftOrFirst], &right = nodes[node.leftOrFirst + 1];
+                node.min = glm::min(left.min, right.min);
+                node.max = glm::max(left.max, right.max);
+            }
+        }
+    }
+
+    // surface area heuristic cost of the tree, relative to the root's area
+    float sahCost() const
+    {
+        if (objects.empty())
+            return 0.0f;
+        float rootArea = area(nodes[0].min, nodes[0].max);
+        if (rootArea <= 0.0f)
+            return 0.0f;
+        float cost = 0.0f;
+        for (uint32_t n = 0; n < nodeCount; n++)
+            cost += area(nodes[n].min, nodes[n].max) / rootArea * (nodes[n].count ? (float)nodes[n].count : 1.0f);
+        return cost;
+    }
+
+    float builtCost() const { return built; }
+
+    // true once refits have made the tree noticeably worse than a fresh build
+    bool needsRebuild(float tolerance = 1.5f) const
+    {
+        return built > 0.0f && sahCost() > built * tolerance;
+    }
+
+    // appends every object intersecting the frustum. Nodes completely inside are accepted without testing their
+    // objects, nodes completely outside are skipped.
+    void query(const Frustum &frustum, std::vector<uint32_t> &visible)
+    {
+        stats = BvhQueryStats();
+        if (objects.empty())
+            return;
+        size_t start = visible.size();
+        std::vector<Entry> &stack = queryStack;
+        stack.clear();
+        stack.push_back({0, 0x3F});
+        while (!stack.empty())
+        {
+            Entry entry = stack.back();
+            stack.pop_back();
+            const BvhNode &node = nodes[entry.node];
+            stats.nodesVisited++;
+            glm::vec3 center = (node.min + node.max) * 0.5f, extent = (node.max - node.min) * 0.5f;
+            uint32_t planes = entry.planes;
+            bool outside = false;
+            for (int p = 0; p < 6 && !outside; p++)
+            {
+                if (!(planes & (1u << p)))
+                    continue;
+                const glm::vec4 &plane = frustum.planes[p];
+                float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+                float radius = glm::dot(glm::abs(glm::vec3(plane)), extent);
+                if (distance + radius < 0.0f)
+                    outside = true;
+                else if (distance - radius >= 0.0f)
+                    planes &= ~(1u << p); // completely on the inner side
+            }
+            if (outside)
+                continue;
+            if (node.count)
+            {
+                for (uint32_t i = 0; i < node.count; i++)
+                {
+                    uint32_t object = items[node.leftOrFirst + i];
+                    if (planes == 0)
+                    {
+                        stats.objectsAccepted++;
+                        visible.push_back(object);
+                    }
+                    else
+                    {
+                        stats.objectsTested++;
+                        if (frustum.intersects(objects[object]))
+                            visible.push_back(object);
+                    }
+                }
+                continue;
+            }
+            stack.push_back({node.leftOrFirst, planes});
+            stack.push_back({node.leftOrFirst + 1, planes});
+        }
+        stats.visible = (unsigned int)(visible.size() - start);
+    }
+
+    // Nearest hit along the ray. hitObject(object, maxT) tests one object and returns its hit distance (FLT_MAX
+    // for a miss); it is only called for objects whose box the ray enters before the nearest hit so far.
+    // Returns the object index, or -1 without a hit; distance receives the hit distance.
+    template <typename F>
+    long intersect(const Ray &ray, F hitObject, float *distance = nullptr) const
+    {
+        long nearestObject = -1;
+        float nearest = FLT_MAX;
+        if (objects.empty())
+            return -1;
+        glm::vec3 inverseDirection(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+        // degenerate splits can make the tree deeper than log2(n), so the stack grows as needed
+        uint32_t fixedStack[64];
+        std::vector<uint32_t> overflow;
+        int top = 0;
+        auto push = [&](uint32_t n) {
+            if (top < 64)
+                fixedStack[top++] = n;
+            else
+                overflow.push_back(n);
+        };
+        if (ray.intersectBox(nodes[0].min, nodes[0].max, inverseDirection, nearest) != FLT_MAX)
+            push(0);
+        while (top > 0 || !overflow.empty())
+        {
+            uint32_t n;
+            if (!overflow.empty())
+            {
+                n = overflow.back();
+                overflow.pop_back();
+            }
+            else
+                n = fixedStack[--top];
+            const BvhNode &node = nodes[n];
+            if (node.count)
+            {
+                for (uint32_t i = 0; i < node.count; i++)
+                {
+                    uint32_t object = items[node.leftOrFirst + i];
+                    if (ray.intersectBox(objects[object].min(), objects[object].max(), inverseDirection, nearest) == FLT_MAX)
+                        continue;
+                    float t = hitObject(object, nearest);
+                    if (t < nearest)
+                    {
+                        nearest = t;
+                        nearestObject = object;
+                    }
+                }
+                continue;
+            }
+            // visit the nearer child first, so the farther one is often rejected by the hit found in it
+            uint32_t first = node.leftOrFirst, second = node.leftOrFirst + 1;
+            float tFirst = ray.intersectBox(nodes[first].min, nodes[first].max, inverseDirection, nearest);
+            float tSecond = ray.intersectBox(nodes[second].min, nodes[second].max, inverseDirection, nearest);
+            if (tFirst > tSecond)
+            {
+                std::swap(first, second);
+                std::swap(tFirst, tSecond);
+            }
+            if (tSecond != FLT_MAX)
+                push(second);
+            if (tFirst != FLT_MAX)
+                push(first);
+        }
+        if (distance)
+            *distance = nearest;
+        return nearestObject;
+    }
+
+private:
+    std::vector<Bounds> objects;
+    std::vector<uint32_t> items;   // object indices, grouped by leaf
+    // build time copy of the object boxes, partitioned in place so the SAH passes stream through memory
+    struct BuildRef {
+        glm::vec3 min;
+        uint32_t object;
+        glm::vec3 max;
+        uint32_t padding;
+    };
+    std::vector<BuildRef> refs;
+    std::vector<BvhNode> nodes;
+    std::vector<uint32_t> parents;
+    std::vector<uint32_t> leafOf;
+    std::vector<uint8_t> dirty;
+    std::atomic<uint32_t> nodeCount{0};
+    struct Entry {
+        uint32_t node;
+        uint32_t planes; // frustum planes the node may still cross
+    };
+    std::vector<Entry> queryStack;
+    float built = 0.0f;
+
+    static float area(const glm::vec3 &min, const glm::vec3 &max)
+    {
+        glm::vec3 d = glm::max(max - min, glm::vec3(0.0f));
+        return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+    }
+
+    void updateBounds(uint32_t n)
+    {
+        BvhNode &node = nodes[n];
+        node.min = glm::vec3(FLT_MAX);
+        node.max = glm::vec3(-FLT_MAX);
+        for (uint32_t i = 0; i < node.count; i++)
+        {
+            const Bounds &b = objects[items[node.leftOrFirst + i]];
+            if (b.empty())
+                continue;
+            node.min = glm::min(node.min, b.min());
+            node.max = glm::max(node.max, b.max());
+        }
+    }
+
+    void refBounds(uint32_t n)
+    {
+        BvhNode &node = nodes[n];
+        node.min = glm::vec3(FLT_MAX);
+        node.max = glm::vec3(-FLT_MAX);
+        for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+        {
+            node.min = glm::min(node.min, refs[i].min);
+            node.max = glm::max(node.max, refs[i].max);
+        }
+    }
+
+    static float centroid(const BuildRef &ref, int axis)
+    {
+        return (ref.min[axis] + ref.max[axis]) * 0.5f;
+    }
+
+    // Binned SAH split of a leaf into two children, recursively. With 'subtrees' set, recursion stops at nodes
+    // of at most PARALLEL_SUBTREE_SIZE objects and those are collected for the pool instead.
+    void subdivide(uint32_t n, std::vector<uint32_t> *subtrees)
+    {
+        BvhNode &node = nodes[n];
+        if (node.count <= MAX_LEAF_SIZE)
+            return;
+        if (subtrees && node.count <= PARALLEL_SUBTREE_SIZE)
+        {
+            subtrees->push_back(n);
+            return;
+        }
+        BuildRef *begin = refs.data() + node.leftOrFirst, *end = begin + node.count;
+
+        // bins span the centroid bounds, which separate better than the node bounds
+        glm::vec3 cmin(FLT_MAX), cmax(-FLT_MAX);
+        for (const BuildRef *ref = begin; ref != end; ref++)
+        {
+            glm::vec3 c = (ref->min + ref->max) * 0.5f;
+            cmin = glm::min(cmin, c);
+            cmax = glm::max(cmax, c);
+        }
+
+        // one pass fills the bins of all three axes
+        struct Bin {
+            glm::vec3 min = glm::vec3(FLT_MAX), max = glm::vec3(-FLT_MAX);
+            uint32_t count = 0;
+        } bins[3][SAH_BINS];
+        glm::vec3 scale;
+        for (int axis = 0; axis < 3; axis++)
+            scale[axis] = cmax[axis] > cmin[axis] ? SAH_BINS / (cmax[axis] - cmin[axis]) : 0.0f;
+        for (const BuildRef *ref = begin; ref != end; ref++)
+        {
+            for (int axis = 0; axis < 3; axis++)
+            {
+                Bin &bin = bins[axis][std::min(SAH_BINS - 1, (unsigned int)((centroid(*ref, axis) - cmin[axis]) * scale[axis]))];
+                bin.count++;
+                bin.min = glm::min(bin.min, ref->min);
+                bin.max = glm::max(bin.max, ref->max);
+            }
+        }
+
+        int bestAxis = -1;
+        unsigned int bestSplit = 0;
+        float bestCost = area(node.min, node.max) * node.count; // cost of keeping the leaf
+        for (int axis = 0; axis < 3; axis++)
+        {
+            if (scale[axis] == 0.0f)
+                continue;
+            // sweep from both sides for the area and count left/right of each split plane
+            float leftArea[SAH_BINS - 1], rightArea[SAH_BINS - 1];
+            uint32_t leftCount[SAH_BINS - 1], rightCount[SAH_BINS - 1];
+            glm::vec3 lmin(FLT_MAX), lmax(-FLT_MAX), rmin(FLT_MAX), rmax(-FLT_MAX);
+            uint32_t lsum = 0, rsum = 0;
+            for (unsigned int i = 0; i < SAH_BINS - 1; i++)
+            {
+                const Bin &l = bins[axis][i];
+                lsum += l.count;
+                lmin = glm::min(lmin, l.min);
+                lmax = glm::max(lmax, l.max);
+                leftCount[i] = lsum;
+                leftArea[i] = area(lmin, lmax);
+                const Bin &r = bins[axis][SAH_BINS - 1 - i];
+                rsum += r.count;
+                rmin = glm::min(rmin, r.min);
+                rmax = glm::max(rmax, r.max);
+                rightCount[SAH_BINS - 2 - i] = rsum;
+                rightArea[SAH_BINS - 2 - i] = area(rmin, rmax);
+            }
+            for (unsigned int i = 0; i < SAH_BINS - 1; i++)
+            {
+                if (leftCount[i] == 0 || rightCount[i] == 0)
+                    continue;
+                float cost = leftArea[i] * leftCount[i] + rightArea[i] * rightCount[i];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = i;
+                }
+            }
+        }
+
+        BuildRef *middle;
+        if (bestAxis >= 0)
+        {
+            float axisScale = scale[bestAxis], axisMin = cmin[bestAxis];
+            middle = std::partition(begin, end, [&](const BuildRef &ref) {
+                return std::min(SAH_BINS - 1, (unsigned int)((centroid(ref, bestAxis) - axisMin) * axisScale)) <= bestSplit;
+            });
+        }
+        else if (node.count > MAX_LEAF_SIZE * 4)
+        {
+            // no split beats a leaf (e.g. all centroids coincide) but the leaf is too large to scan: median split
+            middle = begin + node.count / 2;
+        }
+        else
+            return;
+
+        uint32_t first = node.leftOrFirst, count = node.count;
+        uint32_t leftCount = (uint32_t)(middle - begin);
+        uint32_t left = nodeCount.fetch_add(2);
+        nodes[left].leftOrFirst = first;
+        nodes[left].count = leftCount;
+        nodes[left + 1].leftOrFirst = first + leftCount;
+        nodes[left + 1].count = count - leftCount;
+        parents[left] = parents[left + 1] = n;
+        refBounds(left);
+        refBounds(left + 1);
+        // nodes was sized for 2N up front, so 'node' is still valid here
+        node.leftOrFirst = left;
+        node.count = 0;
+        subdivide(left, subtrees);
+        subdivide(left + 1, subtrees);
+    }
+};
+#endif
@@ -0,0 +1,96 @@
+#ifndef CACHE_FILE_H
+#define CACHE_FILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <filesystem>
+#include <string>
+
+// what ties a cache file to its source: it is only used while all three still match
+struct CacheSourceKey {
+    uint64_t hash;      // FNV-1a of the source path
+    uint64_t size;
+    int64_t  mtime;
+};
+
+// The parts the disk caches share (model_cache.h, texture_container.h, program_cache.h): FNV-1a hashing, the
+// source key, 16 byte aligned blocks, and writing to a temporary file that only replaces the cache once it is
+// complete.
+class CacheFile
+{
+public:
+    static const uint64_t HASH_SEED = 1469598103934665603ull;
+
+    // continues hash over size more bytes, so several pieces can be hashed as one
+    static uint64_t hashBytes(const void *data, size_t size, uint64_t hash = HASH_SEED)
+    {
+        const unsigned char *bytes = (const unsigned char *)data;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    static uint64_t hashString(const std::string &str)
+    {
+        return hashBytes(str.data(), str.size());
+    }
+
+    // false if the source can't be stat'ed
+    static bool sourceKey(const std::string &sourcePath, CacheSourceKey &key)
+    {
+        std::error_code ec;
+        uint64_t size = std::filesystem::file_size(sourcePath, ec);
+        if (ec)
+            return false;
+        auto mtime = std::filesystem::last_write_time(sourcePath, ec);
+        if (ec)
+            return false;
+        key.hash = hashString(sourcePath);
+        key.size = size;
+        key.mtime = (int64_t)mtime.time_since_epoch().count();
+        return true;
+    }
+
+    static uint64_t align(uint64_t offset)
+    {
+        return (offset + 15) & ~(uint64_t)15;
+    }
+
+    static bool writeBytes(FILE *out, const void *data, size_t size)
+    {
+        return size == 0 || fwrite(data, 1, size, out) == size;
+    }
+
+    // zero-fills up to the given absolute offset
+    static bool pad(FILE *out, uint64_t offset)
+    {
+        static const char zeros[16] = {0};
+        long pos = ftell(out);
+        return pos >= 0 && (uint64_t)pos <= offset && writeBytes(out, zeros, (size_t)(offset - (uint64_t)pos));
+    }
+
+    static std::string tmpPath(const std::string &path)
+    {
+        return path + ".tmp";
+    }
+
+    // closes the file written to tmpPath(path) and moves it over path if everything went in (ok), so a crash
+    // never leaves a torn cache behind; otherwise removes it. False when the cache wasn't replaced.
+    static bool commit(FILE *out, const std::string &path, bool ok)
+    {
+        ok = fclose(out) == 0 && ok;
+        std::error_code ec;
+        if (ok)
+            std::filesystem::rename(tmpPath(path), path, ec);
+        if (!ok || ec)
+        {
+            std::filesystem::remove(tmpPath(path), ec);
+            return false;
+        }
+        return true;
+    }
+};
+#endif
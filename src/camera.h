@@ -116,6 +116,16 @@ public:
             Zoom = 45.0f;
     }
 
+    // places the camera directly, e.g. from a recorded camera path
+    void SetPose(glm::vec3 position, float yaw, float pitch, float zoom)
+    {
+        Position = position;
+        Yaw = yaw;
+        Pitch = pitch;
+        Zoom = zoom;
+        updateCameraVectors();
+    }
+
 private:
     // calculates the front vector from the Camera's (updated) Euler Angles
     void updateCameraVectors()
@@ -0,0 +1,126 @@
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include <glm/glm.hpp>
+
+#include "camera.h"
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+// one recorded camera state
+struct CameraKey {
+    float time;          // seconds since the start of the path
+    glm::vec3 position;
+    float yaw;           // degrees, not wrapped, so interpolation doesn't spin the long way round
+    float pitch;
+    float zoom;
+};
+
+// A timestamped camera path, recorded from live input and replayed at a fixed timestep so runs of different builds
+// see exactly the same frames. Text format, one key per line and '#' starts a comment:
+//
+//   # time x y z yaw pitch zoom
+//   0.0 0.0 0.0 3.0 -90.0 0.0 45.0
+//
+// Keys are sorted by time; sample() interpolates linearly between them and clamps outside.
+class CameraPath
+{
+public:
+    std::vector<CameraKey> keys;
+
+    bool load(const std::string &path)
+    {
+        FILE *file = fopen(path.c_str(), "r");
+        if (!file)
+        {
+            printf("[camera_path.h] Could not open %s\n", path.c_str());
+            return false;
+        }
+        keys.clear();
+        char line[512];
+        unsigned int lineNumber = 0;
+        bool ok = true;
+        while (fgets(line, sizeof(line), file))
+        {
+            lineNumber++;
+            const char *start = line;
+            while (*start == ' ' || *start == '\t')
+                start++;
+            if (*start == '#' || *start == '\n' || *start == '\r' || *start == '\0')
+                continue;
+            CameraKey key;
+            if (sscanf(start, "%f %f %f %f %f %f %f", &key.time, &key.position.x, &key.position.y, &key.position.z, &key.yaw, &key.pitch, &key.zoom) != 7 ||
+                (!keys.empty() && key.time < keys.back().time))
+            {
+                printf("[camera_path.h] %s:%u: expected 'time x y z yaw pitch zoom' with increasing times\n", path.c_str(), lineNumber);
+                ok = false;
+                break;
+            }
+            keys.push_back(key);
+        }
+        fclose(file);
+        if (ok && keys.empty())
+        {
+            printf("[camera_path.h] %s has no keys\n", path.c_str());
+            ok = false;
+        }
+        return ok;
+    }
+
+    bool save(const std::string &path) const
+    {
+        FILE *file = fopen(path.c_str(), "w");
+        if (!file)
+        {
+            printf("[camera_path.h] Could not write %s\n", path.c_str());
+            return false;
+        }
+        fprintf(file, "# time x y z yaw pitch zoom\n");
+        for (const CameraKey &key : keys)
+            fprintf(file, "%.4f %.5f %.5f %.5f %.4f %.4f %.4f\n", key.time, key.position.x, key.position.y, key.position.z, key.yaw, key.pitch, key.zoom);
+        fclose(file);
+        return true;
+    }
+
+    // appends the camera's current state, for recording
+    void record(const Camera &camera, float time)
+    {
+        keys.push_back({time, camera.Position, camera.Yaw, camera.Pitch, camera.Zoom});
+    }
+
+    float duration() const { return keys.empty() ? 0.0f : keys.back().time - keys.front().time; }
+
+    CameraKey sample(float time) const
+    {
+        if (keys.empty())
+            return {time, glm::vec3(0.0f), -90.0f, 0.0f, 45.0f};
+        time += keys.front().time;
+        if (time <= keys.front().time)
+            return keys.front();
+        if (time >= keys.back().time)
+            return keys.back();
+        // binary search for the first key after time
+        size_t low = 0, high = keys.size() - 1;
+        while (high - low > 1)
+        {
+            size_t middle = (low + high) / 2;
+            if (keys[middle].time <= time)
+                low = middle;
+            else
+                high = middle;
+        }
+        const CameraKey &a = keys[low], &b = keys[high];
+        float t = b.time > a.time ? (time - a.time) / (b.time - a.time) : 0.0f;
+        return {time, glm::mix(a.position, b.position, t), glm::mix(a.yaw, b.yaw, t), glm::mix(a.pitch, b.pitch, t), glm::mix(a.zoom, b.zoom, t)};
+    }
+
+    // moves the camera to where the path is time seconds after its first key
+    void apply(Camera &camera, float time) const
+    {
+        CameraKey key = sample(time);
+        camera.SetPose(key.position, key.yaw, key.pitch, key.zoom);
+    }
+};
+#endif
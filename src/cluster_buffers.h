@@ -0,0 +1,161 @@
+#ifndef CLUSTER_BUFFERS_H
+#define CLUSTER_BUFFERS_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "light_clusters.h"
+#include "profiler.h"
+#include "shader.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// std140 mirror of the ClusterUniforms block in src/shaders/clusters.glsl
+struct ClusterUniforms {
+    int size[4];             // tiles x, tiles y, slices, lights
+    glm::vec4 screen;        // width and height of the render target in pixels
+    glm::vec4 depth;         // near, far, slice scale, slice bias: slice = log(depth) * scale + bias
+};
+
+// The GPU side of LightClusters. GL 3.3 has no shader storage buffers, so the lists go into buffer textures the
+// fragment shader reads with texelFetch:
+//   clusterLights        RGBA32F, two texels per light: position.xyz and radius, then colour
+//   clusterOffsets       RG32UI, per cluster the offset into clusterLightIndices and the light count
+//   clusterLightIndices  R32UI, the light indices of every cluster
+// bound to the fixed units CLUSTER_*_TEXTURE_UNIT (Shader::reflect points the samplers there), and the grid
+// constants go into a uniform buffer at CLUSTER_UNIFORM_BINDING. Every buffer is orphaned and refilled per frame.
+//
+// Only use from the GL context thread.
+class ClusterBuffers
+{
+public:
+    ClusterBuffers()
+    {
+        GLint units = 0, texels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &units);
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &texels);
+        // 3.3 only promises 16 fragment units and 64k texels per buffer texture
+        supported = units > CLUSTER_INDICES_TEXTURE_UNIT;
+        maxTexels = (size_t)std::max(texels, 0);
+        if (!supported)
+            printf("[cluster_buffers.h] Only %d texture units, clustered lighting needs %d\n", units, CLUSTER_INDICES_TEXTURE_UNIT + 1);
+
+        glGenBuffers(3, buffers);
+        glGenTextures(3, textures);
+        const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+        for (int i = 0; i < 3; i++)
+        {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+            glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+            glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+        }
+        glBindTexture(GL_TEXTURE_BUFFER, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        glGenBuffers(1, &UBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(ClusterUniforms), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, CLUSTER_UNIFORM_BINDING, UBO);
+    }
+
+    ~ClusterBuffers()
+    {
+        glDeleteTextures(3, textures);
+        glDeleteBuffers(3, buffers);
+        glDeleteBuffers(1, &UBO);
+    }
+
+    ClusterBuffers(const ClusterBuffers &) = delete;
+    ClusterBuffers &operator=(const ClusterBuffers &) = delete;
+
+    bool isSupported() const { return supported; }
+
+    // most lights clusterLights can hold
+    size_t maxLights() const { return maxTexels / 2; }
+
+    // uploads the lights and the last assignment of clusters, which was made for exactly these lights (at most
+    // maxLights() of them), for a width x height target
+    void upload(const LightClusters &clusters, const std::vector<ClusterLight> &lights, unsigned int width, unsigned int height)
+    {
+        size_t lightCount = std::min(lights.size(), maxLights());
+        lightTexels.resize(lightCount * 2);
+        for (size_t i = 0; i < lightCount; i++)
+        {
+            lightTexels[i * 2] = glm::vec4(lights[i].position, lights[i].radius);
+            lightTexels[i * 2 + 1] = glm::vec4(lights[i].color, 0.0f);
+        }
+
+        // lists that would run past the largest buffer texture are cut short rather than read out of range
+        const std::vector<uint32_t> *offsets = &clusters.grid;
+        size_t indexCount = std::min(clusters.indices.size(), maxTexels);
+        if (indexCount < clusters.indices.size())
+        {
+            clampedGrid = clusters.grid;
+            for (size_t c = 0; c < clampedGrid.size(); c += 2)
+                clampedGrid[c + 1] = (uint32_t)std::min<size_t>(clampedGrid[c + 1], indexCount - std::min<size_t>(clampedGrid[c], indexCount));
+            offsets = &clampedGrid;
+            if (!warned)
+                printf("[cluster_buffers.h] %zu light indices don't fit the %zu texel buffer texture, the last clusters lose lights\n",
+                       clusters.indices.size(), maxTexels);
+            warned = true;
+        }
+
+        fill(0, lightTexels.data(), lightTexels.size() * sizeof(glm::vec4));
+        fill(1, offsets->data(), offsets->size() * sizeof(uint32_t));
+        fill(2, clusters.indices.data(), indexCount * sizeof(uint32_t));
+
+        ClusterUniforms uniforms;
+        memset((void *)&uniforms, 0, sizeof(uniforms));
+        uniforms.size[0] = clusters.sizeX();
+        uniforms.size[1] = clusters.sizeY();
+        uniforms.size[2] = clusters.sizeZ();
+        uniforms.size[3] = (int)lightCount;
+        uniforms.screen = glm::vec4((float)width, (float)height, 0.0f, 0.0f);
+        uniforms.depth = glm::vec4(clusters.nearPlane(), clusters.farPlane(), clusters.sliceScale(), clusters.sliceBias());
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(ClusterUniforms), &uniforms);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        Shader::uniformCalls++;
+        Profiler::shared().countUpload(sizeof(ClusterUniforms));
+    }
+
+    // binds the buffer textures to their units for the following draws; leaves unit 0 active
+    void bind() const
+    {
+        const int units[3] = {CLUSTER_LIGHTS_TEXTURE_UNIT, CLUSTER_OFFSETS_TEXTURE_UNIT, CLUSTER_INDICES_TEXTURE_UNIT};
+        for (int i = 0; i < 3; i++)
+        {
+            glActiveTexture(GL_TEXTURE0 + units[i]);
+            glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+        }
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+private:
+    GLuint buffers[3];
+    GLuint textures[3];
+    GLuint UBO;
+    bool supported = false;
+    bool warned = false;
+    size_t maxTexels = 0;
+    std::vector<glm::vec4> lightTexels;
+    std::vector<uint32_t> clampedGrid;
+
+    // orphans buffer i and refills it; an empty buffer keeps a few bytes so the texture stays complete
+    void fill(int i, const void *data, size_t size)
+    {
+        glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        glBufferData(GL_TEXTURE_BUFFER, std::max<size_t>(size, 16), NULL, GL_STREAM_DRAW);
+        if (size > 0)
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        Profiler::shared().countUpload(size);
+    }
+};
+#endif
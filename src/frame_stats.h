@@ -0,0 +1,132 @@
+#ifndef FRAME_STATS_H
+#define FRAME_STATS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+// Summary of a run's frame times in ms, with JSON in and out so benchmark results can be stored as a baseline and
+// compared against by later builds. Percentiles are nearest rank.
+struct FrameTimeStats {
+    size_t frames = 0;
+    double min = 0.0;
+    double mean = 0.0;
+    double p50 = 0.0;
+    double p95 = 0.0;
+    double p99 = 0.0;
+    double max = 0.0;
+
+    static FrameTimeStats compute(std::vector<double> frameMs)
+    {
+        FrameTimeStats stats;
+        if (frameMs.empty())
+            return stats;
+        std::sort(frameMs.begin(), frameMs.end());
+        double sum = 0.0;
+        for (double ms : frameMs)
+            sum += ms;
+        auto percentile = [&](double p) {
+            size_t rank = (size_t)std::ceil(p * frameMs.size());
+            return frameMs[std::min(frameMs.size(), std::max<size_t>(rank, 1)) - 1];
+        };
+        stats.frames = frameMs.size();
+        stats.min = frameMs.front();
+        stats.mean = sum / frameMs.size();
+        stats.p50 = percentile(0.50);
+        stats.p95 = percentile(0.95);
+        stats.p99 = percentile(0.99);
+        stats.max = frameMs.back();
+        return stats;
+    }
+
+    void print(const char *prefix) const
+    {
+        printf("%s %zu frames: mean %.3f ms (%.1f fps), min %.3f, p50 %.3f, p95 %.3f, p99 %.3f, max %.3f ms\n", prefix, frames, mean,
+               mean > 0.0 ? 1000.0 / mean : 0.0, min, p50, p95, p99, max);
+    }
+
+    // the "frame_ms" object of a result file
+    void writeJson(FILE *file) const
+    {
+        fprintf(file, "{\"frames\": %zu, \"min\": %.4f, \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}",
+                frames, min, mean, p50, p95, p99, max);
+    }
+
+    // reads the "frame_ms" object back out of a result file written with writeJson. Only understands that
+    // object, not JSON in general.
+    static bool loadJson(const char *path, FrameTimeStats &stats)
+    {
+        FILE *file = fopen(path, "rb");
+        if (!file)
+        {
+            printf("[frame_stats.h] Could not open %s\n", path);
+            return false;
+        }
+        std::string text;
+        char buffer[4096];
+        size_t read;
+        while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            text.append(buffer, read);
+        fclose(file);
+
+        size_t object = text.find("\"frame_ms\"");
+        size_t end = object == std::string::npos ? object : text.find('}', object);
+        if (end == std::string::npos)
+        {
+            printf("[frame_stats.h] %s has no frame_ms object\n", path);
+            return false;
+        }
+        std::string body = text.substr(object, end - object);
+        auto number = [&](const char *name, double &value) {
+            std::string key = std::string("\"") + name + "\"";
+            size_t at = body.find(key);
+            size_t colon = at == std::string::npos ? at : body.find(':', at + key.size());
+            if (colon == std::string::npos)
+                return false;
+            value = strtod(body.c_str() + colon + 1, nullptr);
+            return true;
+        };
+        double frames = 0.0;
+        if (!number("frames", frames) || !number("min", stats.min) || !number("mean", stats.mean) || !number("p50", stats.p50) ||
+            !number("p95", stats.p95) || !number("p99", stats.p99) || !number("max", stats.max))
+        {
+            printf("[frame_stats.h] %s: frame_ms is missing a field\n", path);
+            return false;
+        }
+        stats.frames = (size_t)frames;
+        return true;
+    }
+
+    // prints every metric next to its baseline value and returns how many got more than threshold (0.1 = 10%)
+    // slower. min and max are single frames and too noisy to fail a run on, they're only reported.
+    unsigned int compare(const FrameTimeStats &baseline, double threshold) const
+    {
+        struct Metric {
+            const char *name;
+            double current, baseline;
+            bool gating;
+        };
+        const Metric metrics[] = {
+            {"min", min, baseline.min, false},
+            {"mean", mean, baseline.mean, true},
+            {"p50", p50, baseline.p50, true},
+            {"p95", p95, baseline.p95, true},
+            {"p99", p99, baseline.p99, true},
+            {"max", max, baseline.max, false},
+        };
+        unsigned int regressions = 0;
+        for (const Metric &metric : metrics)
+        {
+            double change = metric.baseline > 0.0 ? metric.current / metric.baseline - 1.0 : 0.0;
+            bool regressed = metric.gating && change > threshold;
+            regressions += regressed;
+            printf("[frame_stats.h] %-4s %8.3f ms vs baseline %8.3f ms (%+6.1f%%)%s\n", metric.name, metric.current, metric.baseline, change * 100.0,
+                   regressed ? "  REGRESSION" : "");
+        }
+        return regressions;
+    }
+};
+#endif
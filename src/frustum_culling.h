@@ -0,0 +1,280 @@
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <stdint.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FRUSTUM_CULLING_WIDTH 8
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_CULLING_WIDTH 4
+#else
+#define FRUSTUM_CULLING_WIDTH 1
+#endif
+
+// Bounding volumes and view frustum culling. Pure CPU code (no GL calls), so it also runs in the headless bench.
+
+// axis aligned box plus a bounding sphere around the box centre. Culling tests both and rejects an object if
+// either one lies outside a plane: the box is tighter for long thin objects, the sphere for round ones.
+struct Bounds {
+    glm::vec3 center = glm::vec3(0.0f);
+    glm::vec3 extent = glm::vec3(-1.0f); // half size; negative while empty
+    float radius = 0.0f;
+
+    bool empty() const { return extent.x < 0.0f; }
+    glm::vec3 min() const { return center - extent; }
+    glm::vec3 max() const { return center + extent; }
+
+    static Bounds fromMinMax(const glm::vec3 &min, const glm::vec3 &max)
+    {
+        Bounds bounds;
+        bounds.center = (min + max) * 0.5f;
+        bounds.extent = (max - min) * 0.5f;
+        bounds.radius = glm::length(bounds.extent);
+        return bounds;
+    }
+
+    // box and sphere of a point cloud; count points of 'stride' bytes, each starting with a vec3
+    static Bounds fromPoints(const void *points, size_t count, size_t stride)
+    {
+        if (count == 0)
+            return Bounds();
+        const unsigned char *bytes = (const unsigned char *)points;
+        glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+        for (size_t i = 0; i < count; i++)
+        {
+            const glm::vec3 &p = *(const glm::vec3 *)(bytes + i * stride);
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+        Bounds bounds = fromMinMax(lo, hi);
+        // the farthest point usually sits well inside the box corner
+        float radius2 = 0.0f;
+        for (size_t i = 0; i < count; i++)
+        {
+            glm::vec3 d = *(const glm::vec3 *)(bytes + i * stride) - bounds.center;
+            radius2 = std::max(radius2, glm::dot(d, d));
+        }
+        bounds.radius = std::sqrt(radius2);
+        return bounds;
+    }
+
+    // smallest bounds (of this form) containing both
+    Bounds merged(const Bounds &other) const
+    {
+        if (empty())
+            return other;
+        if (other.empty())
+            return *this;
+        Bounds bounds = fromMinMax(glm::min(min(), other.min()), glm::max(max(), other.max()));
+        bounds.radius = std::min(bounds.radius, std::max(glm::length(center - bounds.center) + radius, glm::length(other.center - bounds.center) + other.radius));
+        return bounds;
+    }
+
+    // bounds of the transformed volume (Arvo's method for the box, largest axis scale for the sphere)
+    Bounds transformed(const glm::mat4 &m) const
+    {
+        if (empty())
+            return *this;
+        Bounds bounds;
+        bounds.center = glm::vec3(m * glm::vec4(center, 1.0f));
+        glm::mat3 a(m);
+        for (int row = 0; row < 3; row++)
+            bounds.extent[row] = std::fabs(a[0][row]) * extent.x + std::fabs(a[1][row]) * extent.y + std::fabs(a[2][row]) * extent.z;
+        float scale = std::max(glm::length(a[0]), std::max(glm::length(a[1]), glm::length(a[2])));
+        bounds.radius = std::min(radius * scale, glm::length(bounds.extent));
+        return bounds;
+    }
+};
+
+// six planes (a, b, c, d) with normals pointing inwards: a point p is inside a plane when dot(abc, p) + d >= 0
+struct Frustum {
+    glm::vec4 planes[6];
+
+    // Gribb/Hartmann extraction. With projection * view the planes are in world space; with
+    // projection * view * model they are in the model's space, so model space bounds can be tested directly.
+    static Frustum fromMatrix(const glm::mat4 &m)
+    {
+        Frustum frustum;
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+        frustum.planes[0] = row3 + row0; // left
+        frustum.planes[1] = row3 - row0; // right
+        frustum.planes[2] = row3 + row1; // bottom
+        frustum.planes[3] = row3 - row1; // top
+        frustum.planes[4] = row3 + row2; // near
+        frustum.planes[5] = row3 - row2; // far
+        for (glm::vec4 &plane : frustum.planes)
+        {
+            float length = glm::length(glm::vec3(plane));
+            if (length > 0.0f)
+                plane /= length;
+        }
+        return frustum;
+    }
+
+    // scalar reference test
+    bool intersects(const Bounds &bounds) const
+    {
+        if (bounds.empty())
+            return false;
+        for (const glm::vec4 &plane : planes)
+        {
+            glm::vec3 n(plane);
+            float distance = glm::dot(n, bounds.center) + plane.w;
+            float boxRadius = glm::dot(glm::abs(n), bounds.extent);
+            if (distance < -std::min(bounds.radius, boxRadius))
+                return false;
+        }
+        return true;
+    }
+};
+
+struct CullingStats {
+    unsigned int tested = 0;
+    unsigned int visible = 0;
+    unsigned int culled = 0;
+
+    void add(const CullingStats &other)
+    {
+        tested += other.tested;
+        visible += other.visible;
+        culled += other.culled;
+    }
+};
+
+// Bounds of many objects in structure-of-arrays form, tested against a frustum FRUSTUM_CULLING_WIDTH objects at a
+// time (8 with AVX, 4 with SSE2, else 1). The arrays are padded to the SIMD width with empty bounds that never pass.
+class CullingSet
+{
+public:
+    CullingStats stats; // of the last cull
+
+    unsigned int add(const Bounds &bounds)
+    {
+        unsigned int index = count++;
+        if (count > centerX.size())
+            resize(count);
+        set(index, bounds);
+        return index;
+    }
+
+    void set(unsigned int index, const Bounds &bounds)
+    {
+        centerX[index] = bounds.center.x;
+        centerY[index] = bounds.center.y;
+        centerZ[index] = bounds.center.z;
+        extentX[index] = bounds.extent.x;
+        extentY[index] = bounds.extent.y;
+        extentZ[index] = bounds.extent.z;
+        // empty bounds get a negative radius so they fail every plane
+        radius[index] = bounds.empty() ? -FLT_MAX : bounds.radius;
+    }
+
+    void clear()
+    {
+        count = 0;
+        resize(0);
+    }
+
+    unsigned int size() const { return count; }
+
+    // appends the indices of the objects that intersect the frustum to 'visible', in increasing order
+    void cull(const Frustum &frustum, std::vector<uint32_t> &visible)
+    {
+        size_t start = visible.size();
+        unsigned int i = 0;
+#if FRUSTUM_CULLING_WIDTH == 8
+        for (; i < count; i += 8)
+        {
+            __m256 cx = _mm256_loadu_ps(&centerX[i]), cy = _mm256_loadu_ps(&centerY[i]), cz = _mm256_loadu_ps(&centerZ[i]);
+            __m256 ex = _mm256_loadu_ps(&extentX[i]), ey = _mm256_loadu_ps(&extentY[i]), ez = _mm256_loadu_ps(&extentZ[i]);
+            __m256 r = _mm256_loadu_ps(&radius[i]);
+            __m256 outside = _mm256_setzero_ps();
+            const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+            for (const glm::vec4 &plane : frustum.planes)
+            {
+                __m256 nx = _mm256_set1_ps(plane.x), ny = _mm256_set1_ps(plane.y), nz = _mm256_set1_ps(plane.z);
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, cx), _mm256_mul_ps(ny, cy)), _mm256_add_ps(_mm256_mul_ps(nz, cz), _mm256_set1_ps(plane.w)));
+                __m256 boxRadius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_and_ps(nx, absMask), ex), _mm256_mul_ps(_mm256_and_ps(ny, absMask), ey)), _mm256_mul_ps(_mm256_and_ps(nz, absMask), ez));
+                __m256 effective = _mm256_min_ps(r, boxRadius);
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, effective), _mm256_setzero_ps(), _CMP_LT_OQ));
+            }
+            emit(i, ~_mm256_movemask_ps(outside) & 0xFF, visible);
+        }
+#elif FRUSTUM_CULLING_WIDTH == 4
+        for (; i < count; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&centerX[i]), cy = _mm_loadu_ps(&centerY[i]), cz = _mm_loadu_ps(&centerZ[i]);
+            __m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+            __m128 r = _mm_loadu_ps(&radius[i]);
+            __m128 outside = _mm_setzero_ps();
+            const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+            for (const glm::vec4 &plane : frustum.planes)
+            {
+                __m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z);
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_add_ps(_mm_mul_ps(nz, cz), _mm_set1_ps(plane.w)));
+                __m128 boxRadius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_and_ps(nx, absMask), ex), _mm_mul_ps(_mm_and_ps(ny, absMask), ey)), _mm_mul_ps(_mm_and_ps(nz, absMask), ez));
+                __m128 effective = _mm_min_ps(r, boxRadius);
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, effective), _mm_setzero_ps()));
+            }
+            emit(i, ~_mm_movemask_ps(outside) & 0xF, visible);
+        }
+#else
+        for (; i < count; i++)
+        {
+            bool inside = radius[i] >= 0.0f;
+            for (int p = 0; p < 6 && inside; p++)
+            {
+                const glm::vec4 &plane = frustum.planes[p];
+                float distance = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w;
+                float boxRadius = std::fabs(plane.x) * extentX[i] + std::fabs(plane.y) * extentY[i] + std::fabs(plane.z) * extentZ[i];
+                inside = distance + std::min(radius[i], boxRadius) >= 0.0f;
+            }
+            if (inside)
+                visible.push_back(i);
+        }
+#endif
+        stats.tested = count;
+        stats.visible = (unsigned int)(visible.size() - start);
+        stats.culled = stats.tested - stats.visible;
+    }
+
+private:
+    unsigned int count = 0;
+    std::vector<float> centerX, centerY, centerZ, extentX, extentY, extentZ, radius;
+
+    // keeps every array a whole number of SIMD batches long, padding with never visible entries
+    void resize(unsigned int size)
+    {
+        size_t padded = (size + FRUSTUM_CULLING_WIDTH - 1) / FRUSTUM_CULLING_WIDTH * FRUSTUM_CULLING_WIDTH;
+        for (std::vector<float> *array : {&centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ})
+            array->resize(padded, 0.0f);
+        radius.resize(padded, -FLT_MAX);
+        for (size_t i = size; i < padded; i++)
+            radius[i] = -FLT_MAX;
+    }
+
+    // appends the set bits of a visibility mask
+    static void emit(unsigned int base, int mask, std::vector<uint32_t> &visible)
+    {
+        while (mask)
+        {
+            int bit = 0;
+            while (!(mask & (1 << bit)))
+                bit++;
+            visible.push_back(base + bit);
+            mask &= mask - 1;
+        }
+    }
+};
+#endif
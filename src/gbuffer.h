@@ -0,0 +1,103 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <glad/glad.h>
+
+#include "render_graph.h"
+#include "render_targets.h"
+#include "shader.h"
+
+#include <glm/glm.hpp>
+
+#include <math.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <algorithm>
+#include <vector>
+
+// Targets of the deferred path, declared on the frame's render graph. The geometry pass (src/shaders/gbuffer.fs)
+// writes every opaque surface's material here, the lighting pass (src/shaders/deferred_lighting.fs) shades each pixel
+// once from them, whatever the depth complexity. Packed to 12 bytes a pixel:
+//   RGBA8            albedo, specular intensity
+//   RG16             world space normal, octahedral
+//   DEPTH24_STENCIL8 depth, the position is rebuilt from it instead of being stored
+// The depth is the scene's own depth target, so the forward draws after the lighting pass test against the
+// deferred surfaces without a copy.
+struct GBuffer {
+    static const unsigned int BYTES_PER_PIXEL = 4 + 4 + 4;
+    // what the common unpacked layout takes: RGBA16F position, RGBA16F normal, RGBA8 albedo/specular and the depth
+    static const unsigned int UNPACKED_BYTES_PER_PIXEL = 8 + 8 + 4 + 4;
+
+    int albedoSpecular = -1;
+    int normal = -1;
+    int depth = -1;
+
+    // declares the colour targets on graph, next to the scene's depth target
+    static GBuffer declare(RenderGraph &graph, int sceneDepth)
+    {
+        GBuffer gbuffer;
+        gbuffer.albedoSpecular = graph.createTarget("gAlbedoSpecular", {TARGET_RGBA8});
+        gbuffer.normal = graph.createTarget("gNormal", {TARGET_RG16});
+        gbuffer.depth = sceneDepth;
+        return gbuffer;
+    }
+
+    std::vector<int> targets() const { return {albedoSpecular, normal, depth}; }
+
+    // binds the targets to the lighting pass's texture units; leaves unit 0 active. GL thread only.
+    void bindTextures(const RenderGraph &graph, const RenderTargets &renderTargets) const
+    {
+        glActiveTexture(GL_TEXTURE0 + GBUFFER_DEPTH_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, renderTargets.texture(graph, depth));
+        glActiveTexture(GL_TEXTURE0 + GBUFFER_NORMAL_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, renderTargets.texture(graph, normal));
+        glActiveTexture(GL_TEXTURE0 + GBUFFER_ALBEDO_SPECULAR_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, renderTargets.texture(graph, albedoSpecular));
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // the pixels (x, y, width, height) of a width x height screen a sphere can cover, for scissoring a light's pass
+    // to the part of the screen it reaches; false when the sphere is off screen. A sphere reaching behind the camera
+    // covers the whole screen.
+    static bool lightRect(const glm::mat4 &viewProjection, const glm::vec3 &center, float radius, unsigned int width, unsigned int height, int rect[4])
+    {
+        // normalised device coordinates of the corners of the sphere's box
+        float lo[2] = {1.0f, 1.0f}, hi[2] = {-1.0f, -1.0f};
+        bool wholeScreen = isinf(radius);
+        for (int i = 0; i < 8 && !wholeScreen; i++)
+        {
+            glm::vec3 corner = center + radius * glm::vec3(i & 1 ? 1.0f : -1.0f, i & 2 ? 1.0f : -1.0f, i & 4 ? 1.0f : -1.0f);
+            glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+            wholeScreen = clip.w <= 0.0f;
+            for (int axis = 0; axis < 2 && !wholeScreen; axis++)
+            {
+                lo[axis] = std::min(lo[axis], clip[axis] / clip.w);
+                hi[axis] = std::max(hi[axis], clip[axis] / clip.w);
+            }
+        }
+        const float size[2] = {(float)width, (float)height};
+        for (int axis = 0; axis < 2; axis++)
+        {
+            float first = wholeScreen ? 0.0f : std::min(std::max(lo[axis] * 0.5f + 0.5f, 0.0f), 1.0f) * size[axis];
+            float last = wholeScreen ? size[axis] : std::min(std::max(hi[axis] * 0.5f + 0.5f, 0.0f), 1.0f) * size[axis];
+            rect[axis] = (int)floorf(first);
+            rect[axis + 2] = (int)ceilf(last) - rect[axis];
+        }
+        return rect[2] > 0 && rect[3] > 0;
+    }
+
+    static size_t sizeBytes(unsigned int width, unsigned int height) { return (size_t)width * height * BYTES_PER_PIXEL; }
+
+    // the least memory traffic a frame costs: every target written once and read once
+    static size_t frameTrafficBytes(unsigned int width, unsigned int height) { return sizeBytes(width, height) * 2; }
+
+    static void printStats(unsigned int width, unsigned int height, double frameMs)
+    {
+        double mb = 1.0 / (1024.0 * 1024.0);
+        size_t traffic = frameTrafficBytes(width, height);
+        printf("[gbuffer.h] %ux%u, %u bytes/px (%u unpacked): %.1f MB of targets, at least %.1f MB moved per frame, %.2f GB/s at %.2f ms per frame\n",
+               width, height, BYTES_PER_PIXEL, UNPACKED_BYTES_PER_PIXEL, sizeBytes(width, height) * mb, traffic * mb,
+               frameMs > 0.0 ? traffic / (frameMs * 1e6) : 0.0, frameMs);
+    }
+};
+#endif
@@ -0,0 +1,324 @@
+#ifndef GEOMETRY_ARENA_H
+#define GEOMETRY_ARENA_H
+
+#include <glad/glad.h>
+
+#include "profiler.h"
+#include "vertex_format.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <iterator>
+#include <map>
+#include <vector>
+
+// First-fit allocator over a range of [0, capacity) units. Free blocks are kept sorted by offset and merged with
+// their neighbours on free, so fragmentation only comes from live allocations.
+class RangeAllocator
+{
+public:
+    static const unsigned int INVALID = ~0u;
+
+    unsigned int capacity = 0;
+    unsigned int used = 0;
+
+    void grow(unsigned int newCapacity)
+    {
+        if (newCapacity <= capacity)
+            return;
+        // the new space enters as a freed block, merged with any free block at the old end
+        used += newCapacity - capacity;
+        release(capacity, newCapacity - capacity);
+        capacity = newCapacity;
+    }
+
+    // returns the offset of a block of 'size' units, or INVALID if no free block is large enough
+    unsigned int allocate(unsigned int size)
+    {
+        if (size == 0)
+            return 0;
+        for (auto it = freeBlocks.begin(); it != freeBlocks.end(); ++it)
+        {
+            if (it->second < size)
+                continue;
+            unsigned int offset = it->first;
+            unsigned int remaining = it->second - size;
+            freeBlocks.erase(it);
+            if (remaining > 0)
+                freeBlocks[offset + size] = remaining;
+            used += size;
+            return offset;
+        }
+        return INVALID;
+    }
+
+    void release(unsigned int offset, unsigned int size)
+    {
+        if (size == 0)
+            return;
+        used -= size;
+        auto next = freeBlocks.lower_bound(offset);
+        // merge with the following block
+        if (next != freeBlocks.end() && offset + size == next->first)
+        {
+            size += next->second;
+            next = freeBlocks.erase(next);
+        }
+        // merge with the preceding block
+        if (next != freeBlocks.begin())
+        {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == offset)
+            {
+                prev->second += size;
+                return;
+            }
+        }
+        freeBlocks[offset] = size;
+    }
+
+    unsigned int largestFreeBlock() const
+    {
+        unsigned int largest = 0;
+        for (const auto &block : freeBlocks)
+            largest = std::max(largest, block.second);
+        return largest;
+    }
+
+    // 0 when all free space is one block, approaching 1 as it splinters into small holes
+    float fragmentation() const
+    {
+        unsigned int free = capacity - used;
+        return free ? 1.0f - (float)largestFreeBlock() / free : 0.0f;
+    }
+
+    float utilisation() const
+    {
+        return capacity ? (float)used / capacity : 0.0f;
+    }
+
+private:
+    std::map<unsigned int, unsigned int> freeBlocks; // offset -> size
+};
+
+// where a mesh lives inside the arena
+struct ArenaAllocation {
+    unsigned int pool = RangeAllocator::INVALID;
+    unsigned int firstVertex = 0;
+    unsigned int vertexCount = 0;
+    unsigned int firstIndex = 0;
+    unsigned int indexCount = 0;
+
+    bool valid() const { return pool != RangeAllocator::INVALID; }
+};
+
+// Shares a few large vertex/index buffers between all meshes instead of a VAO/VBO/EBO per mesh. There is one pool per
+// (vertex layout, index type) combination, each with a single VAO, so everything in a pool can be drawn with one
+// glMultiDrawElementsBaseVertex. Pools grow by doubling (GPU side copy) when they run out of space.
+class GeometryArena
+{
+public:
+    struct Pool {
+        VertexLayout layout;
+        GLenum indexType;
+        unsigned int VAO = 0, VBO = 0, EBO = 0;
+        RangeAllocator vertices;
+        RangeAllocator indices;
+
+        unsigned int indexSize() const { return indexType == GL_UNSIGNED_SHORT ? 2 : 4; }
+    };
+
+    // initial pool capacities, in vertices and indices
+    static const unsigned int INITIAL_VERTICES = 1 << 16;
+    static const unsigned int INITIAL_INDICES = 3 << 16;
+
+    static GeometryArena &shared()
+    {
+        static GeometryArena arena;
+        return arena;
+    }
+
+    // copies the packed vertices and indices into the arena. Indices stay relative to the allocation, the draw
+    // adds firstVertex as base vertex.
+    ArenaAllocation allocate(VertexLayout layout, const unsigned char *vertexData, unsigned int vertexCount, GLenum indexType, const void *indexData, unsigned int indexCount)
+    {
+        ArenaAllocation allocation = reserve(layout, vertexCount, indexType, indexCount);
+        Pool &pool = pools[allocation.pool];
+
+        // GL_COPY_WRITE_BUFFER keeps the uploads from touching any VAO's element buffer binding
+        unsigned int stride = layout.stride();
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool.VBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, vertexOffset(allocation), (GLsizeiptr)vertexCount * stride, vertexData);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, pool.EBO);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, indexOffset(allocation), (GLsizeiptr)indexCount * pool.indexSize(), indexData);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        Profiler::shared().countUpload((uint64_t)vertexCount * stride + (uint64_t)indexCount * pool.indexSize());
+        return allocation;
+    }
+
+    // makes room for a mesh without filling it; the caller copies the data into the pool's buffers at
+    // vertexOffset / indexOffset. The buffers are replaced when a pool grows, so look them up right before copying.
+    ArenaAllocation reserve(VertexLayout layout, unsigned int vertexCount, GLenum indexType, unsigned int indexCount)
+    {
+        ArenaAllocation allocation;
+        allocation.pool = findPool(layout, indexType);
+        Pool &pool = pools[allocation.pool];
+
+        allocation.firstVertex = pool.vertices.allocate(vertexCount);
+        while (allocation.firstVertex == RangeAllocator::INVALID)
+        {
+            growVertices(pool, std::max(pool.vertices.capacity * 2, pool.vertices.capacity + vertexCount));
+            allocation.firstVertex = pool.vertices.allocate(vertexCount);
+        }
+        allocation.firstIndex = pool.indices.allocate(indexCount);
+        while (allocation.firstIndex == RangeAllocator::INVALID)
+        {
+            growIndices(pool, std::max(pool.indices.capacity * 2, pool.indices.capacity + indexCount));
+            allocation.firstIndex = pool.indices.allocate(indexCount);
+        }
+        allocation.vertexCount = vertexCount;
+        allocation.indexCount = indexCount;
+        return allocation;
+    }
+
+    // byte offsets of an allocation inside its pool's vertex and index buffers
+    GLintptr vertexOffset(const ArenaAllocation &allocation) const
+    {
+        return (GLintptr)allocation.firstVertex * pools[allocation.pool].layout.stride();
+    }
+    GLintptr indexOffset(const ArenaAllocation &allocation) const
+    {
+        return (GLintptr)allocation.firstIndex * pools[allocation.pool].indexSize();
+    }
+
+    void free(ArenaAllocation &allocation)
+    {
+        if (!allocation.valid())
+            return;
+        Pool &pool = pools[allocation.pool];
+        pool.vertices.release(allocation.firstVertex, allocation.vertexCount);
+        pool.indices.release(allocation.firstIndex, allocation.indexCount);
+        allocation = ArenaAllocation();
+    }
+
+    const Pool &pool(unsigned int index) const { return pools[index]; }
+    size_t poolCount() const { return pools.size(); }
+
+    void printStats() const
+    {
+        for (size_t i = 0; i < pools.size(); i++)
+        {
+            const Pool &p = pools[i];
+            printf("[geometry_arena.h] Pool %zu (stride %u, %u-bit indices): vertices %.1f%% used of %u (fragmentation %.2f), indices %.1f%% used of %u (fragmentation %.2f)\n",
+                   i, p.layout.stride(), p.indexSize() * 8,
+                   p.vertices.utilisation() * 100.0f, p.vertices.capacity, p.vertices.fragmentation(),
+                   p.indices.utilisation() * 100.0f, p.indices.capacity, p.indices.fragmentation());
+        }
+    }
+
+private:
+    std::vector<Pool> pools;
+
+    GeometryArena() {}
+
+    unsigned int findPool(VertexLayout layout, GLenum indexType)
+    {
+        for (size_t i = 0; i < pools.size(); i++)
+            if (pools[i].layout.flags == layout.flags && pools[i].indexType == indexType)
+                return (unsigned int)i;
+
+        Pool pool;
+        pool.layout = layout;
+        pool.indexType = indexType;
+        glGenVertexArrays(1, &pool.VAO);
+        growVertices(pool, INITIAL_VERTICES);
+        growIndices(pool, INITIAL_INDICES);
+        pools.push_back(pool);
+        return (unsigned int)(pools.size() - 1);
+    }
+
+    // reallocates a buffer with more room and copies the old contents over on the GPU
+    static unsigned int growBuffer(unsigned int oldBuffer, size_t oldSize, size_t newSize)
+    {
+        unsigned int buffer;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, newSize, NULL, GL_STATIC_DRAW);
+        if (oldBuffer)
+        {
+            glBindBuffer(GL_COPY_READ_BUFFER, oldBuffer);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, oldSize);
+            glBindBuffer(GL_COPY_READ_BUFFER, 0);
+            glDeleteBuffers(1, &oldBuffer);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        return buffer;
+    }
+
+    static void growVertices(Pool &pool, unsigned int capacity)
+    {
+        unsigned int stride = pool.layout.stride();
+        pool.VBO = growBuffer(pool.VBO, (size_t)pool.vertices.capacity * stride, (size_t)capacity * stride);
+        pool.vertices.grow(capacity);
+        // the attribute pointers captured the old buffer
+        glBindVertexArray(pool.VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, pool.VBO);
+        pool.layout.setupAttributes();
+        glBindVertexArray(0);
+    }
+
+    static void growIndices(Pool &pool, unsigned int capacity)
+    {
+        pool.EBO = growBuffer(pool.EBO, (size_t)pool.indices.capacity * pool.indexSize(), (size_t)capacity * pool.indexSize());
+        pool.indices.grow(capacity);
+        glBindVertexArray(pool.VAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.EBO);
+        glBindVertexArray(0);
+    }
+};
+
+// Collects draws of arena meshes and submits every run that shares a pool as one glMultiDrawElementsBaseVertex.
+// Callers bind whatever else the run needs (program, textures) between flushes.
+class ArenaDrawList
+{
+public:
+    // queues count indices starting at firstIndex of the pool, offset by baseVertex
+    void add(unsigned int pool, unsigned int firstIndex, unsigned int count, int baseVertex)
+    {
+        if (pool != currentPool)
+            flush();
+        currentPool = pool;
+        unsigned int indexSize = GeometryArena::shared().pool(pool).indexSize();
+        counts.push_back((GLsizei)count);
+        offsets.push_back((const void *)((size_t)firstIndex * indexSize));
+        baseVertices.push_back(baseVertex);
+    }
+
+    // issues the queued draws, one call per pool run
+    void flush()
+    {
+        if (counts.empty())
+            return;
+        const GeometryArena::Pool &pool = GeometryArena::shared().pool(currentPool);
+        glBindVertexArray(pool.VAO);
+        glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), pool.indexType, (const void *const *)offsets.data(), (GLsizei)counts.size(), baseVertices.data());
+        glBindVertexArray(0);
+        drawCalls++;
+        GLsizei indices = 0;
+        for (GLsizei count : counts)
+            indices += count;
+        Profiler::shared().countDraw(indices);
+        counts.clear();
+        offsets.clear();
+        baseVertices.clear();
+    }
+
+    size_t drawCalls = 0; // multi-draw calls issued so far
+
+private:
+    unsigned int currentPool = RangeAllocator::INVALID;
+    std::vector<GLsizei> counts;
+    std::vector<const void *> offsets;
+    std::vector<GLint> baseVertices;
+};
+#endif
@@ -0,0 +1,133 @@
+#ifndef HEADLESS_CONTEXT_H
+#define HEADLESS_CONTEXT_H
+
+#ifdef HAVE_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+// An OpenGL 3.3 core context without a window or display server, for render farm nodes and benchmarks. Uses EGL
+// on Mesa's surfaceless platform when it's there (software rendering works too: LIBGL_ALWAYS_SOFTWARE=1 gives
+// llvmpipe), else the default EGL display. There is no default framebuffer, so everything has to render into
+// framebuffer objects. Needs a build with ENABLE_HEADLESS, which defines HAVE_EGL; without it create() fails.
+class HeadlessContext
+{
+public:
+    HeadlessContext() {}
+    HeadlessContext(const HeadlessContext &) = delete;
+    HeadlessContext &operator=(const HeadlessContext &) = delete;
+    ~HeadlessContext() { destroy(); }
+
+    // creates the context and makes it current on the calling thread
+    bool create()
+    {
+#ifdef HAVE_EGL
+        // the surfaceless platform needs neither a GPU nor a display server
+        const char *clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay && hasExtension(clientExtensions, "EGL_MESA_platform_surfaceless"))
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display == EGL_NO_DISPLAY)
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        EGLint major = 0, minor = 0;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor))
+            return fail("no EGL display");
+
+        // contexts without any surface need EGL_KHR_surfaceless_context, otherwise render to a 1x1 pbuffer that
+        // is never read from
+        bool surfaceless = hasExtension(eglQueryString(display, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context");
+        const EGLint configAttributes[] = {
+            EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_NONE
+        };
+        EGLConfig config;
+        EGLint configCount = 0;
+        if (!eglChooseConfig(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+            return fail("no EGL config for desktop OpenGL");
+        if (!eglBindAPI(EGL_OPENGL_API))
+            return fail("EGL can't bind desktop OpenGL");
+
+        const EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3,
+            EGL_CONTEXT_MINOR_VERSION, 3,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, contextAttributes);
+        if (context == EGL_NO_CONTEXT)
+            return fail("could not create an OpenGL 3.3 core context");
+        if (!surfaceless)
+        {
+            const EGLint pbufferAttributes[] = {EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE};
+            surface = eglCreatePbufferSurface(display, config, pbufferAttributes);
+            if (surface == EGL_NO_SURFACE)
+                return fail("could not create a pbuffer");
+        }
+        if (!eglMakeCurrent(display, surface, surface, context))
+            return fail("could not make the context current");
+        printf("[headless_context.h] EGL %d.%d %s context\n", major, minor, surfaceless ? "surfaceless" : "pbuffer");
+        return true;
+#else
+        printf("[headless_context.h] Built without EGL, reconfigure with -DENABLE_HEADLESS=ON\n");
+        return false;
+#endif
+    }
+
+    void destroy()
+    {
+#ifdef HAVE_EGL
+        if (display == EGL_NO_DISPLAY)
+            return;
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (surface != EGL_NO_SURFACE)
+            eglDestroySurface(display, surface);
+        if (context != EGL_NO_CONTEXT)
+            eglDestroyContext(display, context);
+        eglTerminate(display);
+        display = EGL_NO_DISPLAY;
+        surface = EGL_NO_SURFACE;
+        context = EGL_NO_CONTEXT;
+#endif
+    }
+
+    // for gladLoadGLLoader
+    static void *getProcAddress(const char *name)
+    {
+#ifdef HAVE_EGL
+        return (void *)eglGetProcAddress(name);
+#else
+        (void)name;
+        return nullptr;
+#endif
+    }
+
+private:
+#ifdef HAVE_EGL
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLSurface surface = EGL_NO_SURFACE;
+    EGLContext context = EGL_NO_CONTEXT;
+
+    static bool hasExtension(const char *extensions, const char *name)
+    {
+        if (!extensions)
+            return false;
+        size_t length = strlen(name);
+        for (const char *found = strstr(extensions, name); found; found = strstr(found + length, name))
+            if ((found == extensions || found[-1] == ' ') && (found[length] == ' ' || found[length] == '\0'))
+                return true;
+        return false;
+    }
+
+    bool fail(const char *reason)
+    {
+        printf("[headless_context.h] Headless context failed: %s (EGL error 0x%04X)\n", reason, eglGetError());
+        destroy();
+        return false;
+    }
+#endif
+};
+#endif
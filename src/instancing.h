@@ -0,0 +1,142 @@
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "profiler.h"
+
+#include <stdint.h>
+
+// Per-instance vertex attributes, read with glVertexAttribDivisor(1). Locations follow the per-vertex ones in
+// vertex_format.h:
+//   7-10 instance transform  mat4
+//   11   instance colour     vec4  (constant white when not given)
+//   12   material index      uint  (constant 0 when not given)
+const unsigned int INSTANCE_TRANSFORM_LOCATION = 7;
+const unsigned int INSTANCE_COLOR_LOCATION = 11;
+const unsigned int INSTANCE_MATERIAL_LOCATION = 12;
+
+// Streams per-instance data to the GPU for one instanced draw. The caller's arrays are copied as they are, one
+// stream after the other (transforms, then colours, then material indices), so no per-instance repacking happens
+// on the CPU. The buffer is orphaned on every upload so a frame never waits on the previous frame's draws.
+class InstanceBuffer
+{
+public:
+    unsigned int VBO;
+    size_t count = 0;
+
+    InstanceBuffer()
+    {
+        glGenBuffers(1, &VBO);
+    }
+
+    InstanceBuffer(const InstanceBuffer &) = delete;
+    InstanceBuffer &operator=(const InstanceBuffer &) = delete;
+
+    ~InstanceBuffer()
+    {
+        glDeleteBuffers(1, &VBO);
+    }
+
+    // replaces the instances; colors and materials are optional and, when given, hold count entries
+    void upload(const glm::mat4 *transforms, size_t count, const glm::vec4 *colors = nullptr, const uint32_t *materials = nullptr)
+    {
+        this->count = count;
+        hasColors = colors != nullptr;
+        hasMaterials = materials != nullptr;
+        colorOffset = count * sizeof(glm::mat4);
+        materialOffset = colorOffset + (hasColors ? count * sizeof(glm::vec4) : 0);
+        size_t size = materialOffset + (hasMaterials ? count * sizeof(uint32_t) : 0);
+
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        if (size > capacity)
+            capacity = size + size / 2;
+        glBufferData(GL_ARRAY_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(glm::mat4), transforms);
+        if (hasColors)
+            glBufferSubData(GL_ARRAY_BUFFER, colorOffset, count * sizeof(glm::vec4), colors);
+        if (hasMaterials)
+            glBufferSubData(GL_ARRAY_BUFFER, materialOffset, count * sizeof(uint32_t), materials);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        Profiler::shared().countUpload(size);
+    }
+
+    // points the instance attributes of the currently bound VAO at this buffer. VAOs are shared (the geometry arena
+    // has one per pool), so every instanced draw attaches right before drawing and detaches afterwards.
+    void attach() const
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        for (unsigned int column = 0; column < 4; column++)
+        {
+            unsigned int location = INSTANCE_TRANSFORM_LOCATION + column;
+            glEnableVertexAttribArray(location);
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void *)(column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(location, 1);
+        }
+        if (hasColors)
+        {
+            glEnableVertexAttribArray(INSTANCE_COLOR_LOCATION);
+            glVertexAttribPointer(INSTANCE_COLOR_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void *)colorOffset);
+            glVertexAttribDivisor(INSTANCE_COLOR_LOCATION, 1);
+        }
+        else
+        {
+            glDisableVertexAttribArray(INSTANCE_COLOR_LOCATION);
+            glVertexAttrib4f(INSTANCE_COLOR_LOCATION, 1.0f, 1.0f, 1.0f, 1.0f);
+        }
+        if (hasMaterials)
+        {
+            glEnableVertexAttribArray(INSTANCE_MATERIAL_LOCATION);
+            glVertexAttribIPointer(INSTANCE_MATERIAL_LOCATION, 1, GL_UNSIGNED_INT, sizeof(uint32_t), (void *)materialOffset);
+            glVertexAttribDivisor(INSTANCE_MATERIAL_LOCATION, 1);
+        }
+        else
+        {
+            glDisableVertexAttribArray(INSTANCE_MATERIAL_LOCATION);
+            glVertexAttribI1ui(INSTANCE_MATERIAL_LOCATION, 0);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // disables the instance attributes of the currently bound VAO again
+    static void detach()
+    {
+        for (unsigned int location = INSTANCE_TRANSFORM_LOCATION; location <= INSTANCE_MATERIAL_LOCATION; location++)
+            glDisableVertexAttribArray(location);
+    }
+
+    // instanced draws of raw VAOs, e.g. the cube in main.cpp
+    void drawArrays(unsigned int VAO, unsigned int first, unsigned int vertexCount) const
+    {
+        if (count == 0)
+            return;
+        glBindVertexArray(VAO);
+        attach();
+        glDrawArraysInstanced(GL_TRIANGLES, first, vertexCount, (GLsizei)count);
+        Profiler::shared().countDraw(vertexCount, count);
+        detach();
+        glBindVertexArray(0);
+    }
+
+    void drawElements(unsigned int VAO, GLenum indexType, unsigned int firstIndex, unsigned int indexCount, int baseVertex = 0) const
+    {
+        if (count == 0)
+            return;
+        unsigned int indexSize = indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+        glBindVertexArray(VAO);
+        attach();
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, indexCount, indexType, (void *)((size_t)firstIndex * indexSize), (GLsizei)count, baseVertex);
+        Profiler::shared().countDraw(indexCount, count);
+        detach();
+        glBindVertexArray(0);
+    }
+
+private:
+    size_t capacity = 0;
+    size_t colorOffset = 0;
+    size_t materialOffset = 0;
+    bool hasColors = false;
+    bool hasMaterials = false;
+};
+#endif
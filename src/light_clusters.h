@@ -0,0 +1,352 @@
+#ifndef LIGHT_CLUSTERS_H
+#define LIGHT_CLUSTERS_H
+
+#include <glm/glm.hpp>
+
+#include "thread_pool.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LIGHT_CLUSTERS_WIDTH 4
+#else
+#define LIGHT_CLUSTERS_WIDTH 1
+#endif
+
+// Clustered light assignment. Pure CPU code (no GL calls), so it also runs in the headless bench; ClusterBuffers
+// (cluster_buffers.h) uploads the result for src/shaders/clusters.glsl.
+//
+// The view frustum is split into tilesX x tilesY screen tiles and 'slices' depth slices spaced exponentially between
+// the near and far plane, so clusters stay roughly cube shaped. assign() lists for every cluster the lights whose
+// sphere of influence touches the cluster's view space bounding box, and a fragment then only shades the lights of
+// its own cluster instead of all of them.
+
+// a point light as the clustered shader sees it: no light at all past 'radius'
+struct ClusterLight {
+    glm::vec3 position = glm::vec3(0.0f);   // world space
+    float radius = 1.0f;
+    glm::vec3 color = glm::vec3(1.0f);
+};
+
+struct ClusterStats {
+    unsigned int lights = 0;        // submitted to assign()
+    unsigned int visible = 0;       // in at least one cluster
+    unsigned int occupied = 0;      // clusters with at least one light
+    unsigned int maxPerCluster = 0;
+    size_t indices = 0;             // light references over all clusters
+    double ms = 0.0;                // wall time of assign()
+};
+
+class LightClusters
+{
+public:
+    // per cluster (x fastest, then y, then slice): offset into 'indices' and light count, so an RG32UI texel
+    std::vector<uint32_t> grid;
+    // the light indices of every cluster, one cluster after the other, in increasing order within a cluster
+    std::vector<uint32_t> indices;
+    ClusterStats stats; // of the last assign
+
+    LightClusters(int tilesX = 16, int tilesY = 9, int slices = 24) : tilesX(tilesX), tilesY(tilesY), slices(slices)
+    {
+    }
+
+    int sizeX() const { return tilesX; }
+    int sizeY() const { return tilesY; }
+    int sizeZ() const { return slices; }
+    int clusterCount() const { return tilesX * tilesY * slices; }
+    float nearPlane() const { return zNear; }
+    float farPlane() const { return zFar; }
+
+    // slice = log(depth) * sliceScale() + sliceBias(), what the shader computes per fragment
+    float sliceScale() const { return (float)slices / std::log(zFar / zNear); }
+    float sliceBias() const { return -std::log(zNear) * sliceScale(); }
+
+    // rebuilds the cluster bounds for a perspective projection (glm::perspective or glm::frustum) with the given
+    // planes. Cheap to call every frame: nothing happens while the projection stays the same.
+    void setProjection(const glm::mat4 &projection, float nearPlane, float farPlane)
+    {
+        if (projection == this->projection && nearPlane == zNear && farPlane == zFar && !minX.empty())
+            return;
+        this->projection = projection;
+        zNear = nearPlane;
+        zFar = farPlane;
+
+        sliceDepth.resize(slices + 1);
+        for (int k = 0; k <= slices; k++)
+            sliceDepth[k] = zNear * std::pow(zFar / zNear, (float)k / slices);
+        sliceDepth[slices] = zFar;
+
+        // the corners of the tiles as view space directions with z = -1, scaled by the slice depths below
+        glm::mat4 inverse = glm::inverse(projection);
+        std::vector<glm::vec2> corners((size_t)(tilesX + 1) * (tilesY + 1));
+        for (int j = 0; j <= tilesY; j++)
+            for (int i = 0; i <= tilesX; i++)
+            {
+                glm::vec4 p = inverse * glm::vec4(ndcX(i), ndcY(j), -1.0f, 1.0f);
+                corners[(size_t)j * (tilesX + 1) + i] = glm::vec2(p) / -p.z;
+            }
+
+        // padded so a batch starting in the last cluster never reads past the end; the padding never passes
+        size_t padded = (size_t)clusterCount() + LIGHT_CLUSTERS_WIDTH;
+        for (std::vector<float> *array : {&minX, &minY, &minZ})
+            array->assign(padded, FLT_MAX);
+        for (std::vector<float> *array : {&maxX, &maxY, &maxZ})
+            array->assign(padded, -FLT_MAX);
+        for (int k = 0; k < slices; k++)
+            for (int j = 0; j < tilesY; j++)
+                for (int i = 0; i < tilesX; i++)
+                {
+                    glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+                    for (int corner = 0; corner < 8; corner++)
+                    {
+                        float depth = sliceDepth[k + (corner >> 2)];
+                        glm::vec2 direction = corners[(size_t)(j + ((corner >> 1) & 1)) * (tilesX + 1) + i + (corner & 1)];
+                        glm::vec3 p(direction * depth, -depth);
+                        lo = glm::min(lo, p);
+                        hi = glm::max(hi, p);
+                    }
+                    size_t c = (size_t)cluster(i, j, k);
+                    minX[c] = lo.x, minY[c] = lo.y, minZ[c] = lo.z;
+                    maxX[c] = hi.x, maxY[c] = hi.y, maxZ[c] = hi.z;
+                }
+    }
+
+    // the cluster a view space point falls in, computed the way the shader does it; -1 outside the frustum
+    int clusterOf(const glm::vec3 &viewPosition) const
+    {
+        float depth = -viewPosition.z;
+        if (depth < zNear || depth > zFar)
+            return -1;
+        glm::vec4 clip = projection * glm::vec4(viewPosition, 1.0f);
+        glm::vec2 ndc = glm::vec2(clip) / clip.w;
+        if (std::fabs(ndc.x) > 1.0f || std::fabs(ndc.y) > 1.0f)
+            return -1;
+        int i = std::min((int)((ndc.x * 0.5f + 0.5f) * tilesX), tilesX - 1);
+        int j = std::min((int)((ndc.y * 0.5f + 0.5f) * tilesY), tilesY - 1);
+        int k = std::clamp((int)(std::log(depth) * sliceScale() + sliceBias()), 0, slices - 1);
+        return cluster(i, j, k);
+    }
+
+    // view space bounding box of a cluster
+    void clusterBounds(int cluster, glm::vec3 &lo, glm::vec3 &hi) const
+    {
+        lo = glm::vec3(minX[cluster], minY[cluster], minZ[cluster]);
+        hi = glm::vec3(maxX[cluster], maxY[cluster], maxZ[cluster]);
+    }
+
+    // the exact test assign() makes for every candidate cluster, in the same order of operations
+    static bool sphereTouchesBox(const glm::vec3 &center, float radius, const glm::vec3 &lo, const glm::vec3 &hi)
+    {
+        float dx = std::max(std::max(lo.x - center.x, center.x - hi.x), 0.0f);
+        float dy = std::max(std::max(lo.y - center.y, center.y - hi.y), 0.0f);
+        float dz = std::max(std::max(lo.z - center.z, center.z - hi.z), 0.0f);
+        return dx * dx + dy * dy + dz * dz <= radius * radius;
+    }
+
+    // Fills grid and indices for the lights seen through 'view'. Every light gets its view position and the range
+    // of slices and tiles its sphere can reach (in chunks on the pool), the lights are bucketed by slice, then every
+    // slice (one pool job each) tests its lights against its clusters LIGHT_CLUSTERS_WIDTH tiles at a time and sorts
+    // the hits by cluster, and finally the slices' lists are joined.
+    void assign(const std::vector<ClusterLight> &lights, const glm::mat4 &view, ThreadPool &pool = ThreadPool::shared())
+    {
+        auto start = std::chrono::steady_clock::now();
+        size_t count = lights.size();
+        candidates.resize(count);
+
+        // 1. view space sphere and candidate cluster range of every light
+        const size_t chunk = 4096;
+        pool.parallelFor((count + chunk - 1) / chunk, [&](size_t c) {
+            size_t end = std::min(count, (c + 1) * chunk);
+            for (size_t l = c * chunk; l < end; l++)
+                candidates[l] = candidate(lights[l], view);
+        });
+
+        // 2. bucket the lights by slice, in light order so every cluster's list comes out sorted
+        sliceLights.resize(slices);
+        for (std::vector<uint32_t> &bucket : sliceLights)
+            bucket.clear();
+        for (size_t l = 0; l < count; l++)
+            for (int k = candidates[l].z0; k <= candidates[l].z1; k++)
+                sliceLights[k].push_back((uint32_t)l);
+
+        // 3. per slice: test, then counting sort the hits into the slice's part of the grid
+        grid.assign((size_t)clusterCount() * 2, 0);
+        sliceHits.resize(slices);
+        sliceIndices.resize(slices);
+        pool.parallelFor((size_t)slices, [&](size_t k) { assignSlice((int)k); });
+
+        // 4. the slices' lists back to back
+        size_t total = 0;
+        std::vector<size_t> sliceOffset(slices);
+        for (int k = 0; k < slices; k++)
+        {
+            sliceOffset[k] = total;
+            total += sliceIndices[k].size();
+        }
+        indices.resize(total);
+        int perSlice = tilesX * tilesY;
+        pool.parallelFor((size_t)slices, [&](size_t k) {
+            std::copy(sliceIndices[k].begin(), sliceIndices[k].end(), indices.begin() + sliceOffset[k]);
+            for (int c = 0; c < perSlice; c++)
+                grid[((size_t)k * perSlice + c) * 2] += (uint32_t)sliceOffset[k];
+        });
+
+        stats = ClusterStats();
+        stats.lights = (unsigned int)count;
+        stats.indices = total;
+        for (int c = 0; c < clusterCount(); c++)
+        {
+            uint32_t lightCount = grid[(size_t)c * 2 + 1];
+            stats.occupied += lightCount > 0;
+            stats.maxPerCluster = std::max(stats.maxPerCluster, lightCount);
+        }
+        visibleFlags.assign(count, 0);
+        for (uint32_t light : indices)
+            visibleFlags[light] = 1;
+        for (unsigned char flag : visibleFlags)
+            stats.visible += flag;
+        stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    // view space sphere and the slices [z0, z1] and tiles [x0, x1] x [y0, y1] it can touch; z1 < z0 when none
+    struct Candidate {
+        float x, y, z, radius;
+        int x0, x1, y0, y1, z0, z1;
+    };
+
+    int tilesX, tilesY, slices;
+    float zNear = 0.0f, zFar = 0.0f;
+    glm::mat4 projection = glm::mat4(0.0f);
+    std::vector<float> sliceDepth;                      // slice k covers depths [sliceDepth[k], sliceDepth[k + 1]]
+    std::vector<float> minX, minY, minZ, maxX, maxY, maxZ; // cluster bounds in view space
+    std::vector<Candidate> candidates;
+    std::vector<std::vector<uint32_t>> sliceLights;     // lights whose slice range includes the slice
+    std::vector<std::vector<uint32_t>> sliceHits;       // (cluster in slice, light) pairs of one slice, interleaved
+    std::vector<std::vector<uint32_t>> sliceIndices;    // a slice's hits sorted by cluster
+    std::vector<unsigned char> visibleFlags;
+
+    int cluster(int i, int j, int k) const { return (k * tilesY + j) * tilesX + i; }
+    float ndcX(int i) const { return -1.0f + 2.0f * i / tilesX; }
+    float ndcY(int j) const { return -1.0f + 2.0f * j / tilesY; }
+
+    Candidate candidate(const ClusterLight &light, const glm::mat4 &view) const
+    {
+        glm::vec3 p = glm::vec3(view * glm::vec4(light.position, 1.0f));
+        Candidate result = {p.x, p.y, p.z, light.radius, 0, tilesX - 1, 0, tilesY - 1, 0, -1};
+        float depth = -p.z, r = light.radius;
+        if (r <= 0.0f || depth + r < zNear || depth - r > zFar)
+            return result;
+
+        // slices: a guess from the log, then moved onto the exact boundaries the cluster boxes were built from
+        int z0 = std::clamp((int)(std::log(std::max(depth - r, zNear)) * sliceScale() + sliceBias()), 0, slices - 1);
+        while (z0 > 0 && sliceDepth[z0] >= depth - r)
+            z0--;
+        while (z0 < slices - 1 && sliceDepth[z0 + 1] < depth - r)
+            z0++;
+        int z1 = std::clamp((int)(std::log(std::min(depth + r, zFar)) * sliceScale() + sliceBias()), 0, slices - 1);
+        while (z1 < slices - 1 && sliceDepth[z1 + 1] <= depth + r)
+            z1++;
+        while (z1 > 0 && sliceDepth[z1] > depth + r)
+            z1--;
+
+        // tiles: project the sphere's bounding box; a sphere reaching the near plane may cover any tile. For a
+        // perspective projection x_ndc = P00 * x / -z - P20 is monotonic in x and in z, so the box corners bound it.
+        if (depth - r > zNear)
+        {
+            float nearZ = depth - r, farZ = depth + r;
+            float lowX = std::min((p.x - r) / nearZ, (p.x - r) / farZ), highX = std::max((p.x + r) / nearZ, (p.x + r) / farZ);
+            float lowY = std::min((p.y - r) / nearZ, (p.y - r) / farZ), highY = std::max((p.y + r) / nearZ, (p.y + r) / farZ);
+            float ndcX0 = projection[0][0] * lowX - projection[2][0], ndcX1 = projection[0][0] * highX - projection[2][0];
+            float ndcY0 = projection[1][1] * lowY - projection[2][1], ndcY1 = projection[1][1] * highY - projection[2][1];
+            if (ndcX1 < -1.0f || ndcX0 > 1.0f || ndcY1 < -1.0f || ndcY0 > 1.0f)
+                return result;
+            // a little slack so a fragment right on a tile edge rounding the other way still finds the light
+            const float slack = 0.01f;
+            result.x0 = std::clamp((int)std::floor((ndcX0 * 0.5f + 0.5f) * tilesX - slack), 0, tilesX - 1);
+            result.x1 = std::clamp((int)std::floor((ndcX1 * 0.5f + 0.5f) * tilesX + slack), 0, tilesX - 1);
+            result.y0 = std::clamp((int)std::floor((ndcY0 * 0.5f + 0.5f) * tilesY - slack), 0, tilesY - 1);
+            result.y1 = std::clamp((int)std::floor((ndcY1 * 0.5f + 0.5f) * tilesY + slack), 0, tilesY - 1);
+        }
+        result.z0 = z0;
+        result.z1 = z1;
+        return result;
+    }
+
+    void assignSlice(int k)
+    {
+        std::vector<uint32_t> &hits = sliceHits[k];
+        hits.clear();
+        int perSlice = tilesX * tilesY;
+        size_t sliceBase = (size_t)k * perSlice;
+        for (uint32_t l : sliceLights[k])
+        {
+            const Candidate &light = candidates[l];
+            for (int j = light.y0; j <= light.y1; j++)
+            {
+                size_t row = sliceBase + (size_t)j * tilesX;
+#if LIGHT_CLUSTERS_WIDTH == 4
+                __m128 cx = _mm_set1_ps(light.x), cy = _mm_set1_ps(light.y), cz = _mm_set1_ps(light.z);
+                __m128 r2 = _mm_set1_ps(light.radius * light.radius);
+                const __m128 zero = _mm_setzero_ps();
+                for (int i = light.x0; i <= light.x1; i += 4)
+                {
+                    size_t c = row + i;
+                    __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX[c]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&maxX[c]))), zero);
+                    __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minY[c]), cy), _mm_sub_ps(cy, _mm_loadu_ps(&maxY[c]))), zero);
+                    __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minZ[c]), cz), _mm_sub_ps(cz, _mm_loadu_ps(&maxZ[c]))), zero);
+                    __m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                    // lanes past x1 belong to the next row (or the padding)
+                    int mask = _mm_movemask_ps(_mm_cmple_ps(d2, r2)) & (0xF >> std::max(0, i + 3 - light.x1));
+                    while (mask)
+                    {
+                        int bit = 0;
+                        while (!(mask & (1 << bit)))
+                            bit++;
+                        hits.push_back((uint32_t)(c + bit - sliceBase));
+                        hits.push_back(l);
+                        mask &= mask - 1;
+                    }
+                }
+#else
+                glm::vec3 center(light.x, light.y, light.z);
+                for (int i = light.x0; i <= light.x1; i++)
+                {
+                    glm::vec3 lo, hi;
+                    clusterBounds((int)(row + i), lo, hi);
+                    if (sphereTouchesBox(center, light.radius, lo, hi))
+                    {
+                        hits.push_back((uint32_t)(row + i - sliceBase));
+                        hits.push_back(l);
+                    }
+                }
+#endif
+            }
+        }
+
+        // counting sort by cluster; the grid offsets are slice relative until assign() adds the slice's offset
+        uint32_t *cells = &grid[sliceBase * 2];
+        for (size_t h = 0; h < hits.size(); h += 2)
+            cells[hits[h] * 2 + 1]++;
+        uint32_t offset = 0;
+        for (int c = 0; c < perSlice; c++)
+        {
+            cells[c * 2] = offset;
+            offset += cells[c * 2 + 1];
+        }
+        std::vector<uint32_t> &sorted = sliceIndices[k];
+        sorted.resize(offset);
+        std::vector<uint32_t> next(perSlice);
+        for (int c = 0; c < perSlice; c++)
+            next[c] = cells[c * 2];
+        for (size_t h = 0; h < hits.size(); h += 2)
+            sorted[next[hits[h]]++] = hits[h + 1];
+    }
+};
+#endif
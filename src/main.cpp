@@ -14,34 +14,76 @@
 #include "imgui_impl_opengl3.h"
 
 #include "shader.h"
+#include "bvh.h"
 #include "camera.h"
+#include "camera_path.h"
+#include "cluster_buffers.h"
+#include "frame_stats.h"
+#include "frustum_culling.h"
+#include "gbuffer.h"
+#include "headless_context.h"
+#include "instancing.h"
+#include "light_clusters.h"
 #include "model.h"
+#include "model_streamer.h"
+#include "profiler.h"
+#include "profiler_overlay.h"
+#include "render_graph.h"
+#include "render_queue.h"
+#include "render_targets.h"
+#include "shader_permutations.h"
+#include "uniform_buffer.h"
 
 #include "minimesh.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <memory>
+#include <random>
+#include <string.h>
+#include <vector>
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
 void mouse_callback(GLFWwindow *window, double xpos, double ypos);
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset);
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods);
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods);
 void processInput(GLFWwindow *window);
 unsigned int loadTexture(const char *path);
-
-// settings
-const unsigned int SCR_WIDTH = 800;
-const unsigned int SCR_HEIGHT = 600;
+void runInstancingStress(GLFWwindow *window, unsigned int cubeVAO, unsigned int cubeTexture, Model *model, ShaderPermutations &litShaders, FrameUniformBuffer &frameUniforms,
+                         ObjectUniformBuffer &objectUniforms);
+GLFWwindow *createWindow();
+bool writeFrame(const char *directory, unsigned int frame, unsigned int width, unsigned int height);
+void setSceneLights(FrameUniforms &frame, int pointLights, float time, const glm::vec3 &center);
+std::vector<ClusterLight> makeClusterLights(size_t count, const glm::vec3 &center);
+int reportReplay(const FrameTimeStats &stats, const char *pathFile, float timestep, const char *jsonPath, const char *baselinePath, double threshold);
+
+// settings (--size WIDTHxHEIGHT)
+unsigned int SCR_WIDTH = 800;
+unsigned int SCR_HEIGHT = 600;
 
 // camera
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
 bool firstMouse = true;
+bool pickRequested = false;
+
+// profiling (F3 toggles the overlay, F4 writes profile.json and profile.csv)
+ProfilerOverlay profilerOverlay;
+bool profileExportRequested = false;
+
+// F5 switches the lit model between forward and deferred shading (--deferred starts deferred)
+bool deferredShading = false;
 
 // timing
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
 
-void upload(RenderMesh &mesh)
+// uploads a minimesh RenderMesh and returns the index type to draw it with: 16-bit whenever every index fits
+GLenum upload(RenderMesh &mesh)
 {
     // Create buffers/arrays
     glGenVertexArrays(1, &mesh.VAO);
@@ -55,7 +97,18 @@ void upload(RenderMesh &mesh)
     glBufferData(GL_ARRAY_BUFFER, vertex_data.size() * sizeof(float), vertex_data.data(), GL_STATIC_DRAW);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(unsigned int), mesh.indices.data(), GL_STATIC_DRAW);
+    GLenum indexType = GL_UNSIGNED_INT;
+    unsigned int maxIndex = 0;
+    for (unsigned int index : mesh.indices)
+        maxIndex = std::max(maxIndex, index);
+    if (maxIndex <= 0xFFFF)
+    {
+        std::vector<unsigned short> shortIndices(mesh.indices.begin(), mesh.indices.end());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short), shortIndices.data(), GL_STATIC_DRAW);
+        indexType = GL_UNSIGNED_SHORT;
+    }
+    else
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.size() * sizeof(unsigned int), mesh.indices.data(), GL_STATIC_DRAW);
 
     // Set the vertex attribute pointers
     // Vertex Positions
@@ -77,56 +130,175 @@ void upload(RenderMesh &mesh)
     }
 
     glBindVertexArray(0);
+    return indexType;
 }
 
-int main()
+int main(int argc, char **argv)
 {
-    // glfw: initialize and configure
-    // ------------------------------
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-#ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    // command line
+    // ------------
+    // --headless               render offscreen through EGL instead of opening a window
+    // --frames N               headless: frames to render before exiting (default 300)
+    // --dump-frames DIR        headless: write every frame to DIR/frame_NNNNN.ppm
+    // --size WIDTHxHEIGHT      render resolution (default 800x600)
+    // --profile-trace PATH     on exit, write the profiled frames as Chrome trace JSON
+    // --profile-csv PATH       on exit, write the profiled frames as CSV
+    // --record-path PATH       windowed: record the camera every frame and save it as a camera path on exit
+    // --replay PATH            drive the camera from a recorded path at a fixed timestep, then report frame times
+    // --timestep SECONDS       replay: time between frames (default 1/60)
+    // --warmup N               replay: frames rendered at the start of the path before measuring (default 30)
+    // --bench-json PATH        replay: write the frame time summary as JSON (default replay.json)
+    // --baseline PATH          replay: exit with 1 when mean/p50/p95/p99 regress past the threshold vs this JSON
+    // --threshold FRACTION     replay: allowed slowdown against the baseline (default 0.10)
+    // --windowed               replay in a window even where REPLAY_BENCHMARK defaults to headless
+    // --stream-model PATH      load a model in the background while rendering (from the first measured frame) and
+    //                          report the frame times until it is fully resident
+    // --upload-budget KB       stream-model: most bytes uploaded per frame (default 2048, at least 64)
+    // --max-frame-ms MS        stream-model: exit with 1 when a frame takes longer while streaming, or it never finishes
+    // --compress-textures      model, stream-model: block compress colour and normal maps (BC1/BC3/BC5)
+    // --lights N               model, stream-model: light the model with a directional light and N point lights (at
+    //                          most MAX_POINT_LIGHTS), every mesh drawn by the light caster permutation for its material
+    // --uber-shader            lights: draw every mesh with the MAX_POINT_LIGHTS + specular map permutation instead,
+    //                          which is what one unspecialised shader costs
+    // --clustered-lights N     model, stream-model: add N lights of random colour and range bobbing around the model,
+    //                          assigned to view space clusters every frame and shaded per cluster (implies --lights 0)
+    // --deferred               lights: start with the lit model on the deferred path (F5 switches at runtime) and
+    //                          report frame times per path (implies --lights 0)
+    // --switch-path-every N    lights: switch between forward and deferred shading every N frames
+    // the opengl-replay target is this program built with REPLAY_BENCHMARK: headless (when built with EGL) and
+    // replaying resources/paths/orbit.path unless told otherwise
+    bool headless = false;
+    unsigned int headlessFrames = 300;
+    const char *recordPath = nullptr;
+    const char *replayPath = nullptr;
+    float timestep = 1.0f / 60.0f;
+    unsigned int warmupFrames = 30;
+    const char *benchJsonPath = "replay.json";
+    const char *baselinePath = nullptr;
+    double threshold = 0.10;
+    const char *streamModelPath = nullptr;
+    size_t uploadBudget = 2048 * 1024;
+    double maxStreamFrameMs = 0.0;
+    ModelLoadOptions modelOptions;
+    int pointLightCount = -1;
+    bool uberShader = false;
+    int clusteredLightCount = -1;
+    unsigned int switchPathEvery = 0;
+#ifdef REPLAY_BENCHMARK
+    replayPath = "resources/paths/orbit.path";
+#ifdef HAVE_EGL
+    headless = true;
 #endif
-
-    // glfw window creation
-    // --------------------
-    GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
-    if (window == NULL)
+#endif
+    const char *dumpDirectory = nullptr;
+    const char *profileTracePath = nullptr;
+    const char *profileCsvPath = nullptr;
+    Profiler &profiler = Profiler::shared();
+    profiler.setThreadName("main");
+    for (int i = 1; i < argc; i++)
     {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return -1;
+        if (strcmp(argv[i], "--headless") == 0)
+            headless = true;
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            headlessFrames = (unsigned int)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--dump-frames") == 0 && i + 1 < argc)
+            dumpDirectory = argv[++i];
+        else if (strcmp(argv[i], "--profile-trace") == 0 && i + 1 < argc)
+            profileTracePath = argv[++i];
+        else if (strcmp(argv[i], "--profile-csv") == 0 && i + 1 < argc)
+            profileCsvPath = argv[++i];
+        else if (strcmp(argv[i], "--record-path") == 0 && i + 1 < argc)
+            recordPath = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replayPath = argv[++i];
+        else if (strcmp(argv[i], "--timestep") == 0 && i + 1 < argc)
+            timestep = std::max((float)atof(argv[++i]), 1e-4f);
+        else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc)
+            warmupFrames = (unsigned int)atoi(argv[++i]);
+        else if (strcmp(argv[i], "--bench-json") == 0 && i + 1 < argc)
+            benchJsonPath = argv[++i];
+        else if (strcmp(argv[i], "--baseline") == 0 && i + 1 < argc)
+            baselinePath = argv[++i];
+        else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc)
+            threshold = atof(argv[++i]);
+        else if (strcmp(argv[i], "--stream-model") == 0 && i + 1 < argc)
+            streamModelPath = argv[++i];
+        else if (strcmp(argv[i], "--upload-budget") == 0 && i + 1 < argc)
+        {
+            uploadBudget = (size_t)std::max(atoi(argv[++i]), 0) * 1024;
+            if (uploadBudget < ModelStreamer::MIN_BUDGET)
+            {
+                uploadBudget = ModelStreamer::MIN_BUDGET;
+                printf("[main.cpp] --upload-budget raised to the streamer's minimum of %zu KB\n", ModelStreamer::MIN_BUDGET / 1024);
+            }
+        }
+        else if (strcmp(argv[i], "--max-frame-ms") == 0 && i + 1 < argc)
+            maxStreamFrameMs = atof(argv[++i]);
+        else if (strcmp(argv[i], "--compress-textures") == 0)
+            modelOptions.compressTextures = true;
+        else if (strcmp(argv[i], "--lights") == 0 && i + 1 < argc)
+            pointLightCount = std::min(std::max(atoi(argv[++i]), 0), MAX_POINT_LIGHTS);
+        else if (strcmp(argv[i], "--uber-shader") == 0)
+            uberShader = true;
+        else if (strcmp(argv[i], "--clustered-lights") == 0 && i + 1 < argc)
+            clusteredLightCount = std::max(atoi(argv[++i]), 0);
+        else if (strcmp(argv[i], "--deferred") == 0)
+            deferredShading = true;
+        else if (strcmp(argv[i], "--switch-path-every") == 0 && i + 1 < argc)
+            switchPathEvery = (unsigned int)std::max(atoi(argv[++i]), 0);
+        else if (strcmp(argv[i], "--windowed") == 0)
+            headless = false;
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            unsigned int width = 0, height = 0;
+            if (sscanf(argv[++i], "%ux%u", &width, &height) == 2 && width > 0 && height > 0)
+            {
+                SCR_WIDTH = width;
+                SCR_HEIGHT = height;
+            }
+            else
+                std::cout << "[main.cpp] Ignoring bad --size " << argv[i] << ", expected WIDTHxHEIGHT" << std::endl;
+        }
     }
-    glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
-    glfwSetCursorPosCallback(window, mouse_callback);
-    glfwSetScrollCallback(window, scroll_callback);
-
-    // tell GLFW to capture our mouse
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-
-    // Setup Dear ImGui context
-    IMGUI_CHECKVERSION();
-    ImGui::CreateContext();
-    ImGuiIO &io = ImGui::GetIO();
-    (void)io;
-    // Setup Dear ImGui style
-    ImGui::StyleColorsDark();
-    // Setup Platform/Renderer bindings
-    ImGui_ImplGlfw_InitForOpenGL(window, true);
-    ImGui_ImplOpenGL3_Init("#version 330");
+    lastX = SCR_WIDTH / 2.0f;
+    lastY = SCR_HEIGHT / 2.0f;
+    if ((clusteredLightCount >= 0 || deferredShading || switchPathEvery > 0) && pointLightCount < 0)
+        pointLightCount = 0;
+
+    // a replay renders every frame of the path once, after the warmup frames
+    CameraPath cameraPath;
+    unsigned int frameLimit = headless ? headlessFrames : ~0u;
+    if (replayPath)
+    {
+        if (!cameraPath.load(replayPath))
+            return -1;
+        frameLimit = warmupFrames + (unsigned int)std::ceil(cameraPath.duration() / timestep) + 1;
+        printf("[main.cpp] Replaying %s: %zu keys, %.2f s at %.4f s per frame, %u warmup frames\n", replayPath, cameraPath.keys.size(), cameraPath.duration(), timestep, warmupFrames);
+    }
+    CameraPath recordedPath;
 
-    // glad: load all OpenGL function pointers
-    // ---------------------------------------
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    // headless: no window, no input and no default framebuffer
+    GLFWwindow *window = NULL;
+    HeadlessContext headlessContext;
+    if (headless)
     {
-        std::cout << "Failed to initialize GLAD" << std::endl;
-        return -1;
+        if (!headlessContext.create() || !gladLoadGLLoader((GLADloadproc)HeadlessContext::getProcAddress))
+        {
+            std::cout << "Failed to create a headless OpenGL context" << std::endl;
+            return -1;
+        }
+        printf("[main.cpp] Headless %ux%u, %u frames on %s\n", SCR_WIDTH, SCR_HEIGHT, frameLimit, (const char *)glGetString(GL_RENDERER));
+        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
     }
+    else
+    {
+        window = createWindow();
+        if (window == NULL)
+            return -1;
+        if (replayPath)
+            glfwSwapInterval(0); // measure the frames, not the display
+    }
+    ProgramCache::shared().loadFunctions(headless ? (GLADloadproc)HeadlessContext::getProcAddress : (GLADloadproc)glfwGetProcAddress);
 
     // configure global opengl state
     // -----------------------------
@@ -139,12 +311,41 @@ int main()
     // -------------------------
     Shader shader("src/shaders/framebuffers.vs", "src/shaders/framebuffers.fs");
     Shader screenShader("src/shaders/framebuffers_screen.vs", "src/shaders/framebuffers_screen.fs");
+    // --model without --lights: the same texturing, decoding the Mesh vertex layout
+    Shader modelShader("src/shaders/model.vs", "src/shaders/framebuffers.fs");
+    // --lights: compiled per material and light count on first use
+    ShaderPermutations litShaders("src/shaders/5.4.light_casters.vs", "src/shaders/5.4.light_casters.fs");
+    // the deferred path: geometry pass per material, lighting pass per light count
+    ShaderPermutations gbufferShaders("src/shaders/5.4.light_casters.vs", "src/shaders/gbuffer.fs");
+    ShaderPermutations deferredLightingShaders("src/shaders/deferred_lighting.vs", "src/shaders/deferred_lighting.fs");
+    ShaderPermutations deferredPointLightShaders("src/shaders/deferred_lighting.vs", "src/shaders/deferred_point_light.fs");
+    // lightIndex of the deferred point light program, looked up when it is first compiled
+    GLint deferredLightIndexLocation = -1;
+    // frame times of the forward ([0]) and deferred ([1]) frames
+    std::vector<double> pathFrameMs[2];
+    // --clustered-lights: the lights at rest, where they are this frame, and their clusters
+    std::vector<ClusterLight> clusterLights, movedClusterLights;
+    LightClusters lightClusters;
+    std::unique_ptr<ClusterBuffers> clusterBuffers;
+    double clusterAssignMs = 0.0;
+    unsigned int clusterAssignFrames = 0;
+    if (clusteredLightCount >= 0)
+    {
+        clusterBuffers.reset(new ClusterBuffers());
+        if (!clusterBuffers->isSupported())
+            clusteredLightCount = -1;
+        else if ((size_t)clusteredLightCount > clusterBuffers->maxLights())
+        {
+            printf("[main.cpp] Clustered lights limited to %zu by the buffer texture size\n", clusterBuffers->maxLights());
+            clusteredLightCount = (int)clusterBuffers->maxLights();
+        }
+    }
 
     // Load my own mesh
 
     RenderMesh mesh = RenderMesh::cylinder(24);
     mesh.compute_vertex_normals();
-    upload(mesh);
+    GLenum meshIndexType = upload(mesh);
 
     // set up vertex data (and buffer(s)) and configure vertex attributes
     // ------------------------------------------------------------------
@@ -253,115 +454,763 @@ int main()
     shader.use();
     shader.setInt("texture1", 0);
 
+    modelShader.use();
+    modelShader.setInt("texture1", 0);
+
     screenShader.use();
     screenShader.setInt("screenTexture", 0);
 
-    unsigned int framebuffer;
-    glGenFramebuffers(1, &framebuffer);
-    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-
-    // generate texture
-    unsigned int textureColorbuffer;
-    glGenTextures(1, &textureColorbuffer);
-    glBindTexture(GL_TEXTURE_2D, textureColorbuffer);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, 800, 600, 0, GL_RGB, GL_UNSIGNED_BYTE, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textureColorbuffer, 0);
-
-    // create renderbuffer
-    unsigned int rbo;
-    glGenRenderbuffers(1, &rbo);
-    glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, 800, 600);
-    glBindRenderbuffer(GL_RENDERBUFFER, 0);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbo);
-
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
-        std::cout << "ERROR::FRAMEBUFFER:: Framebuffer is not complete!" << std::endl;
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    // the frame's render targets, made for the render graph every frame declares (and remade when the window is
+    // resized). Headless contexts have no default framebuffer: the post pass draws into an output target instead,
+    // which is also what --dump-frames reads back.
+    RenderTargets renderTargets;
+
+    // per-frame and per-object constants live in uniform buffers shared by every program
+    FrameUniformBuffer frameUniforms;
+    ObjectUniformBuffer objectUniforms;
+    // draws are queued, sorted by state and submitted once
+    RenderQueue queue;
+    queue.setObjectUniforms(&objectUniforms);
+    queue.setDepthRange(100.0f);
+    // the deferred path's geometry pass, submitted to the G-buffer before the rest
+    RenderQueue gbufferQueue;
+    gbufferQueue.setObjectUniforms(&objectUniforms);
+    gbufferQueue.setDepthRange(100.0f);
+    unsigned int cubeMaterial = MaterialTable::shared().intern({{0, cubeTexture}});
+    unsigned int floorMaterial = MaterialTable::shared().intern({{0, floorTexture}});
+
+    // the scene's objects with their world space bounds, culled against the camera every frame. The object space
+    // triangles are kept around for picking.
+    struct SceneObject {
+        DrawPacket packet;
+        glm::mat4 model;
+        Bounds bounds;
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t> indices;
+    };
+    auto trianglePositions = [](const float *vertices, size_t count, size_t stride) {
+        std::vector<glm::vec3> positions(count);
+        for (size_t i = 0; i < count; i++)
+            positions[i] = glm::vec3(vertices[i * stride], vertices[i * stride + 1], vertices[i * stride + 2]);
+        return positions;
+    };
+    auto sequentialIndices = [](uint32_t count) {
+        std::vector<uint32_t> indices(count);
+        for (uint32_t i = 0; i < count; i++)
+            indices[i] = i;
+        return indices;
+    };
+    std::vector<SceneObject> sceneObjects;
+    Bounds cubeBounds = Bounds::fromMinMax(glm::vec3(-0.5f), glm::vec3(0.5f));
+    auto vertexData = mesh.get_vertex_data();
+    Bounds meshBounds = Bounds::fromPoints(vertexData.data(), vertexData.size() / 8, 8 * sizeof(float));
+    std::vector<glm::vec3> cubePositions = trianglePositions(cubeVertices, 36, 5);
+    glm::mat4 cube1Model = glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f, 0.0f, -1.0f));
+    glm::mat4 cube2Model = glm::translate(glm::mat4(1.0f), glm::vec3(2.0f, 0.0f, 0.0f));
+    sceneObjects.push_back({DrawPacket::arrays(shader.ID, cubeMaterial, cubeVAO, 0, 36), cube1Model, cubeBounds.transformed(cube1Model), cubePositions, sequentialIndices(36)});
+    sceneObjects.push_back({DrawPacket::arrays(shader.ID, cubeMaterial, cubeVAO, 0, 36), cube2Model, cubeBounds.transformed(cube2Model), cubePositions, sequentialIndices(36)});
+    sceneObjects.push_back({DrawPacket::elements(shader.ID, cubeMaterial, mesh.VAO, meshIndexType, 0, mesh.num_elements()), glm::mat4(1.0f), meshBounds,
+                            trianglePositions(vertexData.data(), vertexData.size() / 8, 8), std::vector<uint32_t>(mesh.indices.begin(), mesh.indices.end())});
+    sceneObjects.push_back({DrawPacket::arrays(shader.ID, floorMaterial, planeVAO, 0, 6), glm::mat4(1.0f), Bounds::fromMinMax(glm::vec3(-5.0f, -0.5f, -5.0f), glm::vec3(5.0f, -0.5f, 5.0f)),
+                            trianglePositions(planeVertices, 6, 5), sequentialIndices(6)});
+    // the objects don't move, so the hierarchy is built once; moving objects would Bvh::update + Bvh::refit
+    std::vector<Bounds> sceneBounds;
+    for (const SceneObject &object : sceneObjects)
+        sceneBounds.push_back(object.bounds);
+    Bvh sceneBvh;
+    sceneBvh.build(sceneBounds);
+    std::vector<uint32_t> visibleObjects;
+    unsigned int frameCount = 0;
+    float lastStatsTime = 0.0f;
+
+    // --instancing-stress: measure the instanced path from 1 to 1M cubes instead of running the scene (copies of
+    //                      the --model, when given, up to 10k)
+    // --model <path>: adds a model behind the cubes, drawn with automatic LODs
+    // --stream-model <path> puts the model at the same place, but loads it while the scene runs
+    std::unique_ptr<Model> sceneModel;
+    std::shared_ptr<ModelStream> streamedModel;
+    glm::mat4 sceneModelMatrix = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -4.0f));
+    // both exits free what still holds GL objects while there is a context to delete them in
+    auto releaseGpuResources = [&]() {
+        streamedModel.reset();
+        sceneModel.reset();
+        clusterBuffers.reset();
+        ModelStreamer::shared().shutdown();
+        renderTargets.release();
+        frameUniforms.release();
+        objectUniforms.release();
+    };
+    if (clusteredLightCount >= 0)
+    {
+        clusterLights = makeClusterLights((size_t)clusteredLightCount, glm::vec3(sceneModelMatrix[3]));
+        movedClusterLights = clusterLights;
+    }
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--instancing-stress") == 0 && !headless)
+        {
+            for (int j = i + 1; j + 1 < argc && !sceneModel; j++)
+                if (strcmp(argv[j], "--model") == 0)
+                    sceneModel.reset(new Model(argv[j + 1], false, modelOptions));
+            runInstancingStress(window, cubeVAO, cubeTexture, sceneModel.get(), litShaders, frameUniforms, objectUniforms);
+            releaseGpuResources();
+            glfwTerminate();
+            return 0;
+        }
+        if (strcmp(argv[i], "--model") == 0 && i + 1 < argc)
+            sceneModel.reset(new Model(argv[++i], false, modelOptions));
+    }
+
+    // headless and replayed frames advance a fixed timestep and are timed from start to glFinish
+    bool fixedTimestep = headless || replayPath;
+    bool measured = headless || replayPath;
+    std::vector<double> frameMs;
+    // frames from the start of --stream-model until it is resident
+    unsigned int streamStartFrame = replayPath ? warmupFrames : 0;
+    std::vector<double> streamFrameMs;
+    bool streaming = false;
 
     // render loop
     // -----------
-    while (!glfwWindowShouldClose(window))
+    for (unsigned int frame = 0; frame < frameLimit && (headless || !glfwWindowShouldClose(window)); frame++)
     {
+        profiler.beginFrame();
+        auto frameStart = std::chrono::steady_clock::now();
+
         // per-frame time logic
         // --------------------
-        float currentFrame = static_cast<float>(glfwGetTime());
+        unsigned int pathFrame = replayPath && frame > warmupFrames ? frame - warmupFrames : 0;
+        float currentFrame = replayPath ? pathFrame * timestep : fixedTimestep ? frame / 60.0f : static_cast<float>(glfwGetTime());
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
         // input
         // -----
-        processInput(window);
+        if (!headless)
+            processInput(window);
+        // a replayed path overrides whatever the input did
+        if (replayPath)
+            cameraPath.apply(camera, currentFrame);
+        else if (recordPath && !headless)
+            recordedPath.record(camera, currentFrame);
+
+        // background loading: start the stream, then upload this frame's share of it
+        if (streamModelPath && frame == streamStartFrame)
+        {
+            streamedModel = ModelStreamer::shared().load(streamModelPath, false, modelOptions);
+            streaming = true;
+        }
+        ModelStreamer::shared().pump(uploadBudget);
+        if (switchPathEvery > 0 && frame > 0 && frame % switchPathEvery == 0)
+            deferredShading = !deferredShading;
+        // only the lit model goes through the G-buffer
+        bool deferredFrame = deferredShading && pointLightCount >= 0;
 
         // render
         // ------
-        // bind to framebuffer and draw scene as we normally would to color texture
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-        glEnable(GL_DEPTH_TEST); // enable depth testing (is disabled for rendering screen-space quad)
-
-        // make sure we clear the framebuffer's content
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-        shader.use();
-        glm::mat4 model = glm::mat4(1.0f);
-        glm::mat4 view = camera.GetViewMatrix();
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-        shader.setMat4("view", view);
-        shader.setMat4("projection", projection);
-        // cubes
-        glBindVertexArray(cubeVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, cubeTexture);
-        model = glm::translate(model, glm::vec3(-1.0f, 0.0f, -1.0f));
-        shader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(2.0f, 0.0f, 0.0f));
-        shader.setMat4("model", model);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        
-        // draw my mesh
-        shader.use();
-        model = glm::mat4(1.0f);
-        model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
-        shader.setMat4("model", model);
-        glBindVertexArray(mesh.VAO);
-        glDrawElements(GL_TRIANGLES, mesh.num_elements(), GL_UNSIGNED_INT, 0);
-
-        // floor
-        glBindVertexArray(planeVAO);
-        glBindTexture(GL_TEXTURE_2D, floorTexture);
-        shader.setMat4("model", glm::mat4(1.0f));
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-        glBindVertexArray(0);
-
-        // now bind back to default framebuffer and draw a quad plane with the attached framebuffer color texture
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glDisable(GL_DEPTH_TEST); // disable depth test so screen-space quad isn't discarded due to depth test.
-        // clear all relevant buffers
-        glClearColor(1.0f, 1.0f, 1.0f, 1.0f); // set clear color to white (not really necessary actually, since we won't be able to see behind the quad anyways)
-        glClear(GL_COLOR_BUFFER_BIT);
-
-        screenShader.use();
-        glBindVertexArray(quadVAO);
-        glBindTexture(GL_TEXTURE_2D, textureColorbuffer); // use the color attachment texture as the texture of the quad plane
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+        {
+            PROFILE_ZONE("build frame");
+            // frame constants, one upload for every program
+            Shader::uniformCalls = 0;
+            frameUniforms.data.view = camera.GetViewMatrix();
+            const float zNear = 0.1f, zFar = 100.0f;
+            frameUniforms.data.projection = glm::perspective(glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, zNear, zFar);
+            frameUniforms.data.viewPos = glm::vec4(camera.Position, 1.0f);
+            frameUniforms.data.inverseViewProjection = glm::inverse(frameUniforms.data.projection * frameUniforms.data.view);
+            if (pointLightCount >= 0)
+                setSceneLights(frameUniforms.data, pointLightCount, currentFrame, glm::vec3(sceneModelMatrix[3]));
+            frameUniforms.upload();
+            if (clusteredLightCount >= 0)
+            {
+                PROFILE_ZONE("cluster lights");
+                for (size_t l = 0; l < clusterLights.size(); l++)
+                    movedClusterLights[l].position.y = clusterLights[l].position.y + 0.5f * std::sin(currentFrame * 1.5f + l * 0.37f);
+                lightClusters.setProjection(frameUniforms.data.projection, zNear, zFar);
+                lightClusters.assign(movedClusterLights, frameUniforms.data.view);
+                clusterBuffers->upload(lightClusters, movedClusterLights, SCR_WIDTH, SCR_HEIGHT);
+                clusterBuffers->bind();
+                clusterAssignMs += lightClusters.stats.ms;
+                clusterAssignFrames++;
+            }
+
+            // cull against the camera, then gather the object constants of what's left so they upload in one go
+            Frustum frustum = Frustum::fromMatrix(frameUniforms.data.projection * frameUniforms.data.view);
+            visibleObjects.clear();
+            sceneBvh.query(frustum, visibleObjects);
+            objectUniforms.reset();
+            for (uint32_t i : visibleObjects)
+            {
+                DrawPacket packet = sceneObjects[i].packet;
+                packet.objectSlot = objectUniforms.push(sceneObjects[i].model);
+                packet.depth = RenderQueue::viewDepth(frameUniforms.data.view, sceneObjects[i].bounds.center);
+                queue.add(packet);
+            }
+            Model *drawnModel = sceneModel ? sceneModel.get() : streamedModel ? &streamedModel->model() : nullptr;
+            if (drawnModel)
+            {
+                LodSelector lodSelector = LodSelector::perspective(camera.Position, glm::radians(camera.Zoom), (float)SCR_HEIGHT);
+                int slot = objectUniforms.push(sceneModelMatrix);
+                float depth = RenderQueue::viewDepth(frameUniforms.data.view, glm::vec3(sceneModelMatrix[3]));
+                glm::mat4 viewProjection = frameUniforms.data.projection * frameUniforms.data.view;
+                if (deferredFrame)
+                    drawnModel->Draw(gbufferShaders, 0, gbufferQueue, slot, depth, viewProjection, sceneModelMatrix, lodSelector);
+                else if (pointLightCount >= 0)
+                {
+                    uint32_t frameFeatures = uberShader ? ShaderPermutations::lights(MAX_POINT_LIGHTS) | SHADER_SPECULAR_MAP : ShaderPermutations::lights(pointLightCount);
+                    if (clusteredLightCount >= 0)
+                        frameFeatures |= SHADER_CLUSTERED;
+                    drawnModel->Draw(litShaders, frameFeatures, queue, slot, depth, viewProjection, sceneModelMatrix, lodSelector);
+                }
+                else
+                    drawnModel->Draw(modelShader, queue, slot, depth, viewProjection, sceneModelMatrix, lodSelector);
+            }
+            objectUniforms.upload();
+        }
+        // left click picks the object under the crosshair (the cursor is captured, so that's the screen centre)
+        if (pickRequested)
+        {
+            PROFILE_ZONE("pick");
+            pickRequested = false;
+            Ray ray = Ray::fromScreen(SCR_WIDTH / 2.0f, SCR_HEIGHT / 2.0f, (float)SCR_WIDTH, (float)SCR_HEIGHT, frameUniforms.data.view, frameUniforms.data.projection);
+            uint32_t triangle = 0;
+            float distance = 0.0f;
+            long picked = sceneBvh.intersect(ray, [&](uint32_t object, float maxT) {
+                const SceneObject &o = sceneObjects[object];
+                uint32_t hitTriangle = 0;
+                float t = ray.intersectTriangles(o.positions.data(), o.indices.data(), o.indices.size(), o.model, &hitTriangle);
+                if (t < maxT)
+                    triangle = hitTriangle;
+                return t;
+            }, &distance);
+            if (picked >= 0)
+                printf("[main.cpp] picked object %ld, triangle %u at distance %.2f\n", picked, triangle, distance);
+            else
+                printf("[main.cpp] picked nothing\n");
+        }
+
+        // the frame's passes, declared anew every frame. The graph culls what this frame doesn't need (a forward
+        // frame's scene pass clears the scene targets, so nothing reads the deferred passes) and lets targets whose
+        // lifetimes don't overlap share a texture.
+        RenderGraph graph;
+        int sceneColor = graph.createTarget("scene colour", {TARGET_RGB8});
+        int sceneDepth = graph.createTarget("scene depth", {TARGET_DEPTH24_STENCIL8});
+        int output = headless ? graph.createTarget("output", {TARGET_RGBA8}) : graph.importTarget("screen", 0);
+        if (headless)
+            graph.markOutput(output);
+        GBuffer gbuffer = GBuffer::declare(graph, sceneDepth);
+        graph.addPass("gbuffer", {}, gbuffer.targets(), [&] {
+            glEnable(GL_DEPTH_TEST);
+            glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            gbufferQueue.submit();
+        });
+        // one pass over the screen for the directional (and clustered) lights, then one additive pass per point
+        // light scissored to the pixels its sphere covers. The depth they read is the scene's, which the forward
+        // draws then test against.
+        graph.addPass("deferred lighting", gbuffer.targets(), {sceneColor}, [&] {
+            glDisable(GL_DEPTH_TEST);
+            // the shaders leave the pixels the geometry pass didn't draw
+            glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT);
+            uint32_t features = SHADER_SPECULAR_MAP;
+            if (clusteredLightCount >= 0)
+                features |= SHADER_CLUSTERED;
+            Shader &lighting = deferredLightingShaders.get(features);
+            lighting.use();
+            gbuffer.bindTextures(graph, renderTargets);
+            glBindVertexArray(quadVAO);
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+            profiler.countDraw(6);
+            if (pointLightCount <= 0)
+                return;
+
+            Shader &pointLight = deferredPointLightShaders.get(SHADER_SPECULAR_MAP);
+            if (deferredLightIndexLocation < 0)
+                deferredLightIndexLocation = pointLight.location("lightIndex");
+            pointLight.use();
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_ONE, GL_ONE);
+            glEnable(GL_SCISSOR_TEST);
+            glm::mat4 viewProjection = frameUniforms.data.projection * frameUniforms.data.view;
+            for (int i = 0; i < pointLightCount; i++)
+            {
+                const GpuPointLight &light = frameUniforms.data.pointLights[i];
+                int rect[4];
+                if (!GBuffer::lightRect(viewProjection, glm::vec3(light.position), light.attenuation.w, SCR_WIDTH, SCR_HEIGHT, rect))
+                    continue;
+                glScissor(rect[0], rect[1], rect[2], rect[3]);
+                pointLight.setInt(deferredLightIndexLocation, i);
+                glDrawArrays(GL_TRIANGLES, 0, 6);
+                profiler.countDraw(6);
+            }
+            glDisable(GL_SCISSOR_TEST);
+            glDisable(GL_BLEND);
+        });
+        std::vector<int> sceneReads;
+        if (deferredFrame)
+            sceneReads = {sceneColor, sceneDepth};
+        graph.addPass("scene", sceneReads, {sceneColor, sceneDepth}, [&] {
+            glEnable(GL_DEPTH_TEST);
+            if (!deferredFrame)
+            {
+                glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            }
+            queue.submit();
+        });
+        // a quad plane with the scene colour as its texture
+        graph.addPass("post", {sceneColor}, {output}, [&] {
+            glDisable(GL_DEPTH_TEST); // disable depth test so screen-space quad isn't discarded due to depth test.
+            // clear all relevant buffers
+            glClearColor(1.0f, 1.0f, 1.0f, 1.0f); // set clear color to white (not really necessary actually, since we won't be able to see behind the quad anyways)
+            glClear(GL_COLOR_BUFFER_BIT);
+            screenShader.use();
+            glBindVertexArray(quadVAO);
+            glBindTexture(GL_TEXTURE_2D, renderTargets.texture(graph, sceneColor));
+            glDrawArrays(GL_TRIANGLES, 0, 6);
+            profiler.countDraw(6);
+        });
+        // live profiler numbers, on top of everything
+        if (!headless && profilerOverlay.visible)
+            graph.addPass("overlay", {output}, {output}, [&] {
+                PROFILE_ZONE("overlay");
+                ImGui_ImplOpenGL3_NewFrame();
+                ImGui_ImplGlfw_NewFrame();
+                ImGui::NewFrame();
+                profilerOverlay.draw(profiler);
+                ImGui::Render();
+                ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+            });
+        {
+            PROFILE_ZONE("render graph");
+            graph.compile(SCR_WIDTH, SCR_HEIGHT);
+            // new targets: the first frame of a path or size, so the memory aliasing saves is worth a line
+            if (renderTargets.allocate(graph))
+                graph.printStats();
+        }
+        renderTargets.execute(graph);
+
+        if (profileExportRequested)
+        {
+            profileExportRequested = false;
+            profiler.writeChromeTrace("profile.json");
+            profiler.writeCsv("profile.csv");
+        }
+
+        // uniform traffic of this frame, about once a second
+        frameCount++;
+        if (currentFrame - lastStatsTime >= 1.0f)
+        {
+            std::cout << "[main.cpp] " << frameCount << " fps, " << Shader::uniformCalls << " uniform calls per frame" << std::endl;
+            queue.printStats();
+            printf("[main.cpp] culling: %u nodes visited, %u objects tested, %u visible, %u culled\n", sceneBvh.stats.nodesVisited, sceneBvh.stats.objectsTested,
+                   sceneBvh.stats.visible, (unsigned int)(sceneBvh.objectCount() - sceneBvh.stats.visible));
+            if (sceneModel)
+                sceneModel->printLodStats();
+            if (deferredFrame)
+            {
+                gbufferQueue.printStats();
+                GBuffer::printStats(SCR_WIDTH, SCR_HEIGHT, 1000.0 / frameCount);
+            }
+            if (clusteredLightCount >= 0)
+                printf("[main.cpp] clusters: %u of %u lights visible, %zu light indices, %u clusters lit, at most %u lights per cluster, assigned in %.2f ms\n",
+                       lightClusters.stats.visible, lightClusters.stats.lights, lightClusters.stats.indices, lightClusters.stats.occupied,
+                       lightClusters.stats.maxPerCluster, lightClusters.stats.ms);
+            frameCount = 0;
+            lastStatsTime = currentFrame;
+        }
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         // -------------------------------------------------------------------------------
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        if (!headless)
+        {
+            PROFILE_ZONE("swap");
+            glfwSwapBuffers(window);
+        }
+        if (measured)
+        {
+            PROFILE_ZONE("glFinish");
+            glFinish();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count();
+            if (!replayPath || frame >= warmupFrames)
+                frameMs.push_back(ms);
+            if (streaming)
+                streamFrameMs.push_back(ms);
+        }
+        if (pointLightCount >= 0 && (!replayPath || frame >= warmupFrames))
+            pathFrameMs[deferredFrame].push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+        if (streaming && (streamedModel->ready() || streamedModel->failed()))
+        {
+            streaming = false;
+            if (streamedModel->ready())
+                printf("[main.cpp] %s resident after %zu frames, %.1f MB staged\n", streamModelPath, streamFrameMs.size(),
+                       ModelStreamer::shared().totalStagedBytes() / (1024.0 * 1024.0));
+        }
+        // dumping isn't part of the frame time
+        if (headless && dumpDirectory && !writeFrame(dumpDirectory, frame, SCR_WIDTH, SCR_HEIGHT))
+            dumpDirectory = nullptr;
+        if (!headless)
+            glfwPollEvents();
     }
 
+    profiler.finish();
+    // at exit, so the permutations compiled on first use are counted too
+    ProgramCache::shared().printStats();
+    if (pointLightCount >= 0)
+        litShaders.printStats();
+    if (!pathFrameMs[1].empty())
+    {
+        gbufferShaders.printStats();
+        deferredLightingShaders.printStats();
+        deferredPointLightShaders.printStats();
+        FrameTimeStats forwardStats = FrameTimeStats::compute(pathFrameMs[0]), deferredStats = FrameTimeStats::compute(pathFrameMs[1]);
+        if (forwardStats.frames > 0)
+            forwardStats.print("[main.cpp] forward:");
+        deferredStats.print("[main.cpp] deferred:");
+        GBuffer::printStats(SCR_WIDTH, SCR_HEIGHT, deferredStats.mean);
+    }
+    if (clusterAssignFrames > 0)
+        printf("[main.cpp] %d clustered lights assigned to %d clusters in %.3f ms per frame on average\n", clusteredLightCount,
+               lightClusters.clusterCount(), clusterAssignMs / clusterAssignFrames);
+    if (profileTracePath)
+        profiler.writeChromeTrace(profileTracePath);
+    if (profileCsvPath)
+        profiler.writeCsv(profileCsvPath);
+
+    if (recordPath && !replayPath && !headless && recordedPath.save(recordPath))
+        printf("[main.cpp] Recorded %zu camera keys to %s\n", recordedPath.keys.size(), recordPath);
+
+    int exitCode = 0;
+    if (measured)
+    {
+        FrameTimeStats stats = FrameTimeStats::compute(frameMs);
+        stats.print("[main.cpp]");
+        if (replayPath)
+            exitCode = reportReplay(stats, replayPath, timestep, benchJsonPath, baselinePath, threshold);
+    }
+    if (measured && streamModelPath)
+    {
+        // the frame time spike a load causes is the worst frame while it streamed in
+        FrameTimeStats streamStats = FrameTimeStats::compute(streamFrameMs);
+        streamStats.print("[main.cpp] while streaming:");
+        bool complete = streamedModel && streamedModel->ready();
+        if (!complete && !(streamedModel && streamedModel->failed()))
+            printf("[main.cpp] %s did not finish streaming within %u frames\n", streamModelPath, frameLimit);
+        if (maxStreamFrameMs > 0.0 && (!complete || streamStats.max > maxStreamFrameMs))
+        {
+            if (complete)
+                printf("[main.cpp] worst frame while streaming took %.3f ms, more than --max-frame-ms %.3f\n", streamStats.max, maxStreamFrameMs);
+            exitCode = 1;
+        }
+    }
+    releaseGpuResources();
+    if (headless)
+        return exitCode;
+
     // glfw: terminate, clearing all previously allocated GLFW resources.
     // ------------------------------------------------------------------
     glfwTerminate();
-    return 0;
+    return exitCode;
+}
+
+// instancing stress scene: a grid of N cubes drawn with one instanced draw, N from 1 to 1M. The transforms are
+// streamed again every frame, so the CPU time includes the upload. Up to 10k cubes the same grid is also drawn
+// the old way (one object constant bind + glDrawArrays per cube) for comparison. Given a model, the grid is of
+// that model instead, lit by the directional light through the INSTANCED light caster permutations, up to 10k
+// copies. Results go to stdout and instancing_stress.csv.
+// ---------------------------------------------------------------------------------------------------------
+void runInstancingStress(GLFWwindow *window, unsigned int cubeVAO, unsigned int cubeTexture, Model *model, ShaderPermutations &litShaders, FrameUniformBuffer &frameUniforms,
+                         ObjectUniformBuffer &objectUniforms)
+{
+    const int warmupFrames = 10;
+    const int measuredFrames = 60;
+    const size_t maxNaiveCount = 10000;
+    const size_t maxModelCount = 10000;
+    const size_t counts[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+    // a model that failed to load has no meshes (nor bounds): stress the cubes instead
+    if (model && (model->meshes.empty() || model->nodes.empty()))
+    {
+        printf("[main.cpp] The model has no meshes, stressing cubes instead\n");
+        model = nullptr;
+    }
+    // grid spacing, wide enough for the model's bounding sphere, and the offset that puts its centre on a grid point
+    const float spacing = model ? std::max(model->nodes[0].bounds.radius * 2.2f, 0.01f) : 2.0f;
+    const glm::vec3 centerOffset = model ? -model->nodes[0].bounds.center : glm::vec3(0.0f);
+
+    Shader instancedShader("src/shaders/instanced.vs", "src/shaders/instanced.fs");
+    instancedShader.use();
+    instancedShader.setInt("texture1", 0);
+    Shader shader("src/shaders/framebuffers.vs", "src/shaders/framebuffers.fs");
+    shader.use();
+    shader.setInt("texture1", 0);
+    InstanceBuffer instances;
+
+    glfwSwapInterval(0); // measure the CPU, not the display
+    glEnable(GL_DEPTH_TEST);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, cubeTexture);
+
+    FILE *csv = fopen("instancing_stress.csv", "w");
+    if (csv)
+        fprintf(csv, "instances,instanced_cpu_ms,instanced_frame_ms,naive_cpu_ms,naive_frame_ms\n");
+    printf("[main.cpp] %10s %18s %18s %18s %18s\n", "instances", "instanced cpu ms", "instanced frame ms", "naive cpu ms", "naive frame ms");
+
+    for (size_t count : counts)
+    {
+        if (model && count > maxModelCount)
+            break;
+        // cube grid, centred on the origin
+        int side = (int)std::ceil(std::cbrt((double)count));
+        std::vector<glm::mat4> transforms(count);
+        std::vector<glm::vec4> colors(count);
+        for (size_t i = 0; i < count; i++)
+        {
+            int x = (int)(i % side), y = (int)(i / side % side), z = (int)(i / ((size_t)side * side));
+            glm::vec3 position = (glm::vec3((float)x, (float)y, (float)z) - glm::vec3((side - 1) * 0.5f)) * spacing;
+            transforms[i] = glm::translate(glm::mat4(1.0f), position + centerOffset);
+            colors[i] = glm::vec4((float)x / side, (float)y / side, (float)z / side, 1.0f) * 0.5f + glm::vec4(0.5f);
+        }
+        float distance = (side * 3.0f + 3.0f) * spacing * 0.5f;
+        if (model)
+            setSceneLights(frameUniforms.data, 0, 0.0f, glm::vec3(0.0f));
+        frameUniforms.data.view = glm::lookAt(glm::vec3(distance * 0.6f, distance * 0.5f, distance), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+        frameUniforms.data.projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, distance * 3.0f);
+        frameUniforms.upload();
+
+        // returns the average CPU (submission) and whole frame times in ms
+        auto measure = [&](bool instanced, double &cpuMs, double &frameMs) {
+            cpuMs = frameMs = 0.0;
+            for (int frame = 0; frame < warmupFrames + measuredFrames && !glfwWindowShouldClose(window); frame++)
+            {
+                auto start = std::chrono::steady_clock::now();
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+                if (instanced && model)
+                {
+                    instances.upload(transforms.data(), count);
+                    model->DrawInstanced(litShaders, ShaderPermutations::lights(0), instances);
+                }
+                else if (instanced)
+                {
+                    instancedShader.use();
+                    instances.upload(transforms.data(), count, colors.data());
+                    instances.drawArrays(cubeVAO, 0, 36);
+                }
+                else
+                {
+                    shader.use();
+                    objectUniforms.reset();
+                    for (size_t i = 0; i < count; i++)
+                        objectUniforms.push(transforms[i]);
+                    objectUniforms.upload();
+                    if (model)
+                    {
+                        for (size_t i = 0; i < count; i++)
+                        {
+                            objectUniforms.bind((unsigned int)i);
+                            for (Mesh &mesh : model->meshes)
+                            {
+                                Shader &lit = litShaders.get(mesh.shaderFeatures | ShaderPermutations::lights(0));
+                                lit.use();
+                                mesh.Draw(lit);
+                            }
+                        }
+                    }
+                    else
+                    {
+                        glBindVertexArray(cubeVAO);
+                        for (size_t i = 0; i < count; i++)
+                        {
+                            objectUniforms.bind((unsigned int)i);
+                            glDrawArrays(GL_TRIANGLES, 0, 36);
+                        }
+                        glBindVertexArray(0);
+                    }
+                }
+                auto submitted = std::chrono::steady_clock::now();
+                glfwSwapBuffers(window);
+                glFinish();
+                auto end = std::chrono::steady_clock::now();
+                glfwPollEvents();
+                if (frame >= warmupFrames)
+                {
+                    cpuMs += std::chrono::duration<double, std::milli>(submitted - start).count();
+                    frameMs += std::chrono::duration<double, std::milli>(end - start).count();
+                }
+            }
+            cpuMs /= measuredFrames;
+            frameMs /= measuredFrames;
+        };
+
+        double instancedCpu, instancedFrame, naiveCpu = -1.0, naiveFrame = -1.0;
+        measure(true, instancedCpu, instancedFrame);
+        if (count <= maxNaiveCount)
+            measure(false, naiveCpu, naiveFrame);
+        printf("[main.cpp] %10zu %18.3f %18.3f %18.3f %18.3f\n", count, instancedCpu, instancedFrame, naiveCpu, naiveFrame);
+        if (csv)
+            fprintf(csv, "%zu,%.4f,%.4f,%.4f,%.4f\n", count, instancedCpu, instancedFrame, naiveCpu, naiveFrame);
+        if (glfwWindowShouldClose(window))
+            break;
+    }
+    if (csv)
+        fclose(csv);
+    printf("[main.cpp] Wrote instancing_stress.csv (naive columns are -1 above %zu instances)\n", maxNaiveCount);
+}
+
+// opens the window with an OpenGL 3.3 core context, captures the mouse and loads the GL functions
+// ----------------------------------------------------------------------------------------------
+GLFWwindow *createWindow()
+{
+    // glfw: initialize and configure
+    // ------------------------------
+    glfwInit();
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+
+#ifdef __APPLE__
+    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+#endif
+
+    // glfw window creation
+    // --------------------
+    GLFWwindow *window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "LearnOpenGL", NULL, NULL);
+    if (window == NULL)
+    {
+        std::cout << "Failed to create GLFW window" << std::endl;
+        glfwTerminate();
+        return NULL;
+    }
+    glfwMakeContextCurrent(window);
+    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+    glfwSetCursorPosCallback(window, mouse_callback);
+    glfwSetScrollCallback(window, scroll_callback);
+    glfwSetMouseButtonCallback(window, mouse_button_callback);
+    glfwSetKeyCallback(window, key_callback);
+
+    // tell GLFW to capture our mouse
+    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+
+    // Setup Dear ImGui context
+    IMGUI_CHECKVERSION();
+    ImGui::CreateContext();
+    ImGuiIO &io = ImGui::GetIO();
+    (void)io;
+    // Setup Dear ImGui style
+    ImGui::StyleColorsDark();
+    // Setup Platform/Renderer bindings
+    ImGui_ImplGlfw_InitForOpenGL(window, true);
+    ImGui_ImplOpenGL3_Init("#version 330");
+
+    // glad: load all OpenGL function pointers
+    // ---------------------------------------
+    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress))
+    {
+        std::cout << "Failed to initialize GLAD" << std::endl;
+        return NULL;
+    }
+    return window;
+}
+
+// --lights: a dim directional light plus point lights of different colours circling center. Lights past the count
+// are black with no falloff, so permutations that shade more of them than are used still produce the same image.
+// ---------------------------------------------------------------------------------------------------------------
+void setSceneLights(FrameUniforms &frame, int pointLights, float time, const glm::vec3 &center)
+{
+    frame.dirLight.direction = glm::vec4(-0.2f, -1.0f, -0.3f, 0.0f);
+    frame.dirLight.ambient = glm::vec4(0.05f, 0.05f, 0.05f, 0.0f);
+    frame.dirLight.diffuse = glm::vec4(0.4f, 0.4f, 0.4f, 0.0f);
+    frame.dirLight.specular = glm::vec4(0.5f, 0.5f, 0.5f, 0.0f);
+    static const glm::vec3 colors[] = {{1.0f, 0.6f, 0.3f}, {0.3f, 0.6f, 1.0f}, {0.4f, 1.0f, 0.4f}, {1.0f, 0.3f, 0.8f}};
+    for (int i = 0; i < MAX_POINT_LIGHTS; i++)
+    {
+        GpuPointLight &light = frame.pointLights[i];
+        if (i >= pointLights)
+        {
+            light.position = light.ambient = light.diffuse = light.specular = glm::vec4(0.0f);
+            light.attenuation = glm::vec4(1.0f, 0.0f, 0.0f, 0.0f);
+            continue;
+        }
+        float angle = time * 0.5f + i * 6.2831853f / pointLights;
+        glm::vec3 color = colors[i % 4];
+        light.position = glm::vec4(center + glm::vec3(2.5f * std::cos(angle), 1.0f, 2.5f * std::sin(angle)), 1.0f);
+        light.ambient = glm::vec4(color * 0.05f, 0.0f);
+        light.diffuse = glm::vec4(color * 0.8f, 0.0f);
+        light.specular = glm::vec4(color, 0.0f);
+        light.attenuation = glm::vec4(1.0f, 0.09f, 0.032f, 0.0f);
+        light.attenuation.w = pointLightRadius(light);
+    }
+    frame.lightCounts[0] = pointLights;
+}
+
+// --clustered-lights: lights with random colours and ranges in a box around center, the size of the scene
+// ---------------------------------------------------------------------------------------------------------------
+std::vector<ClusterLight> makeClusterLights(size_t count, const glm::vec3 &center)
+{
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> x(-6.0f, 6.0f), y(-1.0f, 3.0f), z(-6.0f, 6.0f), radius(0.5f, 1.5f), hue(0.0f, 1.0f);
+    std::vector<ClusterLight> lights(count);
+    for (ClusterLight &light : lights)
+    {
+        light.position = center + glm::vec3(x(rng), y(rng), z(rng));
+        light.radius = radius(rng);
+        // bright, saturated colours from a hue
+        float h = hue(rng) * 6.0f;
+        light.color = glm::clamp(glm::vec3(std::fabs(h - 3.0f) - 1.0f, 2.0f - std::fabs(h - 2.0f), 2.0f - std::fabs(h - 4.0f)), 0.0f, 1.0f);
+    }
+    return lights;
+}
+
+// reads the bound framebuffer back and writes it to directory/frame_NNNNN.ppm
+// -------------------------------------------------------------------------
+bool writeFrame(const char *directory, unsigned int frame, unsigned int width, unsigned int height)
+{
+    std::vector<unsigned char> pixels((size_t)width * height * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/frame_%05u.ppm", directory, frame);
+    FILE *file = fopen(path, "wb");
+    if (!file)
+    {
+        std::cout << "[main.cpp] Could not write " << path << ", no more frames will be dumped" << std::endl;
+        return false;
+    }
+    fprintf(file, "P6\n%u %u\n255\n", width, height);
+    // GL rows go bottom to top
+    for (unsigned int y = height; y-- > 0;)
+        fwrite(pixels.data() + (size_t)y * width * 3, 1, (size_t)width * 3, file);
+    fclose(file);
+    return true;
+}
+
+// writes the replay's frame times as JSON and checks them against a stored baseline. Returns the exit code: 1 when
+// the baseline regressed past the threshold (or can't be read), 0 otherwise.
+// ---------------------------------------------------------------------------------------------------------------
+int reportReplay(const FrameTimeStats &stats, const char *pathFile, float timestep, const char *jsonPath, const char *baselinePath, double threshold)
+{
+    FILE *json = fopen(jsonPath, "w");
+    if (!json)
+        std::cout << "[main.cpp] Could not write " << jsonPath << std::endl;
+    else
+    {
+        fprintf(json, "{\n  \"path\": \"%s\",\n  \"timestep\": %.6f,\n  \"width\": %u,\n  \"height\": %u,\n  \"renderer\": \"%s\",\n  \"frame_ms\": ",
+                pathFile, timestep, SCR_WIDTH, SCR_HEIGHT, (const char *)glGetString(GL_RENDERER));
+        stats.writeJson(json);
+        fprintf(json, "\n}\n");
+        fclose(json);
+        printf("[main.cpp] Wrote %s\n", jsonPath);
+    }
+
+    if (!baselinePath)
+        return 0;
+    FrameTimeStats baseline;
+    if (!FrameTimeStats::loadJson(baselinePath, baseline))
+        return 1;
+    unsigned int regressions = stats.compare(baseline, threshold);
+    if (regressions > 0)
+        printf("[main.cpp] %u frame time metrics regressed more than %.0f%% against %s\n", regressions, threshold * 100.0, baselinePath);
+    return regressions > 0 ? 1 : 0;
 }
 
 // process all input: query GLFW whether relevant keys are pressed/released this frame and react accordingly
@@ -381,13 +1230,35 @@ void processInput(GLFWwindow *window)
         camera.ProcessKeyboard(RIGHT, deltaTime);
 }
 
+// glfw: F3 shows/hides the profiler overlay, F4 writes the recorded frames to profile.json and profile.csv, F5
+// switches between forward and deferred shading
+// ------------------------------------------------------------------------------------------------------
+void key_callback(GLFWwindow *window, int key, int scancode, int action, int mods)
+{
+    if (action != GLFW_PRESS)
+        return;
+    if (key == GLFW_KEY_F3)
+        profilerOverlay.visible = !profilerOverlay.visible;
+    else if (key == GLFW_KEY_F4)
+        profileExportRequested = true;
+    else if (key == GLFW_KEY_F5)
+    {
+        deferredShading = !deferredShading;
+        printf("[main.cpp] %s shading\n", deferredShading ? "Deferred" : "Forward");
+    }
+}
+
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
 // ---------------------------------------------------------------------------------------------
 void framebuffer_size_callback(GLFWwindow *window, int width, int height)
 {
-    // make sure the viewport matches the new window dimensions; note that width and
-    // height will be significantly larger than specified on retina displays.
-    glViewport(0, 0, width, height);
+    // the render graph sizes its targets and the viewport from these next frame; note that width and height will
+    // be significantly larger than specified on retina displays. Minimised windows report 0.
+    if (width > 0 && height > 0)
+    {
+        SCR_WIDTH = width;
+        SCR_HEIGHT = height;
+    }
 }
 
 // glfw: whenever the mouse moves, this callback is called
@@ -413,6 +1284,14 @@ void mouse_callback(GLFWwindow *window, double xposIn, double yposIn)
     camera.ProcessMouseMovement(xoffset, yoffset);
 }
 
+// glfw: left clicks request a pick in the next frame
+// ---------------------------------------------------
+void mouse_button_callback(GLFWwindow *window, int button, int action, int mods)
+{
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS)
+        pickRequested = true;
+}
+
 // glfw: whenever the mouse scroll wheel scrolls, this callback is called
 // ----------------------------------------------------------------------
 void scroll_callback(GLFWwindow *window, double xoffset, double yoffset)
@@ -427,33 +1306,12 @@ unsigned int loadTexture(char const *path)
     unsigned int textureID;
     glGenTextures(1, &textureID);
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(path, &width, &height, &nrComponents, 0);
-    if (data)
+    // flipped like everything else (stbi_set_flip_vertically_on_load above), which also lets the image and its
+    // mips be baked into a texture container on the first run and mapped on later ones
+    if (TextureLoader::upload(textureID, TextureLoader::decode(path, true, 1)))
     {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
     }
 
     return textureID;
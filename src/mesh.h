@@ -6,13 +6,23 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "frustum_culling.h"
+#include "geometry_arena.h"
+#include "instancing.h"
+#include "mesh_simplifier.h"
+#include "render_queue.h"
 #include "shader.h"
+#include "shader_permutations.h"
+#include "vertex_format.h"
 
+#include <stdint.h>
 #include <string>
 #include <vector>
 using namespace std;
 
 #define MAX_BONE_INFLUENCE 4
+// most vertices a draw range may reference with 16-bit indices
+#define MAX_SHORT_INDEX_VERTICES 65536
 
 struct Vertex {
     // position
@@ -37,110 +47,363 @@ struct Texture {
     string path;
 };
 
+// a sub-range of a mesh's index buffer drawn with its own base vertex. Meshes with more vertices than 16-bit
+// indices can address are split into several ranges so they can still use GL_UNSIGNED_SHORT.
+struct MeshRange {
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    int baseVertex;
+};
+
+// a level of detail: the ranges it draws (Mesh::ranges holds the ranges of every level, one level after the other)
+// and how far its surface may be from the full detail one, in model units
+struct MeshLod {
+    unsigned int firstRange;
+    unsigned int rangeCount;
+    float error;
+};
+
 class Mesh {
 public:
     // mesh Data
     vector<Vertex>       vertices;
     vector<unsigned int> indices;
     vector<Texture>      textures;
-    unsigned int VAO;
+    vector<int>          textureUnits; // fixed unit of each texture (Shader::materialTextureUnit), -1 if it has none
+    unsigned int         material;     // the same texture set as a MaterialTable id, for the render queue
+    uint32_t             shaderFeatures = 0; // material ShaderFeatures the textures and vertex layout support
+    unsigned int         maxBoneId = 0;      // largest bone id of a skinned layout
+    unsigned int VAO;        // the VAO of the arena pool the mesh lives in, shared with other meshes
+    ArenaAllocation allocation;
+    unsigned int indexCount;
+    unsigned int vertexCount;
+    VertexLayout layout;     // packed GPU layout of the vertex buffer (see vertex_format.h)
+    GLenum indexType;        // GL_UNSIGNED_SHORT whenever every range fits, else GL_UNSIGNED_INT
+    vector<MeshRange> ranges;
+    vector<MeshLod> lods;    // lods[0] is the mesh as imported, coarser levels index the same vertices
+    unsigned int residentLod = 0; // finest level whose indices are on the GPU; draws never go finer (model_streamer.h)
+    Bounds bounds;           // in model space
 
-    // constructor
+    // constructor, picks the smallest vertex layout that represents the vertices
     Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures)
+        : Mesh(vertices, indices, textures, VertexPacker::chooseLayout(vertices, true, false))
+    {
+    }
+
+    // constructor with an explicit GPU vertex layout. Always ends up with 16-bit indices: meshes with too many
+    // vertices are split into ranges, in which case indices are relative to their range's baseVertex. With a
+    // lodCount above 1 up to lodCount - 1 simplified levels are appended to the index buffer.
+    Mesh(vector<Vertex> vertices, vector<unsigned int> indices, vector<Texture> textures, VertexLayout layout, unsigned int lodCount = 1)
     {
         this->vertices = vertices;
         this->indices = indices;
         this->textures = textures;
+        this->layout = layout;
+        this->indexType = GL_UNSIGNED_SHORT;
+        buildRanges(this->vertices, this->indices, lodCount, this->ranges, this->lods);
+        this->bounds = Bounds::fromPoints(this->vertices.data(), this->vertices.size(), sizeof(Vertex));
 
         // now that we have all the required data, set the vertex buffers and its attribute pointers.
-        setupMesh();
+        vector<unsigned char> packed;
+        VertexPacker::pack(this->vertices, layout, packed);
+        this->maxBoneId = VertexPacker::maxBoneId(packed.data(), this->vertices.size(), layout);
+        assignTextureUnits();
+        vector<uint16_t> shortIndices(this->indices.begin(), this->indices.end());
+        setupMesh(packed.data(), this->vertices.size(), shortIndices.data(), shortIndices.size());
+    }
+
+    // constructor for already packed streams that live elsewhere (e.g. a memory-mapped model cache). The data is
+    // uploaded straight from the given pointers and no CPU-side copy is kept, so vertices and indices stay empty
+    // and the bounds have to be passed in. Without lods, all ranges make up a single level.
+    Mesh(const unsigned char *vertexData, size_t vertexCount, VertexLayout layout, const void *indexData, size_t indexCount, GLenum indexType, vector<MeshRange> ranges, vector<Texture> textures, Bounds bounds, vector<MeshLod> lods = {})
+    {
+        this->textures = textures;
+        this->bounds = bounds;
+        this->layout = layout;
+        this->indexType = indexType;
+        this->ranges = ranges;
+        this->lods = lods.empty() ? vector<MeshLod>{{0, static_cast<unsigned int>(ranges.size()), 0.0f}} : lods;
+        this->maxBoneId = VertexPacker::maxBoneId(vertexData, vertexCount, layout);
+        assignTextureUnits();
+        setupMesh(vertexData, vertexCount, indexData, indexCount);
+    }
+
+    // constructor for geometry someone else copies into the arena (model_streamer.h stages it over several
+    // frames). Only residentLod and coarser levels may be drawn until the caller lowers residentLod. maxBoneId is
+    // VertexPacker::maxBoneId of the vertices.
+    Mesh(const ArenaAllocation &allocation, VertexLayout layout, GLenum indexType, vector<MeshRange> ranges, vector<MeshLod> lods, vector<Texture> textures, Bounds bounds, unsigned int residentLod,
+         unsigned int maxBoneId = 0)
+    {
+        this->maxBoneId = maxBoneId;
+        this->textures = textures;
+        this->bounds = bounds;
+        this->layout = layout;
+        this->indexType = indexType;
+        this->ranges = ranges;
+        this->lods = lods;
+        this->residentLod = residentLod;
+        this->allocation = allocation;
+        this->indexCount = allocation.indexCount;
+        this->vertexCount = allocation.vertexCount;
+        VAO = GeometryArena::shared().pool(allocation.pool).VAO;
+        assignTextureUnits();
+    }
+
+    // the GL free part of the vertex constructor: splits the mesh for 16-bit indices (rewriting vertices and
+    // indices) and appends up to lodCount - 1 simplified levels. Safe to call from any thread.
+    static void buildRanges(vector<Vertex> &vertices, vector<unsigned int> &indices, unsigned int lodCount, vector<MeshRange> &ranges, vector<MeshLod> &lods)
+    {
+        ranges = splitForShortIndices(vertices, indices);
+        lods = {{0, static_cast<unsigned int>(ranges.size()), 0.0f}};
+        if (lodCount > 1)
+            buildLods(vertices, indices, ranges, lods, lodCount);
+    }
+
+    unsigned int indexSize() const
+    {
+        return indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+    }
+
+    unsigned int triangleCount(unsigned int lod = 0) const
+    {
+        unsigned int count = 0;
+        for (unsigned int r = lods[lod].firstRange; r < lods[lod].firstRange + lods[lod].rangeCount; r++)
+            count += ranges[r].indexCount / 3;
+        return count;
+    }
+
+    // the level to draw this mesh at when placed with 'model', given the level it was drawn at last time
+    unsigned int selectLod(const LodSelector &selector, const glm::mat4 &model, unsigned int current) const
+    {
+        if (lods.size() < 2 || bounds.empty())
+            return residentLod;
+        // the sphere and the errors scale with the largest axis of the transform
+        float scale = std::sqrt(std::max(glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+                                std::max(glm::dot(glm::vec3(model[1]), glm::vec3(model[1])), glm::dot(glm::vec3(model[2]), glm::vec3(model[2])))));
+        float radius = bounds.radius * scale;
+        glm::vec3 center = glm::vec3(model * glm::vec4(bounds.center, 1.0f));
+        unsigned int selected = selector.select(static_cast<unsigned int>(lods.size()), selector.projectedRadius(center, radius), radius, current,
+                                                [&](unsigned int level) { return lods[level].error * scale; });
+        return std::max(selected, residentLod);
     }
 
     // render the mesh
     void Draw(Shader &shader) 
     {
-        // bind appropriate textures
-        unsigned int diffuseNr  = 1;
-        unsigned int specularNr = 1;
-        unsigned int normalNr   = 1;
-        unsigned int heightNr   = 1;
-        for(unsigned int i = 0; i < textures.size(); i++)
-        {
-            glActiveTexture(GL_TEXTURE0 + i); // active proper texture unit before binding
-            // retrieve texture number (the N in diffuse_textureN)
-            string number;
-            string name = textures[i].type;
-            if(name == "texture_diffuse")
-                number = std::to_string(diffuseNr++);
-            else if(name == "texture_specular")
-                number = std::to_string(specularNr++); // transfer unsigned int to string
-            else if(name == "texture_normal")
-                number = std::to_string(normalNr++); // transfer unsigned int to string
-             else if(name == "texture_height")
-                number = std::to_string(heightNr++); // transfer unsigned int to string
-
-            // now set the sampler to the correct texture unit
-            glUniform1i(glGetUniformLocation(shader.ID, (name + number).c_str()), i);
-            // and finally bind the texture
-            glBindTexture(GL_TEXTURE_2D, textures[i].id);
-        }
+        bindTextures(shader);
         
         // draw mesh
         glBindVertexArray(VAO);
-        glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()), GL_UNSIGNED_INT, 0);
+        for (const MeshRange &range : lodRanges(residentLod))
+        {
+            glDrawElementsBaseVertex(GL_TRIANGLES, range.indexCount, indexType, (void *)((size_t)(allocation.firstIndex + range.firstIndex) * indexSize()), allocation.firstVertex + range.baseVertex);
+            Profiler::shared().countDraw(range.indexCount);
+        }
         glBindVertexArray(0);
 
         // always good practice to set everything back to defaults once configured.
         glActiveTexture(GL_TEXTURE0);
     }
 
+    // draws every instance in the buffer, one instanced draw per range
+    void DrawInstanced(Shader &shader, const InstanceBuffer &instances)
+    {
+        bindTextures(shader);
+        for (const MeshRange &range : lodRanges(residentLod))
+            instances.drawElements(VAO, indexType, allocation.firstIndex + range.firstIndex, range.indexCount, allocation.firstVertex + range.baseVertex);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    // queues the mesh on a draw list instead of drawing it right away; textures must be bound by the caller
+    void addTo(ArenaDrawList &drawList) const
+    {
+        for (const MeshRange &range : lodRanges(residentLod))
+            drawList.add(allocation.pool, allocation.firstIndex + range.firstIndex, range.indexCount, allocation.firstVertex + range.baseVertex);
+    }
+
+    // queues one packet per range of the given level; the render queue binds the textures
+    void enqueue(RenderQueue &queue, unsigned int program, int objectSlot, float depth, bool translucent = false, unsigned int lod = 0) const
+    {
+        for (const MeshRange &range : lodRanges(std::max(lod, residentLod)))
+        {
+            DrawPacket packet = DrawPacket::elements(program, material, VAO, indexType, allocation.firstIndex + range.firstIndex, range.indexCount, allocation.firstVertex + range.baseVertex);
+            packet.objectSlot = objectSlot;
+            packet.depth = depth;
+            packet.translucent = translucent;
+            queue.add(packet);
+        }
+    }
+
+    // binds the mesh's textures to their units. The texture_diffuseN etc. samplers already point at those units
+    // (Shader sets them once at link time), so no uniforms are touched here.
+    void bindTextures(Shader &shader) const
+    {
+        for(unsigned int i = 0; i < textures.size(); i++)
+        {
+            if (textureUnits[i] < 0)
+                continue;
+            glActiveTexture(GL_TEXTURE0 + textureUnits[i]); // active proper texture unit before binding
+            glBindTexture(GL_TEXTURE_2D, textures[i].id);
+        }
+    }
+
+    // true if both meshes bind exactly the same textures
+    bool sameTextures(const Mesh &other) const
+    {
+        if (textures.size() != other.textures.size())
+            return false;
+        for (size_t i = 0; i < textures.size(); i++)
+            if (textures[i].id != other.textures[i].id || textures[i].type != other.textures[i].type)
+                return false;
+        return true;
+    }
+
+    // returns the mesh's geometry to the arena; the mesh can't be drawn afterwards
+    void release()
+    {
+        GeometryArena::shared().free(allocation);
+    }
+
 private:
-    // render data 
-    unsigned int VBO, EBO;
+    // the ranges of one level, for range-based for loops
+    struct RangeSpan {
+        const MeshRange *first, *last;
+        const MeshRange *begin() const { return first; }
+        const MeshRange *end() const { return last; }
+    };
 
-    // initializes all the buffer objects/arrays
-    void setupMesh()
+    RangeSpan lodRanges(unsigned int lod) const
     {
-        // create buffers/arrays
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-        glGenBuffers(1, &EBO);
+        const MeshRange *first = ranges.data() + lods[lod].firstRange;
+        return {first, first + lods[lod].rangeCount};
+    }
 
-        glBindVertexArray(VAO);
-        // load data into vertex buffers
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        // A great thing about structs is that their memory layout is sequential for all its items.
-        // The effect is that we can simply pass a pointer to the struct and it translates perfectly to a glm::vec3/2 array which
-        // again translates to 3/2 floats which translates to a byte array.
-        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);  
-
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
-
-        // set the vertex attribute pointers
-        // vertex Positions
-        glEnableVertexAttribArray(0);	
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
-        // vertex normals
-        glEnableVertexAttribArray(1);	
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
-        // vertex texture coords
-        glEnableVertexAttribArray(2);	
-        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
-        // vertex tangent
-        glEnableVertexAttribArray(3);
-        glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Tangent));
-        // vertex bitangent
-        glEnableVertexAttribArray(4);
-        glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Bitangent));
-		// ids
-		glEnableVertexAttribArray(5);
-		glVertexAttribIPointer(5, 4, GL_INT, sizeof(Vertex), (void*)offsetof(Vertex, m_BoneIDs));
-
-		// weights
-		glEnableVertexAttribArray(6);
-		glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, m_Weights));
-        glBindVertexArray(0);
+    // simplifies every range on its own (its indices are relative to its baseVertex) and appends the levels to
+    // indices, ranges and lods. A level is only kept if every range got one.
+    static void buildLods(const vector<Vertex> &vertices, vector<unsigned int> &indices, vector<MeshRange> &ranges, vector<MeshLod> &lods, unsigned int lodCount)
+    {
+        size_t fullRanges = ranges.size();
+        vector<vector<SimplifiedLod>> simplified(fullRanges);
+        size_t levels = lodCount;
+        for (size_t r = 0; r < fullRanges; r++)
+        {
+            const MeshRange &range = ranges[r];
+            size_t rangeEnd = r + 1 < fullRanges ? static_cast<size_t>(ranges[r + 1].baseVertex) : vertices.size();
+            vector<unsigned int> rangeIndices(indices.begin() + range.firstIndex, indices.begin() + range.firstIndex + range.indexCount);
+            simplified[r] = MeshSimplifier::buildLods(vertices.data() + range.baseVertex, rangeEnd - range.baseVertex, rangeIndices, lodCount);
+            levels = std::min(levels, simplified[r].size() + 1);
+        }
+        for (size_t level = 1; level < levels; level++)
+        {
+            MeshLod lod = {static_cast<unsigned int>(ranges.size()), static_cast<unsigned int>(fullRanges), 0.0f};
+            for (size_t r = 0; r < fullRanges; r++)
+            {
+                const SimplifiedLod &source = simplified[r][level - 1];
+                ranges.push_back({static_cast<unsigned int>(indices.size()), static_cast<unsigned int>(source.indices.size()), ranges[r].baseVertex});
+                indices.insert(indices.end(), source.indices.begin(), source.indices.end());
+                lod.error = std::max(lod.error, source.error);
+            }
+            lods.push_back(lod);
+        }
+    }
+
+    // the N in texture_diffuseN counts textures of the same type, in order
+    void assignTextureUnits()
+    {
+        unsigned int diffuseNr  = 1;
+        unsigned int specularNr = 1;
+        unsigned int normalNr   = 1;
+        unsigned int heightNr   = 1;
+        textureUnits.clear();
+        // SKINNING takes MAX_SHADER_BONES matrices; a mesh indexing past them stays in its bind pose instead
+        shaderFeatures = 0;
+        if ((layout.flags & VERTEX_SKINNED) && maxBoneId < (unsigned int)MAX_SHADER_BONES)
+            shaderFeatures = SHADER_SKINNING;
+        else if (layout.flags & VERTEX_SKINNED)
+            printf("[mesh.h] Mesh uses bone %u, the shaders take %d bones: drawn unskinned\n", maxBoneId, MAX_SHADER_BONES);
+        vector<pair<int, unsigned int>> bindings;
+        for (const Texture &texture : textures)
+        {
+            unsigned int number = 0;
+            if(texture.type == "texture_diffuse")
+                number = diffuseNr++;
+            else if(texture.type == "texture_specular")
+                number = specularNr++;
+            else if(texture.type == "texture_normal")
+                number = normalNr++;
+            else if(texture.type == "texture_height")
+                number = heightNr++;
+            textureUnits.push_back(Shader::materialTextureUnit(texture.type, number));
+            bindings.push_back(make_pair(textureUnits.back(), texture.id));
+            // the permutations sample the first texture of a type
+            if (number == 1 && texture.type == "texture_specular")
+                shaderFeatures |= SHADER_SPECULAR_MAP;
+            else if (number == 1 && texture.type == "texture_normal" && (layout.flags & VERTEX_TANGENTS))
+                shaderFeatures |= SHADER_NORMAL_MAP;
+        }
+        material = MaterialTable::shared().intern(bindings);
+    }
+
+    // uploads the packed streams
+    void setupMesh(const unsigned char *vertexData, size_t vertexCount, const void *indexData, size_t indexCount)
+    {
+        this->indexCount = static_cast<unsigned int>(indexCount);
+        this->vertexCount = static_cast<unsigned int>(vertexCount);
+
+        // sub-allocate the buffers from the shared arena; its pool VAO already has the attribute pointers for the layout
+        allocation = GeometryArena::shared().allocate(layout, vertexData, this->vertexCount, indexType, indexData, this->indexCount);
+        VAO = GeometryArena::shared().pool(allocation.pool).VAO;
+    }
+
+    // partitions the triangles into ranges that reference at most MAX_SHORT_INDEX_VERTICES vertices each and
+    // rewrites vertices/indices so every range owns a contiguous block of vertices (vertices shared across a
+    // range boundary are duplicated). Works best on meshes already in first-use vertex order.
+    static vector<MeshRange> splitForShortIndices(vector<Vertex> &vertices, vector<unsigned int> &indices)
+    {
+        if (vertices.size() <= MAX_SHORT_INDEX_VERTICES)
+            return {{0, static_cast<unsigned int>(indices.size()), 0}};
+
+        vector<Vertex> splitVertices;
+        vector<unsigned int> splitIndices;
+        splitVertices.reserve(vertices.size());
+        splitIndices.reserve(indices.size());
+        vector<MeshRange> result;
+        const unsigned int none = ~0u;
+        vector<unsigned int> rangeOf(vertices.size(), none);   // last range that used each vertex
+        vector<unsigned int> localIndex(vertices.size(), 0);
+        MeshRange range = {0, 0, 0};
+        unsigned int rangeId = 0;
+        for (size_t t = 0; t + 2 < indices.size(); t += 3)
+        {
+            unsigned int needed = 0;
+            for (int k = 0; k < 3; k++)
+                needed += rangeOf[indices[t + k]] != rangeId;
+            if (splitVertices.size() - range.baseVertex + needed > MAX_SHORT_INDEX_VERTICES)
+            {
+                range.indexCount = static_cast<unsigned int>(splitIndices.size()) - range.firstIndex;
+                result.push_back(range);
+                range.firstIndex = static_cast<unsigned int>(splitIndices.size());
+                range.baseVertex = static_cast<int>(splitVertices.size());
+                rangeId++;
+            }
+            for (int k = 0; k < 3; k++)
+            {
+                unsigned int v = indices[t + k];
+                if (rangeOf[v] != rangeId)
+                {
+                    rangeOf[v] = rangeId;
+                    localIndex[v] = static_cast<unsigned int>(splitVertices.size()) - range.baseVertex;
+                    splitVertices.push_back(vertices[v]);
+                }
+                splitIndices.push_back(localIndex[v]);
+            }
+        }
+        range.indexCount = static_cast<unsigned int>(splitIndices.size()) - range.firstIndex;
+        result.push_back(range);
+
+        vertices.swap(splitVertices);
+        indices.swap(splitIndices);
+        return result;
     }
 };
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,248 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glm/glm.hpp>
+
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+// Post-import index/vertex reordering, run by Model::processMesh before the buffers are created. Pure CPU code
+// (no GL calls), so the passes and the cache simulator can be measured on machines without a GPU.
+//
+//   1. optimizeVertexCache: Tipsify (Sander, Nehab, Barczak 2007) triangle reordering for post-transform cache hits
+//   2. optimizeOverdraw:    orders the Tipsify clusters front-to-back-ish so outward facing clusters draw first
+//   3. optimizeVertexFetch: renumbers vertices in first-use order so the pre-transform fetches stream linearly
+
+// cache size Tipsify optimises for; small enough to be a good fit for all current GPUs
+const unsigned int MESH_OPTIMIZER_CACHE_SIZE = 16;
+
+struct VertexCacheStats {
+    float acmr = 0.0f; // average cache miss ratio: transformed vertices per triangle (0.5 is ideal on large meshes)
+    float atvr = 0.0f; // average transform to vertex ratio: transformed vertices per unique vertex (1.0 is ideal)
+};
+
+class MeshOptimizer
+{
+public:
+    // FIFO post-transform cache simulation over a triangle list
+    static VertexCacheStats simulateCache(const std::vector<unsigned int> &indices, size_t vertexCount, unsigned int cacheSize = MESH_OPTIMIZER_CACHE_SIZE)
+    {
+        VertexCacheStats stats;
+        if (indices.empty() || vertexCount == 0)
+            return stats;
+
+        // a vertex is in the cache if it was pushed less than cacheSize misses ago
+        std::vector<size_t> timestamps(vertexCount, 0);
+        size_t time = cacheSize + 1;
+        size_t misses = 0;
+        std::vector<bool> used(vertexCount, false);
+        size_t unique = 0;
+        for (unsigned int index : indices)
+        {
+            if (!used[index])
+            {
+                used[index] = true;
+                unique++;
+            }
+            if (time - timestamps[index] > cacheSize)
+            {
+                timestamps[index] = time++;
+                misses++;
+            }
+        }
+        stats.acmr = (float)misses / (indices.size() / 3);
+        stats.atvr = unique ? (float)misses / unique : 0.0f;
+        return stats;
+    }
+
+    // Tipsify triangle reordering. If clusters is given it receives the first triangle of every cluster
+    // (a run of triangles between two dead-end restarts) for optimizeOverdraw.
+    static void optimizeVertexCache(std::vector<unsigned int> &indices, size_t vertexCount, std::vector<unsigned int> *clusters = nullptr, unsigned int cacheSize = MESH_OPTIMIZER_CACHE_SIZE)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0)
+            return;
+
+        // vertex -> triangle adjacency in CSR form
+        std::vector<unsigned int> liveTriangles(vertexCount, 0);
+        for (unsigned int index : indices)
+            liveTriangles[index]++;
+        std::vector<unsigned int> adjacencyOffset(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++)
+            adjacencyOffset[v + 1] = adjacencyOffset[v] + liveTriangles[v];
+        std::vector<unsigned int> adjacency(indices.size());
+        std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++)
+            for (int k = 0; k < 3; k++)
+                adjacency[fill[indices[t * 3 + k]]++] = (unsigned int)t;
+
+        std::vector<unsigned int> result;
+        result.reserve(indices.size());
+        std::vector<bool> emitted(triangleCount, false);
+        std::vector<size_t> cacheTime(vertexCount, 0);
+        std::vector<unsigned int> deadEnd;
+        std::vector<unsigned int> candidates;
+        size_t time = cacheSize + 1;
+        size_t cursor = 0;
+        bool restarted = true;
+
+        long fanning = indices[0];
+        while (fanning >= 0)
+        {
+            if (clusters && restarted)
+                clusters->push_back((unsigned int)(result.size() / 3));
+            candidates.clear();
+            // emit every remaining triangle around the fanning vertex
+            for (unsigned int a = adjacencyOffset[fanning]; a < adjacencyOffset[fanning + 1]; a++)
+            {
+                unsigned int t = adjacency[a];
+                if (emitted[t])
+                    continue;
+                emitted[t] = true;
+                for (int k = 0; k < 3; k++)
+                {
+                    unsigned int v = indices[t * 3 + k];
+                    result.push_back(v);
+                    deadEnd.push_back(v);
+                    candidates.push_back(v);
+                    liveTriangles[v]--;
+                    if (time - cacheTime[v] > cacheSize)
+                        cacheTime[v] = time++;
+                }
+            }
+
+            // next fanning vertex: the candidate that stays in the cache longest and still has work left
+            long best = -1;
+            long bestPriority = -1;
+            for (unsigned int v : candidates)
+            {
+                if (liveTriangles[v] == 0)
+                    continue;
+                long priority = 0;
+                if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+                    priority = (long)(time - cacheTime[v]);
+                if (priority > bestPriority)
+                {
+                    bestPriority = priority;
+                    best = v;
+                }
+            }
+            restarted = best < 0;
+            if (restarted)
+                best = skipDeadEnd(deadEnd, liveTriangles, cursor);
+            fanning = best;
+        }
+        indices.swap(result);
+    }
+
+    // reorders the clusters found by optimizeVertexCache so that clusters facing away from the mesh centre are
+    // drawn first: they are the most likely to occlude the rest of the mesh. Triangle order inside clusters is kept,
+    // so the cache efficiency only changes at the (already expensive) cluster boundaries.
+    template <typename V>
+    static void optimizeOverdraw(std::vector<unsigned int> &indices, const std::vector<V> &vertices, const std::vector<unsigned int> &clusters)
+    {
+        size_t triangleCount = indices.size() / 3;
+        if (clusters.size() < 2)
+            return;
+
+        glm::vec3 meshCentroid(0.0f);
+        for (const V &v : vertices)
+            meshCentroid += v.Position;
+        meshCentroid /= (float)std::max<size_t>(vertices.size(), 1);
+
+        struct Cluster {
+            unsigned int first, end;
+            float sortKey;
+        };
+        std::vector<Cluster> sorted(clusters.size());
+        for (size_t c = 0; c < clusters.size(); c++)
+        {
+            Cluster &cluster = sorted[c];
+            cluster.first = clusters[c];
+            cluster.end = c + 1 < clusters.size() ? clusters[c + 1] : (unsigned int)triangleCount;
+
+            // area weighted centroid and normal of the cluster
+            glm::vec3 centroid(0.0f), normal(0.0f);
+            float area = 0.0f;
+            for (unsigned int t = cluster.first; t < cluster.end; t++)
+            {
+                const glm::vec3 &p0 = vertices[indices[t * 3 + 0]].Position;
+                const glm::vec3 &p1 = vertices[indices[t * 3 + 1]].Position;
+                const glm::vec3 &p2 = vertices[indices[t * 3 + 2]].Position;
+                glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+                float a = glm::length(n);
+                centroid += (p0 + p1 + p2) * (a / 3.0f);
+                normal += n;
+                area += a;
+            }
+            if (area > 0.0f)
+                centroid /= area;
+            float length = glm::length(normal);
+            cluster.sortKey = length > 0.0f ? glm::dot(centroid - meshCentroid, normal / length) : 0.0f;
+        }
+        std::stable_sort(sorted.begin(), sorted.end(), [](const Cluster &a, const Cluster &b) { return a.sortKey > b.sortKey; });
+
+        std::vector<unsigned int> result;
+        result.reserve(indices.size());
+        for (const Cluster &cluster : sorted)
+            result.insert(result.end(), indices.begin() + cluster.first * 3, indices.begin() + cluster.end * 3);
+        indices.swap(result);
+    }
+
+    // renumbers the vertices in the order the index buffer first references them. Unreferenced vertices are dropped.
+    template <typename V>
+    static void optimizeVertexFetch(std::vector<unsigned int> &indices, std::vector<V> &vertices)
+    {
+        const unsigned int unused = ~0u;
+        std::vector<unsigned int> remap(vertices.size(), unused);
+        std::vector<V> result;
+        result.reserve(vertices.size());
+        for (unsigned int &index : indices)
+        {
+            if (remap[index] == unused)
+            {
+                remap[index] = (unsigned int)result.size();
+                result.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+        vertices.swap(result);
+    }
+
+    // runs all passes and returns the cache statistics before and after
+    template <typename V>
+    static void optimize(std::vector<unsigned int> &indices, std::vector<V> &vertices, VertexCacheStats *before = nullptr, VertexCacheStats *after = nullptr)
+    {
+        if (before)
+            *before = simulateCache(indices, vertices.size());
+        std::vector<unsigned int> clusters;
+        optimizeVertexCache(indices, vertices.size(), &clusters);
+        optimizeOverdraw(indices, vertices, clusters);
+        optimizeVertexFetch(indices, vertices);
+        if (after)
+            *after = simulateCache(indices, vertices.size());
+    }
+
+private:
+    static long skipDeadEnd(std::vector<unsigned int> &deadEnd, const std::vector<unsigned int> &liveTriangles, size_t &cursor)
+    {
+        // recently used vertices first, they are the most likely to still be cached
+        while (!deadEnd.empty())
+        {
+            unsigned int v = deadEnd.back();
+            deadEnd.pop_back();
+            if (liveTriangles[v] > 0)
+                return v;
+        }
+        // otherwise the next vertex in input order that still has triangles
+        while (cursor < liveTriangles.size())
+        {
+            if (liveTriangles[cursor] > 0)
+                return (long)cursor;
+            cursor++;
+        }
+        return -1;
+    }
+};
+#endif
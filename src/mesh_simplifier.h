@@ -0,0 +1,535 @@
+#ifndef MESH_SIMPLIFIER_H
+#define MESH_SIMPLIFIER_H
+
+#include <glm/glm.hpp>
+
+#include "mesh_optimizer.h"
+
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+// Import-time level of detail generation, run by Mesh when a model is loaded with LODs. Pure CPU code like
+// mesh_optimizer.h, so it can be measured without a GPU.
+//
+// Simplification is quadric error metric (Garland, Heckbert 1997) edge collapsing onto existing vertices, so every
+// LOD is just another index list over the mesh's vertex buffer. Open borders and seams (edges whose sides use
+// different vertices, i.e. different normals or uvs) get extra constraint planes and their vertices may only slide
+// along them, which keeps uv charts and hard normal edges intact. Collapses that turn a triangle by more than 60
+// degrees are rejected, so the shading normals stay valid for the coarser surface.
+
+// most levels a mesh keeps, the full detail one included
+const unsigned int MAX_MESH_LODS = 4;
+
+// a simplified index list and how far its surface may be from the original one, in model units
+struct SimplifiedLod {
+    std::vector<unsigned int> indices;
+    float error = 0.0f;
+};
+
+class MeshSimplifier
+{
+public:
+    // weight of the constraint planes along borders and seams, relative to the triangle planes
+    static constexpr double LINE_WEIGHT = 10.0;
+    // smallest cosine between a triangle's normal before and after a collapse
+    static constexpr float MIN_NORMAL_COSINE = 0.5f;
+
+    // Builds up to maxLods - 1 coarser index lists, each with about 'ratio' times the triangles of the one before.
+    // Stops early when the surface would have to move by more than maxError times the mesh's bounding radius, or
+    // when the mesh can't be simplified any further. The lists reference the given vertices and come out in
+    // post-transform cache friendly order.
+    template <typename V>
+    static std::vector<SimplifiedLod> buildLods(const V *vertices, size_t vertexCount, const std::vector<unsigned int> &indices,
+                                                unsigned int maxLods = MAX_MESH_LODS, float ratio = 0.5f, float maxError = 0.05f)
+    {
+        std::vector<SimplifiedLod> lods;
+        if (vertexCount == 0 || indices.size() < 3 || maxLods < 2)
+            return lods;
+
+        Simplifier simplifier;
+        simplifier.setup(vertices, vertexCount, indices);
+        float errorLimit = maxError * simplifier.radius;
+
+        size_t previous = indices.size() / 3;
+        for (unsigned int level = 1; level < maxLods; level++)
+        {
+            size_t target = (size_t)(previous * ratio);
+            while (simplifier.triangles.size() / 3 > target)
+                if (!simplifier.collapsePass(target, errorLimit))
+                    break;
+            // a level that barely differs from the last one isn't worth its indices
+            size_t triangles = simplifier.triangles.size() / 3;
+            if (triangles == 0 || triangles > previous * (1.0f + ratio) * 0.5f)
+                break;
+            SimplifiedLod lod;
+            lod.indices = simplifier.triangles;
+            lod.error = simplifier.error;
+            MeshOptimizer::optimizeVertexCache(lod.indices, vertexCount);
+            lods.push_back(std::move(lod));
+            previous = triangles;
+        }
+        return lods;
+    }
+
+private:
+    // symmetric 4x4 matrix of summed squared plane distances, plus the summed plane weights
+    struct Quadric {
+        double a00 = 0, a11 = 0, a22 = 0, a01 = 0, a02 = 0, a12 = 0;
+        double b0 = 0, b1 = 0, b2 = 0, c = 0, w = 0;
+
+        void addPlane(const glm::vec3 &n, float d, double weight)
+        {
+            a00 += weight * n.x * n.x;
+            a11 += weight * n.y * n.y;
+            a22 += weight * n.z * n.z;
+            a01 += weight * n.x * n.y;
+            a02 += weight * n.x * n.z;
+            a12 += weight * n.y * n.z;
+            b0 += weight * n.x * d;
+            b1 += weight * n.y * d;
+            b2 += weight * n.z * d;
+            c += weight * d * d;
+            w += weight;
+        }
+
+        void operator+=(const Quadric &q)
+        {
+            a00 += q.a00; a11 += q.a11; a22 += q.a22; a01 += q.a01; a02 += q.a02; a12 += q.a12;
+            b0 += q.b0; b1 += q.b1; b2 += q.b2; c += q.c; w += q.w;
+        }
+
+        // weighted mean squared distance of p to the planes
+        double error(const glm::vec3 &p) const
+        {
+            double x = p.x, y = p.y, z = p.z;
+            double sum = a00 * x * x + a11 * y * y + a22 * z * z + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+                         2.0 * (b0 * x + b1 * y + b2 * z) + c;
+            return w > 0.0 ? std::max(sum, 0.0) / w : 0.0;
+        }
+    };
+
+    // a byte-wise hashable vertex key; position only, or position + normal + uv
+    template <int N>
+    struct Key {
+        float values[N];
+        bool operator==(const Key &other) const { return memcmp(values, other.values, sizeof(values)) == 0; }
+    };
+    template <int N>
+    struct KeyHash {
+        size_t operator()(const Key<N> &key) const
+        {
+            uint64_t hash = 1469598103934665603ull;
+            const unsigned char *bytes = (const unsigned char *)key.values;
+            for (size_t i = 0; i < sizeof(key.values); i++)
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            return (size_t)hash;
+        }
+    };
+
+    enum VertexKind : unsigned char {
+        VERTEX_INTERIOR, // may collapse along any edge
+        VERTEX_LINE,     // on exactly one border or seam, may only collapse along it
+        VERTEX_LOCKED    // corner, end of a seam or non-manifold: never moves
+    };
+
+    struct Collapse {
+        unsigned int from, to; // position representatives
+        float cost;
+    };
+
+    struct Simplifier {
+        std::vector<glm::vec3> positions;
+        std::vector<unsigned int> remap;     // vertex -> first vertex at the same position
+        std::vector<Quadric> quadrics;       // per position representative
+        std::vector<unsigned int> triangles; // current index list, over attribute-welded vertices
+        float radius = 0.0f;
+        float error = 0.0f;                  // largest collapse error so far
+
+        // per pass scratch
+        std::vector<unsigned int> adjacencyOffset, adjacency; // vertex -> triangles
+        std::vector<unsigned int> copyOffset, copies;         // position representative -> vertices in use
+        std::vector<uint64_t> lineEdges;                      // undirected, sorted
+        std::vector<unsigned char> kind, locked;
+        std::vector<unsigned int> collapseTo, partners;
+        std::vector<float> bestCost;
+        std::vector<unsigned int> bestTarget;
+        std::vector<Collapse> collapses;
+
+        template <typename V>
+        void setup(const V *vertices, size_t vertexCount, const std::vector<unsigned int> &indices)
+        {
+            // vertices identical in position, normal and uv are one vertex (meshes are often imported unwelded);
+            // vertices sharing only the position are the copies of one corner on either side of a seam
+            std::vector<unsigned int> wedge(vertexCount);
+            remap.resize(vertexCount);
+            positions.resize(vertexCount);
+            std::unordered_map<Key<8>, unsigned int, KeyHash<8>> attributeIds;
+            std::unordered_map<Key<3>, unsigned int, KeyHash<3>> positionIds;
+            attributeIds.reserve(vertexCount);
+            positionIds.reserve(vertexCount);
+            glm::vec3 minimum(FLT_MAX), maximum(-FLT_MAX);
+            for (size_t v = 0; v < vertexCount; v++)
+            {
+                const V &vertex = vertices[v];
+                positions[v] = vertex.Position;
+                minimum = glm::min(minimum, vertex.Position);
+                maximum = glm::max(maximum, vertex.Position);
+                Key<8> attributes = {{vertex.Position.x, vertex.Position.y, vertex.Position.z, vertex.Normal.x, vertex.Normal.y, vertex.Normal.z, vertex.TexCoords.x, vertex.TexCoords.y}};
+                Key<3> position = {{vertex.Position.x, vertex.Position.y, vertex.Position.z}};
+                wedge[v] = attributeIds.emplace(attributes, (unsigned int)v).first->second;
+                remap[v] = positionIds.emplace(position, (unsigned int)v).first->second;
+            }
+            radius = glm::length(maximum - minimum) * 0.5f;
+
+            triangles.clear();
+            triangles.reserve(indices.size());
+            for (size_t i = 0; i + 2 < indices.size(); i += 3)
+            {
+                unsigned int a = wedge[indices[i]], b = wedge[indices[i + 1]], c = wedge[indices[i + 2]];
+                if (remap[a] != remap[b] && remap[b] != remap[c] && remap[a] != remap[c])
+                {
+                    triangles.push_back(a);
+                    triangles.push_back(b);
+                    triangles.push_back(c);
+                }
+            }
+
+            // every triangle's plane, weighted by its area, on its corners; border and seam edges add a plane
+            // through the edge perpendicular to the triangle so the lines keep their shape
+            quadrics.assign(vertexCount, Quadric());
+            buildAdjacency();
+            for (size_t i = 0; i < triangles.size(); i += 3)
+            {
+                glm::vec3 normal = glm::cross(positions[triangles[i + 1]] - positions[triangles[i]], positions[triangles[i + 2]] - positions[triangles[i]]);
+                float length = glm::length(normal);
+                if (length == 0.0f)
+                    continue;
+                normal = normal / length;
+                for (int k = 0; k < 3; k++)
+                {
+                    unsigned int v = triangles[i + k];
+                    quadrics[remap[v]].addPlane(normal, -glm::dot(normal, positions[v]), length * 0.5);
+                }
+                for (int k = 0; k < 3; k++)
+                {
+                    unsigned int a = triangles[i + k], b = triangles[i + (k + 1) % 3];
+                    if (!isLine(a, b))
+                        continue;
+                    glm::vec3 edge = positions[b] - positions[a];
+                    float edgeLength = glm::length(edge);
+                    if (edgeLength == 0.0f)
+                        continue;
+                    glm::vec3 planeNormal = glm::normalize(glm::cross(edge, normal));
+                    double weight = LINE_WEIGHT * edgeLength * edgeLength;
+                    float d = -glm::dot(planeNormal, positions[a]);
+                    quadrics[remap[a]].addPlane(planeNormal, d, weight);
+                    quadrics[remap[b]].addPlane(planeNormal, d, weight);
+                }
+            }
+        }
+
+        static uint64_t edgeKey(unsigned int a, unsigned int b)
+        {
+            return ((uint64_t)a << 32) | b;
+        }
+
+        // true if a triangle runs along a -> b (vertices)
+        bool hasEdge(unsigned int a, unsigned int b) const
+        {
+            for (unsigned int i = adjacencyOffset[a]; i < adjacencyOffset[a + 1]; i++)
+            {
+                const unsigned int *triangle = &triangles[adjacency[i] * 3];
+                for (int k = 0; k < 3; k++)
+                    if (triangle[k] == a && triangle[(k + 1) % 3] == b)
+                        return true;
+            }
+            return false;
+        }
+
+        // true if a triangle runs along a -> b (position representatives), whatever copies it uses
+        bool hasPositionEdge(unsigned int a, unsigned int b) const
+        {
+            for (unsigned int c = copyOffset[a]; c < copyOffset[a + 1]; c++)
+            {
+                unsigned int vertex = copies[c];
+                for (unsigned int i = adjacencyOffset[vertex]; i < adjacencyOffset[vertex + 1]; i++)
+                {
+                    const unsigned int *triangle = &triangles[adjacency[i] * 3];
+                    for (int k = 0; k < 3; k++)
+                        if (triangle[k] == vertex && remap[triangle[(k + 1) % 3]] == b)
+                            return true;
+                }
+            }
+            return false;
+        }
+
+        // the edge a -> b is on an open border when no triangle runs along it the other way, and on a seam when
+        // the triangle on the other side uses different vertices for the same positions. Needs buildAdjacency.
+        bool isLine(unsigned int a, unsigned int b) const
+        {
+            return !hasEdge(b, a) || !hasPositionEdge(remap[b], remap[a]);
+        }
+
+        // performs a batch of independent collapses, cheapest first, until the triangle count reaches target or the
+        // next collapse would exceed errorLimit. Returns false if nothing could be collapsed.
+        bool collapsePass(size_t target, float errorLimit)
+        {
+            size_t vertexCount = positions.size();
+            buildAdjacency();
+
+            // classify the position representatives by the border and seam edges (undirected) they are on
+            lineEdges.clear();
+            for (size_t i = 0; i < triangles.size(); i += 3)
+                for (int k = 0; k < 3; k++)
+                {
+                    unsigned int a = triangles[i + k], b = triangles[i + (k + 1) % 3];
+                    if (isLine(a, b))
+                        lineEdges.push_back(edgeKey(std::min(remap[a], remap[b]), std::max(remap[a], remap[b])));
+                }
+            std::sort(lineEdges.begin(), lineEdges.end());
+            lineEdges.erase(std::unique(lineEdges.begin(), lineEdges.end()), lineEdges.end());
+            kind.assign(vertexCount, VERTEX_INTERIOR);
+            std::vector<unsigned char> lineCount(vertexCount, 0);
+            for (uint64_t edge : lineEdges)
+            {
+                unsigned int a = (unsigned int)(edge >> 32), b = (unsigned int)edge;
+                lineCount[a] = (unsigned char)std::min(lineCount[a] + 1, 3);
+                lineCount[b] = (unsigned char)std::min(lineCount[b] + 1, 3);
+            }
+            for (size_t v = 0; v < vertexCount; v++)
+                kind[v] = lineCount[v] == 0 ? VERTEX_INTERIOR : lineCount[v] == 2 ? VERTEX_LINE : VERTEX_LOCKED;
+
+            // the cheapest allowed collapse of every position representative
+            bestCost.assign(vertexCount, FLT_MAX);
+            bestTarget.assign(vertexCount, ~0u);
+            for (size_t i = 0; i < triangles.size(); i += 3)
+                for (int k = 0; k < 3; k++)
+                {
+                    unsigned int a = remap[triangles[i + k]], b = remap[triangles[i + (k + 1) % 3]];
+                    consider(a, b);
+                    consider(b, a);
+                }
+            collapses.clear();
+            for (size_t v = 0; v < vertexCount; v++)
+                if (bestTarget[v] != ~0u)
+                    collapses.push_back({(unsigned int)v, bestTarget[v], bestCost[v]});
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse &a, const Collapse &b) { return a.cost < b.cost; });
+
+            // collapses only touch the triangles around their source, so locking the source's neighbourhood keeps
+            // every triangle changed by at most one collapse per pass
+            locked.assign(vertexCount, 0);
+            collapseTo.resize(vertexCount);
+            for (size_t v = 0; v < vertexCount; v++)
+                collapseTo[v] = (unsigned int)v;
+            size_t removable = triangles.size() / 3 - target;
+            if (collapses.empty())
+                return false;
+
+            // A pass only takes collapses up to a little more than the cost of the cheapest ones it needs: once
+            // locking rejects those, taking pricier ones right away would skip cheaper collapses that only become
+            // possible next pass. If that bound lets nothing through, the pass falls back to the full error limit.
+            size_t needed = std::min(collapses.size() - 1, removable / 2);
+            float passLimit = std::min(std::sqrt(collapses[needed].cost) * 1.5f, errorLimit);
+            size_t removed = 0;
+            unsigned int performed = 0;
+            for (float limit : {passLimit, errorLimit})
+            {
+                for (const Collapse &collapse : collapses)
+                {
+                    if (removed >= removable)
+                        break;
+                    float collapseError = std::sqrt(collapse.cost);
+                    if (collapseError > limit)
+                        break;
+                    if (locked[collapse.from] || locked[collapse.to])
+                        continue;
+                    size_t count = tryCollapse(collapse.from, collapse.to);
+                    if (count == 0)
+                        continue;
+                    removed += count;
+                    performed++;
+                    error = std::max(error, collapseError);
+                }
+                if (performed > 0 || passLimit >= errorLimit)
+                    break;
+            }
+            if (performed == 0)
+                return false;
+
+            // apply the collapses and drop the triangles that became degenerate
+            size_t write = 0;
+            for (size_t i = 0; i < triangles.size(); i += 3)
+            {
+                unsigned int a = collapseTo[triangles[i]], b = collapseTo[triangles[i + 1]], c = collapseTo[triangles[i + 2]];
+                if (remap[a] == remap[b] || remap[b] == remap[c] || remap[a] == remap[c])
+                    continue;
+                triangles[write++] = a;
+                triangles[write++] = b;
+                triangles[write++] = c;
+            }
+            triangles.resize(write);
+            return true;
+        }
+
+        void consider(unsigned int from, unsigned int to)
+        {
+            if (kind[from] == VERTEX_LOCKED)
+                return;
+            if (kind[from] == VERTEX_LINE && !std::binary_search(lineEdges.begin(), lineEdges.end(), edgeKey(std::min(from, to), std::max(from, to))))
+                return;
+            float cost = (float)quadrics[from].error(positions[to]);
+            if (cost < bestCost[from])
+            {
+                bestCost[from] = cost;
+                bestTarget[from] = to;
+            }
+        }
+
+        // vertex -> triangle and position -> used vertex tables of the current triangles
+        void buildAdjacency()
+        {
+            size_t vertexCount = positions.size();
+            adjacencyOffset.assign(vertexCount + 1, 0);
+            for (unsigned int v : triangles)
+                adjacencyOffset[v + 1]++;
+            for (size_t v = 0; v < vertexCount; v++)
+                adjacencyOffset[v + 1] += adjacencyOffset[v];
+            adjacency.resize(triangles.size());
+            std::vector<unsigned int> fill(adjacencyOffset.begin(), adjacencyOffset.end() - 1);
+            for (size_t i = 0; i < triangles.size(); i++)
+                adjacency[fill[triangles[i]]++] = (unsigned int)(i / 3);
+
+            copyOffset.assign(vertexCount + 1, 0);
+            for (size_t v = 0; v < vertexCount; v++)
+                if (adjacencyOffset[v + 1] > adjacencyOffset[v])
+                    copyOffset[remap[v] + 1]++;
+            for (size_t v = 0; v < vertexCount; v++)
+                copyOffset[v + 1] += copyOffset[v];
+            copies.resize(copyOffset[vertexCount]);
+            fill.assign(copyOffset.begin(), copyOffset.end() - 1);
+            for (size_t v = 0; v < vertexCount; v++)
+                if (adjacencyOffset[v + 1] > adjacencyOffset[v])
+                    copies[fill[remap[v]]++] = (unsigned int)v;
+        }
+
+        // Moves every copy of 'from' onto the copy of 'to' it shares a triangle with, so uvs and normals stay in
+        // their chart. Returns the number of triangles removed, 0 when the collapse isn't allowed.
+        size_t tryCollapse(unsigned int from, unsigned int to)
+        {
+            size_t removed = 0;
+            partners.clear();
+            for (unsigned int c = copyOffset[from]; c < copyOffset[from + 1]; c++)
+            {
+                unsigned int vertex = copies[c];
+                unsigned int partner = ~0u;
+                for (unsigned int a = adjacencyOffset[vertex]; a < adjacencyOffset[vertex + 1]; a++)
+                {
+                    const unsigned int *triangle = &triangles[adjacency[a] * 3];
+                    bool collapsing = false;
+                    for (int k = 0; k < 3; k++)
+                        if (remap[triangle[k]] == to)
+                        {
+                            // a copy next to two different copies of 'to' would have to pick a side
+                            if (partner != ~0u && partner != triangle[k])
+                                return 0;
+                            partner = triangle[k];
+                            collapsing = true;
+                        }
+                    if (collapsing)
+                    {
+                        removed++;
+                        continue;
+                    }
+                    // the triangle survives with 'from' moved to 'to': it must not flip or turn too far
+                    glm::vec3 p[3], moved[3];
+                    for (int k = 0; k < 3; k++)
+                    {
+                        p[k] = positions[triangle[k]];
+                        moved[k] = triangle[k] == vertex ? positions[to] : p[k];
+                    }
+                    glm::vec3 before = glm::cross(p[1] - p[0], p[2] - p[0]);
+                    glm::vec3 after = glm::cross(moved[1] - moved[0], moved[2] - moved[0]);
+                    float lengths = glm::length(before) * glm::length(after);
+                    if (lengths == 0.0f || glm::dot(before, after) < MIN_NORMAL_COSINE * lengths)
+                        return 0;
+                }
+                if (partner == ~0u)
+                    return 0;
+                partners.push_back(partner);
+            }
+            if (removed == 0)
+                return 0;
+
+            for (unsigned int c = copyOffset[from]; c < copyOffset[from + 1]; c++)
+                collapseTo[copies[c]] = partners[c - copyOffset[from]];
+
+            quadrics[to] += quadrics[from];
+            locked[from] = 1;
+            locked[to] = 1;
+            for (unsigned int c = copyOffset[from]; c < copyOffset[from + 1]; c++)
+            {
+                unsigned int vertex = copies[c];
+                for (unsigned int a = adjacencyOffset[vertex]; a < adjacencyOffset[vertex + 1]; a++)
+                    for (int k = 0; k < 3; k++)
+                        locked[remap[triangles[adjacency[a] * 3 + k]]] = 1;
+            }
+            return removed;
+        }
+    };
+};
+
+// Picks LODs from the projected size of a bounding sphere: a level's error is a fraction of the sphere's radius,
+// so on screen it covers that fraction of the projected radius. The coarsest level whose error stays below
+// pixelError pixels wins. A level is only left once its error is 'hysteresis' (as a fraction of pixelError) past the
+// threshold, so an object resting near a switching distance doesn't pop back and forth.
+struct LodSelector {
+    glm::vec3 cameraPosition = glm::vec3(0.0f);
+    float pixelsPerUnit = 0.0f; // projected size of one unit at distance one: viewportHeight / (2 tan(fovY / 2))
+    float pixelError = 1.0f;
+    float hysteresis = 0.25f;
+
+    // fovY in radians, e.g. glm::radians(camera.Zoom)
+    static LodSelector perspective(const glm::vec3 &cameraPosition, float fovY, float viewportHeight, float pixelError = 1.0f)
+    {
+        LodSelector selector;
+        selector.cameraPosition = cameraPosition;
+        selector.pixelsPerUnit = viewportHeight / (2.0f * std::tan(fovY * 0.5f));
+        selector.pixelError = pixelError;
+        return selector;
+    }
+
+    // projected radius in pixels of a world space sphere; FLT_MAX when the camera is inside it
+    float projectedRadius(const glm::vec3 &center, float radius) const
+    {
+        float distance = glm::length(center - cameraPosition);
+        if (distance <= radius)
+            return FLT_MAX;
+        return radius * pixelsPerUnit / distance;
+    }
+
+    // the level to draw out of 'count', given the one drawn last frame. errorOf(level) is the level's error in the
+    // same units as radius and must grow with the level.
+    template <typename F>
+    unsigned int select(unsigned int count, float projectedRadius, float radius, unsigned int current, F errorOf) const
+    {
+        if (count <= 1 || projectedRadius == FLT_MAX || radius <= 0.0f)
+            return 0;
+        auto errorPixels = [&](unsigned int level) { return errorOf(level) / radius * projectedRadius; };
+        auto coarsest = [&](float threshold) {
+            unsigned int level = 0;
+            while (level + 1 < count && errorPixels(level + 1) <= threshold)
+                level++;
+            return level;
+        };
+        current = std::min(current, count - 1);
+        if (errorPixels(current) > pixelError * (1.0f + hysteresis))
+            return coarsest(pixelError);
+        return std::max(current, coarsest(pixelError * (1.0f - hysteresis)));
+    }
+};
+#endif
@@ -0,0 +1,226 @@
+#ifndef MIP_FILTER_H
+#define MIP_FILTER_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// integer SSE2 only: AVX without AVX2 has no 256 bit integer instructions, so AVX builds use the same
+// (VEX encoded) 128 bit path
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIP_FILTER_SIMD 1
+#else
+#define MIP_FILTER_SIMD 0
+#endif
+
+// 2x2 box filter for mip chains. The colour channels of sRGB images are averaged in linear space: averaging the
+// encoded bytes darkens every level, which shows up as textures getting darker and muddier with distance. Alpha
+// and linear data (normal, specular and height maps) are averaged as stored. Pure CPU code, safe from any thread.
+//
+// Everything is integer math: sRGB bytes are decoded to 14 bit linear values through a table, so the sum of four
+// still fits 16 bits, and the rounded average indexes a second table that encodes it back to sRGB. A level is
+// filtered a row pair at a time: the rows are added vertically into 16 bit sums (8 texel channels per SSE2 add),
+// then neighbouring sums are added horizontally, 2 texels per vector for 4 channel images and 8 for 1 channel ones.
+class MipFilter
+{
+public:
+    // filters src (srcW x srcH) into dst, which is levelSize(srcW) x levelSize(srcH). Odd edges drop the last
+    // row or column; a 1 texel wide or high level reuses it.
+    static void downsample(const unsigned char *src, int srcW, int srcH, unsigned char *dst, int components, bool srgb)
+    {
+        // constant channel counts let the compiler unroll the per texel loops and pick the tables up front;
+        // only 3 and 4 channel images have sRGB channels
+        if (components == 1)
+            downsampleRows<1, false>(src, srcW, srcH, dst);
+        else if (components == 2)
+            downsampleRows<2, false>(src, srcW, srcH, dst);
+        else if (components == 3)
+            srgb ? downsampleRows<3, true>(src, srcW, srcH, dst) : downsampleRows<3, false>(src, srcW, srcH, dst);
+        else
+            srgb ? downsampleRows<4, true>(src, srcW, srcH, dst) : downsampleRows<4, false>(src, srcW, srcH, dst);
+    }
+
+    // the same filter one value at a time, which the bench compares downsample against
+    static void downsampleReference(const unsigned char *src, int srcW, int srcH, unsigned char *dst, int components, bool srgb)
+    {
+        const Tables &tables = getTables();
+        int c = components;
+        int dstW = levelSize(srcW), dstH = levelSize(srcH);
+        for (int y = 0; y < dstH; y++)
+        {
+            const unsigned char *row0 = src + (size_t)std::min(2 * y, srcH - 1) * srcW * c;
+            const unsigned char *row1 = src + (size_t)std::min(2 * y + 1, srcH - 1) * srcW * c;
+            for (int x = 0; x < dstW; x++)
+            {
+                int x0 = std::min(2 * x, srcW - 1) * c;
+                int x1 = std::min(2 * x + 1, srcW - 1) * c;
+                for (int k = 0; k < c; k++)
+                {
+                    bool srgbChannel = isSrgbChannel(srgb, c, k);
+                    const uint16_t *decode = srgbChannel ? tables.toLinear : tables.identity;
+                    int total = decode[row0[x0 + k]] + decode[row1[x0 + k]] + decode[row0[x1 + k]] + decode[row1[x1 + k]];
+                    dst[((size_t)y * dstW + x) * c + k] = encode(tables, (total + 2) >> 2, srgbChannel);
+                }
+            }
+        }
+    }
+
+    static int levelSize(int size) { return size > 1 ? size / 2 : 1; }
+
+    static float srgbToLinear(float s)
+    {
+        return s <= 0.04045f ? s / 12.92f : std::pow((s + 0.055f) / 1.055f, 2.4f);
+    }
+
+    static float linearToSrgb(float l)
+    {
+        return l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+    }
+
+private:
+    // largest 14 bit linear value; fine enough that even the darkest sRGB bytes (where the curve is steepest)
+    // survive a round trip
+    static const int LINEAR_MAX = 16383;
+
+    struct Tables {
+        uint16_t toLinear[256];                 // sRGB byte -> 14 bit linear
+        uint16_t identity[256];                 // byte -> byte, for linear channels
+        unsigned char toSrgb[LINEAR_MAX + 1];   // 14 bit linear -> sRGB byte
+    };
+
+    static const Tables &getTables()
+    {
+        static const Tables tables = [] {
+            Tables t;
+            for (int i = 0; i < 256; i++)
+            {
+                t.identity[i] = (uint16_t)i;
+                t.toLinear[i] = (uint16_t)std::lround(srgbToLinear(i / 255.0f) * LINEAR_MAX);
+            }
+            for (int i = 0; i <= LINEAR_MAX; i++)
+                t.toSrgb[i] = (unsigned char)std::lround(std::min(1.0f, linearToSrgb((float)i / LINEAR_MAX)) * 255.0f);
+            return t;
+        }();
+        return tables;
+    }
+
+    // alpha and the channels of grey and grey+alpha images are never sRGB
+    static bool isSrgbChannel(bool srgb, int components, int channel)
+    {
+        return srgb && components >= 3 && channel < 3;
+    }
+
+    static unsigned char encode(const Tables &tables, int average, bool srgb)
+    {
+        return srgb ? tables.toSrgb[average] : (unsigned char)average;
+    }
+
+    // downsample() for C channels, the colour ones sRGB if SRGB
+    template <int C, bool SRGB>
+    static void downsampleRows(const unsigned char *src, int srcW, int srcH, unsigned char *dst)
+    {
+        const Tables &tables = getTables();
+        int dstW = levelSize(srcW), dstH = levelSize(srcH);
+        size_t rowValues = (size_t)srcW * C;
+        std::vector<uint16_t> sum(rowValues);
+        for (int y = 0; y < dstH; y++)
+        {
+            const unsigned char *row0 = src + (size_t)std::min(2 * y, srcH - 1) * rowValues;
+            const unsigned char *row1 = src + (size_t)std::min(2 * y + 1, srcH - 1) * rowValues;
+            if (SRGB)
+            {
+                // no gather before AVX2: the table lookups stay scalar. SRGB implies 3 or 4 channels.
+                const uint16_t *toLinear = tables.toLinear;
+                for (size_t i = 0; i < rowValues; i += C)
+                {
+                    sum[i] = (uint16_t)(toLinear[row0[i]] + toLinear[row1[i]]);
+                    sum[i + 1] = (uint16_t)(toLinear[row0[i + 1]] + toLinear[row1[i + 1]]);
+                    sum[i + 2] = (uint16_t)(toLinear[row0[i + 2]] + toLinear[row1[i + 2]]);
+                    if (C == 4)
+                        sum[i + 3] = (uint16_t)(row0[i + 3] + row1[i + 3]);
+                }
+            }
+            else
+                addRows(row0, row1, sum.data(), rowValues);
+
+            unsigned char *out = dst + (size_t)y * dstW * C;
+            int x = 0;
+#if MIP_FILTER_SIMD
+            // the pair of a 1 texel wide level is that texel twice, which only the scalar loop handles
+            if (srcW > 1)
+                x = averagePairs(tables, sum.data(), out, dstW, C, SRGB);
+#endif
+            for (; x < dstW; x++)
+            {
+                const uint16_t *a = sum.data() + (size_t)std::min(2 * x, srcW - 1) * C;
+                const uint16_t *b = sum.data() + (size_t)std::min(2 * x + 1, srcW - 1) * C;
+                for (int k = 0; k < C; k++)
+                    out[(size_t)x * C + k] = encode(tables, (a[k] + b[k] + 2) >> 2, isSrgbChannel(SRGB, C, k));
+            }
+        }
+    }
+
+    // sum[i] = row0[i] + row1[i]
+    static void addRows(const unsigned char *row0, const unsigned char *row1, uint16_t *sum, size_t count)
+    {
+        size_t i = 0;
+#if MIP_FILTER_SIMD
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 16 <= count; i += 16)
+        {
+            __m128i a = _mm_loadu_si128((const __m128i *)(row0 + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(row1 + i));
+            _mm_storeu_si128((__m128i *)(sum + i), _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)));
+            _mm_storeu_si128((__m128i *)(sum + i + 8), _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)));
+        }
+#endif
+        for (; i < count; i++)
+            sum[i] = (uint16_t)(row0[i] + row1[i]);
+    }
+
+#if MIP_FILTER_SIMD
+    // writes the averages of texel pairs (2x, 2x + 1) of a row of vertical sums for as many texels x as the vector
+    // paths cover and returns the first one left to the caller
+    static int averagePairs(const Tables &tables, const uint16_t *sum, unsigned char *out, int dstW, int c, bool srgb)
+    {
+        int x = 0;
+        const __m128i round = _mm_set1_epi16(2);
+        if (c == 4)
+        {
+            // two source texel pairs per iteration: [p0 p1] [p2 p3] -> [p0+p1 p2+p3]
+            for (; x + 2 <= dstW; x += 2)
+            {
+                __m128i a = _mm_loadu_si128((const __m128i *)(sum + (size_t)x * 8));
+                __m128i b = _mm_loadu_si128((const __m128i *)(sum + (size_t)x * 8 + 8));
+                __m128i average = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi64(a, b), _mm_unpackhi_epi64(a, b)), round), 2);
+                unsigned char *texels = out + (size_t)x * 4;
+                if (!srgb)
+                {
+                    _mm_storel_epi64((__m128i *)texels, _mm_packus_epi16(average, average));
+                    continue;
+                }
+                alignas(16) uint16_t index[8];
+                _mm_store_si128((__m128i *)index, average);
+                for (int k = 0; k < 8; k++)
+                    texels[k] = (k & 3) == 3 ? (unsigned char)index[k] : tables.toSrgb[index[k]];
+            }
+        }
+        else if (c == 1)
+        {
+            // eight texels per iteration: madd adds neighbouring 16 bit sums (at most 510 each) into 32 bits
+            const __m128i ones = _mm_set1_epi16(1);
+            for (; x + 8 <= dstW; x += 8)
+            {
+                __m128i a = _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(sum + (size_t)x * 2)), ones);
+                __m128i b = _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(sum + (size_t)x * 2 + 8)), ones);
+                __m128i average = _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(a, b), round), 2);
+                _mm_storel_epi64((__m128i *)(out + x), _mm_packus_epi16(average, average));
+            }
+        }
+        return x;
+    }
+#endif
+};
+#endif
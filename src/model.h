@@ -12,94 +12,188 @@
 #include <assimp/postprocess.h>
 
 #include "mesh.h"
+#include "mesh_optimizer.h"
+#include "model_cache.h"
 #include "shader.h"
+#include "texture_cache.h"
+#include "texture_loader.h"
 
 #include <stdio.h>
+#include <chrono>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <map>
+#include <unordered_map>
 #include <vector>
 using namespace std;
 
 unsigned int TextureFromFile(const char *path, const string &directory, bool gamma = false);
 
+// Assimp post-processing applied on import. Part of the model cache key, so changing it invalidates old caches.
+const unsigned int MODEL_IMPORT_FLAGS = aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace;
+
+// Our own stages run on the imported streams before upload; also part of the model cache key.
+enum ModelProcessFlags {
+    MODEL_PROCESS_OPTIMIZE = 1 << 0, // vertex cache, overdraw and vertex fetch reordering (mesh_optimizer.h)
+    MODEL_PROCESS_LODS     = 1 << 1  // simplified levels of detail per mesh (mesh_simplifier.h)
+};
+
+// everything about how a model is loaded, apart from its path and gamma
+struct ModelLoadOptions {
+    bool useCache = true;        // store the imported streams in a binary cache next to the model and reuse them
+    bool flipTextures = true;    // flip textures vertically on load
+    bool optimizeMeshes = true;  // run the MeshOptimizer passes on every mesh
+    bool generateLods = true;    // build up to MAX_MESH_LODS levels of detail per mesh
+    bool compressTextures = false; // block compress colour and normal maps (BC1/BC3/BC5) where the GL supports it
+
+    unsigned int processFlags() const
+    {
+        return (optimizeMeshes ? MODEL_PROCESS_OPTIMIZE : 0) | (generateLods ? MODEL_PROCESS_LODS : 0);
+    }
+};
+
+// triangles submitted by the last LOD draw, and what the full detail meshes would have cost
+struct LodStats {
+    unsigned int fullTriangles = 0;
+    unsigned int submittedTriangles = 0;
+    unsigned int meshesPerLevel[MAX_MESH_LODS] = {0};
+};
+
+// a node of the imported hierarchy. Meshes are stored in pre-order, so a node's subtree is the mesh range
+// [firstMesh, meshEnd). Node transforms are not applied (all meshes share the model space).
+struct ModelNode {
+    Bounds bounds;
+    unsigned int firstMesh;
+    unsigned int meshEnd;
+};
+
 class Model 
 {
 public:
     // model data 
-    vector<Texture> textures_loaded;	// stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once.
+    vector<Texture> textures_loaded;	// every texture this model holds a TextureCache reference on, each one once.
     vector<Mesh>    meshes;
+    vector<ModelNode> nodes;            // nodes[0] is the root, its bounds cover the whole model
+    CullingStats    cullingStats;       // of the last culled Draw
+    LodStats        lodStats;           // of the last LOD Draw
     string directory;
     bool gammaCorrection;
+    ModelLoadOptions options;
 
     // constructor, expects a filepath to a 3D model.
-    Model(string const &path, bool gamma = false) : gammaCorrection(gamma)
+    Model(string const &path, bool gamma = false, ModelLoadOptions options = ModelLoadOptions()) : gammaCorrection(gamma), options(options)
     {
         loadModel(path);
     }
 
-    // draws the model, and thus all its meshes
+    // textures are shared through the TextureCache, so a model owns references and can't be copied. Moving out
+    // leaves the source empty; move assignment would have to release the target's meshes and references first,
+    // and nothing needs it.
+    Model(const Model &) = delete;
+    Model &operator=(const Model &) = delete;
+    Model(Model &&) = default;
+    Model &operator=(Model &&) = delete;
+
+    ~Model()
+    {
+        for (Mesh &mesh : meshes)
+            mesh.release();
+        for (const Texture &texture : textures_loaded)
+            TextureCache::shared().release(texture.id);
+    }
+
+    // draws the model, and thus all its meshes. Runs of meshes that share textures and an arena pool
+    // go out as a single multi-draw.
     void Draw(Shader &shader)
     {
-        for(unsigned int i = 0; i < meshes.size(); i++)
-            meshes[i].Draw(shader);
+        Draw(shader, drawList);
+        drawList.flush();
+        glActiveTexture(GL_TEXTURE0);
     }
-    
-private:
-    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
-    void loadModel(string const &path)
+
+    // queues the model on a caller owned draw list, so meshes of several models can share multi-draws.
+    // The caller flushes the list.
+    void Draw(Shader &shader, ArenaDrawList &drawList)
     {
-        std::cout << "[mesh.h] Loading model: " << path << "..." << std::endl;
-        // read file via ASSIMP
-        Assimp::Importer importer;
-        const aiScene* scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_GenSmoothNormals | aiProcess_FlipUVs | aiProcess_CalcTangentSpace);
-        // check for errors
-        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+        for(unsigned int i = 0; i < meshes.size(); i++)
         {
-            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
-            return;
+            if (i == 0 || !meshes[i].sameTextures(meshes[i - 1]))
+            {
+                drawList.flush();
+                meshes[i].bindTextures(shader);
+            }
+            meshes[i].addTo(drawList);
         }
-        // retrieve the directory path of the filepath
-        directory = path.substr(0, path.find_last_of('/'));
-
-        // process ASSIMP's root node recursively
-        processNode(scene->mRootNode, scene);
-        
-        printf("[mesh.h] Model loaded successfully! (%zu meshes)\n", meshes.size());
     }
 
-    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
-    void processNode(aiNode *node, const aiScene *scene)
+    // draws one copy of the model per instance in the buffer, every mesh with the INSTANCED permutation for its
+    // material features plus frameFeatures
+    void DrawInstanced(ShaderPermutations &permutations, uint32_t frameFeatures, const InstanceBuffer &instances)
     {
-        // process each mesh located at the current node
-        for(unsigned int i = 0; i < node->mNumMeshes; i++)
+        for (Mesh &mesh : meshes)
         {
-            // the node object only contains indices to index the actual objects in the scene. 
-            // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
-            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
-            meshes.push_back(processMesh(mesh, scene));
-        }
-        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
-        for(unsigned int i = 0; i < node->mNumChildren; i++)
-        {
-            processNode(node->mChildren[i], scene);
+            Shader &shader = permutations.get(mesh.shaderFeatures | frameFeatures | SHADER_INSTANCED);
+            shader.use();
+            mesh.DrawInstanced(shader, instances);
         }
+    }
 
+    // queues every mesh on a render queue, drawn with the given ObjectUniformBuffer slot. depth is the model's
+    // view space distance, used for the queue's front-to-back ordering.
+    void Draw(Shader &shader, RenderQueue &queue, int objectSlot, float depth, bool translucent = false) const
+    {
+        for (const Mesh &mesh : meshes)
+            mesh.enqueue(queue, shader.ID, objectSlot, depth, translucent);
     }
 
-    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    // queues only the meshes inside the view frustum. The frustum is extracted from viewProjection * model,
+    // so the model space bounds are tested without transforming them. Counts end up in cullingStats.
+    void Draw(Shader &shader, RenderQueue &queue, int objectSlot, float depth, const glm::mat4 &viewProjection, const glm::mat4 &model, bool translucent = false)
     {
-        // data to fill
-        vector<Vertex> vertices;
-        vector<unsigned int> indices;
-        vector<Texture> textures;
+        cullMeshes(viewProjection * model);
+        for (uint32_t i : visibleMeshes)
+            meshes[i].enqueue(queue, shader.ID, objectSlot, depth, translucent);
+    }
+
+    // culled Draw that also picks every visible mesh's level of detail from its projected size. The levels are
+    // kept between frames for the selector's hysteresis, so this suits a model placed once per frame; placing it
+    // several times only costs some extra level switches. Triangle counts end up in lodStats.
+    void Draw(Shader &shader, RenderQueue &queue, int objectSlot, float depth, const glm::mat4 &viewProjection, const glm::mat4 &model, const LodSelector &selector, bool translucent = false)
+    {
+        enqueueLods([&](const Mesh &) { return shader.ID; }, queue, objectSlot, depth, viewProjection, model, selector, translucent);
+    }
+
+    // the same with every mesh drawn by the permutation for its material features plus frameFeatures (the light
+    // count, see ShaderPermutations::lights)
+    void Draw(ShaderPermutations &permutations, uint32_t frameFeatures, RenderQueue &queue, int objectSlot, float depth, const glm::mat4 &viewProjection, const glm::mat4 &model, const LodSelector &selector, bool translucent = false)
+    {
+        enqueueLods([&](const Mesh &mesh) { return permutations.program(mesh.shaderFeatures | frameFeatures); }, queue, objectSlot, depth, viewProjection, model, selector, translucent);
+    }
+
+    void printLodStats() const
+    {
+        printf("[mesh.h] LOD: %u -> %u triangles submitted (%.1f%%), meshes per level:", lodStats.fullTriangles, lodStats.submittedTriangles,
+               lodStats.fullTriangles ? 100.0 * lodStats.submittedTriangles / lodStats.fullTriangles : 100.0);
+        for (unsigned int level = 0; level < MAX_MESH_LODS; level++)
+            printf(" %u", lodStats.meshesPerLevel[level]);
+        printf("\n");
+    }
+    
+    // the GL free part of processMesh: copies an Assimp mesh's vertices (with bone weights when skinned) and
+    // triangle indices into the renderer's format. Public for the micro-benchmarks.
+    static void extractMesh(const aiMesh *mesh, vector<Vertex> &vertices, vector<unsigned int> &indices)
+    {
+        vertices.clear();
+        indices.clear();
+        vertices.reserve(mesh->mNumVertices);
+        indices.reserve((size_t)mesh->mNumFaces * 3);
 
         // walk through each of the mesh's vertices
         for(unsigned int i = 0; i < mesh->mNumVertices; i++)
         {
-            Vertex vertex;
+            Vertex vertex = {};
             glm::vec3 vector; // we declare a placeholder vector since assimp uses its own vector class that doesn't directly convert to glm's vec3 class so we transfer the data to this placeholder glm::vec3 first.
             // positions
             vector.x = mesh->mVertices[i].x;
@@ -139,71 +233,388 @@ private:
 
             vertices.push_back(vertex);
         }
+        // bone influences, only present on skinned meshes
+        if (mesh->HasBones())
+            extractBoneWeights(vertices, mesh);
         // now wak through each of the mesh's faces (a face is a mesh its triangle) and retrieve the corresponding vertex indices.
         for(unsigned int i = 0; i < mesh->mNumFaces; i++)
         {
-            aiFace face = mesh->mFaces[i];
+            const aiFace &face = mesh->mFaces[i];
             // retrieve all indices of the face and store them in the indices vector
             for(unsigned int j = 0; j < face.mNumIndices; j++)
                 indices.push_back(face.mIndices[j]);        
         }
-        // process materials
-        aiMaterial* material = scene->mMaterials[mesh->mMaterialIndex];    
+    }
+
+    // lists the texture files of a material, in the order they are bound. GL free, so the streaming loader can
+    // call it on a worker thread. Public for the micro-benchmarks.
+    static void materialTextures(const aiMaterial *material, vector<ModelCache::TextureRef> &textures)
+    {
         // we assume a convention for sampler names in the shaders. Each diffuse texture should be named
         // as 'texture_diffuseN' where N is a sequential number ranging from 1 to MAX_SAMPLER_NUMBER. 
         // Same applies to other texture as the following list summarizes:
         // diffuse: texture_diffuseN
         // specular: texture_specularN
         // normal: texture_normalN
+        // height: texture_heightN
+        const pair<aiTextureType, const char *> types[] = {
+            {aiTextureType_DIFFUSE, "texture_diffuse"},
+            {aiTextureType_SPECULAR, "texture_specular"},
+            {aiTextureType_HEIGHT, "texture_normal"},
+            {aiTextureType_AMBIENT, "texture_height"},
+        };
+        for (const auto &type : types)
+        {
+            for(unsigned int i = 0; i < material->GetTextureCount(type.first); i++)
+            {
+                aiString str;
+                material->GetTexture(type.first, i, &str);
+                textures.push_back({type.second, str.C_Str()});
+            }
+        }
+    }
 
-        // 1. diffuse maps
-        vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-        textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-        // 2. specular maps
-        vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-        textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
-        // 3. normal maps
-        std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-        textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
-        // 4. height maps
-        std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-        textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
-        
-        // return a mesh object created from the extracted mesh data
-        return Mesh(vertices, indices, textures);
+private:
+    // ModelStreamer fills models in mesh by mesh, see model_streamer.h
+    friend class ModelStreamer;
+
+    // an empty model, for ModelStreamer to fill in
+    Model(bool gamma, ModelLoadOptions options, const string &directory) : directory(directory), gammaCorrection(gamma), options(options)
+    {
     }
 
-    // checks all material textures of a given type and loads the textures if they're not loaded yet.
-    // the required info is returned as a Texture struct.
-    vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, string typeName)
+    // body of the LOD selecting Draws; programFor returns the program a mesh is drawn with
+    template <typename ProgramFor>
+    void enqueueLods(const ProgramFor &programFor, RenderQueue &queue, int objectSlot, float depth, const glm::mat4 &viewProjection, const glm::mat4 &model, const LodSelector &selector, bool translucent)
     {
+        cullMeshes(viewProjection * model);
+        lodStats = LodStats();
+        meshLods.resize(meshes.size(), 0);
+        for (uint32_t i : visibleMeshes)
+        {
+            unsigned int lod = meshes[i].selectLod(selector, model, meshLods[i]);
+            meshLods[i] = (unsigned char)lod;
+            meshes[i].enqueue(queue, programFor(meshes[i]), objectSlot, depth, translucent, lod);
+            lodStats.fullTriangles += meshes[i].triangleCount(0);
+            lodStats.submittedTriangles += meshes[i].triangleCount(lod);
+            lodStats.meshesPerLevel[lod]++;
+        }
+    }
+
+    ArenaDrawList drawList;
+    unordered_map<string, size_t> textureIndex; // material path -> index into textures_loaded
+    double coldLoadMs = 0.0;
+    CullingSet meshCulling;           // model space bounds of every mesh, in mesh order
+    vector<uint32_t> visibleMeshes;
+    vector<unsigned char> meshLods;   // level each mesh was drawn at last, for the LOD hysteresis
+
+    // fills visibleMeshes with the meshes inside the frustum of the given model-view-projection matrix
+    void cullMeshes(const glm::mat4 &modelViewProjection)
+    {
+        Frustum frustum = Frustum::fromMatrix(modelViewProjection);
+        visibleMeshes.clear();
+        // whole model outside: one test instead of one per mesh
+        if (!nodes.empty() && !frustum.intersects(nodes[0].bounds))
+        {
+            cullingStats.tested = 1;
+            cullingStats.visible = 0;
+            cullingStats.culled = (unsigned int)meshes.size();
+            return;
+        }
+        meshCulling.cull(frustum, visibleMeshes);
+        cullingStats = meshCulling.stats;
+    }
+
+    // loads a model with supported ASSIMP extensions from file and stores the resulting meshes in the meshes vector.
+    void loadModel(string const &path)
+    {
+        PROFILE_ZONE("Model::loadModel");
+        std::cout << "[mesh.h] Loading model: " << path << "..." << std::endl;
+        auto start = std::chrono::steady_clock::now();
+        // retrieve the directory path of the filepath
+        directory = path.substr(0, path.find_last_of('/'));
+
+        // warm start: upload the cached streams without touching Assimp
+        if (options.useCache && loadFromCache(path))
+        {
+            buildBounds();
+            TextureCache::shared().flush();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            printf("[mesh.h] Model loaded from cache! (%zu meshes, warm %.2f ms, cold was %.2f ms)\n", meshes.size(), ms, coldLoadMs);
+            printVertexStats();
+            return;
+        }
+
+        // read file via ASSIMP
+        Assimp::Importer importer;
+        const aiScene* scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
+        // check for errors
+        if(!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) // if is Not Zero
+        {
+            cout << "ERROR::ASSIMP:: " << importer.GetErrorString() << endl;
+            return;
+        }
+
+        // process ASSIMP's root node recursively
+        processNode(scene->mRootNode, scene);
+        buildBounds();
+        // the meshes are built, now wait for the decoders and upload their results
+        TextureCache::shared().flush();
+
+        coldLoadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        printf("[mesh.h] Model loaded successfully! (%zu meshes, cold %.2f ms)\n", meshes.size(), coldLoadMs);
+        printVertexStats();
+
+        if (options.useCache)
+            writeCache(path);
+    }
+
+    // node bounds from the mesh bounds, and the SoA copy of the mesh bounds the culled Draw tests
+    void buildBounds()
+    {
+        if (nodes.empty())
+            nodes.push_back({Bounds(), 0, (unsigned int)meshes.size()});
+        for (ModelNode &node : nodes)
+        {
+            node.bounds = Bounds();
+            for (unsigned int i = node.firstMesh; i < node.meshEnd; i++)
+                node.bounds = node.bounds.merged(meshes[i].bounds);
+        }
+        meshCulling.clear();
+        for (const Mesh &mesh : meshes)
+            meshCulling.add(mesh.bounds);
+    }
+
+    // compares the packed vertex and index buffers against uploading the full Vertex struct and 32-bit indices
+    void printVertexStats() const
+    {
+        size_t vertexCount = 0, packedBytes = 0;
+        for (const Mesh &mesh : meshes)
+        {
+            vertexCount += mesh.vertexCount;
+            packedBytes += (size_t)mesh.vertexCount * mesh.layout.stride();
+        }
+        if (vertexCount == 0)
+            return;
+        size_t fullBytes = vertexCount * sizeof(Vertex);
+        printf("[mesh.h] Vertex data: %zu vertices, %zu -> %.1f bytes/vertex (%.1f KB -> %.1f KB, %.2fx smaller)\n",
+               vertexCount, sizeof(Vertex), (double)packedBytes / vertexCount, fullBytes / 1024.0, packedBytes / 1024.0, (double)fullBytes / packedBytes);
+
+        size_t indexCount = 0, indexBytes = 0, rangeCount = 0;
+        for (const Mesh &mesh : meshes)
+        {
+            indexCount += mesh.indexCount;
+            indexBytes += (size_t)mesh.indexCount * mesh.indexSize();
+            rangeCount += mesh.ranges.size();
+        }
+        printf("[mesh.h] Index data: %zu indices in %zu draw ranges, %.1f KB (%.1f KB as 32-bit)\n",
+               indexCount, rangeCount, indexBytes / 1024.0, indexCount * sizeof(unsigned int) / 1024.0);
+
+        // triangles of every level over all meshes; meshes with fewer levels count their coarsest one
+        unsigned int levels = 0;
+        for (const Mesh &mesh : meshes)
+            levels = std::max(levels, (unsigned int)mesh.lods.size());
+        if (levels > 1)
+        {
+            printf("[mesh.h] LODs:");
+            for (unsigned int level = 0; level < levels; level++)
+            {
+                size_t triangles = 0;
+                for (const Mesh &mesh : meshes)
+                    triangles += mesh.triangleCount(std::min(level, (unsigned int)mesh.lods.size() - 1));
+                printf(" %zu", triangles);
+            }
+            printf(" triangles\n");
+        }
+        GeometryArena::shared().printStats();
+    }
+
+    // rebuilds the meshes from a valid cache file; returns false when there is no usable cache
+    bool loadFromCache(string const &path)
+    {
+        MappedFile file;
+        if (!ModelCache::open(path, MODEL_IMPORT_FLAGS, options.processFlags(), file))
+            return false;
+
+        const ModelCacheHeader *header = ModelCache::getHeader(file);
+        const ModelCacheMesh *cachedMeshes = ModelCache::getMeshes(file);
+        const ModelCacheTexture *cachedTextures = ModelCache::getTextures(file);
+        const ModelCacheNode *cachedNodes = ModelCache::getNodes(file);
+        coldLoadMs = header->coldLoadMs;
+        for (uint32_t i = 0; i < header->nodeCount; i++)
+            nodes.push_back({Bounds(), cachedNodes[i].firstMesh, cachedNodes[i].meshEnd});
+
+        meshes.reserve(header->meshCount);
+        for (uint32_t i = 0; i < header->meshCount; i++)
+        {
+            const ModelCacheMesh &entry = cachedMeshes[i];
+            vector<Texture> textures;
+            for (uint32_t t = entry.firstTexture; t < entry.firstTexture + entry.textureCount; t++)
+                textures.push_back(loadTexture(ModelCache::getString(file, cachedTextures[t].pathOffset), ModelCache::getString(file, cachedTextures[t].typeOffset)));
+
+            VertexLayout layout;
+            layout.flags = entry.vertexLayout;
+            const MeshRange *ranges = ModelCache::getRanges(file) + entry.firstRange;
+            const MeshLod *lods = ModelCache::getLods(file) + entry.firstLod;
+            Bounds bounds;
+            bounds.center = glm::vec3(entry.boundsCenter[0], entry.boundsCenter[1], entry.boundsCenter[2]);
+            bounds.extent = glm::vec3(entry.boundsExtent[0], entry.boundsExtent[1], entry.boundsExtent[2]);
+            bounds.radius = entry.boundsRadius;
+            meshes.push_back(Mesh(file.data + entry.vertexOffset, entry.vertexCount, layout,
+                                  file.data + entry.indexOffset, entry.indexCount, entry.indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                                  vector<MeshRange>(ranges, ranges + entry.rangeCount), textures, bounds, vector<MeshLod>(lods, lods + entry.lodCount)));
+        }
+        return true;
+    }
+
+    // stores the freshly imported meshes so the next load can skip Assimp
+    void writeCache(string const &path)
+    {
+        vector<ModelCache::MeshSource> sources(meshes.size());
+        vector<vector<unsigned char>> packed(meshes.size());
+        vector<vector<uint16_t>> shortIndices(meshes.size());
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            VertexPacker::pack(meshes[i].vertices, meshes[i].layout, packed[i]);
+            sources[i].vertices = packed[i].data();
+            sources[i].vertexCount = meshes[i].vertices.size();
+            sources[i].layout = meshes[i].layout;
+            sources[i].indexCount = meshes[i].indices.size();
+            sources[i].indexSize = meshes[i].indexSize();
+            if (meshes[i].indexType == GL_UNSIGNED_SHORT)
+            {
+                shortIndices[i].assign(meshes[i].indices.begin(), meshes[i].indices.end());
+                sources[i].indices = shortIndices[i].data();
+            }
+            else
+                sources[i].indices = meshes[i].indices.data();
+            sources[i].ranges = meshes[i].ranges;
+            sources[i].lods = meshes[i].lods;
+            sources[i].bounds = meshes[i].bounds;
+            for (const Texture &texture : meshes[i].textures)
+                sources[i].textures.push_back({texture.type, texture.path});
+        }
+        vector<ModelCacheNode> cacheNodes;
+        for (const ModelNode &node : nodes)
+            cacheNodes.push_back({node.firstMesh, node.meshEnd});
+        if (!ModelCache::write(path, MODEL_IMPORT_FLAGS, options.processFlags(), sources, cacheNodes, coldLoadMs))
+            std::cout << "[mesh.h] Could not write model cache: " << ModelCache::cachePath(path) << std::endl;
+    }
+
+    // processes a node in a recursive fashion. Processes each individual mesh located at the node and repeats this process on its children nodes (if any).
+    void processNode(aiNode *node, const aiScene *scene)
+    {
+        size_t nodeIndex = nodes.size();
+        nodes.push_back({Bounds(), (unsigned int)meshes.size(), 0});
+        // process each mesh located at the current node
+        for(unsigned int i = 0; i < node->mNumMeshes; i++)
+        {
+            // the node object only contains indices to index the actual objects in the scene. 
+            // the scene contains all the data, node is just to keep stuff organized (like relations between nodes).
+            aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+            meshes.push_back(processMesh(mesh, scene));
+        }
+        // after we've processed all of the meshes (if any) we then recursively process each of the children nodes
+        for(unsigned int i = 0; i < node->mNumChildren; i++)
+        {
+            processNode(node->mChildren[i], scene);
+        }
+        nodes[nodeIndex].meshEnd = (unsigned int)meshes.size();
+
+    }
+
+    Mesh processMesh(aiMesh *mesh, const aiScene *scene)
+    {
+        // data to fill
+        vector<Vertex> vertices;
+        vector<unsigned int> indices;
         vector<Texture> textures;
-        for(unsigned int i = 0; i < mat->GetTextureCount(type); i++)
+        extractMesh(mesh, vertices, indices);
+        bool skinned = mesh->HasBones();
+
+        // process materials
+        vector<ModelCache::TextureRef> materialRefs;
+        materialTextures(scene->mMaterials[mesh->mMaterialIndex], materialRefs);
+        for (const ModelCache::TextureRef &ref : materialRefs)
+            textures.push_back(loadTexture(ref.path.c_str(), ref.type));
+        
+        // reorder triangles and vertices for the post-transform cache, overdraw and vertex fetch
+        if (options.optimizeMeshes)
         {
-            aiString str;
-            mat->GetTexture(type, i, &str);
-            // check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-            bool skip = false;
-            for(unsigned int j = 0; j < textures_loaded.size(); j++)
+            VertexCacheStats before, after;
+            MeshOptimizer::optimize(indices, vertices, &before, &after);
+            printf("[mesh_optimizer.h] Mesh %zu (%zu tris): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+                   meshes.size(), indices.size() / 3, before.acmr, after.acmr, before.atvr, after.atvr);
+        }
+
+        // return a mesh object created from the extracted mesh data, stored in the smallest layout that fits it
+        bool hasTangents = mesh->mTextureCoords[0] && mesh->mTangents;
+        return Mesh(vertices, indices, textures, VertexPacker::chooseLayout(vertices, hasTangents, skinned), options.generateLods ? MAX_MESH_LODS : 1);
+    }
+
+    // keeps the (up to) MAX_BONE_INFLUENCE strongest bones per vertex, indexed by their position in mesh->mBones
+    static void extractBoneWeights(vector<Vertex> &vertices, const aiMesh *mesh)
+    {
+        for(unsigned int boneIndex = 0; boneIndex < mesh->mNumBones; boneIndex++)
+        {
+            aiBone *bone = mesh->mBones[boneIndex];
+            for(unsigned int w = 0; w < bone->mNumWeights; w++)
             {
-                if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0)
+                Vertex &vertex = vertices[bone->mWeights[w].mVertexId];
+                float weight = bone->mWeights[w].mWeight;
+                // replace the weakest influence if this one is stronger
+                int slot = 0;
+                for(int k = 1; k < MAX_BONE_INFLUENCE; k++)
+                    if(vertex.m_Weights[k] < vertex.m_Weights[slot])
+                        slot = k;
+                if(weight > vertex.m_Weights[slot])
                 {
-                    textures.push_back(textures_loaded[j]);
-                    skip = true; // a texture with the same filepath has already been loaded, continue to next one. (optimization)
-                    break;
+                    vertex.m_BoneIDs[slot] = (int)boneIndex;
+                    vertex.m_Weights[slot] = weight;
                 }
             }
-            if(!skip)
-            {   // if texture hasn't been loaded already, load it
-                Texture texture;
-                texture.id = TextureFromFile(str.C_Str(), this->directory);
-                texture.type = typeName;
-                texture.path = str.C_Str();
-                textures.push_back(texture);
-                textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
-            }
         }
-        return textures;
+        // dropped influences would otherwise make the vertex shrink towards the origin
+        for(Vertex &vertex : vertices)
+        {
+            float total = 0.0f;
+            for(int k = 0; k < MAX_BONE_INFLUENCE; k++)
+                total += vertex.m_Weights[k];
+            if(total > 0.0f)
+                for(int k = 0; k < MAX_BONE_INFLUENCE; k++)
+                    vertex.m_Weights[k] /= total;
+        }
+    }
+
+    // returns the texture at the given (model relative) path. The first use within this model takes a reference
+    // in the process-wide TextureCache, which decodes the image in the background if no other model has it yet.
+    Texture loadTexture(const char *path, const string &typeName)
+    {
+        auto it = textureIndex.find(path);
+        if (it != textureIndex.end())
+            return textures_loaded[it->second];
+
+        Texture texture;
+        // only colour data is stored in sRGB; normal, height and specular maps hold linear values
+        bool gamma = gammaCorrection && typeName == "texture_diffuse";
+        texture.id = TextureCache::shared().acquire(this->directory + '/' + path, gamma, options.flipTextures, textureCompression(typeName));
+        texture.type = typeName;
+        texture.path = path;
+        textureIndex[texture.path] = textures_loaded.size();
+        textures_loaded.push_back(texture);  // store it as texture loaded for entire model, to ensure we won't unnecessary load duplicate textures.
+        return texture;
+    }
+
+    // height maps keep full precision: displacement shows the steps of a 4x4 block palette
+    TextureCompression textureCompression(const string &typeName) const
+    {
+        if (!options.compressTextures)
+            return TEXTURE_UNCOMPRESSED;
+        if (typeName == "texture_normal")
+            return TEXTURE_COMPRESS_NORMAL;
+        if (typeName == "texture_diffuse" || typeName == "texture_specular")
+            return TEXTURE_COMPRESS_COLOR;
+        return TEXTURE_UNCOMPRESSED;
     }
 };
 
@@ -216,34 +627,8 @@ unsigned int TextureFromFile(const char *path, const string &directory, bool gam
     unsigned int textureID;
     glGenTextures(1, &textureID);
 
-    int width, height, nrComponents;
-    unsigned char *data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if (data)
-    {
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-        stbi_image_free(data);
-    }
-    else
-    {
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
+    // synchronous version of the Model loader path: decode here, then upload
+    TextureLoader::upload(textureID, TextureLoader::decode(filename, true, -1, gamma), gamma);
 
     return textureID;
 }
@@ -0,0 +1,326 @@
+#ifndef MODEL_CACHE_H
+#define MODEL_CACHE_H
+
+#include "cache_file.h"
+#include "mapped_file.h"
+#include "mesh.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+// Binary cache of everything Model::loadModel produces from Assimp: the final vertex/index streams of every mesh
+// plus the material -> texture table. A cache file lives next to its source ("backpack.obj.meshcache") and is only
+// used when the source path hash, size, mtime, import/process flags and Vertex layout all still match the header.
+//
+// File layout (all offsets are absolute and 16 byte aligned so the mapped data can go straight to glBufferData):
+//   ModelCacheHeader
+//   ModelCacheMesh[meshCount]
+//   ModelCacheTexture[textureCount]
+//   MeshRange[rangeCount]
+//   ModelCacheNode[nodeCount]
+//   MeshLod[lodCount]
+//   string blob (texture types and paths, NUL terminated)
+//   vertex and index streams
+const uint32_t MODEL_CACHE_MAGIC   = 0x434D474C; // "LGMC"
+const uint32_t MODEL_CACHE_VERSION = 6;
+
+struct ModelCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;    // FNV-1a of the source path
+    uint64_t sourceSize;
+    int64_t  sourceMtime;
+    uint32_t importFlags;   // Assimp post-process flags used to build the streams
+    uint32_t processFlags;  // our own post-import stages (ModelProcessFlags) applied to the streams
+    uint32_t vertexStride;  // sizeof(Vertex) of the importer that wrote the cache
+    uint32_t lodCount;
+    uint32_t meshCount;
+    uint32_t textureCount;
+    uint32_t rangeCount;
+    uint32_t nodeCount;
+    uint64_t stringsOffset;
+    double   coldLoadMs;    // how long the Assimp path took, reported on warm loads
+};
+
+struct ModelCacheMesh {
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+    uint32_t vertexCount;
+    uint32_t indexCount;
+    uint32_t firstTexture;  // range into the ModelCacheTexture table
+    uint32_t textureCount;
+    uint32_t vertexLayout;  // VertexLayoutFlags of the packed vertex stream
+    uint32_t vertexStride;
+    uint32_t indexSize;     // 2 or 4 bytes per index
+    uint32_t firstRange;    // range into the MeshRange table
+    uint32_t rangeCount;
+    uint32_t firstLod;      // range into the MeshLod table, whose ranges are relative to firstRange
+    float    boundsCenter[3]; // model space Bounds of the mesh
+    float    boundsExtent[3];
+    float    boundsRadius;
+    uint32_t lodCount;
+};
+
+// a node of the import hierarchy as the range of meshes in its subtree (nodes are stored in pre-order)
+struct ModelCacheNode {
+    uint32_t firstMesh;
+    uint32_t meshEnd;
+};
+
+struct ModelCacheTexture {
+    uint32_t typeOffset;    // offsets into the string blob
+    uint32_t pathOffset;
+};
+
+class ModelCache
+{
+public:
+    // a texture reference as stored in the material table
+    struct TextureRef {
+        string type;
+        string path;
+    };
+
+    // a mesh as produced by the importer, ready to be serialized
+    struct MeshSource {
+        const unsigned char *vertices;  // packed with layout
+        size_t vertexCount;
+        VertexLayout layout;
+        const void *indices;
+        size_t indexCount;
+        unsigned int indexSize;         // 2 or 4
+        vector<MeshRange> ranges;
+        vector<MeshLod> lods;
+        vector<TextureRef> textures;
+        Bounds bounds;
+    };
+
+    static string cachePath(const string &sourcePath)
+    {
+        return sourcePath + ".meshcache";
+    }
+
+    // fills in the key fields of a header for the given source file; false if the source can't be stat'ed
+    static bool makeKey(const string &sourcePath, unsigned int importFlags, unsigned int processFlags, ModelCacheHeader &header)
+    {
+        CacheSourceKey source;
+        if (!CacheFile::sourceKey(sourcePath, source))
+            return false;
+
+        memset(&header, 0, sizeof(header));
+        header.magic = MODEL_CACHE_MAGIC;
+        header.version = MODEL_CACHE_VERSION;
+        header.sourceHash = source.hash;
+        header.sourceSize = source.size;
+        header.sourceMtime = source.mtime;
+        header.importFlags = importFlags;
+        header.processFlags = processFlags;
+        header.vertexStride = sizeof(Vertex);
+        return true;
+    }
+
+    // maps the cache of sourcePath and validates it against the current key. On success the returned
+    // pointers stay valid for as long as 'file' is kept open.
+    static bool open(const string &sourcePath, unsigned int importFlags, unsigned int processFlags, MappedFile &file)
+    {
+        ModelCacheHeader key;
+        if (!makeKey(sourcePath, importFlags, processFlags, key))
+            return false;
+        if (!file.open(cachePath(sourcePath)))
+            return false;
+
+        const ModelCacheHeader *header = getHeader(file);
+        bool valid = file.size >= sizeof(ModelCacheHeader) &&
+                     header->magic == key.magic &&
+                     header->version == key.version &&
+                     header->sourceHash == key.sourceHash &&
+                     header->sourceSize == key.sourceSize &&
+                     header->sourceMtime == key.sourceMtime &&
+                     header->importFlags == key.importFlags &&
+                     header->processFlags == key.processFlags &&
+                     header->vertexStride == key.vertexStride;
+        if (valid)
+        {
+            // make sure every table and stream the header points at lies inside the file
+            uint64_t tablesEnd = sizeof(ModelCacheHeader) + header->meshCount * sizeof(ModelCacheMesh) + header->textureCount * sizeof(ModelCacheTexture) + header->rangeCount * sizeof(MeshRange) + header->nodeCount * sizeof(ModelCacheNode) + header->lodCount * sizeof(MeshLod);
+            valid = tablesEnd <= header->stringsOffset && header->stringsOffset <= file.size;
+            for (uint32_t i = 0; valid && i < header->meshCount; i++)
+            {
+                const ModelCacheMesh &mesh = getMeshes(file)[i];
+                VertexLayout layout;
+                layout.flags = mesh.vertexLayout;
+                valid = mesh.vertexStride == layout.stride() &&
+                        mesh.vertexOffset + (uint64_t)mesh.vertexCount * mesh.vertexStride <= file.size &&
+                        (mesh.indexSize == 2 || mesh.indexSize == 4) &&
+                        mesh.indexOffset + (uint64_t)mesh.indexCount * mesh.indexSize <= file.size &&
+                        (uint64_t)mesh.firstTexture + mesh.textureCount <= header->textureCount &&
+                        (uint64_t)mesh.firstRange + mesh.rangeCount <= header->rangeCount &&
+                        (uint64_t)mesh.firstLod + mesh.lodCount <= header->lodCount;
+                for (uint32_t l = 0; valid && l < mesh.lodCount; l++)
+                {
+                    const MeshLod &lod = getLods(file)[mesh.firstLod + l];
+                    valid = (uint64_t)lod.firstRange + lod.rangeCount <= mesh.rangeCount;
+                }
+                for (uint32_t r = 0; valid && r < mesh.rangeCount; r++)
+                    valid = validRange(file, mesh, getRanges(file)[mesh.firstRange + r]);
+            }
+            // the string blob ends where the first stream starts
+            uint64_t stringsEnd = file.size;
+            for (uint32_t i = 0; valid && i < header->meshCount; i++)
+            {
+                const ModelCacheMesh &mesh = getMeshes(file)[i];
+                valid = mesh.vertexOffset >= header->stringsOffset && mesh.indexOffset >= header->stringsOffset;
+                stringsEnd = std::min(stringsEnd, std::min(mesh.vertexOffset, mesh.indexOffset));
+            }
+            for (uint32_t i = 0; valid && i < header->textureCount; i++)
+            {
+                const ModelCacheTexture &texture = getTextures(file)[i];
+                valid = validString(file, stringsEnd, texture.typeOffset) && validString(file, stringsEnd, texture.pathOffset);
+            }
+            for (uint32_t i = 0; valid && i < header->nodeCount; i++)
+            {
+                const ModelCacheNode &node = getNodes(file)[i];
+                valid = node.firstMesh <= node.meshEnd && node.meshEnd <= header->meshCount;
+            }
+        }
+        if (!valid)
+            file.close();
+        return valid;
+    }
+
+    static const ModelCacheHeader *getHeader(const MappedFile &file)
+    {
+        return (const ModelCacheHeader *)file.data;
+    }
+    static const ModelCacheMesh *getMeshes(const MappedFile &file)
+    {
+        return (const ModelCacheMesh *)(file.data + sizeof(ModelCacheHeader));
+    }
+    static const ModelCacheTexture *getTextures(const MappedFile &file)
+    {
+        return (const ModelCacheTexture *)(file.data + sizeof(ModelCacheHeader) + getHeader(file)->meshCount * sizeof(ModelCacheMesh));
+    }
+    static const MeshRange *getRanges(const MappedFile &file)
+    {
+        return (const MeshRange *)(getTextures(file) + getHeader(file)->textureCount);
+    }
+    static const ModelCacheNode *getNodes(const MappedFile &file)
+    {
+        return (const ModelCacheNode *)(getRanges(file) + getHeader(file)->rangeCount);
+    }
+    static const MeshLod *getLods(const MappedFile &file)
+    {
+        return (const MeshLod *)(getNodes(file) + getHeader(file)->nodeCount);
+    }
+    static const char *getString(const MappedFile &file, uint32_t offset)
+    {
+        return (const char *)(file.data + getHeader(file)->stringsOffset + offset);
+    }
+
+    // writes a new cache for sourcePath. Writes to a temporary file first so a crash never leaves a torn cache behind.
+    static bool write(const string &sourcePath, unsigned int importFlags, unsigned int processFlags, const vector<MeshSource> &meshes, const vector<ModelCacheNode> &nodes, double coldLoadMs)
+    {
+        ModelCacheHeader header;
+        if (!makeKey(sourcePath, importFlags, processFlags, header))
+            return false;
+
+        vector<ModelCacheMesh> meshTable(meshes.size());
+        vector<ModelCacheTexture> textureTable;
+        vector<MeshRange> rangeTable;
+        vector<MeshLod> lodTable;
+        string strings;
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            meshTable[i].firstRange = (uint32_t)rangeTable.size();
+            meshTable[i].rangeCount = (uint32_t)meshes[i].ranges.size();
+            rangeTable.insert(rangeTable.end(), meshes[i].ranges.begin(), meshes[i].ranges.end());
+            meshTable[i].firstLod = (uint32_t)lodTable.size();
+            meshTable[i].lodCount = (uint32_t)meshes[i].lods.size();
+            lodTable.insert(lodTable.end(), meshes[i].lods.begin(), meshes[i].lods.end());
+            for (int k = 0; k < 3; k++)
+            {
+                meshTable[i].boundsCenter[k] = meshes[i].bounds.center[k];
+                meshTable[i].boundsExtent[k] = meshes[i].bounds.extent[k];
+            }
+            meshTable[i].boundsRadius = meshes[i].bounds.radius;
+            meshTable[i].firstTexture = (uint32_t)textureTable.size();
+            meshTable[i].textureCount = (uint32_t)meshes[i].textures.size();
+            for (const TextureRef &ref : meshes[i].textures)
+            {
+                ModelCacheTexture entry;
+                entry.typeOffset = (uint32_t)strings.size();
+                strings.append(ref.type.c_str(), ref.type.size() + 1);
+                entry.pathOffset = (uint32_t)strings.size();
+                strings.append(ref.path.c_str(), ref.path.size() + 1);
+                textureTable.push_back(entry);
+            }
+        }
+
+        header.meshCount = (uint32_t)meshTable.size();
+        header.textureCount = (uint32_t)textureTable.size();
+        header.rangeCount = (uint32_t)rangeTable.size();
+        header.nodeCount = (uint32_t)nodes.size();
+        header.lodCount = (uint32_t)lodTable.size();
+        header.stringsOffset = sizeof(ModelCacheHeader) + meshTable.size() * sizeof(ModelCacheMesh) + textureTable.size() * sizeof(ModelCacheTexture) + rangeTable.size() * sizeof(MeshRange) + nodes.size() * sizeof(ModelCacheNode) + lodTable.size() * sizeof(MeshLod);
+        header.coldLoadMs = coldLoadMs;
+
+        uint64_t offset = CacheFile::align(header.stringsOffset + strings.size());
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            meshTable[i].vertexCount = (uint32_t)meshes[i].vertexCount;
+            meshTable[i].vertexLayout = meshes[i].layout.flags;
+            meshTable[i].vertexStride = meshes[i].layout.stride();
+            meshTable[i].vertexOffset = offset;
+            offset = CacheFile::align(offset + meshes[i].vertexCount * meshTable[i].vertexStride);
+            meshTable[i].indexCount = (uint32_t)meshes[i].indexCount;
+            meshTable[i].indexSize = meshes[i].indexSize;
+            meshTable[i].indexOffset = offset;
+            offset = CacheFile::align(offset + meshes[i].indexCount * meshes[i].indexSize);
+        }
+
+        FILE *out = fopen(CacheFile::tmpPath(cachePath(sourcePath)).c_str(), "wb");
+        if (!out)
+            return false;
+        bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+        ok = ok && CacheFile::writeBytes(out, meshTable.data(), meshTable.size() * sizeof(ModelCacheMesh));
+        ok = ok && CacheFile::writeBytes(out, textureTable.data(), textureTable.size() * sizeof(ModelCacheTexture));
+        ok = ok && CacheFile::writeBytes(out, rangeTable.data(), rangeTable.size() * sizeof(MeshRange));
+        ok = ok && CacheFile::writeBytes(out, nodes.data(), nodes.size() * sizeof(ModelCacheNode));
+        ok = ok && CacheFile::writeBytes(out, lodTable.data(), lodTable.size() * sizeof(MeshLod));
+        ok = ok && CacheFile::writeBytes(out, strings.data(), strings.size());
+        for (size_t i = 0; ok && i < meshes.size(); i++)
+        {
+            ok = CacheFile::pad(out, meshTable[i].vertexOffset);
+            ok = ok && CacheFile::writeBytes(out, meshes[i].vertices, meshes[i].vertexCount * meshTable[i].vertexStride);
+            ok = ok && CacheFile::pad(out, meshTable[i].indexOffset);
+            ok = ok && CacheFile::writeBytes(out, meshes[i].indices, meshes[i].indexCount * meshes[i].indexSize);
+        }
+        return CacheFile::commit(out, cachePath(sourcePath), ok);
+    }
+
+private:
+    // offset starts a string inside the blob, and the string is NUL terminated before the blob ends
+    static bool validString(const MappedFile &file, uint64_t stringsEnd, uint32_t offset)
+    {
+        uint64_t blobSize = stringsEnd - getHeader(file)->stringsOffset;
+        return offset < blobSize && memchr(getString(file, offset), 0, (size_t)(blobSize - offset)) != nullptr;
+    }
+
+    // the range's indices lie inside the mesh's index stream and, offset by its baseVertex, name vertices of the mesh.
+    // The ranges don't store how many vertices they use, so the indices themselves are checked.
+    static bool validRange(const MappedFile &file, const ModelCacheMesh &mesh, const MeshRange &range)
+    {
+        if ((uint64_t)range.firstIndex + range.indexCount > mesh.indexCount || range.baseVertex < 0 || (uint32_t)range.baseVertex > mesh.vertexCount)
+            return false;
+        const unsigned char *indices = file.data + mesh.indexOffset + (uint64_t)range.firstIndex * mesh.indexSize;
+        uint32_t maxIndex = 0;
+        for (uint32_t i = 0; i < range.indexCount; i++)
+            maxIndex = std::max(maxIndex, mesh.indexSize == 2 ? (uint32_t)((const uint16_t *)indices)[i] : ((const uint32_t *)indices)[i]);
+        return range.indexCount == 0 || (uint64_t)range.baseVertex + maxIndex < mesh.vertexCount;
+    }
+};
+#endif
@@ -0,0 +1,488 @@
+#ifndef MODEL_STREAMER_H
+#define MODEL_STREAMER_H
+
+#include <glad/glad.h>
+
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+
+#include "geometry_arena.h"
+#include "mesh.h"
+#include "mesh_optimizer.h"
+#include "model.h"
+#include "model_cache.h"
+#include "profiler.h"
+#include "staging_buffer.h"
+#include "texture_cache.h"
+#include "thread_pool.h"
+
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+using namespace std;
+
+// one mesh as the loading job hands it over: packed and ready to copy into the arena
+struct StreamedMesh {
+    vector<unsigned char> vertexData;   // packed with layout
+    vector<unsigned char> indexData;    // indexCount indices of indexType
+    unsigned int vertexCount = 0;
+    unsigned int indexCount = 0;
+    VertexLayout layout;
+    unsigned int maxBoneId = 0;         // VertexPacker::maxBoneId of vertexData
+    GLenum indexType = GL_UNSIGNED_SHORT;
+    vector<MeshRange> ranges;
+    vector<MeshLod> lods;
+    Bounds bounds;
+    vector<ModelCache::TextureRef> textures;
+
+    unsigned int indexSize() const { return indexType == GL_UNSIGNED_SHORT ? 2 : 4; }
+
+    // the bytes of indexData a level's ranges use; every level is one contiguous block
+    void levelSpan(unsigned int level, size_t &first, size_t &end) const
+    {
+        first = indexData.size();
+        end = 0;
+        for (unsigned int r = lods[level].firstRange; r < lods[level].firstRange + lods[level].rangeCount; r++)
+        {
+            first = std::min(first, (size_t)ranges[r].firstIndex * indexSize());
+            end = std::max(end, (size_t)(ranges[r].firstIndex + ranges[r].indexCount) * indexSize());
+        }
+        if (first > end)
+            first = end;
+    }
+};
+
+// what a loading job shares with the GL thread. The job appends meshes in the model's mesh order.
+struct ModelStreamJob {
+    std::mutex mutex;
+    std::deque<shared_ptr<const StreamedMesh>> meshes;  // finished, not picked up by pump() yet
+    vector<ModelCacheNode> nodes;                       // valid once done
+    bool done = false;
+    bool failed = false;
+    bool fromCache = false;
+    string error;
+    std::atomic<bool> cancelled{false};                 // the handle was dropped, stop working
+};
+
+// Handle of a model that is being streamed in. model() can be drawn at any time: it starts out empty and gains
+// meshes in order as their vertices and coarsest level of detail reach the GPU, then the finer levels follow.
+// Textures sample as grey until their coarsest mips arrive and sharpen from there. Dropping the last reference
+// cancels the load.
+class ModelStream
+{
+public:
+    const string path;
+
+    Model &model() { return *loaded; }
+    const Model &model() const { return *loaded; }
+
+    // every mesh and texture is resident at full detail
+    bool ready() const { return state == READY; }
+    bool failed() const { return state == FAILED; }
+    // meshes drawable so far, and how many the job handed over (the total is only known once it's done)
+    size_t meshesDrawable() const { return loaded->meshes.size(); }
+    size_t meshesReceived() const { return received; }
+    double readyMs() const { return loadMs; }
+    unsigned int framesPumped() const { return frames; }
+
+    ModelStream(const string &path, Model *model) : path(path), loaded(model) {}
+
+private:
+    friend class ModelStreamer;
+
+    enum State { LOADING, READY, FAILED };
+
+    // a mesh whose arena range is being filled: all vertices first, then the index block of every level from
+    // the coarsest to the full one
+    struct Upload {
+        shared_ptr<const StreamedMesh> data;
+        ArenaAllocation allocation;
+        vector<Texture> textures;
+        size_t vertexBytesDone = 0;
+        int nextLod = 0;             // level whose indices are being copied, -1 once all are in
+        size_t indexBytesDone = 0;   // of nextLod's block
+        int meshIndex = -1;          // into model().meshes once drawable
+    };
+
+    unique_ptr<Model> loaded;
+    shared_ptr<ModelStreamJob> job;
+    vector<Upload> uploads;
+    State state = LOADING;
+    bool jobDone = false;
+    size_t received = 0;
+    unsigned int frames = 0;
+    double loadMs = 0.0;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Loads models without blocking the render loop. load() returns a handle right away; file I/O, Assimp (or the
+// model cache), mesh optimisation, LOD generation and packing run as a job on the shared ThreadPool, and textures
+// decode there too. Once a frame, pump() moves whatever is ready to the GPU through a StagingBuffer, at most
+// budgetBytes per frame, so loading costs a bounded slice of every frame instead of one long stall.
+//
+// Only use from the GL context thread.
+class ModelStreamer
+{
+public:
+    // smallest staging buffer pump() uses, whatever the budget
+    static constexpr size_t MIN_BUDGET = 64 * 1024;
+
+    static ModelStreamer &shared()
+    {
+        // streams still loading at exit free arena ranges and textures when the streamer goes away, so the
+        // singletons they use are constructed first and destroyed after it
+        GeometryArena::shared();
+        TextureCache::shared();
+        static ModelStreamer streamer;
+        return streamer;
+    }
+
+    // starts loading the model and returns its (still empty) handle
+    shared_ptr<ModelStream> load(const string &path, bool gamma = false, ModelLoadOptions options = ModelLoadOptions())
+    {
+        printf("[model_streamer.h] Streaming model: %s...\n", path.c_str());
+        string directory = path.substr(0, path.find_last_of('/'));
+        shared_ptr<ModelStream> stream = make_shared<ModelStream>(path, new Model(gamma, options, directory));
+        stream->job = make_shared<ModelStreamJob>();
+        stream->start = std::chrono::steady_clock::now();
+        shared_ptr<ModelStreamJob> job = stream->job;
+        ThreadPool::shared().submit([job, path, options] { runJob(*job, path, options); });
+        streams.push_back(stream);
+        return stream;
+    }
+
+    // uploads up to budgetBytes of geometry and texels. First every received mesh is made drawable at its coarsest
+    // level, in mesh order, then the finer levels and the textures get what is left. Returns the bytes staged.
+    size_t pump(size_t budgetBytes)
+    {
+        if (!busy())
+            return 0;
+        PROFILE_ZONE("ModelStreamer::pump");
+        for (size_t i = 0; i < streams.size();)
+        {
+            if (streams[i].use_count() == 1)
+            {
+                cancel(*streams[i]);
+                streams.erase(streams.begin() + i);
+                continue;
+            }
+            receive(*streams[i]);
+            i++;
+        }
+
+        staging.begin(std::max(budgetBytes, MIN_BUDGET));
+        for (int pass = 0; pass < 2; pass++)
+        {
+            bool drawablePass = pass == 0;
+            for (shared_ptr<ModelStream> &stream : streams)
+            {
+                for (ModelStream::Upload &upload : stream->uploads)
+                {
+                    if (drawablePass && upload.meshIndex >= 0)
+                        continue;
+                    if (!stageMesh(*stream, upload, drawablePass))
+                        break;
+                }
+            }
+        }
+        TextureCache::shared().stream(staging);
+        size_t bytes = staging.end();
+
+        for (size_t i = 0; i < streams.size();)
+        {
+            ModelStream &stream = *streams[i];
+            stream.frames++;
+            stream.uploads.erase(std::remove_if(stream.uploads.begin(), stream.uploads.end(), [](const ModelStream::Upload &upload) { return upload.nextLod < 0; }),
+                                 stream.uploads.end());
+            if (finished(stream))
+                streams.erase(streams.begin() + i);
+            else
+                i++;
+        }
+        return bytes;
+    }
+
+    // true while any model or texture still has something to upload
+    bool busy() const { return !streams.empty() || TextureCache::shared().pendingUploads() > 0; }
+
+    size_t totalStagedBytes() const { return staging.totalBytes; }
+
+    // cancels every stream still loading and deletes the staging buffer. The streamer is a static that outlives
+    // the GL context, so call this before the context goes away; later loads start over.
+    void shutdown()
+    {
+        for (shared_ptr<ModelStream> &stream : streams)
+            cancel(*stream);
+        streams.clear();
+        staging.release();
+    }
+
+private:
+    vector<shared_ptr<ModelStream>> streams;
+    StagingBuffer staging;
+
+    ModelStreamer() {}
+
+    // the loading job, on a worker thread. Never touches GL.
+    static void runJob(ModelStreamJob &job, const string &path, const ModelLoadOptions &options)
+    {
+        PROFILE_ZONE("ModelStreamer::runJob");
+        auto start = std::chrono::steady_clock::now();
+        if (options.useCache && readCache(job, path, options))
+            return;
+
+        Assimp::Importer importer;
+        const aiScene *scene = importer.ReadFile(path, MODEL_IMPORT_FLAGS);
+        if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode)
+        {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            job.error = importer.GetErrorString();
+            job.failed = true;
+            job.done = true;
+            return;
+        }
+
+        // same pre-order mesh numbering as Model::processNode
+        vector<ModelCacheNode> nodes;
+        vector<shared_ptr<const StreamedMesh>> meshes;
+        if (!importNode(job, scene->mRootNode, scene, options, nodes, meshes))
+            return;
+        double coldLoadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        {
+            std::lock_guard<std::mutex> lock(job.mutex);
+            job.nodes = nodes;
+            job.done = true;
+        }
+        if (options.useCache)
+            writeCache(path, options, meshes, nodes, coldLoadMs);
+    }
+
+    // walks the node tree like Model::processNode, handing every mesh over as soon as it's packed.
+    // Returns false when the load was cancelled.
+    static bool importNode(ModelStreamJob &job, const aiNode *node, const aiScene *scene, const ModelLoadOptions &options,
+                           vector<ModelCacheNode> &nodes, vector<shared_ptr<const StreamedMesh>> &meshes)
+    {
+        size_t nodeIndex = nodes.size();
+        nodes.push_back({(uint32_t)meshes.size(), 0});
+        for (unsigned int i = 0; i < node->mNumMeshes; i++)
+        {
+            if (job.cancelled)
+                return false;
+            meshes.push_back(prepareMesh(scene->mMeshes[node->mMeshes[i]], scene, options));
+            std::lock_guard<std::mutex> lock(job.mutex);
+            job.meshes.push_back(meshes.back());
+        }
+        for (unsigned int i = 0; i < node->mNumChildren; i++)
+            if (!importNode(job, node->mChildren[i], scene, options, nodes, meshes))
+                return false;
+        nodes[nodeIndex].meshEnd = (uint32_t)meshes.size();
+        return true;
+    }
+
+    // Model::processMesh and the Mesh vertex constructor, minus the upload
+    static shared_ptr<const StreamedMesh> prepareMesh(const aiMesh *mesh, const aiScene *scene, const ModelLoadOptions &options)
+    {
+        shared_ptr<StreamedMesh> result = make_shared<StreamedMesh>();
+        vector<Vertex> vertices;
+        vector<unsigned int> indices;
+        Model::extractMesh(mesh, vertices, indices);
+        Model::materialTextures(scene->mMaterials[mesh->mMaterialIndex], result->textures);
+        if (options.optimizeMeshes)
+            MeshOptimizer::optimize(indices, vertices);
+
+        bool hasTangents = mesh->mTextureCoords[0] && mesh->mTangents;
+        result->layout = VertexPacker::chooseLayout(vertices, hasTangents, mesh->HasBones());
+        Mesh::buildRanges(vertices, indices, options.generateLods ? MAX_MESH_LODS : 1, result->ranges, result->lods);
+        result->bounds = Bounds::fromPoints(vertices.data(), vertices.size(), sizeof(Vertex));
+        VertexPacker::pack(vertices, result->layout, result->vertexData);
+        result->vertexCount = (unsigned int)vertices.size();
+        result->maxBoneId = VertexPacker::maxBoneId(result->vertexData.data(), vertices.size(), result->layout);
+        result->indexCount = (unsigned int)indices.size();
+        result->indexType = GL_UNSIGNED_SHORT;
+        result->indexData.resize(indices.size() * sizeof(uint16_t));
+        uint16_t *shortIndices = (uint16_t *)result->indexData.data();
+        for (size_t i = 0; i < indices.size(); i++)
+            shortIndices[i] = (uint16_t)indices[i];
+        return result;
+    }
+
+    // hands the meshes of a valid model cache over; false when there is none
+    static bool readCache(ModelStreamJob &job, const string &path, const ModelLoadOptions &options)
+    {
+        MappedFile file;
+        if (!ModelCache::open(path, MODEL_IMPORT_FLAGS, options.processFlags(), file))
+            return false;
+        const ModelCacheHeader *header = ModelCache::getHeader(file);
+        const ModelCacheMesh *cachedMeshes = ModelCache::getMeshes(file);
+        const ModelCacheTexture *cachedTextures = ModelCache::getTextures(file);
+        for (uint32_t i = 0; i < header->meshCount; i++)
+        {
+            if (job.cancelled)
+                return true;
+            const ModelCacheMesh &entry = cachedMeshes[i];
+            shared_ptr<StreamedMesh> mesh = make_shared<StreamedMesh>();
+            mesh->layout.flags = entry.vertexLayout;
+            mesh->vertexCount = entry.vertexCount;
+            mesh->vertexData.assign(file.data + entry.vertexOffset, file.data + entry.vertexOffset + (size_t)entry.vertexCount * entry.vertexStride);
+            mesh->maxBoneId = VertexPacker::maxBoneId(mesh->vertexData.data(), entry.vertexCount, mesh->layout);
+            mesh->indexType = entry.indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+            mesh->indexCount = entry.indexCount;
+            mesh->indexData.assign(file.data + entry.indexOffset, file.data + entry.indexOffset + (size_t)entry.indexCount * entry.indexSize);
+            const MeshRange *ranges = ModelCache::getRanges(file) + entry.firstRange;
+            mesh->ranges.assign(ranges, ranges + entry.rangeCount);
+            const MeshLod *lods = ModelCache::getLods(file) + entry.firstLod;
+            mesh->lods.assign(lods, lods + entry.lodCount);
+            if (mesh->lods.empty())
+                mesh->lods.push_back({0, entry.rangeCount, 0.0f});
+            mesh->bounds.center = glm::vec3(entry.boundsCenter[0], entry.boundsCenter[1], entry.boundsCenter[2]);
+            mesh->bounds.extent = glm::vec3(entry.boundsExtent[0], entry.boundsExtent[1], entry.boundsExtent[2]);
+            mesh->bounds.radius = entry.boundsRadius;
+            for (uint32_t t = entry.firstTexture; t < entry.firstTexture + entry.textureCount; t++)
+                mesh->textures.push_back({ModelCache::getString(file, cachedTextures[t].typeOffset), ModelCache::getString(file, cachedTextures[t].pathOffset)});
+            std::lock_guard<std::mutex> lock(job.mutex);
+            job.meshes.push_back(mesh);
+        }
+        const ModelCacheNode *cachedNodes = ModelCache::getNodes(file);
+        std::lock_guard<std::mutex> lock(job.mutex);
+        job.nodes.assign(cachedNodes, cachedNodes + header->nodeCount);
+        job.fromCache = true;
+        job.done = true;
+        return true;
+    }
+
+    static void writeCache(const string &path, const ModelLoadOptions &options, const vector<shared_ptr<const StreamedMesh>> &meshes, const vector<ModelCacheNode> &nodes, double coldLoadMs)
+    {
+        vector<ModelCache::MeshSource> sources(meshes.size());
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            const StreamedMesh &mesh = *meshes[i];
+            sources[i].vertices = mesh.vertexData.data();
+            sources[i].vertexCount = mesh.vertexCount;
+            sources[i].layout = mesh.layout;
+            sources[i].indices = mesh.indexData.data();
+            sources[i].indexCount = mesh.indexCount;
+            sources[i].indexSize = mesh.indexSize();
+            sources[i].ranges = mesh.ranges;
+            sources[i].lods = mesh.lods;
+            sources[i].textures = mesh.textures;
+            sources[i].bounds = mesh.bounds;
+        }
+        if (!ModelCache::write(path, MODEL_IMPORT_FLAGS, options.processFlags(), sources, nodes, coldLoadMs))
+            printf("[model_streamer.h] Could not write model cache: %s\n", ModelCache::cachePath(path).c_str());
+    }
+
+    // takes over the meshes the job finished since the last frame: reserves their arena space and requests
+    // their textures (which starts the decodes)
+    void receive(ModelStream &stream)
+    {
+        deque<shared_ptr<const StreamedMesh>> meshes;
+        {
+            std::lock_guard<std::mutex> lock(stream.job->mutex);
+            meshes.swap(stream.job->meshes);
+            stream.jobDone = stream.job->done;
+        }
+        Model &model = *stream.loaded;
+        for (shared_ptr<const StreamedMesh> &mesh : meshes)
+        {
+            ModelStream::Upload upload;
+            upload.data = mesh;
+            upload.allocation = GeometryArena::shared().reserve(mesh->layout, mesh->vertexCount, mesh->indexType, mesh->indexCount);
+            for (const ModelCache::TextureRef &ref : mesh->textures)
+                upload.textures.push_back(model.loadTexture(ref.path.c_str(), ref.type));
+            upload.nextLod = (int)mesh->lods.size() - 1;
+            stream.uploads.push_back(upload);
+            stream.received++;
+        }
+    }
+
+    // stages as much of a mesh as the budget allows, stopping once it is drawable when untilDrawable is set.
+    // Returns false when the budget ran out.
+    bool stageMesh(ModelStream &stream, ModelStream::Upload &upload, bool untilDrawable)
+    {
+        const StreamedMesh &data = *upload.data;
+        GeometryArena &arena = GeometryArena::shared();
+        const GeometryArena::Pool &pool = arena.pool(upload.allocation.pool);
+        while (upload.vertexBytesDone < data.vertexData.size())
+        {
+            size_t size = std::min(data.vertexData.size() - upload.vertexBytesDone, staging.remaining());
+            if (size == 0)
+                return false;
+            size_t offset = staging.stage(data.vertexData.data() + upload.vertexBytesDone, size);
+            staging.copyToBuffer(pool.VBO, arena.vertexOffset(upload.allocation) + upload.vertexBytesDone, offset, size);
+            upload.vertexBytesDone += size;
+        }
+        while (upload.nextLod >= 0 && !(untilDrawable && upload.meshIndex >= 0))
+        {
+            size_t first, end;
+            data.levelSpan((unsigned int)upload.nextLod, first, end);
+            while (first + upload.indexBytesDone < end)
+            {
+                size_t size = std::min(end - first - upload.indexBytesDone, staging.remaining());
+                if (size == 0)
+                    return false;
+                size_t offset = staging.stage(data.indexData.data() + first + upload.indexBytesDone, size);
+                staging.copyToBuffer(pool.EBO, arena.indexOffset(upload.allocation) + first + upload.indexBytesDone, offset, size);
+                upload.indexBytesDone += size;
+            }
+            // the level's copies go out in this frame's staging.end(), before anything is drawn
+            Model &model = *stream.loaded;
+            if (upload.meshIndex < 0)
+            {
+                upload.meshIndex = (int)model.meshes.size();
+                model.meshes.push_back(Mesh(upload.allocation, data.layout, data.indexType, data.ranges, data.lods, upload.textures, data.bounds, (unsigned int)upload.nextLod,
+                                           data.maxBoneId));
+                model.meshCulling.add(data.bounds);
+            }
+            else
+                model.meshes[upload.meshIndex].residentLod = (unsigned int)upload.nextLod;
+            upload.nextLod--;
+            upload.indexBytesDone = 0;
+        }
+        return true;
+    }
+
+    // READY once the job is done and every mesh and texture of the model is resident. Returns true when the
+    // stream needs no more pumping.
+    bool finished(ModelStream &stream)
+    {
+        if (!stream.jobDone || !stream.uploads.empty())
+            return false;
+        Model &model = *stream.loaded;
+        if (stream.job->failed)
+        {
+            printf("[model_streamer.h] ERROR::ASSIMP:: %s (%s)\n", stream.job->error.c_str(), stream.path.c_str());
+            stream.state = ModelStream::FAILED;
+            return true;
+        }
+        for (const Texture &texture : model.textures_loaded)
+            if (!TextureCache::shared().resident(texture.id))
+                return false;
+
+        for (const ModelCacheNode &node : stream.job->nodes)
+            model.nodes.push_back({Bounds(), node.firstMesh, node.meshEnd});
+        model.buildBounds();
+        stream.loadMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stream.start).count();
+        stream.state = ModelStream::READY;
+        printf("[model_streamer.h] Streamed %s: %zu meshes in %.2f ms over %u frames%s\n", stream.path.c_str(), model.meshes.size(),
+               stream.loadMs, stream.frames, stream.job->fromCache ? " (from cache)" : "");
+        return true;
+    }
+
+    // the handle was dropped: stop the job and give back the arena space of meshes the model doesn't own yet
+    void cancel(ModelStream &stream)
+    {
+        stream.job->cancelled = true;
+        for (ModelStream::Upload &upload : stream.uploads)
+            if (upload.meshIndex < 0)
+                GeometryArena::shared().free(upload.allocation);
+        stream.uploads.clear();
+    }
+};
+#endif
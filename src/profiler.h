@@ -0,0 +1,487 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <glad/glad.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// zones a thread can record between two frames before the oldest unread ones are dropped
+#define PROFILER_RING_SIZE 4096
+// GPU queries per frame, zones beyond that go untimed
+#define PROFILER_MAX_GPU_ZONES 32
+// frames of GPU queries in flight: results are read two frames late, when they are normally long available
+#define PROFILER_GPU_FRAMES 2
+// thread id of the GPU track in exports
+#define PROFILER_GPU_THREAD 1000
+
+// per-frame totals, counted on the GL context thread by the code issuing the calls
+struct ProfileCounters {
+    uint64_t drawCalls = 0;
+    uint64_t triangles = 0;
+    uint64_t stateChanges = 0;   // program, texture, VAO and uniform range binds
+    uint64_t uploadedBytes = 0;  // buffer and texture data sent to the GPU
+};
+
+// one timed zone. Names are string literals, only the pointer is stored.
+struct ProfileZoneRecord {
+    const char *name;
+    uint64_t startNs;
+    uint64_t endNs;
+    uint32_t thread;  // threads are numbered in the order they first record, the GPU is PROFILER_GPU_THREAD
+    uint32_t depth;   // nesting level on its thread
+};
+
+struct ProfileFrame {
+    uint64_t index = 0;
+    uint64_t startNs = 0;
+    uint64_t endNs = 0;
+    uint32_t thread = 0;        // the thread running beginFrame
+    bool gpuValid = false;      // false until the GPU results arrive, or if they were dropped
+    ProfileCounters counters;
+    std::vector<ProfileZoneRecord> cpuZones;
+    std::vector<ProfileZoneRecord> gpuZones;  // start is when the zone was issued on the CPU, the length is GPU time
+
+    double cpuMs() const { return (endNs - startNs) * 1e-6; }
+    double gpuMs() const
+    {
+        uint64_t total = 0;
+        for (const ProfileZoneRecord &zone : gpuZones)
+            total += zone.endNs - zone.startNs;
+        return total * 1e-6;
+    }
+};
+
+// Single producer, single consumer queue of finished zones. The owning thread pushes, endFrame drains; neither
+// side ever waits for the other.
+class ProfileRing
+{
+public:
+    bool push(const ProfileZoneRecord &zone)
+    {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= PROFILER_RING_SIZE)
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots[h % PROFILER_RING_SIZE] = zone;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    template <typename F>
+    void drain(F &&consume)
+    {
+        uint32_t t = tail.load(std::memory_order_relaxed);
+        uint32_t h = head.load(std::memory_order_acquire);
+        for (; t != h; t++)
+            consume(slots[t % PROFILER_RING_SIZE]);
+        tail.store(t, std::memory_order_release);
+    }
+
+    std::atomic<uint64_t> dropped{0};
+
+private:
+    ProfileZoneRecord slots[PROFILER_RING_SIZE];
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+};
+
+// Frame profiler: CPU zones from any thread (PROFILE_ZONE), GPU zones timed with GL_TIME_ELAPSED queries
+// (PROFILE_GPU_ZONE, GL thread only) and the counters above, kept for the last few hundred frames. GPU zones
+// can't overlap, nested ones are folded into the outermost.
+//
+//   while (running) {
+//       Profiler::shared().beginFrame();  // also ends the previous one
+//       { PROFILE_ZONE("cull"); ... }
+//       { PROFILE_GPU_ZONE("scene"); ... }
+//   }
+//   Profiler::shared().finish();
+//   Profiler::shared().writeChromeTrace("profile.json");
+class Profiler
+{
+public:
+    ProfileCounters counters; // of the frame being recorded
+    bool enabled = true;
+
+    static Profiler &shared()
+    {
+        static Profiler profiler;
+        return profiler;
+    }
+
+    // nanoseconds since the profiler started
+    static uint64_t now()
+    {
+        static const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    // names the calling thread in exports, threads are "thread N" otherwise
+    void setThreadName(const char *name)
+    {
+        ThreadState &state = thread();
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        state.name = name;
+    }
+
+    void countDraw(uint64_t vertices, uint64_t instances = 1)
+    {
+        counters.drawCalls++;
+        counters.triangles += vertices / 3 * instances;
+    }
+    void countStateChanges(uint64_t count) { counters.stateChanges += count; }
+    void countUpload(uint64_t bytes) { counters.uploadedBytes += bytes; }
+
+    // starts recording a frame, ending the current one first. Call on the GL context thread.
+    void beginFrame()
+    {
+        if (recording)
+            endFrame();
+        collectGpu(gpuFrames[frameIndex % PROFILER_GPU_FRAMES], false);
+        current = ProfileFrame();
+        current.index = frameIndex++;
+        current.thread = thread().index;
+        current.startNs = now();
+        counters = ProfileCounters();
+        gpuSlot = &gpuFrames[current.index % PROFILER_GPU_FRAMES];
+        gpuSlot->frame = current.index;
+        gpuSlot->count = 0;
+        gpuDepth = 0;
+        recording = true;
+    }
+
+    void endFrame()
+    {
+        if (!recording)
+            return;
+        // a GPU zone left open ends with the frame
+        if (gpuDepth > 0)
+        {
+            gpuDepth = 1;
+            endGpuZone();
+        }
+        recording = false;
+        current.endNs = now();
+        current.counters = counters;
+        {
+            std::lock_guard<std::mutex> lock(threadsMutex);
+            for (auto &state : threads)
+                state->ring.drain([this](const ProfileZoneRecord &zone) { current.cpuZones.push_back(zone); });
+        }
+        history.push_back(std::move(current));
+        while (history.size() > historySize)
+            history.pop_front();
+    }
+
+    // ends the frame and waits for the GPU results still in flight, e.g. before exporting at exit
+    void finish()
+    {
+        endFrame();
+        for (uint64_t frame = frameIndex - std::min<uint64_t>(frameIndex, PROFILER_GPU_FRAMES); frame < frameIndex; frame++)
+            collectGpu(gpuFrames[frame % PROFILER_GPU_FRAMES], true);
+    }
+
+    // GL_TIME_ELAPSED queries can't nest, only the outermost zone gets one
+    void beginGpuZone(const char *name)
+    {
+        if (!enabled || !recording || gpuDepth++ > 0 || gpuSlot->count >= PROFILER_MAX_GPU_ZONES)
+            return;
+        if (gpuSlot->queries[0] == 0)
+            glGenQueries(PROFILER_MAX_GPU_ZONES, gpuSlot->queries);
+        GpuZone &zone = gpuSlot->zones[gpuSlot->count];
+        zone.name = name;
+        zone.issuedNs = now();
+        glBeginQuery(GL_TIME_ELAPSED, gpuSlot->queries[gpuSlot->count]);
+        zone.open = true;
+    }
+
+    void endGpuZone()
+    {
+        if (!recording || gpuDepth == 0 || --gpuDepth > 0 || gpuSlot->count >= PROFILER_MAX_GPU_ZONES)
+            return;
+        if (!gpuSlot->zones[gpuSlot->count].open)
+            return;
+        glEndQuery(GL_TIME_ELAPSED);
+        gpuSlot->zones[gpuSlot->count].open = false;
+        gpuSlot->count++;
+    }
+
+    // recorded frames, oldest first. The newest PROFILER_GPU_FRAMES don't have their GPU zones yet.
+    const std::deque<ProfileFrame> &frames() const { return history; }
+    void setHistorySize(size_t frames) { historySize = std::max<size_t>(frames, PROFILER_GPU_FRAMES + 1); }
+
+    // newest frame with GPU results (the newest frame until any arrive), nullptr before the first frame
+    const ProfileFrame *latestComplete() const
+    {
+        for (auto it = history.rbegin(); it != history.rend(); ++it)
+            if (it->gpuValid)
+                return &*it;
+        return history.empty() ? nullptr : &history.back();
+    }
+
+    // zones lost because a thread's ring was full, or GPU frames whose queries weren't done in time
+    uint64_t droppedZones()
+    {
+        uint64_t total = 0;
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        for (auto &state : threads)
+            total += state->ring.dropped.load(std::memory_order_relaxed);
+        return total;
+    }
+    uint64_t droppedGpuFrames() const { return gpuDropped; }
+
+    // Chrome trace event JSON (chrome://tracing, Perfetto): CPU zones per thread, GPU zones on their own track,
+    // frames as spans and the counters as counter tracks
+    bool writeChromeTrace(const char *path)
+    {
+        FILE *file = fopen(path, "w");
+        if (!file)
+        {
+            printf("[profiler.h] Could not write %s\n", path);
+            return false;
+        }
+        fprintf(file, "{\"traceEvents\":[\n");
+        bool first = true;
+        auto separator = [&]() {
+            if (!first)
+                fprintf(file, ",\n");
+            first = false;
+        };
+        auto zone = [&](const char *name, uint64_t startNs, uint64_t endNs, uint32_t tid) {
+            separator();
+            fprintf(file, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}", name, startNs * 1e-3, (endNs - startNs) * 1e-3, tid);
+        };
+        {
+            std::lock_guard<std::mutex> lock(threadsMutex);
+            for (auto &state : threads)
+            {
+                separator();
+                fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", state->index, state->name.c_str());
+            }
+        }
+        separator();
+        fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"GPU\"}}", PROFILER_GPU_THREAD);
+        char frameName[32];
+        for (const ProfileFrame &frame : history)
+        {
+            snprintf(frameName, sizeof(frameName), "frame %llu", (unsigned long long)frame.index);
+            zone(frameName, frame.startNs, frame.endNs, frame.thread);
+            for (const ProfileZoneRecord &z : frame.cpuZones)
+                zone(z.name, z.startNs, z.endNs, z.thread);
+            for (const ProfileZoneRecord &z : frame.gpuZones)
+                zone(z.name, z.startNs, z.endNs, PROFILER_GPU_THREAD);
+            const ProfileCounters &c = frame.counters;
+            separator();
+            fprintf(file, "{\"name\":\"counters\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"args\":{\"draw calls\":%llu,\"triangles\":%llu,\"state changes\":%llu,\"uploaded bytes\":%llu}}",
+                    frame.startNs * 1e-3, (unsigned long long)c.drawCalls, (unsigned long long)c.triangles, (unsigned long long)c.stateChanges, (unsigned long long)c.uploadedBytes);
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+        printf("[profiler.h] Wrote %zu frames to %s\n", history.size(), path);
+        return true;
+    }
+
+    // one row per frame: frame and GPU time, counters, then the total ms of every zone name (cpu:/gpu: columns)
+    bool writeCsv(const char *path)
+    {
+        FILE *file = fopen(path, "w");
+        if (!file)
+        {
+            printf("[profiler.h] Could not write %s\n", path);
+            return false;
+        }
+        std::vector<std::string> cpuNames, gpuNames;
+        std::map<std::string, size_t> cpuColumn, gpuColumn;
+        for (const ProfileFrame &frame : history)
+        {
+            for (const ProfileZoneRecord &zone : frame.cpuZones)
+                if (cpuColumn.emplace(zone.name, cpuNames.size()).second)
+                    cpuNames.push_back(zone.name);
+            for (const ProfileZoneRecord &zone : frame.gpuZones)
+                if (gpuColumn.emplace(zone.name, gpuNames.size()).second)
+                    gpuNames.push_back(zone.name);
+        }
+        fprintf(file, "frame,cpu_ms,gpu_ms,draw_calls,triangles,state_changes,uploaded_bytes");
+        for (const std::string &name : cpuNames)
+            fprintf(file, ",cpu:%s", name.c_str());
+        for (const std::string &name : gpuNames)
+            fprintf(file, ",gpu:%s", name.c_str());
+        fprintf(file, "\n");
+
+        std::vector<double> cpuTotals, gpuTotals;
+        for (const ProfileFrame &frame : history)
+        {
+            const ProfileCounters &c = frame.counters;
+            fprintf(file, "%llu,%.4f,", (unsigned long long)frame.index, frame.cpuMs());
+            if (frame.gpuValid)
+                fprintf(file, "%.4f", frame.gpuMs());
+            fprintf(file, ",%llu,%llu,%llu,%llu", (unsigned long long)c.drawCalls, (unsigned long long)c.triangles, (unsigned long long)c.stateChanges, (unsigned long long)c.uploadedBytes);
+            cpuTotals.assign(cpuNames.size(), 0.0);
+            gpuTotals.assign(gpuNames.size(), 0.0);
+            for (const ProfileZoneRecord &zone : frame.cpuZones)
+                cpuTotals[cpuColumn[zone.name]] += (zone.endNs - zone.startNs) * 1e-6;
+            for (const ProfileZoneRecord &zone : frame.gpuZones)
+                gpuTotals[gpuColumn[zone.name]] += (zone.endNs - zone.startNs) * 1e-6;
+            for (double ms : cpuTotals)
+                fprintf(file, ",%.4f", ms);
+            for (double ms : gpuTotals)
+                if (frame.gpuValid)
+                    fprintf(file, ",%.4f", ms);
+                else
+                    fprintf(file, ",");
+            fprintf(file, "\n");
+        }
+        fclose(file);
+        printf("[profiler.h] Wrote %zu frames to %s\n", history.size(), path);
+        return true;
+    }
+
+    // used by ProfileZone
+    ProfileRing &ring() { return thread().ring; }
+    uint32_t threadIndex() { return thread().index; }
+    uint32_t &depth() { return thread().depth; }
+
+private:
+    struct ThreadState {
+        ProfileRing ring;
+        uint32_t index = 0;
+        uint32_t depth = 0;
+        std::string name;
+    };
+
+    struct GpuZone {
+        const char *name = nullptr;
+        uint64_t issuedNs = 0;
+        bool open = false;
+    };
+
+    struct GpuFrame {
+        uint64_t frame = 0;
+        unsigned int count = 0;
+        unsigned int queries[PROFILER_MAX_GPU_ZONES] = {0};
+        GpuZone zones[PROFILER_MAX_GPU_ZONES];
+    };
+
+    // registration takes the lock once per thread, recording never does
+    std::mutex threadsMutex;
+    std::vector<std::unique_ptr<ThreadState>> threads;
+
+    std::deque<ProfileFrame> history;
+    size_t historySize = 300;
+    ProfileFrame current;
+    uint64_t frameIndex = 0;
+    bool recording = false;
+
+    GpuFrame gpuFrames[PROFILER_GPU_FRAMES];
+    GpuFrame *gpuSlot = &gpuFrames[0];
+    unsigned int gpuDepth = 0;
+    uint64_t gpuDropped = 0;
+
+    Profiler() {}
+
+    ThreadState &thread()
+    {
+        thread_local ThreadState *state = nullptr;
+        if (!state)
+        {
+            std::lock_guard<std::mutex> lock(threadsMutex);
+            threads.emplace_back(new ThreadState());
+            state = threads.back().get();
+            state->index = (uint32_t)(threads.size() - 1);
+            state->name = state->index == 0 ? "main" : "thread " + std::to_string(state->index);
+        }
+        return *state;
+    }
+
+    // reads the queries of a slot's frame into its history entry. Unless told to wait, results that aren't ready
+    // are dropped rather than stalling the frame.
+    void collectGpu(GpuFrame &slot, bool wait)
+    {
+        if (slot.count == 0)
+            return;
+        ProfileFrame *frame = nullptr;
+        for (auto it = history.rbegin(); it != history.rend() && !frame; ++it)
+            if (it->index == slot.frame)
+                frame = &*it;
+        GLint available = wait;
+        if (!wait)
+            glGetQueryObjectiv(slot.queries[slot.count - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+        {
+            gpuDropped++;
+            slot.count = 0;
+            return;
+        }
+        for (unsigned int i = 0; i < slot.count && frame; i++)
+        {
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(slot.queries[i], GL_QUERY_RESULT, &elapsed);
+            frame->gpuZones.push_back({slot.zones[i].name, slot.zones[i].issuedNs, slot.zones[i].issuedNs + elapsed, PROFILER_GPU_THREAD, 0});
+        }
+        if (frame)
+            frame->gpuValid = true;
+        slot.count = 0;
+    }
+};
+
+// times the enclosing scope on the calling thread
+class ProfileZone
+{
+public:
+    explicit ProfileZone(const char *name) : name(name)
+    {
+        Profiler &profiler = Profiler::shared();
+        if (!profiler.enabled)
+        {
+            this->name = nullptr;
+            return;
+        }
+        depth = profiler.depth()++;
+        startNs = Profiler::now();
+    }
+
+    ~ProfileZone()
+    {
+        if (!name)
+            return;
+        Profiler &profiler = Profiler::shared();
+        profiler.depth()--;
+        profiler.ring().push({name, startNs, Profiler::now(), profiler.threadIndex(), depth});
+    }
+
+    ProfileZone(const ProfileZone &) = delete;
+    ProfileZone &operator=(const ProfileZone &) = delete;
+
+private:
+    const char *name;
+    uint64_t startNs = 0;
+    uint32_t depth = 0;
+};
+
+// times the GL commands issued in the enclosing scope
+class GpuProfileZone
+{
+public:
+    explicit GpuProfileZone(const char *name) { Profiler::shared().beginGpuZone(name); }
+    ~GpuProfileZone() { Profiler::shared().endGpuZone(); }
+
+    GpuProfileZone(const GpuProfileZone &) = delete;
+    GpuProfileZone &operator=(const GpuProfileZone &) = delete;
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(name)
+#define PROFILE_GPU_ZONE(name) GpuProfileZone PROFILE_CONCAT(gpuProfileZone, __LINE__)(name)
+#endif
@@ -0,0 +1,106 @@
+#ifndef PROFILER_OVERLAY_H
+#define PROFILER_OVERLAY_H
+
+#include "imgui.h"
+
+#include "profiler.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+// frames the zone table averages over
+#define PROFILER_OVERLAY_FRAMES 60
+
+// Dear ImGui window with the profiler's live numbers: CPU and GPU frame time with a graph of the recorded
+// history, the counters of the last frame and every zone's time averaged over the last PROFILER_OVERLAY_FRAMES
+// frames. Call between ImGui::NewFrame and ImGui::Render.
+class ProfilerOverlay
+{
+public:
+    bool visible = true;
+
+    void draw(Profiler &profiler)
+    {
+        if (!visible)
+            return;
+        const std::deque<ProfileFrame> &frames = profiler.frames();
+        const ProfileFrame *latest = profiler.latestComplete();
+        if (!latest)
+            return;
+
+        // averages over the frames whose GPU results are in, newest first
+        struct ZoneTimes {
+            double cpuMs = 0.0;
+            double gpuMs = 0.0;
+        };
+        std::map<std::string, ZoneTimes> zones;
+        double cpuMs = 0.0, gpuMs = 0.0;
+        unsigned int averaged = 0;
+        cpuGraph.clear();
+        for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+        {
+            if (!it->gpuValid)
+                continue;
+            cpuGraph.push_back((float)it->cpuMs());
+            if (averaged == PROFILER_OVERLAY_FRAMES)
+                continue;
+            averaged++;
+            cpuMs += it->cpuMs();
+            gpuMs += it->gpuMs();
+            for (const ProfileZoneRecord &zone : it->cpuZones)
+                zones[zone.name].cpuMs += (zone.endNs - zone.startNs) * 1e-6;
+            for (const ProfileZoneRecord &zone : it->gpuZones)
+                zones[zone.name].gpuMs += (zone.endNs - zone.startNs) * 1e-6;
+        }
+        std::reverse(cpuGraph.begin(), cpuGraph.end());
+        if (averaged == 0)
+            return;
+        cpuMs /= averaged;
+        gpuMs /= averaged;
+
+        ImGui::SetNextWindowPos(ImVec2(10.0f, 10.0f), ImGuiCond_Always);
+        ImGui::SetNextWindowBgAlpha(0.6f);
+        ImGui::Begin("Profiler", nullptr, ImGuiWindowFlags_AlwaysAutoResize | ImGuiWindowFlags_NoFocusOnAppearing);
+        ImGui::Text("frame %.2f ms (%.0f fps), GPU %.2f ms", cpuMs, cpuMs > 0.0 ? 1000.0 / cpuMs : 0.0, gpuMs);
+        float maxMs = 0.0f;
+        for (float ms : cpuGraph)
+            maxMs = std::max(maxMs, ms);
+        ImGui::PlotLines("##frame", cpuGraph.data(), (int)cpuGraph.size(), 0, "frame ms", 0.0f, maxMs * 1.2f, ImVec2(300.0f, 60.0f));
+
+        const ProfileCounters &c = latest->counters;
+        ImGui::Text("%llu draw calls, %llu triangles", (unsigned long long)c.drawCalls, (unsigned long long)c.triangles);
+        ImGui::Text("%llu state changes, %.1f KB uploaded", (unsigned long long)c.stateChanges, c.uploadedBytes / 1024.0);
+        uint64_t droppedZones = profiler.droppedZones(), droppedGpu = profiler.droppedGpuFrames();
+        if (droppedZones || droppedGpu)
+            ImGui::Text("dropped: %llu zones, %llu GPU frames", (unsigned long long)droppedZones, (unsigned long long)droppedGpu);
+
+        ImGui::Separator();
+        if (ImGui::BeginTable("zones", 3, ImGuiTableFlags_Borders))
+        {
+            ImGui::TableSetupColumn("zone");
+            ImGui::TableSetupColumn("CPU ms");
+            ImGui::TableSetupColumn("GPU ms");
+            ImGui::TableHeadersRow();
+            for (const auto &zone : zones)
+            {
+                ImGui::TableNextRow();
+                ImGui::TableNextColumn();
+                ImGui::Text("%s", zone.first.c_str());
+                ImGui::TableNextColumn();
+                if (zone.second.cpuMs > 0.0)
+                    ImGui::Text("%.3f", zone.second.cpuMs / averaged);
+                ImGui::TableNextColumn();
+                if (zone.second.gpuMs > 0.0)
+                    ImGui::Text("%.3f", zone.second.gpuMs / averaged);
+            }
+            ImGui::EndTable();
+        }
+        ImGui::End();
+    }
+
+private:
+    std::vector<float> cpuGraph;
+};
+#endif
@@ -0,0 +1,224 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <glad/glad.h>
+
+#include "cache_file.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// ARB_get_program_binary (core since 4.1), which the 3.3 core glad loader leaves out
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+// Disk cache of linked programs. Shader compiles and links from source once, stores what glGetProgramBinary
+// returns and on later launches hands it back to glProgramBinary, skipping the driver's compiler. An entry is
+// keyed by a hash of the final (preprocessed) sources and the driver's vendor, renderer and version strings, so
+// editing a shader or updating the driver simply misses; a binary the driver still rejects is deleted and the
+// program compiled from source again.
+//
+// Entries live in 'directory' as <key>.progcache: ProgramCacheHeader followed by the binary. Without a context
+// that offers at least one binary format the cache stays disabled and every program is compiled.
+//
+// Only use from the GL context thread.
+const uint32_t PROGRAM_CACHE_MAGIC   = 0x42504C47; // "GLPB"
+const uint32_t PROGRAM_CACHE_VERSION = 1;
+
+struct ProgramCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t binaryFormat;
+    uint32_t binarySize;
+    double   coldBuildMs;   // how long compiling and linking from source took, reported on hits
+};
+
+class ProgramCache
+{
+public:
+    std::string directory = "shader_cache";
+
+    // resolves the entry points through the loader glad was initialised with. Call once the context is current.
+    void loadFunctions(GLADloadproc load)
+    {
+        getProgramBinary = (GetProgramBinaryProc)load("glGetProgramBinary");
+        programBinary = (ProgramBinaryProc)load("glProgramBinary");
+        programParameteri = (ProgramParameteriProc)load("glProgramParameteri");
+        GLint formats = 0;
+        if (getProgramBinary && programBinary && programParameteri)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        enabled = formats > 0;
+        // renderer and driver build decide whether an old binary is still valid
+        driver.clear();
+        for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION})
+        {
+            const char *value = (const char *)glGetString(name);
+            driver += value ? value : "";
+            driver += '\n';
+        }
+        if (!enabled)
+            printf("[program_cache.h] No program binary formats, shaders are compiled on every launch\n");
+    }
+
+    bool isEnabled() const { return enabled; }
+
+    uint64_t makeKey(const std::string &vertexSource, const std::string &fragmentSource) const
+    {
+        uint64_t hash = CacheFile::hashBytes(driver.data(), driver.size());
+        hash = CacheFile::hashBytes(vertexSource.data(), vertexSource.size() + 1, hash); // the NUL separates the stages
+        return CacheFile::hashBytes(fragmentSource.data(), fragmentSource.size() + 1, hash);
+    }
+
+    // loads the cached binary for key into program. False on a miss or when the driver rejects the binary, in which
+    // case the program has to be linked from source (the object can be reused for that).
+    bool load(uint64_t key, GLuint program)
+    {
+        if (!enabled)
+            return false;
+        std::string path = entryPath(key);
+        std::vector<char> data;
+        const ProgramCacheHeader *header = read(path, key, data);
+        if (!header)
+        {
+            missCount++;
+            return false;
+        }
+        programBinary(program, header->binaryFormat, data.data() + sizeof(ProgramCacheHeader), (GLsizei)header->binarySize);
+        GLint linked = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &linked);
+        if (!linked)
+        {
+            printf("[program_cache.h] Driver rejected %s, compiling from source\n", path.c_str());
+            std::error_code ec;
+            std::filesystem::remove(path, ec);
+            rejectCount++;
+            return false;
+        }
+        hitCount++;
+        savedMs += header->coldBuildMs;
+        return true;
+    }
+
+    // call between glCreateProgram and glLinkProgram of a program that will be store()d; some drivers only keep
+    // a retrievable binary when asked before linking
+    void prepare(GLuint program)
+    {
+        if (enabled)
+            programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // writes the binary of a successfully linked program. buildMs is what compiling and linking it cost.
+    void store(uint64_t key, GLuint program, double buildMs)
+    {
+        if (!enabled)
+            return;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        std::vector<char> binary((size_t)length);
+        GLenum format = 0;
+        GLsizei written = 0;
+        getProgramBinary(program, length, &written, &format, binary.data());
+        if (written <= 0)
+            return;
+
+        ProgramCacheHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = PROGRAM_CACHE_MAGIC;
+        header.version = PROGRAM_CACHE_VERSION;
+        header.key = key;
+        header.binaryFormat = format;
+        header.binarySize = (uint32_t)written;
+        header.coldBuildMs = buildMs;
+
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+        std::string path = entryPath(key);
+        FILE *out = fopen(CacheFile::tmpPath(path).c_str(), "wb");
+        bool ok = out != NULL &&
+                  CacheFile::commit(out, path, CacheFile::writeBytes(out, &header, sizeof(header)) &&
+                                               CacheFile::writeBytes(out, binary.data(), (size_t)written));
+        if (!ok)
+            printf("[program_cache.h] Could not write %s\n", path.c_str());
+    }
+
+    // adds one program's construction time (load or compile) to the startup total
+    void addBuildTime(double ms)
+    {
+        programCount++;
+        buildMs += ms;
+    }
+
+    void printStats() const
+    {
+        printf("[program_cache.h] %zu programs in %.2f ms: %zu hits (%.2f ms of compiling saved), %zu misses, %zu rejected\n",
+               programCount, buildMs, hitCount, savedMs, missCount, rejectCount);
+    }
+
+    size_t hits() const { return hitCount; }
+    size_t misses() const { return missCount; }
+    size_t rejects() const { return rejectCount; }
+
+    static ProgramCache &shared()
+    {
+        static ProgramCache cache;
+        return cache;
+    }
+
+private:
+    typedef void (APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+    typedef void (APIENTRYP ProgramBinaryProc)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+    typedef void (APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname, GLint value);
+
+    GetProgramBinaryProc getProgramBinary = nullptr;
+    ProgramBinaryProc programBinary = nullptr;
+    ProgramParameteriProc programParameteri = nullptr;
+    bool enabled = false;
+    std::string driver;
+
+    size_t programCount = 0;
+    size_t hitCount = 0;
+    size_t missCount = 0;
+    size_t rejectCount = 0;
+    double buildMs = 0.0;
+    double savedMs = 0.0;
+
+    std::string entryPath(uint64_t key) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%016llx.progcache", (unsigned long long)key);
+        return directory + "/" + name;
+    }
+
+    // reads a whole entry into data and returns its header, or NULL when it is missing or doesn't match key
+    static const ProgramCacheHeader *read(const std::string &path, uint64_t key, std::vector<char> &data)
+    {
+        FILE *in = fopen(path.c_str(), "rb");
+        if (!in)
+            return NULL;
+        ProgramCacheHeader header;
+        bool ok = fread(&header, sizeof(header), 1, in) == 1 &&
+                  header.magic == PROGRAM_CACHE_MAGIC &&
+                  header.version == PROGRAM_CACHE_VERSION &&
+                  header.key == key &&
+                  header.binarySize > 0;
+        if (ok)
+        {
+            data.resize(sizeof(header) + header.binarySize);
+            memcpy(data.data(), &header, sizeof(header));
+            ok = fread(data.data() + sizeof(header), 1, header.binarySize, in) == header.binarySize;
+        }
+        fclose(in);
+        return ok ? (const ProgramCacheHeader *)data.data() : NULL;
+    }
+};
+#endif
@@ -0,0 +1,266 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+// Declarative description of a frame's render passes. Pure CPU code (no GL calls), so it also runs in the headless
+// bench; RenderTargets (render_targets.h) creates the GL objects for a compiled graph and runs it.
+//
+// A frame declares its targets and then its passes in order, each with the targets it reads and writes. compile():
+//   - culls passes nothing needs: walking backwards, a pass is kept when it writes an output or imported target,
+//     or a target a kept later pass reads; a write that doesn't also read ends the need for what came before
+//   - runs the kept passes in declaration order, which is a valid order because a pass can only read what an
+//     earlier pass wrote
+//   - gives every transient target the span of passes between its first and last use, and lets targets of the
+//     same format and size whose spans don't overlap share one physical target
+//
+//   RenderGraph graph;
+//   int color = graph.createTarget("color", {TARGET_RGBA8});
+//   int screen = graph.importTarget("screen", 0);
+//   graph.addPass("scene", {}, {color}, [&] { ... });
+//   graph.addPass("post", {color}, {screen}, [&] { ... });
+//   graph.compile(width, height);
+
+enum RenderTargetFormat {
+    TARGET_RGB8,
+    TARGET_RGBA8,
+    TARGET_RG16,
+    TARGET_RGBA16F,
+    TARGET_DEPTH24_STENCIL8,
+};
+
+inline unsigned int renderTargetBytes(RenderTargetFormat format)
+{
+    switch (format)
+    {
+    case TARGET_RGB8: return 4; // padded to 32 bits by every driver we know of
+    case TARGET_RGBA8: return 4;
+    case TARGET_RG16: return 4;
+    case TARGET_RGBA16F: return 8;
+    case TARGET_DEPTH24_STENCIL8: return 4;
+    }
+    return 4;
+}
+
+inline bool isDepthFormat(RenderTargetFormat format)
+{
+    return format == TARGET_DEPTH24_STENCIL8;
+}
+
+struct RenderTargetDesc {
+    RenderTargetFormat format = TARGET_RGBA8;
+    float scale = 1.0f; // of the screen size
+};
+
+struct RenderGraphStats {
+    unsigned int passes = 0;
+    unsigned int culledPasses = 0;
+    unsigned int targets = 0;           // transient targets some kept pass uses
+    unsigned int physicalTargets = 0;   // after aliasing
+    uint64_t unaliasedBytes = 0;        // every used transient target allocated on its own
+    uint64_t aliasedBytes = 0;          // the physical targets
+    uint64_t peakLiveBytes = 0;         // most bytes of targets in use by the same pass, the floor aliasing can reach
+};
+
+class RenderGraph
+{
+public:
+    struct Target {
+        const char *name;
+        RenderTargetDesc desc;
+        bool imported = false;          // lives outside the graph, e.g. the default framebuffer
+        unsigned int framebuffer = 0;   // the GL framebuffer of an imported target
+        bool output = false;            // read after the graph ran, so its last pass is never culled
+        // filled in by compile()
+        unsigned int width = 0, height = 0;
+        int firstPass = -1, lastPass = -1; // span of kept passes using it, -1 when none
+        int slot = -1;                     // physical target, -1 for imported and unused targets
+    };
+
+    struct Pass {
+        const char *name;
+        std::vector<int> reads;
+        std::vector<int> writes;
+        std::function<void()> execute;
+        bool culled = false;            // filled in by compile()
+    };
+
+    // a physical target several targets may share
+    struct Slot {
+        RenderTargetFormat format;
+        unsigned int width, height;
+    };
+
+    std::vector<Target> targets;
+    std::vector<Pass> passes;
+    std::vector<Slot> slots;        // filled in by compile()
+    std::vector<int> order;         // kept passes in execution order, filled in by compile()
+    RenderGraphStats stats;         // of the last compile
+
+    int createTarget(const char *name, RenderTargetDesc desc)
+    {
+        Target target;
+        target.name = name;
+        target.desc = desc;
+        targets.push_back(target);
+        return (int)targets.size() - 1;
+    }
+
+    // a target the graph doesn't own: passes writing it draw into 'framebuffer' as it is
+    int importTarget(const char *name, unsigned int framebuffer)
+    {
+        Target target;
+        target.name = name;
+        target.imported = true;
+        target.framebuffer = framebuffer;
+        targets.push_back(target);
+        return (int)targets.size() - 1;
+    }
+
+    // keeps the target and the passes writing it alive, e.g. for reading it back after the frame
+    void markOutput(int target) { targets[target].output = true; }
+
+    int addPass(const char *name, std::vector<int> reads, std::vector<int> writes, std::function<void()> execute)
+    {
+        Pass pass;
+        pass.name = name;
+        pass.reads = std::move(reads);
+        pass.writes = std::move(writes);
+        pass.execute = std::move(execute);
+        passes.push_back(std::move(pass));
+        return (int)passes.size() - 1;
+    }
+
+    // culls, orders and aliases for a width x height screen. False (with a message) when a kept pass reads a
+    // transient target no earlier kept pass wrote.
+    bool compile(unsigned int width, unsigned int height)
+    {
+        for (Target &target : targets)
+        {
+            target.width = std::max(1u, (unsigned int)(width * target.desc.scale));
+            target.height = std::max(1u, (unsigned int)(height * target.desc.scale));
+            target.firstPass = target.lastPass = -1;
+            target.slot = -1;
+        }
+
+        // 1. cull, last pass first
+        std::vector<char> needed(targets.size(), 0);
+        for (size_t t = 0; t < targets.size(); t++)
+            needed[t] = targets[t].output || targets[t].imported;
+        for (size_t p = passes.size(); p-- > 0;)
+        {
+            Pass &pass = passes[p];
+            pass.culled = true;
+            for (int t : pass.writes)
+                pass.culled = pass.culled && !needed[t];
+            if (pass.culled)
+                continue;
+            // earlier contents of what this pass overwrites are dead, unless it also reads them
+            for (int t : pass.writes)
+                needed[t] = targets[t].output || targets[t].imported;
+            for (int t : pass.reads)
+                needed[t] = 1;
+        }
+
+        // 2. order and lifetimes
+        order.clear();
+        bool valid = true;
+        std::vector<char> written(targets.size(), 0);
+        for (size_t p = 0; p < passes.size(); p++)
+        {
+            const Pass &pass = passes[p];
+            if (pass.culled)
+                continue;
+            int index = (int)order.size();
+            order.push_back((int)p);
+            for (int t : pass.reads)
+            {
+                if (!written[t] && !targets[t].imported)
+                {
+                    printf("[render_graph.h] Pass %s reads %s before anything wrote it\n", pass.name, targets[t].name);
+                    valid = false;
+                }
+                use(targets[t], index);
+            }
+            for (int t : pass.writes)
+            {
+                written[t] = 1;
+                use(targets[t], index);
+            }
+        }
+        for (Target &target : targets)
+            if (target.output && target.firstPass >= 0)
+                target.lastPass = (int)order.size(); // read after the last pass
+
+        // 3. alias: in order of first use, take the first compatible slot whose last user is done
+        std::vector<int> sorted;
+        for (size_t t = 0; t < targets.size(); t++)
+            if (!targets[t].imported && targets[t].firstPass >= 0)
+                sorted.push_back((int)t);
+        std::stable_sort(sorted.begin(), sorted.end(), [&](int a, int b) { return targets[a].firstPass < targets[b].firstPass; });
+        slots.clear();
+        std::vector<int> slotFreeAfter; // last pass using each slot so far
+        for (int t : sorted)
+        {
+            Target &target = targets[t];
+            for (size_t s = 0; s < slots.size() && target.slot < 0; s++)
+                if (slots[s].format == target.desc.format && slots[s].width == target.width && slots[s].height == target.height &&
+                    slotFreeAfter[s] < target.firstPass)
+                    target.slot = (int)s;
+            if (target.slot < 0)
+            {
+                target.slot = (int)slots.size();
+                slots.push_back({target.desc.format, target.width, target.height});
+                slotFreeAfter.push_back(-1);
+            }
+            slotFreeAfter[target.slot] = target.lastPass;
+        }
+
+        stats = RenderGraphStats();
+        stats.passes = (unsigned int)passes.size();
+        stats.culledPasses = (unsigned int)(passes.size() - order.size());
+        stats.targets = (unsigned int)sorted.size();
+        stats.physicalTargets = (unsigned int)slots.size();
+        for (int t : sorted)
+            stats.unaliasedBytes += bytes(targets[t]);
+        for (const Slot &slot : slots)
+            stats.aliasedBytes += (uint64_t)slot.width * slot.height * renderTargetBytes(slot.format);
+        for (int p = 0; p <= (int)order.size(); p++)
+        {
+            uint64_t live = 0;
+            for (int t : sorted)
+                if (targets[t].firstPass <= p && p <= targets[t].lastPass)
+                    live += bytes(targets[t]);
+            stats.peakLiveBytes = std::max(stats.peakLiveBytes, live);
+        }
+        return valid;
+    }
+
+    void printStats() const
+    {
+        double mb = 1.0 / (1024.0 * 1024.0);
+        printf("[render_graph.h] %u passes (%u culled):", stats.passes, stats.culledPasses);
+        for (int p : order)
+            printf(" %s", passes[p].name);
+        printf("; %u targets in %u: %.1f MB without aliasing, %.1f MB aliased (%.1f MB live at the peak)\n", stats.targets,
+               stats.physicalTargets, stats.unaliasedBytes * mb, stats.aliasedBytes * mb, stats.peakLiveBytes * mb);
+    }
+
+private:
+    static void use(Target &target, int pass)
+    {
+        if (target.firstPass < 0)
+            target.firstPass = pass;
+        target.lastPass = pass;
+    }
+
+    static uint64_t bytes(const Target &target)
+    {
+        return (uint64_t)target.width * target.height * renderTargetBytes(target.desc.format);
+    }
+};
+#endif
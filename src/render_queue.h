@@ -0,0 +1,328 @@
+#ifndef RENDER_QUEUE_H
+#define RENDER_QUEUE_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "profiler.h"
+#include "uniform_buffer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <map>
+#include <utility>
+#include <vector>
+
+// most textures a material binds: four of each texture_diffuse/specular/normal/height (see Shader::materialTextureUnit)
+#define MAX_MATERIAL_TEXTURES 16
+
+// the set of textures a draw binds, and to which units
+struct Material {
+    unsigned int count = 0;
+    int units[MAX_MATERIAL_TEXTURES];
+    unsigned int textures[MAX_MATERIAL_TEXTURES];
+};
+
+// Interns texture sets into small ids, so draws can be sorted and compared by material without looking at the
+// textures. Meshes intern their material once at construction.
+class MaterialTable
+{
+public:
+    static MaterialTable &shared()
+    {
+        static MaterialTable table;
+        return table;
+    }
+
+    // id of the material binding each texture to its unit; negative units are skipped
+    unsigned int intern(const std::vector<std::pair<int, unsigned int>> &bindings)
+    {
+        std::vector<std::pair<int, unsigned int>> key;
+        for (const auto &binding : bindings)
+            if (binding.first >= 0 && key.size() < MAX_MATERIAL_TEXTURES)
+                key.push_back(binding);
+        std::sort(key.begin(), key.end());
+        auto it = ids.find(key);
+        if (it != ids.end())
+            return it->second;
+
+        Material material;
+        for (const auto &binding : key)
+        {
+            material.units[material.count] = binding.first;
+            material.textures[material.count] = binding.second;
+            material.count++;
+        }
+        unsigned int id = (unsigned int)materials.size();
+        materials.push_back(material);
+        ids[key] = id;
+        return id;
+    }
+
+    const Material &get(unsigned int id) const { return materials[id]; }
+
+private:
+    std::vector<Material> materials;
+    std::map<std::vector<std::pair<int, unsigned int>>, unsigned int> ids;
+
+    MaterialTable()
+    {
+        intern({}); // material 0 binds nothing
+    }
+};
+
+// everything needed to issue one draw
+struct DrawPacket {
+    uint64_t key = 0;           // filled in by RenderQueue::add
+    unsigned int program = 0;
+    unsigned int material = 0;  // MaterialTable id
+    unsigned int VAO = 0;
+    int objectSlot = -1;        // ObjectUniformBuffer slot, -1 leaves the ObjectUniforms binding alone
+    float depth = 0.0f;         // view space distance, for front-to-back / back-to-front ordering
+    bool translucent = false;
+    // glDrawArrays when indexType is 0, glDrawElementsBaseVertex otherwise
+    GLenum indexType = 0;
+    unsigned int first = 0;     // first vertex, or first index
+    unsigned int count = 0;
+    int baseVertex = 0;
+
+    static DrawPacket arrays(unsigned int program, unsigned int material, unsigned int VAO, unsigned int first, unsigned int count)
+    {
+        DrawPacket packet;
+        packet.program = program;
+        packet.material = material;
+        packet.VAO = VAO;
+        packet.first = first;
+        packet.count = count;
+        return packet;
+    }
+
+    static DrawPacket elements(unsigned int program, unsigned int material, unsigned int VAO, GLenum indexType, unsigned int firstIndex, unsigned int count, int baseVertex = 0)
+    {
+        DrawPacket packet = arrays(program, material, VAO, firstIndex, count);
+        packet.indexType = indexType;
+        packet.baseVertex = baseVertex;
+        return packet;
+    }
+};
+
+struct RenderQueueStats {
+    unsigned int packets = 0;
+    unsigned int drawCalls = 0;        // GL draw calls after merging runs into multi-draws
+    unsigned int triangles = 0;
+    unsigned int programSwitches = 0;
+    unsigned int textureSwitches = 0;  // glBindTexture calls
+    unsigned int vaoSwitches = 0;
+    unsigned int objectSwitches = 0;   // ObjectUniforms range binds
+};
+
+// Collects the draws of a frame, sorts them by a packed 64-bit key and submits them with redundant state changes
+// removed. Key layout, most significant bit first:
+//   opaque:      0 | program (10) | material (16) | VAO (12) | depth (24, front to back) | 1 unused
+//   translucent: 1 | depth (24, back to front) | program (10) | material (16) | VAO (12) | 1 unused
+// Ids are truncated to their fields; a collision only costs sort quality, submit compares the real state.
+class RenderQueue
+{
+public:
+    RenderQueueStats stats; // of the last submit
+
+    // the object constants the packets' objectSlot refer to
+    void setObjectUniforms(const ObjectUniformBuffer *objects) { this->objects = objects; }
+
+    // depths are quantised over [0, far]
+    void setDepthRange(float far) { depthScale = far > 0.0f ? 1.0f / far : 1.0f; }
+
+    // view space distance of a world space point, for DrawPacket::depth
+    static float viewDepth(const glm::mat4 &view, const glm::vec3 &position)
+    {
+        return -(view * glm::vec4(position, 1.0f)).z;
+    }
+
+    void add(DrawPacket packet)
+    {
+        packet.key = makeKey(packet);
+        packets.push_back(packet);
+    }
+
+    size_t size() const { return packets.size(); }
+
+    // sorts, draws and clears the queue
+    void submit()
+    {
+        PROFILE_ZONE("RenderQueue::submit");
+        stats = RenderQueueStats();
+        stats.packets = (unsigned int)packets.size();
+        sort();
+
+        // state is unknown at the start of the frame, the first packet binds everything
+        unsigned int program = ~0u, VAO = ~0u, material = ~0u;
+        int objectSlot = -1;
+        unsigned int bound[MAX_MATERIAL_TEXTURES];
+        std::fill(bound, bound + MAX_MATERIAL_TEXTURES, ~0u);
+        bool blending = false;
+
+        for (size_t i = 0; i < order.size(); i++)
+        {
+            const DrawPacket &packet = packets[order[i].index];
+            stats.triangles += packet.count / 3;
+            if (packet.translucent != blending)
+            {
+                flushBatch();
+                blending = packet.translucent;
+                if (blending)
+                {
+                    glEnable(GL_BLEND);
+                    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                    glDepthMask(GL_FALSE);
+                }
+            }
+            if (packet.program != program)
+            {
+                flushBatch();
+                glUseProgram(packet.program);
+                program = packet.program;
+                stats.programSwitches++;
+            }
+            if (packet.material != material)
+            {
+                flushBatch();
+                const Material &m = MaterialTable::shared().get(packet.material);
+                for (unsigned int t = 0; t < m.count; t++)
+                {
+                    if (bound[m.units[t]] == m.textures[t])
+                        continue;
+                    glActiveTexture(GL_TEXTURE0 + m.units[t]);
+                    glBindTexture(GL_TEXTURE_2D, m.textures[t]);
+                    bound[m.units[t]] = m.textures[t];
+                    stats.textureSwitches++;
+                }
+                material = packet.material;
+            }
+            if (packet.VAO != VAO)
+            {
+                flushBatch();
+                glBindVertexArray(packet.VAO);
+                VAO = packet.VAO;
+                stats.vaoSwitches++;
+            }
+            if (packet.objectSlot >= 0 && packet.objectSlot != objectSlot && objects)
+            {
+                flushBatch();
+                objects->bind((unsigned int)packet.objectSlot);
+                objectSlot = packet.objectSlot;
+                stats.objectSwitches++;
+            }
+
+            if (packet.indexType == 0)
+            {
+                flushBatch();
+                glDrawArrays(GL_TRIANGLES, packet.first, packet.count);
+                stats.drawCalls++;
+                continue;
+            }
+            // indexed draws with identical state accumulate into one glMultiDrawElementsBaseVertex
+            if (packet.indexType != batchIndexType)
+                flushBatch();
+            batchIndexType = packet.indexType;
+            unsigned int indexSize = packet.indexType == GL_UNSIGNED_SHORT ? 2 : 4;
+            counts.push_back((GLsizei)packet.count);
+            offsets.push_back((const void *)((size_t)packet.first * indexSize));
+            baseVertices.push_back(packet.baseVertex);
+        }
+        flushBatch();
+
+        if (blending)
+        {
+            glDisable(GL_BLEND);
+            glDepthMask(GL_TRUE);
+        }
+        glBindVertexArray(0);
+        glActiveTexture(GL_TEXTURE0);
+        packets.clear();
+
+        Profiler &profiler = Profiler::shared();
+        profiler.counters.drawCalls += stats.drawCalls;
+        profiler.counters.triangles += stats.triangles;
+        profiler.countStateChanges(stats.programSwitches + stats.textureSwitches + stats.vaoSwitches + stats.objectSwitches);
+    }
+
+    void printStats() const
+    {
+        printf("[render_queue.h] %u packets (%u triangles) -> %u draw calls, switches: %u program, %u texture, %u VAO, %u object\n",
+               stats.packets, stats.triangles, stats.drawCalls, stats.programSwitches, stats.textureSwitches, stats.vaoSwitches, stats.objectSwitches);
+    }
+
+private:
+    struct SortItem {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    std::vector<DrawPacket> packets;
+    std::vector<SortItem> order, scratch;
+    const ObjectUniformBuffer *objects = nullptr;
+    float depthScale = 1.0f / 100.0f;
+
+    GLenum batchIndexType = 0;
+    std::vector<GLsizei> counts;
+    std::vector<const void *> offsets;
+    std::vector<GLint> baseVertices;
+
+    uint64_t makeKey(const DrawPacket &packet) const
+    {
+        float normalized = std::min(std::max(packet.depth * depthScale, 0.0f), 1.0f);
+        uint64_t depth = (uint64_t)(normalized * 0xFFFFFF);
+        uint64_t program = packet.program & 0x3FF;
+        uint64_t material = packet.material & 0xFFFF;
+        uint64_t VAO = packet.VAO & 0xFFF;
+        if (packet.translucent)
+            return (1ull << 63) | ((0xFFFFFF - depth) << 39) | (program << 29) | (material << 13) | (VAO << 1);
+        return (program << 53) | (material << 37) | (VAO << 25) | (depth << 1);
+    }
+
+    // LSD radix sort on the keys, 8 bits per pass. Passes where every key has the same byte are skipped, which
+    // covers the unused high bits of small scenes.
+    void sort()
+    {
+        size_t n = packets.size();
+        order.resize(n);
+        scratch.resize(n);
+        for (size_t i = 0; i < n; i++)
+            order[i] = {packets[i].key, (uint32_t)i};
+
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            size_t histogram[256] = {0};
+            for (const SortItem &item : order)
+                histogram[(item.key >> shift) & 0xFF]++;
+            if (n == 0 || histogram[(order[0].key >> shift) & 0xFF] == n)
+                continue;
+            size_t offset = 0;
+            for (int b = 0; b < 256; b++)
+            {
+                size_t count = histogram[b];
+                histogram[b] = offset;
+                offset += count;
+            }
+            for (const SortItem &item : order)
+                scratch[histogram[(item.key >> shift) & 0xFF]++] = item;
+            order.swap(scratch);
+        }
+    }
+
+    void flushBatch()
+    {
+        if (counts.empty())
+            return;
+        if (counts.size() == 1)
+            glDrawElementsBaseVertex(GL_TRIANGLES, counts[0], batchIndexType, (void *)offsets[0], baseVertices[0]);
+        else
+            glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), batchIndexType, (const void *const *)offsets.data(), (GLsizei)counts.size(), baseVertices.data());
+        stats.drawCalls++;
+        counts.clear();
+        offsets.clear();
+        baseVertices.clear();
+    }
+};
+#endif
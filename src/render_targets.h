@@ -0,0 +1,213 @@
+#ifndef RENDER_TARGETS_H
+#define RENDER_TARGETS_H
+
+#include <glad/glad.h>
+
+#include "profiler.h"
+#include "render_graph.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <map>
+#include <vector>
+
+// frames a pooled texture outlives its last use
+#define RENDER_TARGETS_KEEP_FRAMES 120
+
+// The GL side of RenderGraph: a texture per physical target of the compiled graph and a framebuffer per set of
+// targets a pass writes. GL can't place two textures in the same memory, so aliased targets share one texture
+// object. The textures are pooled by format and size and reused from frame to frame; when the screen size changes
+// (framebuffer_size_callback) the next allocate() makes new ones and drops the old.
+//
+// Only use from the GL context thread.
+class RenderTargets
+{
+public:
+    RenderTargets() = default;
+    ~RenderTargets() { release(); }
+
+    RenderTargets(const RenderTargets &) = delete;
+    RenderTargets &operator=(const RenderTargets &) = delete;
+
+    // finds a texture for each of graph's slots (after compile()), making the ones the pool doesn't have; true when
+    // any was made. Textures this graph doesn't use stay pooled for RENDER_TARGETS_KEEP_FRAMES calls, so frames
+    // switching between graphs (forward and deferred) don't reallocate, unless their size is gone altogether.
+    bool allocate(const RenderGraph &graph)
+    {
+        bool made = false, deleted = false;
+        taken.assign(pool.size(), 0);
+        slotTextures.assign(graph.slots.size(), 0);
+        for (size_t s = 0; s < graph.slots.size(); s++)
+        {
+            const RenderGraph::Slot &slot = graph.slots[s];
+            size_t i = 0;
+            while (i < pool.size() && (taken[i] || !sameSlot(pool[i].slot, slot)))
+                i++;
+            if (i == pool.size())
+            {
+                PooledTexture pooled = {slot, 0, 0};
+                glGenTextures(1, &pooled.texture);
+                allocateTexture(pooled.texture, slot);
+                pool.push_back(pooled);
+                taken.push_back(0);
+                made = true;
+            }
+            taken[i] = 1;
+            slotTextures[s] = pool[i].texture;
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        for (size_t i = pool.size(); i-- > 0;)
+        {
+            if (taken[i])
+            {
+                pool[i].unusedFrames = 0;
+                continue;
+            }
+            bool sizeInUse = false;
+            for (const RenderGraph::Slot &slot : graph.slots)
+                sizeInUse = sizeInUse || (slot.width == pool[i].slot.width && slot.height == pool[i].slot.height);
+            if (sizeInUse && ++pool[i].unusedFrames <= RENDER_TARGETS_KEEP_FRAMES)
+                continue;
+            glDeleteTextures(1, &pool[i].texture);
+            pool.erase(pool.begin() + i);
+            deleted = true;
+        }
+        // a deleted texture's name may come back for a new one, so no cached framebuffer may refer to it
+        if (deleted)
+            releaseFramebuffers();
+        return made;
+    }
+
+    // texture of a transient target of the last allocated graph, 0 for imported and culled ones
+    unsigned int texture(const RenderGraph &graph, int target) const
+    {
+        int slot = graph.targets[target].slot;
+        return slot >= 0 && slot < (int)slotTextures.size() ? slotTextures[slot] : 0;
+    }
+
+    // bytes of every pooled texture, used by the last graph or not
+    uint64_t pooledBytes() const
+    {
+        uint64_t bytes = 0;
+        for (const PooledTexture &pooled : pool)
+            bytes += (uint64_t)pooled.slot.width * pooled.slot.height * renderTargetBytes(pooled.slot.format);
+        return bytes;
+    }
+
+    // framebuffer drawing into targets: the colour targets in order, then the depth target if any. A pass writing an
+    // imported target draws into that target's framebuffer.
+    unsigned int framebuffer(const RenderGraph &graph, const std::vector<int> &targets)
+    {
+        std::vector<unsigned int> key;
+        for (int t : targets)
+        {
+            if (graph.targets[t].imported)
+                return graph.targets[t].framebuffer;
+            key.push_back(texture(graph, t));
+        }
+        auto cached = framebuffers.find(key);
+        if (cached != framebuffers.end())
+            return cached->second;
+
+        unsigned int FBO;
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        std::vector<GLenum> drawBuffers;
+        for (size_t i = 0; i < targets.size(); i++)
+        {
+            if (isDepthFormat(graph.targets[targets[i]].desc.format))
+                glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, key[i], 0);
+            else
+            {
+                GLenum attachment = GL_COLOR_ATTACHMENT0 + (GLenum)drawBuffers.size();
+                glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, key[i], 0);
+                drawBuffers.push_back(attachment);
+            }
+        }
+        if (drawBuffers.empty())
+            glDrawBuffer(GL_NONE);
+        else
+            glDrawBuffers((GLsizei)drawBuffers.size(), drawBuffers.data());
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        {
+            printf("[render_targets.h] Framebuffer of");
+            for (int t : targets)
+                printf(" %s", graph.targets[t].name);
+            printf(" is not complete\n");
+        }
+        framebuffers[key] = FBO;
+        return FBO;
+    }
+
+    // runs graph's kept passes in order, each with the framebuffer of what it writes bound, the viewport set to its
+    // size and a GPU profiler zone of its name around it. Leaves the last pass's framebuffer bound.
+    void execute(RenderGraph &graph)
+    {
+        Profiler &profiler = Profiler::shared();
+        for (int p : graph.order)
+        {
+            RenderGraph::Pass &pass = graph.passes[p];
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer(graph, pass.writes));
+            // kept passes write something, or nothing would have needed them
+            const RenderGraph::Target &size = graph.targets[pass.writes[0]];
+            glViewport(0, 0, size.width, size.height);
+            profiler.beginGpuZone(pass.name);
+            pass.execute();
+            profiler.endGpuZone();
+        }
+    }
+
+    void release()
+    {
+        releaseFramebuffers();
+        for (PooledTexture &pooled : pool)
+            glDeleteTextures(1, &pooled.texture);
+        pool.clear();
+        slotTextures.clear();
+    }
+
+private:
+    struct PooledTexture {
+        RenderGraph::Slot slot;     // what it was allocated as
+        unsigned int texture;
+        unsigned int unusedFrames;
+    };
+
+    std::vector<PooledTexture> pool;
+    std::vector<char> taken;
+    std::vector<unsigned int> slotTextures;     // per slot of the last allocated graph
+    std::map<std::vector<unsigned int>, unsigned int> framebuffers;
+
+    static bool sameSlot(const RenderGraph::Slot &a, const RenderGraph::Slot &b)
+    {
+        return a.format == b.format && a.width == b.width && a.height == b.height;
+    }
+
+    void releaseFramebuffers()
+    {
+        for (auto &entry : framebuffers)
+            glDeleteFramebuffers(1, &entry.second);
+        framebuffers.clear();
+    }
+
+    static void allocateTexture(unsigned int texture, const RenderGraph::Slot &slot)
+    {
+        GLenum internalFormat = GL_RGBA8, format = GL_RGBA, type = GL_UNSIGNED_BYTE;
+        switch (slot.format)
+        {
+        case TARGET_RGB8: internalFormat = GL_RGB8; format = GL_RGB; break;
+        case TARGET_RGBA8: break;
+        case TARGET_RG16: internalFormat = GL_RG16; format = GL_RG; type = GL_UNSIGNED_SHORT; break;
+        case TARGET_RGBA16F: internalFormat = GL_RGBA16F; type = GL_HALF_FLOAT; break;
+        case TARGET_DEPTH24_STENCIL8: internalFormat = GL_DEPTH24_STENCIL8; format = GL_DEPTH_STENCIL; type = GL_UNSIGNED_INT_24_8; break;
+        }
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, slot.width, slot.height, 0, format, type, NULL);
+        // colour targets are sampled by post effects, depth is only read with texelFetch
+        GLint filter = isDepthFormat(slot.format) ? GL_NEAREST : GL_LINEAR;
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+    }
+};
+#endif
@@ -4,71 +4,83 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "program_cache.h"
+
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
 #include <string>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <unordered_map>
+#include <vector>
+
+// uniform buffer binding points of the std140 blocks shared by all programs (see uniform_buffer.h)
+const unsigned int FRAME_UNIFORM_BINDING  = 0;
+const unsigned int OBJECT_UNIFORM_BINDING = 1;
+const unsigned int CLUSTER_UNIFORM_BINDING = 2;
+
+// texture units of the material samplers: texture_diffuseN uses unit N-1, texture_specularN unit 3+N, etc.
+const int MATERIAL_TEXTURES_PER_TYPE = 4;
+// texture units of the clustered lighting buffer textures (see cluster_buffers.h), right after the material units
+const int CLUSTER_LIGHTS_TEXTURE_UNIT  = 4 * MATERIAL_TEXTURES_PER_TYPE;
+const int CLUSTER_OFFSETS_TEXTURE_UNIT = CLUSTER_LIGHTS_TEXTURE_UNIT + 1;
+const int CLUSTER_INDICES_TEXTURE_UNIT = CLUSTER_LIGHTS_TEXTURE_UNIT + 2;
+// texture units of the G-buffer targets in the deferred lighting pass (see gbuffer.h), which binds no materials
+const int GBUFFER_ALBEDO_SPECULAR_TEXTURE_UNIT = 0;
+const int GBUFFER_NORMAL_TEXTURE_UNIT          = 1;
+const int GBUFFER_DEPTH_TEXTURE_UNIT           = 2;
 
 class Shader
 {
 public:
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // glUniform*/uniform buffer calls issued since the last reset, for the per-frame counter
+    static inline unsigned int uniformCalls = 0;
+    // constructor generates the shader on the fly. Sources may #include "file" (relative to the including file) and
+    // every entry of defines ("NAME" or "NAME VALUE") becomes a #define right after the #version line.
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
+    Shader(const char* vertexPath, const char* fragmentPath, const std::vector<std::string> &defines = {})
     {
-        // 1. retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        try 
-        {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();		
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
-        }
-        catch (std::ifstream::failure& e)
+        // 1. retrieve the vertex/fragment source code from filePath, includes resolved and defines injected
+        std::string vertexCode = preprocess(vertexPath, defines);
+        std::string fragmentCode = preprocess(fragmentPath, defines);
+        // 2. reuse the program an earlier launch linked from the same sources, if the driver still takes it
+        auto start = std::chrono::steady_clock::now();
+        ProgramCache &cache = ProgramCache::shared();
+        uint64_t key = cache.makeKey(vertexCode, fragmentCode);
+        ID = glCreateProgram();
+        if (!cache.load(key, ID))
         {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
+            const char* vShaderCode = vertexCode.c_str();
+            const char * fShaderCode = fragmentCode.c_str();
+            // 3. compile shaders
+            unsigned int vertex, fragment;
+            // vertex shader
+            vertex = glCreateShader(GL_VERTEX_SHADER);
+            glShaderSource(vertex, 1, &vShaderCode, NULL);
+            glCompileShader(vertex);
+            checkCompileErrors(vertex, "VERTEX");
+            // fragment Shader
+            fragment = glCreateShader(GL_FRAGMENT_SHADER);
+            glShaderSource(fragment, 1, &fShaderCode, NULL);
+            glCompileShader(fragment);
+            checkCompileErrors(fragment, "FRAGMENT");
+            // shader Program
+            glAttachShader(ID, vertex);
+            glAttachShader(ID, fragment);
+            cache.prepare(ID);
+            glLinkProgram(ID);
+            if (checkCompileErrors(ID, "PROGRAM"))
+                cache.store(key, ID, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+            // delete the shaders as they're linked into our program now and no longer necessary
+            glDeleteShader(vertex);
+            glDeleteShader(fragment);
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessary
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-
+        cache.addBuildTime(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        // look up every uniform once so the setters never have to ask the driver
+        reflect();
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -76,69 +88,273 @@ public:
     { 
         glUseProgram(ID); 
     }
+    // returns the location of an active uniform, or -1. Resolve locations once and keep them for the render loop:
+    // the location based setters below don't hash or allocate.
+    GLint location(const std::string &name) const
+    {
+        auto it = uniforms.find(name);
+        return it != uniforms.end() ? it->second : -1;
+    }
     // utility uniform functions
     // ------------------------------------------------------------------------
     void setBool(const std::string &name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        setInt(location(name), (int)value); 
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string &name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        setInt(location(name), value); 
+    }
+    void setInt(GLint location, int value) const
+    { 
+        uniformCalls++;
+        glUniform1i(location, value); 
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        setFloat(location(name), value); 
+    }
+    void setFloat(GLint location, float value) const
+    { 
+        uniformCalls++;
+        glUniform1f(location, value); 
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string &name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec2(location(name), value); 
+    }
+    void setVec2(GLint location, const glm::vec2 &value) const
+    { 
+        uniformCalls++;
+        glUniform2fv(location, 1, &value[0]); 
     }
     void setVec2(const std::string &name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        setVec2(location(name), glm::vec2(x, y)); 
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string &name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec3(location(name), value); 
+    }
+    void setVec3(GLint location, const glm::vec3 &value) const
+    { 
+        uniformCalls++;
+        glUniform3fv(location, 1, &value[0]); 
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        setVec3(location(name), glm::vec3(x, y, z)); 
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string &name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec4(location(name), value); 
+    }
+    void setVec4(GLint location, const glm::vec4 &value) const
+    { 
+        uniformCalls++;
+        glUniform4fv(location, 1, &value[0]); 
     }
     void setVec4(const std::string &name, float x, float y, float z, float w) const
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        setVec4(location(name), glm::vec4(x, y, z, w)); 
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        uniformCalls++;
+        glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        uniformCalls++;
+        glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat4(location(name), mat);
+    }
+    void setMat4(GLint location, const glm::mat4 &mat) const
+    {
+        uniformCalls++;
+        glUniformMatrix4fv(location, 1, GL_FALSE, &mat[0][0]);
+    }
+
+    // texture unit for the Nth (1 based) material texture of a type, following the texture_diffuseN convention.
+    // Returns -1 for unknown types or numbers past MATERIAL_TEXTURES_PER_TYPE.
+    static int materialTextureUnit(const std::string &type, unsigned int number)
+    {
+        static const char *types[] = {"texture_diffuse", "texture_specular", "texture_normal", "texture_height"};
+        if (number < 1 || number > (unsigned int)MATERIAL_TEXTURES_PER_TYPE)
+            return -1;
+        for (int i = 0; i < 4; i++)
+            if (type == types[i])
+                return i * MATERIAL_TEXTURES_PER_TYPE + (int)number - 1;
+        return -1;
+    }
+
+    // unit of a sampler that isn't a material texture, -1 for names that have none
+    static int fixedTextureUnit(const std::string &name)
+    {
+        static const struct {
+            const char *name;
+            int unit;
+        } units[] = {
+            {"clusterLights", CLUSTER_LIGHTS_TEXTURE_UNIT},
+            {"clusterOffsets", CLUSTER_OFFSETS_TEXTURE_UNIT},
+            {"clusterLightIndices", CLUSTER_INDICES_TEXTURE_UNIT},
+            {"gAlbedoSpecular", GBUFFER_ALBEDO_SPECULAR_TEXTURE_UNIT},
+            {"gNormal", GBUFFER_NORMAL_TEXTURE_UNIT},
+            {"gDepth", GBUFFER_DEPTH_TEXTURE_UNIT},
+        };
+        for (const auto &entry : units)
+            if (name == entry.name)
+                return entry.unit;
+        return -1;
+    }
+
+    // the source of path with every #include "file" line replaced by that file and the defines inserted after
+    // #version. A file is included once per stage, so shared headers need no guards. #line directives keep compiler
+    // messages pointing at the right line; their source string number is the file's position in the include order
+    // (0 is path itself).
+    static std::string preprocess(const std::string &path, const std::vector<std::string> &defines)
+    {
+        std::vector<std::string> files;
+        std::string source;
+        if (!appendSource(path, files, source))
+            return std::string();
+        std::string header;
+        for (const std::string &define : defines)
+            header += "#define " + define + "\n";
+        // #version has to stay the first directive
+        size_t insert = source.find("#version");
+        insert = insert == std::string::npos ? 0 : source.find('\n', insert);
+        insert = insert == std::string::npos ? source.size() : insert + (insert > 0 ? 1 : 0);
+        size_t nextLine = (size_t)std::count(source.begin(), source.begin() + insert, '\n') + 1;
+        header += "#line " + std::to_string(nextLine) + " 0\n";
+        return source.insert(insert, header);
     }
 
 private:
-    // utility function for checking shader compilation/linking errors.
+    std::unordered_map<std::string, GLint> uniforms;
+
+    // appends the lines of path to out, resolving includes recursively; files lists every file read so far
+    static bool appendSource(const std::string &path, std::vector<std::string> &files, std::string &out)
+    {
+        std::ifstream file(path);
+        if (!file)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << path << std::endl;
+            return false;
+        }
+        std::string sourceNumber = std::to_string(files.size());
+        files.push_back(path);
+        std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+        std::string line;
+        for (int lineNumber = 1; std::getline(file, line); lineNumber++)
+        {
+            size_t start = line.find_first_not_of(" \t");
+            if (start == std::string::npos || line.compare(start, 8, "#include") != 0)
+            {
+                out += line;
+                out += '\n';
+                continue;
+            }
+            size_t open = line.find('"', start + 8);
+            size_t close = open == std::string::npos ? open : line.find('"', open + 1);
+            if (close == std::string::npos)
+            {
+                std::cout << "ERROR::SHADER::BAD_INCLUDE: " << path << ":" << lineNumber << ": " << line << std::endl;
+                return false;
+            }
+            std::string includePath = directory + line.substr(open + 1, close - open - 1);
+            if (std::find(files.begin(), files.end(), includePath) != files.end())
+            {
+                out += '\n'; // already included, keep the line count
+                continue;
+            }
+            out += "#line 1 " + std::to_string(files.size()) + "\n";
+            if (!appendSource(includePath, files, out))
+                return false;
+            out += "#line " + std::to_string(lineNumber + 1) + " " + sourceNumber + "\n";
+        }
+        return true;
+    }
+
+    // caches the location of every active uniform, binds the shared uniform blocks to their binding points
+    // and points material, cluster and G-buffer samplers at their fixed texture units
+    void reflect()
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<char> buffer(maxLength + 1);
+        glUseProgram(ID);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, (GLuint)i, (GLsizei)buffer.size(), &length, &size, &type, buffer.data());
+            std::string name(buffer.data(), length);
+            GLint location = glGetUniformLocation(ID, name.c_str());
+            if (location < 0)
+                continue; // member of a uniform block
+            // arrays are reported as "name[0]"; make every element (and the bare name) resolvable
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0)
+            {
+                std::string base = name.substr(0, name.size() - 3);
+                uniforms[base] = location;
+                for (GLint element = 1; element < size; element++)
+                {
+                    std::string elementName = base + "[" + std::to_string(element) + "]";
+                    uniforms[elementName] = glGetUniformLocation(ID, elementName.c_str());
+                }
+            }
+            uniforms[name] = location;
+
+            // material samplers: texture_diffuse1 etc.
+            if (type == GL_SAMPLER_2D)
+            {
+                size_t digits = name.find_first_of("0123456789");
+                if (digits != std::string::npos)
+                {
+                    int unit = materialTextureUnit(name.substr(0, digits), (unsigned int)atoi(name.c_str() + digits));
+                    if (unit >= 0)
+                        glUniform1i(location, unit);
+                }
+            }
+            // clustered lighting buffers and G-buffer targets
+            int unit = fixedTextureUnit(name);
+            if (unit >= 0 && (type == GL_SAMPLER_2D || type == GL_SAMPLER_BUFFER || type == GL_UNSIGNED_INT_SAMPLER_BUFFER))
+                glUniform1i(location, unit);
+        }
+        glUseProgram(0);
+
+        GLint blockCount = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+        for (GLint i = 0; i < blockCount; i++)
+        {
+            GLchar name[256];
+            glGetActiveUniformBlockName(ID, (GLuint)i, sizeof(name), NULL, name);
+            if (std::string(name) == "FrameUniforms")
+                glUniformBlockBinding(ID, (GLuint)i, FRAME_UNIFORM_BINDING);
+            else if (std::string(name) == "ObjectUniforms")
+                glUniformBlockBinding(ID, (GLuint)i, OBJECT_UNIFORM_BINDING);
+            else if (std::string(name) == "ClusterUniforms")
+                glUniformBlockBinding(ID, (GLuint)i, CLUSTER_UNIFORM_BINDING);
+        }
+    }
+
+    // utility function for checking shader compilation/linking errors; true when there were none.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    bool checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -160,6 +376,7 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success == GL_TRUE;
     }
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,120 @@
+#ifndef SHADER_PERMUTATIONS_H
+#define SHADER_PERMUTATIONS_H
+
+#include <glm/glm.hpp>
+
+#include "shader.h"
+#include "uniform_buffer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// most bone matrices a SKINNING permutation takes (MAX_BONES in the shader)
+const int MAX_SHADER_BONES = 64;
+
+// Feature bits of a permutation. The material bits come from a mesh (Mesh::shaderFeatures), the point light count
+// and SHADER_CLUSTERED from the frame; a draw uses the permutation of both or'ed together.
+enum ShaderFeatures {
+    SHADER_SPECULAR_MAP = 1 << 0,   // HAS_SPECULAR_MAP: sample texture_specular1, else no specular terms at all
+    SHADER_NORMAL_MAP   = 1 << 1,   // HAS_NORMAL_MAP: perturb the normal with texture_normal1 (needs tangents)
+    SHADER_SKINNING     = 1 << 2,   // SKINNING: blend over the bones[] matrices (needs bone ids and weights)
+    SHADER_MATERIAL_FEATURES = SHADER_SPECULAR_MAP | SHADER_NORMAL_MAP | SHADER_SKINNING,
+    SHADER_CLUSTERED    = 1 << 3,   // CLUSTERED: add the lights of the fragment's cluster (frame feature, see cluster_buffers.h)
+    SHADER_INSTANCED    = 1 << 4,   // INSTANCED: take the model matrix from the instance attributes (draw feature, see instancing.h)
+};
+// POINT_LIGHTS is stored in bits 8 and up
+const int SHADER_POINT_LIGHT_SHIFT = 8;
+
+// The compiled variants of one vertex/fragment shader pair, keyed by a ShaderFeatures bitmask. A variant is compiled
+// the first time a draw asks for it (through the ProgramCache, so that is a binary load after the first launch) and
+// kept for the lifetime of the set. Specialising on the light count turns the light loop into one of constant length
+// the compiler unrolls, and leaving features out removes their texture reads and math instead of branching around
+// them per fragment.
+//
+// Only use from the GL context thread.
+class ShaderPermutations
+{
+public:
+    ShaderPermutations(const std::string &vertexPath, const std::string &fragmentPath) : vertexPath(vertexPath), fragmentPath(fragmentPath)
+    {
+    }
+
+    ShaderPermutations(const ShaderPermutations &) = delete;
+    ShaderPermutations &operator=(const ShaderPermutations &) = delete;
+
+    static uint32_t lights(int pointLights)
+    {
+        return (uint32_t)glm::clamp(pointLights, 0, MAX_POINT_LIGHTS) << SHADER_POINT_LIGHT_SHIFT;
+    }
+
+    static int pointLights(uint32_t features)
+    {
+        return (int)(features >> SHADER_POINT_LIGHT_SHIFT);
+    }
+
+    // the defines a permutation is compiled with
+    static std::vector<std::string> defines(uint32_t features)
+    {
+        std::vector<std::string> result;
+        result.push_back("MAX_POINT_LIGHTS " + std::to_string(MAX_POINT_LIGHTS));
+        result.push_back("POINT_LIGHTS " + std::to_string(pointLights(features)));
+        if (features & SHADER_SPECULAR_MAP)
+            result.push_back("HAS_SPECULAR_MAP");
+        if (features & SHADER_NORMAL_MAP)
+            result.push_back("HAS_NORMAL_MAP");
+        if (features & SHADER_SKINNING)
+        {
+            result.push_back("SKINNING");
+            result.push_back("MAX_BONES " + std::to_string(MAX_SHADER_BONES));
+        }
+        if (features & SHADER_CLUSTERED)
+            result.push_back("CLUSTERED");
+        if (features & SHADER_INSTANCED)
+            result.push_back("INSTANCED");
+        return result;
+    }
+
+    // the variant for the given features, compiled on first use
+    Shader &get(uint32_t features)
+    {
+        auto it = variants.find(features);
+        if (it != variants.end())
+            return *it->second;
+        std::unique_ptr<Shader> shader(new Shader(vertexPath.c_str(), fragmentPath.c_str(), defines(features)));
+        // skinned meshes draw in their bind pose until something poses them
+        if (features & SHADER_SKINNING)
+        {
+            shader->use();
+            for (int bone = 0; bone < MAX_SHADER_BONES; bone++)
+                shader->setMat4("bones[" + std::to_string(bone) + "]", glm::mat4(1.0f));
+            glUseProgram(0);
+        }
+        Shader &result = *shader;
+        variants[features] = std::move(shader);
+        return result;
+    }
+
+    unsigned int program(uint32_t features) { return get(features).ID; }
+
+    size_t size() const { return variants.size(); }
+
+    void printStats() const
+    {
+        printf("[shader_permutations.h] %s: %zu permutations:", fragmentPath.c_str(), variants.size());
+        for (const auto &variant : variants)
+            printf(" %u lights%s%s%s%s%s", (unsigned int)pointLights(variant.first), variant.first & SHADER_SPECULAR_MAP ? "+spec" : "",
+                   variant.first & SHADER_NORMAL_MAP ? "+normal" : "", variant.first & SHADER_SKINNING ? "+skin" : "",
+                   variant.first & SHADER_CLUSTERED ? "+clustered" : "", variant.first & SHADER_INSTANCED ? "+instanced" : "");
+        printf("\n");
+    }
+
+private:
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::unordered_map<uint32_t, std::unique_ptr<Shader>> variants;
+};
+#endif
@@ -1,112 +1,35 @@
 #version 330 core
+// Permutations (see shader_permutations.h): POINT_LIGHTS point lights are shaded in a loop of constant length,
+// HAS_SPECULAR_MAP samples texture_specular1 for the specular terms (none without it), HAS_NORMAL_MAP perturbs the
+// normal with texture_normal1, CLUSTERED adds the lights of the fragment's cluster
 out vec4 FragColor;
 
-struct Material {
-    sampler2D diffuse;
-    sampler2D specular;    
-    float shininess;
-}; 
-
-struct Light {
-    vec3 position;  
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
-  
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-	
-    float constant;
-    float linear;
-    float quadratic;
-};
-
-struct DirLight {
-    vec3 direction;
-    
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct PointLight {
-    vec3 position;
-
-    float constant;
-    float linear;
-    float quadratic;
-
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-#define NR_POINT_LIGHTS 4
-
-
-in vec3 FragPos;  
-in vec3 Normal;  
-in vec2 TexCoords;
-  
-uniform vec3 viewPos;
-uniform Material material;
-uniform Light light;
-uniform DirLight dirLight;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
-
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);  
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);  
+#include "surface.glsl"
+#include "uniforms.glsl"
+#include "lighting.glsl"
+#ifdef CLUSTERED
+#include "clusters.glsl"
+#endif
 
 void main()
 {
     // properties
-    vec3 norm = normalize(Normal);
-    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 norm = surfaceNormal();
+    vec3 viewDir = normalize(viewPos.xyz - FragPos);
+    vec3 albedo = texture(texture_diffuse1, TexCoords).rgb;
+    vec3 specularColor = surfaceSpecular();
 
     // phase 1: Directional lighting
-    vec3 result = CalcDirLight(dirLight, norm, viewDir);
+    vec3 result = calcDirLight(dirLight, norm, viewDir, albedo, specularColor);
     // phase 2: Point lights
-    for(int i = 0; i < NR_POINT_LIGHTS; i++)
-        result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);    
-    // phase 3: Spot light
-    //result += CalcSpotLight(spotLight, norm, FragPos, viewDir);    
-    
-    FragColor = vec4(result, 1.0);
-} 
+#if POINT_LIGHTS > 0
+    for (int i = 0; i < POINT_LIGHTS; i++)
+        result += calcPointLight(pointLights[i], norm, FragPos, viewDir, albedo, specularColor);
+#endif
+#ifdef CLUSTERED
+    // phase 3: clustered lights
+    result += calcClusterLights(norm, FragPos, viewDir, albedo, specularColor);
+#endif
 
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir) {
-    vec3 lightDir = normalize(-light.direction);
-    // diffuse
-    float diff = max(dot(normal, lightDir), 0.0);
-    // spec
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    // combined results
-    vec3 ambient = light.ambient * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse = light.diffuse * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
-    return (ambient + diffuse + specular);
+    FragColor = vec4(result, 1.0);
 }
-
-vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
-{
-    vec3 lightDir = normalize(light.position - fragPos);
-    // diffuse shading
-    float diff = max(dot(normal, lightDir), 0.0);
-    // specular shading
-    vec3 reflectDir = reflect(-lightDir, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    // attenuation
-    float distance    = length(light.position - fragPos);
-    float attenuation = 1.0 / (light.constant + light.linear * distance + 
-  			     light.quadratic * (distance * distance));    
-    // combine results
-    vec3 ambient  = light.ambient  * vec3(texture(material.diffuse, TexCoords));
-    vec3 diffuse  = light.diffuse  * diff * vec3(texture(material.diffuse, TexCoords));
-    vec3 specular = light.specular * spec * vec3(texture(material.specular, TexCoords));
-    ambient  *= attenuation;
-    diffuse  *= attenuation;
-    specular *= attenuation;
-    return (ambient + diffuse + specular);
-} 
\ No newline at end of file
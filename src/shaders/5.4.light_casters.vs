@@ -1,21 +1,64 @@
 #version 330 core
+// Permutations (see shader_permutations.h): HAS_NORMAL_MAP passes the tangent frame on, SKINNING blends the
+// position and normals over MAX_BONES bone matrices, INSTANCED places the vertex with the instance's transform
+// instead of the object constants
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+layout (location = 1) in vec2 aNormal;      // octahedral, see vertex_format.h
 layout (location = 2) in vec2 aTexCoords;
+#ifdef HAS_NORMAL_MAP
+layout (location = 3) in vec4 aTangent;     // octahedral tangent in xy, bitangent sign in z
+#endif
+#ifdef SKINNING
+layout (location = 5) in uvec4 aBoneIds;
+layout (location = 6) in vec4 aWeights;
+uniform mat4 bones[MAX_BONES];
+#endif
+#ifdef INSTANCED
+layout (location = 7) in mat4 aInstanceModel;  // per instance, see instancing.h
+#endif
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
+#ifdef HAS_NORMAL_MAP
+out vec3 Tangent;
+out float BitangentSign;
+#endif
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include "uniforms.glsl"
+#include "vertex_format.glsl"
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;  
+    vec4 position = vec4(aPos, 1.0);
+    vec3 normal = octDecode(aNormal);
+#ifdef HAS_NORMAL_MAP
+    vec3 tangent = octDecode(aTangent.xy);
+#endif
+#ifdef SKINNING
+    mat4 skin = bones[aBoneIds.x] * aWeights.x + bones[aBoneIds.y] * aWeights.y +
+                bones[aBoneIds.z] * aWeights.z + bones[aBoneIds.w] * aWeights.w;
+    position = skin * position;
+    normal = mat3(skin) * normal;
+#ifdef HAS_NORMAL_MAP
+    tangent = mat3(skin) * tangent;
+#endif
+#endif
+
+#ifdef INSTANCED
+    mat4 placement = aInstanceModel;
+    mat3 normalPlacement = transpose(inverse(mat3(aInstanceModel)));
+#else
+    mat4 placement = model;
+    mat3 normalPlacement = mat3(normalMatrix);
+#endif
+    FragPos = vec3(placement * position);
+    Normal = normalPlacement * normal;
+#ifdef HAS_NORMAL_MAP
+    Tangent = mat3(placement) * tangent;
+    BitangentSign = aTangent.z;
+#endif
     TexCoords = aTexCoords;
-    
+
     gl_Position = projection * view * vec4(FragPos, 1.0);
-}
\ No newline at end of file
+}
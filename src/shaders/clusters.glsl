@@ -0,0 +1,30 @@
+// Clustered lights, see light_clusters.h and cluster_buffers.h. Needs uniforms.glsl (for view) and lighting.glsl.
+layout (std140) uniform ClusterUniforms
+{
+    ivec4 clusterSize;      // tiles x, tiles y, slices, lights
+    vec4 clusterScreen;     // width and height of the render target
+    vec4 clusterDepth;      // near, far, slice scale, slice bias: slice = log(depth) * scale + bias
+};
+
+uniform samplerBuffer clusterLights;         // two texels per light: position.xyz and radius, colour
+uniform usamplerBuffer clusterOffsets;       // per cluster: offset into clusterLightIndices, light count
+uniform usamplerBuffer clusterLightIndices;
+
+// the lights of the cluster this fragment falls in
+vec3 calcClusterLights(vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor)
+{
+    float depth = -(view * vec4(fragPos, 1.0)).z;
+    ivec3 cell = ivec3(gl_FragCoord.xy * vec2(clusterSize.xy) / clusterScreen.xy, log(max(depth, clusterDepth.x)) * clusterDepth.z + clusterDepth.w);
+    cell = clamp(cell, ivec3(0), clusterSize.xyz - 1);
+    uvec2 range = texelFetch(clusterOffsets, (cell.z * clusterSize.y + cell.y) * clusterSize.x + cell.x).xy;
+
+    vec3 result = vec3(0.0);
+    for (uint i = 0u; i < range.y; i++)
+    {
+        int light = int(texelFetch(clusterLightIndices, int(range.x + i)).r);
+        vec4 positionRadius = texelFetch(clusterLights, light * 2);
+        vec3 color = texelFetch(clusterLights, light * 2 + 1).rgb;
+        result += calcClusterLight(positionRadius.xyz, positionRadius.w, color, normal, fragPos, viewDir, albedo, specularColor);
+    }
+    return result;
+}
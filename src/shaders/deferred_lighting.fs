@@ -0,0 +1,32 @@
+#version 330 core
+// Lighting pass of the deferred path (see gbuffer.h): one full screen pass that rebuilds every pixel's position from
+// the depth buffer and shades it with the directional light, plus with CLUSTERED the lights of the pixel's cluster.
+// The point lights are added afterwards by deferred_point_light.fs, each only inside the screen rectangle it can
+// reach. Always compiled with HAS_SPECULAR_MAP, surfaces without one stored zero.
+out vec4 FragColor;
+
+#include "uniforms.glsl"
+#include "lighting.glsl"
+#include "vertex_format.glsl"
+#include "gbuffer.glsl"
+#ifdef CLUSTERED
+#include "clusters.glsl"
+#endif
+
+void main()
+{
+    GBufferSurface surface;
+    // nothing was drawn here, keep the clear colour
+    if (!readGBuffer(surface))
+        discard;
+    vec3 viewDir = normalize(viewPos.xyz - surface.position);
+
+    // phase 1: Directional lighting
+    vec3 result = calcDirLight(dirLight, surface.normal, viewDir, surface.albedo, surface.specularColor);
+#ifdef CLUSTERED
+    // phase 2: clustered lights
+    result += calcClusterLights(surface.normal, surface.position, viewDir, surface.albedo, surface.specularColor);
+#endif
+
+    FragColor = vec4(result, 1.0);
+}
@@ -0,0 +1,8 @@
+#version 330 core
+// full screen pass over the screen quad
+layout (location = 0) in vec2 aPos;
+
+void main()
+{
+    gl_Position = vec4(aPos, 0.0, 1.0);
+}
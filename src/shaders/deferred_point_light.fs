@@ -0,0 +1,25 @@
+#version 330 core
+// Point light pass of the deferred path (see gbuffer.h): the screen quad is drawn once per point light, scissored
+// to the rectangle of the sphere the light reaches (its attenuation.w, see pointLightRadius in uniform_buffer.h),
+// and adds that light to the pixels inside the sphere. Always compiled with HAS_SPECULAR_MAP, like
+// deferred_lighting.fs.
+out vec4 FragColor;
+
+#include "uniforms.glsl"
+#include "lighting.glsl"
+#include "vertex_format.glsl"
+#include "gbuffer.glsl"
+
+uniform int lightIndex;
+
+void main()
+{
+    GBufferSurface surface;
+    if (!readGBuffer(surface))
+        discard;
+    PointLight light = pointLights[lightIndex];
+    if (distance(light.position.xyz, surface.position) > light.attenuation.w)
+        discard;
+    vec3 viewDir = normalize(viewPos.xyz - surface.position);
+    FragColor = vec4(calcPointLight(light, surface.normal, surface.position, viewDir, surface.albedo, surface.specularColor), 1.0);
+}
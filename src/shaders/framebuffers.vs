@@ -4,9 +4,18 @@ layout (location = 1) in vec2 aTexCoords;
 
 out vec2 TexCoords;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// shared blocks, see uniform_buffer.h (std140 offsets are fixed, so declaring the leading members is enough)
+layout (std140) uniform FrameUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+layout (std140) uniform ObjectUniforms
+{
+    mat4 model;
+    mat4 normalMatrix;
+};
 
 void main()
 {
@@ -0,0 +1,16 @@
+#version 330 core
+// Geometry pass of the deferred path (see gbuffer.h): writes the surface to the G-buffer instead of lighting it.
+// Linked with 5.4.light_casters.vs and specialised on the same material features. The specular map is folded into
+// one intensity, the G-buffer has no room for its colour.
+layout (location = 0) out vec4 gAlbedoSpecular;  // albedo, specular intensity
+layout (location = 1) out vec2 gNormal;          // world space normal, octahedral, mapped to [0, 1]
+
+#include "surface.glsl"
+#include "vertex_format.glsl"
+
+void main()
+{
+    vec3 specular = surfaceSpecular();
+    gAlbedoSpecular = vec4(texture(texture_diffuse1, TexCoords).rgb, (specular.r + specular.g + specular.b) / 3.0);
+    gNormal = octEncode(surfaceNormal()) * 0.5 + 0.5;
+}
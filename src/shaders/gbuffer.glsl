@@ -0,0 +1,30 @@
+// Reads the deferred path's G-buffer (see gbuffer.h) under the fragment, for the lighting passes. Needs uniforms.glsl
+// and vertex_format.glsl.
+uniform sampler2D gAlbedoSpecular;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+
+struct GBufferSurface {
+    vec3 position;      // world space, rebuilt from the depth
+    vec3 normal;
+    vec3 albedo;
+    vec3 specularColor;
+};
+
+// false where the geometry pass drew nothing
+bool readGBuffer(out GBufferSurface surface)
+{
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gDepth, texel, 0).r;
+    if (depth == 1.0)
+        return false;
+    vec2 ndc = gl_FragCoord.xy / vec2(textureSize(gDepth, 0)) * 2.0 - 1.0;
+    vec4 world = inverseViewProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    surface.position = world.xyz / world.w;
+
+    vec4 albedoSpecular = texelFetch(gAlbedoSpecular, texel, 0);
+    surface.normal = octDecode(texelFetch(gNormal, texel, 0).xy * 2.0 - 1.0);
+    surface.albedo = albedoSpecular.rgb;
+    surface.specularColor = vec3(albedoSpecular.a);
+    return true;
+}
@@ -0,0 +1,12 @@
+#version 330 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+in vec4 Color;
+
+uniform sampler2D texture1;
+
+void main()
+{    
+    FragColor = texture(texture1, TexCoords) * Color;
+}
\ No newline at end of file
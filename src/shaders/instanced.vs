@@ -0,0 +1,24 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec2 aTexCoords;
+// per instance, see instancing.h
+layout (location = 7) in mat4 aInstanceModel;
+layout (location = 11) in vec4 aInstanceColor;
+
+out vec2 TexCoords;
+out vec4 Color;
+
+// shared block, see uniform_buffer.h
+layout (std140) uniform FrameUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+
+void main()
+{
+    TexCoords = aTexCoords;
+    Color = aInstanceColor;
+    gl_Position = projection * view * aInstanceModel * vec4(aPos, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,57 @@
+// Phong lighting for the light caster shaders. Without HAS_SPECULAR_MAP the specular terms are left out
+// altogether instead of being computed and multiplied by zero.
+#define SHININESS 32.0
+
+vec3 calcDirLight(DirLight light, vec3 normal, vec3 viewDir, vec3 albedo, vec3 specularColor)
+{
+    vec3 lightDir = normalize(-light.direction.xyz);
+    // diffuse
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 result = (light.ambient.rgb + light.diffuse.rgb * diff) * albedo;
+#ifdef HAS_SPECULAR_MAP
+    // spec
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), SHININESS);
+    result += light.specular.rgb * spec * specularColor;
+#endif
+    return result;
+}
+
+vec3 calcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor)
+{
+    vec3 toLight = light.position.xyz - fragPos;
+    float distance = length(toLight);
+    vec3 lightDir = toLight / distance;
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 result = (light.ambient.rgb + light.diffuse.rgb * diff) * albedo;
+#ifdef HAS_SPECULAR_MAP
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), SHININESS);
+    result += light.specular.rgb * spec * specularColor;
+#endif
+    // attenuation
+    float attenuation = 1.0 / (light.attenuation.x + light.attenuation.y * distance + light.attenuation.z * (distance * distance));
+    return result * attenuation;
+}
+
+// a clustered light: no constant/linear/quadratic terms but a window that reaches zero at the light's radius, so
+// leaving it out of the clusters past that radius changes nothing
+vec3 calcClusterLight(vec3 position, float radius, vec3 color, vec3 normal, vec3 fragPos, vec3 viewDir, vec3 albedo, vec3 specularColor)
+{
+    vec3 toLight = position - fragPos;
+    float distance2 = dot(toLight, toLight);
+    float window = clamp(1.0 - distance2 / (radius * radius), 0.0, 1.0);
+    vec3 lightDir = toLight * inversesqrt(max(distance2, 1e-8));
+    // diffuse shading
+    float diff = max(dot(normal, lightDir), 0.0);
+    vec3 result = color * diff * albedo;
+#ifdef HAS_SPECULAR_MAP
+    // specular shading
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0), SHININESS);
+    result += color * spec * specularColor;
+#endif
+    return result * (window * window);
+}
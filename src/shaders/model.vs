@@ -0,0 +1,26 @@
+#version 330 core
+// Unlit textured drawing of Mesh vertices (see vertex_format.h), for models drawn without --lights. Pairs with
+// framebuffers.fs; the octahedral normal at location 1 isn't needed.
+layout (location = 0) in vec3 aPos;
+layout (location = 2) in vec2 aTexCoords;
+
+out vec2 TexCoords;
+
+// shared blocks, see uniform_buffer.h (std140 offsets are fixed, so declaring the leading members is enough)
+layout (std140) uniform FrameUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+};
+layout (std140) uniform ObjectUniforms
+{
+    mat4 model;
+    mat4 normalMatrix;
+};
+
+void main()
+{
+    TexCoords = aTexCoords;
+    gl_Position = projection * view * model * vec4(aPos, 1.0);
+}
@@ -0,0 +1,40 @@
+// The material inputs of the light caster vertex shader's fragments, shared by the forward shader and the
+// G-buffer pass. HAS_SPECULAR_MAP and HAS_NORMAL_MAP as in 5.4.light_casters.fs.
+in vec3 FragPos;
+in vec3 Normal;
+in vec2 TexCoords;
+#ifdef HAS_NORMAL_MAP
+in vec3 Tangent;
+in float BitangentSign;
+#endif
+
+uniform sampler2D texture_diffuse1;
+#ifdef HAS_SPECULAR_MAP
+uniform sampler2D texture_specular1;
+#endif
+#ifdef HAS_NORMAL_MAP
+uniform sampler2D texture_normal1;
+#endif
+
+// world space normal, perturbed by the normal map
+vec3 surfaceNormal()
+{
+    vec3 norm = normalize(Normal);
+#ifdef HAS_NORMAL_MAP
+    vec3 tangent = normalize(Tangent - dot(Tangent, norm) * norm);
+    vec3 bitangent = cross(norm, tangent) * BitangentSign;
+    // only x and y are read: BC5 normal maps have no z, so it is rebuilt for every map
+    vec2 xy = texture(texture_normal1, TexCoords).xy * 2.0 - 1.0;
+    norm = normalize(mat3(tangent, bitangent, norm) * vec3(xy, sqrt(max(1.0 - dot(xy, xy), 0.0))));
+#endif
+    return norm;
+}
+
+vec3 surfaceSpecular()
+{
+#ifdef HAS_SPECULAR_MAP
+    return texture(texture_specular1, TexCoords).rgb;
+#else
+    return vec3(0.0);
+#endif
+}
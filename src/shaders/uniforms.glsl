@@ -0,0 +1,33 @@
+// the uniform blocks shared by all programs, see uniform_buffer.h. MAX_POINT_LIGHTS is injected by
+// ShaderPermutations from the C++ constant, so the array always matches FrameUniforms.
+struct DirLight {
+    vec4 direction;
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+};
+
+struct PointLight {
+    vec4 position;
+    vec4 ambient;
+    vec4 diffuse;
+    vec4 specular;
+    vec4 attenuation;   // constant, linear, quadratic, radius
+};
+
+layout (std140) uniform FrameUniforms
+{
+    mat4 view;
+    mat4 projection;
+    vec4 viewPos;
+    DirLight dirLight;
+    PointLight pointLights[MAX_POINT_LIGHTS];
+    ivec4 lightCounts;  // x: point lights in use
+    mat4 inverseViewProjection;
+};
+
+layout (std140) uniform ObjectUniforms
+{
+    mat4 model;
+    mat4 normalMatrix;
+};
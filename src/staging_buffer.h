@@ -0,0 +1,197 @@
+#ifndef STAGING_BUFFER_H
+#define STAGING_BUFFER_H
+
+#include <glad/glad.h>
+
+#include "profiler.h"
+
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+// A per-frame upload buffer. Data is copied into a mapped buffer object with stage(), the copies out of it (into
+// arena buffers with glCopyBufferSubData, into plain or block compressed textures through GL_PIXEL_UNPACK_BUFFER)
+// are recorded and issued by end(), once the buffer is unmapped. The buffer is orphaned every frame, so the driver
+// never has to wait for last frame's copies, and the capacity is the most a frame uploads: callers split their
+// data into chunks that fit remaining().
+//
+// Only use from the GL context thread.
+class StagingBuffer
+{
+public:
+    StagingBuffer() {}
+    StagingBuffer(const StagingBuffer &) = delete;
+    StagingBuffer &operator=(const StagingBuffer &) = delete;
+
+    ~StagingBuffer() { release(); }
+
+    // starts a frame's uploads with room for capacity bytes. Nothing is mapped until the first stage().
+    void begin(size_t capacity)
+    {
+        this->capacity = capacity;
+        used = 0;
+        commands.clear();
+    }
+
+    size_t remaining() const { return capacity - used; }
+    size_t size() const { return capacity; }
+
+    // copies size bytes into the buffer and returns their offset, which the copy commands take as source.
+    // The caller makes sure the data fits remaining().
+    size_t stage(const void *data, size_t size)
+    {
+        if (!mapped)
+            map();
+        size_t offset = used;
+        memcpy(mapped + offset, data, size);
+        // keep every chunk 16 byte aligned, which covers any texel or index size
+        used = std::min(capacity, (offset + size + 15) & ~(size_t)15);
+        return offset;
+    }
+
+    // glCopyBufferSubData from the staging buffer into target once the frame's data is unmapped
+    void copyToBuffer(unsigned int target, GLintptr targetOffset, size_t offset, size_t size)
+    {
+        Command command = {Command::BUFFER};
+        command.target = target;
+        command.targetOffset = targetOffset;
+        command.offset = offset;
+        command.size = size;
+        commands.push_back(command);
+    }
+
+    // glTexSubImage2D of rows [y, y + height) of a texture level, tightly packed at offset
+    void copyToTexture(unsigned int texture, int level, int y, int width, int height, GLenum format, size_t offset)
+    {
+        Command command = {Command::TEXTURE};
+        command.target = texture;
+        command.level = level;
+        command.y = y;
+        command.width = width;
+        command.height = height;
+        command.format = format;
+        command.offset = offset;
+        commands.push_back(command);
+    }
+
+    // glCompressedTexSubImage2D of rows [y, y + height) of a block compressed texture level; y is a multiple of 4
+    // and the size bytes at offset hold the blocks covering those rows
+    void copyToCompressedTexture(unsigned int texture, int level, int y, int width, int height, GLenum internalFormat, size_t offset, size_t size)
+    {
+        Command command = {Command::COMPRESSED_TEXTURE};
+        command.target = texture;
+        command.level = level;
+        command.y = y;
+        command.width = width;
+        command.height = height;
+        command.format = internalFormat;
+        command.offset = offset;
+        command.size = size;
+        commands.push_back(command);
+    }
+
+    // GL_TEXTURE_BASE_LEVEL of a texture, set after the copies recorded before it
+    void setBaseLevel(unsigned int texture, int level)
+    {
+        Command command = {Command::BASE_LEVEL};
+        command.target = texture;
+        command.level = level;
+        commands.push_back(command);
+    }
+
+    // unmaps the buffer and issues the recorded copies. Returns the bytes staged this frame.
+    size_t end()
+    {
+        if (!mapped)
+            return 0;
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        if (mapped == fallback.data())
+            glBufferSubData(GL_COPY_READ_BUFFER, 0, used, fallback.data());
+        else
+            glUnmapBuffer(GL_COPY_READ_BUFFER);
+        mapped = nullptr;
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (const Command &command : commands)
+        {
+            if (command.type == Command::BUFFER)
+            {
+                glBindBuffer(GL_COPY_WRITE_BUFFER, command.target);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, (GLintptr)command.offset, command.targetOffset, (GLsizeiptr)command.size);
+            }
+            else if (command.type == Command::TEXTURE)
+            {
+                glBindTexture(GL_TEXTURE_2D, command.target);
+                glTexSubImage2D(GL_TEXTURE_2D, command.level, 0, command.y, command.width, command.height, command.format, GL_UNSIGNED_BYTE, (const void *)command.offset);
+            }
+            else if (command.type == Command::COMPRESSED_TEXTURE)
+            {
+                glBindTexture(GL_TEXTURE_2D, command.target);
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, command.level, 0, command.y, command.width, command.height, command.format, (GLsizei)command.size, (const void *)command.offset);
+            }
+            else
+            {
+                glBindTexture(GL_TEXTURE_2D, command.target);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, command.level);
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        // a bound unpack buffer would turn every later client memory glTexImage2D into a buffer offset
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        Profiler::shared().countUpload(used);
+        totalBytes += used;
+        return used;
+    }
+
+    // deletes the buffer object; the next frame's stage() makes a new one
+    void release()
+    {
+        if (buffer)
+            glDeleteBuffers(1, &buffer);
+        buffer = 0;
+        mapped = nullptr;
+        commands.clear();
+    }
+
+    size_t totalBytes = 0; // staged over the buffer's lifetime
+
+private:
+    struct Command {
+        enum Type { BUFFER, TEXTURE, COMPRESSED_TEXTURE, BASE_LEVEL } type;
+        unsigned int target = 0;
+        GLintptr targetOffset = 0;
+        size_t offset = 0;
+        size_t size = 0;
+        int level = 0;
+        int y = 0, width = 0, height = 0;
+        GLenum format = 0;
+    };
+
+    unsigned int buffer = 0;
+    unsigned char *mapped = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+    std::vector<Command> commands;
+    std::vector<unsigned char> fallback; // staged into instead when mapping fails
+
+    // orphans last frame's storage and maps a fresh one
+    void map()
+    {
+        if (!buffer)
+            glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glBufferData(GL_COPY_READ_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+        mapped = (unsigned char *)glMapBufferRange(GL_COPY_READ_BUFFER, 0, capacity, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (!mapped)
+        {
+            fallback.resize(capacity);
+            mapped = fallback.data();
+        }
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    }
+};
+#endif
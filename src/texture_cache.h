@@ -0,0 +1,250 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <glad/glad.h>
+
+#include "staging_buffer.h"
+#include "texture_loader.h"
+
+#include <chrono>
+#include <filesystem>
+#include <future>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Process-wide, reference counted texture store. Textures are keyed by canonical file path plus the
+// load parameters that change their contents (gamma, vertical flip, block compression), so every model sharing
+// an image shares one GL texture. The GL texture is deleted when the last reference is released.
+//
+// Only use from the GL context thread; decoding itself happens on the shared ThreadPool.
+class TextureCache
+{
+public:
+    static TextureCache &shared()
+    {
+        static TextureCache cache;
+        return cache;
+    }
+
+    // returns a texture handle for the file and takes a reference on it. New textures get their handle
+    // immediately and are decoded in the background; until flush() or stream() uploads them they sample as a
+    // grey placeholder. Compression the context can't sample falls back to uncompressed texels.
+    unsigned int acquire(const string &path, bool gamma, bool flip, TextureCompression compression = TEXTURE_UNCOMPRESSED)
+    {
+        if (!TextureLoader::supportsCompression(compression))
+            compression = TEXTURE_UNCOMPRESSED;
+        string key = makeKey(path, gamma, flip, compression);
+        auto it = entries.find(key);
+        if (it != entries.end())
+        {
+            it->second.refCount++;
+            hitCount++;
+            return it->second.id;
+        }
+
+        missCount++;
+        Entry entry;
+        glGenTextures(1, &entry.id);
+        TextureLoader::uploadPlaceholder(entry.id);
+        entry.gamma = gamma;
+        if (pending.empty())
+            decodeStart = std::chrono::steady_clock::now();
+        pending.push_back({entry.id, TextureLoader::decodeAsync(path, true, flip, gamma, compression)});
+        keys[entry.id] = key;
+        entries[key] = entry;
+        return entry.id;
+    }
+
+    // drops one reference; the texture is deleted when nobody uses it anymore
+    void release(unsigned int id)
+    {
+        auto keyIt = keys.find(id);
+        if (keyIt == keys.end())
+            return;
+        auto it = entries.find(keyIt->second);
+        if (--it->second.refCount > 0)
+            return;
+
+        // a texture may be released before its decode finished; upload nothing into a deleted name
+        for (size_t i = 0; i < pending.size(); i++)
+        {
+            if (pending[i].id == id)
+            {
+                pending.erase(pending.begin() + i);
+                break;
+            }
+        }
+        vramBytes -= it->second.bytes;
+        glDeleteTextures(1, &id);
+        entries.erase(it);
+        keys.erase(keyIt);
+    }
+
+    // uploads the textures whose decodes have finished through the staging buffer, as much as fits its
+    // remaining space. Levels go in coarsest first (large ones in bands of rows) and GL_TEXTURE_BASE_LEVEL follows
+    // the finest complete level, so a texture sharpens over a few frames instead of costing one long upload.
+    // Block compressed levels go in rows of blocks.
+    // Never waits for a decode. Returns the number of textures completed.
+    size_t stream(StagingBuffer &staging)
+    {
+        size_t completed = 0;
+        for (size_t i = 0; i < pending.size() && staging.remaining() > 0;)
+        {
+            PendingUpload &upload = pending[i];
+            if (upload.image.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+            {
+                i++;
+                continue;
+            }
+            const DecodedImage &image = upload.image.get();
+            Entry &entry = entries[keys[upload.id]];
+            int coarsest = (int)image.levelOffsets.size() - 1;
+            if (!image.valid() || image.levelBytes(coarsest) > staging.size() || image.rowBytes(0) > staging.size())
+            {
+                // nothing to stream (the error is printed by upload), or a coarsest level or a row too large for
+                // a whole frame's budget: upload it in one go
+                finishUpload(upload.id, image, entry);
+                pending.erase(pending.begin() + i);
+                completed++;
+                continue;
+            }
+
+            GLenum format = TextureLoader::formatFor(image.components);
+            GLenum internalFormat = TextureLoader::internalFormatFor(image, entry.gamma);
+            if (upload.nextLevel < 0)
+            {
+                // wait until the coarsest level fits, so there is never a frame that samples an empty texture
+                if (image.levelBytes(coarsest) > staging.remaining())
+                    break;
+                TextureLoader::allocate(upload.id, image, entry.gamma);
+                upload.nextLevel = coarsest;
+                upload.nextRow = 0;
+            }
+            while (upload.nextLevel >= 0)
+            {
+                int level = upload.nextLevel;
+                int width = image.levelWidth(level), height = image.levelHeight(level);
+                size_t rowBytes = image.rowBytes(level);
+                int levelRows = image.levelRows(level);
+                int rows = (int)std::min<size_t>(levelRows - upload.nextRow, staging.remaining() / rowBytes);
+                if (rows == 0)
+                    break;
+                size_t offset = staging.stage(image.levelData(level) + upload.nextRow * rowBytes, rows * rowBytes);
+                // in texel rows; the last row of blocks may cover fewer than 4
+                int y = upload.nextRow * image.rowHeight();
+                int texelRows = std::min(rows * image.rowHeight(), height - y);
+                if (image.blockFormat != BLOCK_NONE)
+                    staging.copyToCompressedTexture(upload.id, level, y, width, texelRows, internalFormat, offset, rows * rowBytes);
+                else
+                    staging.copyToTexture(upload.id, level, y, width, texelRows, format, offset);
+                upload.nextRow += rows;
+                if (upload.nextRow < levelRows)
+                    break;
+                staging.setBaseLevel(upload.id, level);
+                upload.nextLevel--;
+                upload.nextRow = 0;
+            }
+            if (upload.nextLevel >= 0)
+                break;
+            entry.bytes = image.byteSize();
+            vramBytes += entry.bytes;
+            pending.erase(pending.begin() + i);
+            completed++;
+        }
+        return completed;
+    }
+
+    // false while the texture still waits for its decode or for part of its upload
+    bool resident(unsigned int id) const
+    {
+        for (const PendingUpload &upload : pending)
+            if (upload.id == id)
+                return false;
+        return true;
+    }
+
+    // waits for all outstanding decodes and uploads them. Returns the number of textures uploaded.
+    size_t flush()
+    {
+        if (pending.empty())
+            return 0;
+        double decodeCpuMs = 0.0;
+        for (PendingUpload &upload : pending)
+        {
+            const DecodedImage &image = upload.image.get();
+            decodeCpuMs += image.decodeMs;
+            finishUpload(upload.id, image, entries[keys[upload.id]]);
+        }
+        size_t count = pending.size();
+        pending.clear();
+
+        double wallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - decodeStart).count();
+        // CPU time over wall time is the speedup the worker pool gave us over decoding one texture after another
+        printf("[texture_cache.h] %zu textures decoded in %.2f ms wall / %.2f ms CPU (%.2fx on %u threads)\n",
+               count, wallMs, decodeCpuMs, wallMs > 0.0 ? decodeCpuMs / wallMs : 0.0, ThreadPool::shared().size());
+        printStats();
+        return count;
+    }
+
+    void printStats() const
+    {
+        printf("[texture_cache.h] %zu live textures, %.2f MB, %zu hits / %zu misses\n",
+               entries.size(), vramBytes / (1024.0 * 1024.0), hitCount, missCount);
+    }
+
+    size_t pendingUploads() const { return pending.size(); }
+    size_t hits() const { return hitCount; }
+    size_t misses() const { return missCount; }
+    size_t size() const { return entries.size(); }
+    // bytes of texel data (all mip levels) held by live textures
+    size_t totalVramBytes() const { return vramBytes; }
+
+private:
+    struct Entry {
+        unsigned int id = 0;
+        int refCount = 1;
+        bool gamma = false;
+        size_t bytes = 0;
+    };
+    // a texture whose GL handle exists but whose pixels are still being decoded or streamed in
+    struct PendingUpload {
+        unsigned int id;
+        std::shared_future<DecodedImage> image;
+        int nextLevel = -1;   // stream(): level being uploaded, -1 before the levels are allocated
+        int nextRow = 0;      // stream(): first row (of texels or blocks) of nextLevel not uploaded yet
+    };
+
+    unordered_map<string, Entry> entries;
+    unordered_map<unsigned int, string> keys;
+    vector<PendingUpload> pending;
+    std::chrono::steady_clock::time_point decodeStart;
+    size_t hitCount = 0;
+    size_t missCount = 0;
+    size_t vramBytes = 0;
+
+    TextureCache() {}
+
+    // uploads the whole image at once, over anything stream() already put in
+    void finishUpload(unsigned int id, const DecodedImage &image, Entry &entry)
+    {
+        if (TextureLoader::upload(id, image, entry.gamma))
+        {
+            entry.bytes = image.byteSize();
+            vramBytes += entry.bytes;
+        }
+    }
+
+    static string makeKey(const string &path, bool gamma, bool flip, TextureCompression compression)
+    {
+        std::error_code ec;
+        std::filesystem::path canonical = std::filesystem::weakly_canonical(path, ec);
+        string key = ec ? path : canonical.string();
+        key += gamma ? "|srgb" : "|linear";
+        key += flip ? "|flip" : "";
+        key += compression == TEXTURE_COMPRESS_COLOR ? "|bc" : compression == TEXTURE_COMPRESS_NORMAL ? "|bc5" : "";
+        return key;
+    }
+};
+#endif
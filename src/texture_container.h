@@ -0,0 +1,188 @@
+#ifndef TEXTURE_CONTAINER_H
+#define TEXTURE_CONTAINER_H
+
+#include "block_compressor.h"
+#include "cache_file.h"
+#include "mapped_file.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Baked texture: an image with its whole mip chain, stored exactly as glTexImage2D (or glCompressedTexImage2D)
+// takes it, so loading is a memory mapping and the upload reads straight from the mapped pages: no PNG/JPEG
+// decode, no mip filtering, no block compression. A container is written the first time TextureLoader::decode
+// sees an image and lives next to its source ("container2.png.srgb.flip.texcache"); the sRGB, flip and
+// compression variants of one image are separate files because each changes the stored data. It is only used
+// while the source path hash, size and mtime still match.
+//
+// File layout (level offsets are absolute and 16 byte aligned):
+//   TextureContainerHeader
+//   TextureContainerLevel[levelCount]
+//   level data, level 0 first, tightly packed rows of texels or of 4x4 blocks
+const uint32_t TEXTURE_CONTAINER_MAGIC   = 0x58544C47; // "GLTX"
+const uint32_t TEXTURE_CONTAINER_VERSION = 2;
+
+enum TextureContainerFlags {
+    TEXTURE_CONTAINER_SRGB    = 1 << 0, // colour channels are sRGB and the mips were filtered in linear space
+    TEXTURE_CONTAINER_FLIPPED = 1 << 1, // rows were flipped vertically on decode
+    TEXTURE_CONTAINER_BC      = 1 << 2, // block compressed as a colour texture (BC1 or BC3, see BlockCompressor::choose)
+    TEXTURE_CONTAINER_BC5     = 1 << 3, // block compressed as a normal map
+};
+
+struct TextureContainerHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t sourceHash;    // FNV-1a of the source path
+    uint64_t sourceSize;
+    int64_t  sourceMtime;
+    uint32_t flags;         // TextureContainerFlags
+    uint32_t width;
+    uint32_t height;
+    uint32_t components;    // channels of the source image, 1 to 4 bytes per texel when not block compressed
+    uint32_t blockFormat;   // BlockFormat of the levels, BLOCK_NONE for plain texels
+    uint32_t levelCount;
+    uint32_t internalFormat; // GL internal format the levels are meant for
+};
+
+struct TextureContainerLevel {
+    uint64_t offset;
+    uint64_t size;
+    uint32_t width;
+    uint32_t height;
+};
+
+class TextureContainer
+{
+public:
+    static std::string containerPath(const std::string &sourcePath, uint32_t flags)
+    {
+        std::string path = sourcePath;
+        if (flags & TEXTURE_CONTAINER_SRGB)
+            path += ".srgb";
+        if (flags & TEXTURE_CONTAINER_FLIPPED)
+            path += ".flip";
+        if (flags & TEXTURE_CONTAINER_BC)
+            path += ".bc";
+        if (flags & TEXTURE_CONTAINER_BC5)
+            path += ".bc5";
+        return path + ".texcache";
+    }
+
+    // fills in the key fields of a header for the given source file; false if the source can't be stat'ed
+    static bool makeKey(const std::string &sourcePath, uint32_t flags, TextureContainerHeader &header)
+    {
+        CacheSourceKey source;
+        if (!CacheFile::sourceKey(sourcePath, source))
+            return false;
+
+        memset(&header, 0, sizeof(header));
+        header.magic = TEXTURE_CONTAINER_MAGIC;
+        header.version = TEXTURE_CONTAINER_VERSION;
+        header.sourceHash = source.hash;
+        header.sourceSize = source.size;
+        header.sourceMtime = source.mtime;
+        header.flags = flags;
+        return true;
+    }
+
+    // maps the container of sourcePath and validates it against the current key. The header and levels stay
+    // valid for as long as 'file' is kept open.
+    static bool open(const std::string &sourcePath, uint32_t flags, MappedFile &file)
+    {
+        TextureContainerHeader key;
+        if (!makeKey(sourcePath, flags, key))
+            return false;
+        if (!file.open(containerPath(sourcePath, flags)))
+            return false;
+
+        const TextureContainerHeader *header = getHeader(file);
+        bool valid = file.size >= sizeof(TextureContainerHeader) &&
+                     header->magic == key.magic &&
+                     header->version == key.version &&
+                     header->sourceHash == key.sourceHash &&
+                     header->sourceSize == key.sourceSize &&
+                     header->sourceMtime == key.sourceMtime &&
+                     header->flags == key.flags &&
+                     header->components >= 1 && header->components <= 4 &&
+                     header->blockFormat <= BLOCK_BC5 &&
+                     header->levelCount >= 1 && header->levelCount <= 32 &&
+                     sizeof(TextureContainerHeader) + header->levelCount * sizeof(TextureContainerLevel) <= file.size;
+        for (uint32_t i = 0; valid && i < header->levelCount; i++)
+        {
+            const TextureContainerLevel &level = getLevels(file)[i];
+            valid = level.width == levelSize(header->width, i) &&
+                    level.height == levelSize(header->height, i) &&
+                    level.size == levelBytes(*header, level.width, level.height) &&
+                    level.offset + level.size <= file.size;
+        }
+        if (!valid)
+            file.close();
+        return valid;
+    }
+
+    static const TextureContainerHeader *getHeader(const MappedFile &file)
+    {
+        return (const TextureContainerHeader *)file.data;
+    }
+
+    static const TextureContainerLevel *getLevels(const MappedFile &file)
+    {
+        return (const TextureContainerLevel *)(file.data + sizeof(TextureContainerHeader));
+    }
+
+    // writes the container of sourcePath from levels stored back to back in 'pixels' (level i starting at
+    // levelOffsets[i]). Writes to a temporary file first so a crash never leaves a torn container behind.
+    static bool write(const std::string &sourcePath, uint32_t flags, uint32_t internalFormat, int width, int height, int components, BlockFormat blockFormat, const unsigned char *pixels, const std::vector<size_t> &levelOffsets)
+    {
+        TextureContainerHeader header;
+        if (!makeKey(sourcePath, flags, header))
+            return false;
+        header.width = (uint32_t)width;
+        header.height = (uint32_t)height;
+        header.components = (uint32_t)components;
+        header.blockFormat = (uint32_t)blockFormat;
+        header.levelCount = (uint32_t)levelOffsets.size();
+        header.internalFormat = internalFormat;
+
+        std::vector<TextureContainerLevel> levels(levelOffsets.size());
+        uint64_t offset = CacheFile::align(sizeof(TextureContainerHeader) + levels.size() * sizeof(TextureContainerLevel));
+        for (size_t i = 0; i < levels.size(); i++)
+        {
+            levels[i].width = levelSize(header.width, (uint32_t)i);
+            levels[i].height = levelSize(header.height, (uint32_t)i);
+            levels[i].size = levelBytes(header, levels[i].width, levels[i].height);
+            levels[i].offset = offset;
+            offset = CacheFile::align(offset + levels[i].size);
+        }
+
+        std::string path = containerPath(sourcePath, flags);
+        FILE *out = fopen(CacheFile::tmpPath(path).c_str(), "wb");
+        if (!out)
+            return false;
+        bool ok = fwrite(&header, sizeof(header), 1, out) == 1;
+        ok = ok && fwrite(levels.data(), sizeof(TextureContainerLevel), levels.size(), out) == levels.size();
+        for (size_t i = 0; ok && i < levels.size(); i++)
+        {
+            ok = CacheFile::pad(out, levels[i].offset);
+            ok = ok && fwrite(pixels + levelOffsets[i], 1, (size_t)levels[i].size, out) == levels[i].size;
+        }
+        return CacheFile::commit(out, path, ok);
+    }
+
+private:
+    static uint64_t levelBytes(const TextureContainerHeader &header, uint32_t width, uint32_t height)
+    {
+        if (header.blockFormat != BLOCK_NONE)
+            return BlockCompressor::levelSize((BlockFormat)header.blockFormat, (int)width, (int)height);
+        return (uint64_t)width * height * header.components;
+    }
+
+    static uint32_t levelSize(uint32_t size, uint32_t level)
+    {
+        return size >> level > 0 ? size >> level : 1;
+    }
+};
+#endif
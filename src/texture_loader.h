@@ -0,0 +1,305 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <glad/glad.h>
+// main.cpp owns STB_IMAGE_IMPLEMENTATION; pulling the header in again after that would redefine the implementation
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include <stb_image.h>
+#endif
+
+#include "block_compressor.h"
+#include "mip_filter.h"
+#include "profiler.h"
+#include "texture_container.h"
+#include "thread_pool.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+using namespace std;
+
+// EXT_texture_compression_s3tc and its sRGB variants from EXT_texture_sRGB, which the core profile glad
+// loader leaves out
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+// what decode() block compresses an image as; BlockCompressor::choose picks the format
+enum TextureCompression {
+    TEXTURE_UNCOMPRESSED,
+    TEXTURE_COMPRESS_COLOR,   // BC1, or BC3 with translucent texels (diffuse and specular maps)
+    TEXTURE_COMPRESS_NORMAL,  // BC5 (normal maps)
+};
+
+// A decoded image together with its full mip chain, produced off the GL thread. Images loaded from a baked
+// container (texture_container.h) keep the mapping instead of a copy of the levels.
+struct DecodedImage {
+    string path;
+    int width = 0;
+    int height = 0;
+    int components = 0;
+    BlockFormat blockFormat = BLOCK_NONE; // the levels hold 4x4 blocks of this format instead of texels
+    vector<unsigned char> pixels;   // all mip levels back to back, level 0 first; empty when mapped
+    vector<size_t> levelOffsets;    // byte offset of every level inside pixels (or the mapped container)
+    shared_ptr<MappedFile> container; // the baked container the levels are read from
+    double decodeMs = 0.0;          // CPU time spent decoding and building mips, or mapping the container
+
+    bool valid() const { return !pixels.empty() || container; }
+    const unsigned char *levelData(int level) const { return (container ? container->data : pixels.data()) + levelOffsets[level]; }
+    // levels upload in rows: of texels, or of 4x4 blocks when block compressed
+    int rowHeight() const { return blockFormat != BLOCK_NONE ? 4 : 1; }
+    int levelRows(int level) const { return (levelHeight(level) + rowHeight() - 1) / rowHeight(); }
+    size_t rowBytes(int level) const
+    {
+        if (blockFormat != BLOCK_NONE)
+            return (size_t)(levelWidth(level) + 3) / 4 * BlockCompressor::blockBytes(blockFormat);
+        return (size_t)levelWidth(level) * components;
+    }
+    size_t levelBytes(int level) const { return rowBytes(level) * levelRows(level); }
+    // texel (or block) bytes of all levels
+    size_t byteSize() const
+    {
+        size_t bytes = 0;
+        for (size_t level = 0; level < levelOffsets.size(); level++)
+            bytes += levelBytes((int)level);
+        return bytes;
+    }
+    int levelWidth(int level) const { return width >> level > 0 ? width >> level : 1; }
+    int levelHeight(int level) const { return height >> level > 0 ? height >> level : 1; }
+};
+
+class TextureLoader
+{
+public:
+    // decodes the file and (optionally) builds its mip chain on the calling thread. Safe to call from any thread.
+    // flip overrides stb's vertical flip for this thread (0/1); -1 keeps whatever stbi_set_flip_vertically_on_load set.
+    // With gamma the colour channels are sRGB and the mips are filtered in linear space.
+    //
+    // compression block compresses every level (see BlockCompressor; 1 and 2 channel images stay as they are).
+    //
+    // A full chain with an explicit flip is baked: the first decode writes a texture container next to the file and
+    // later ones map it instead of decoding.
+    static DecodedImage decode(const string &filename, bool generateMips = true, int flip = -1, bool gamma = false, TextureCompression compression = TEXTURE_UNCOMPRESSED)
+    {
+        PROFILE_ZONE("TextureLoader::decode");
+        auto start = std::chrono::steady_clock::now();
+        DecodedImage image;
+        image.path = filename;
+        bool baked = generateMips && flip >= 0;
+        uint32_t flags = (gamma ? TEXTURE_CONTAINER_SRGB : 0) | (flip > 0 ? TEXTURE_CONTAINER_FLIPPED : 0) |
+                         (compression == TEXTURE_COMPRESS_COLOR ? TEXTURE_CONTAINER_BC : 0) |
+                         (compression == TEXTURE_COMPRESS_NORMAL ? TEXTURE_CONTAINER_BC5 : 0);
+        if (baked && openContainer(filename, flags, image))
+        {
+            image.decodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            return image;
+        }
+
+        if (flip >= 0)
+            stbi_set_flip_vertically_on_load_thread(flip);
+        unsigned char *data = stbi_load(filename.c_str(), &image.width, &image.height, &image.components, 0);
+        if (data)
+        {
+            size_t baseSize = (size_t)image.width * image.height * image.components;
+            image.levelOffsets.push_back(0);
+            image.pixels.assign(data, data + baseSize);
+            stbi_image_free(data);
+            if (generateMips)
+                buildMipChain(image, gamma);
+            if (compression != TEXTURE_UNCOMPRESSED)
+                compressLevels(image, compression == TEXTURE_COMPRESS_NORMAL);
+            if (baked && !TextureContainer::write(filename, flags, internalFormatFor(image, gamma), image.width, image.height, image.components, image.blockFormat, image.pixels.data(), image.levelOffsets))
+                printf("[texture_loader.h] Could not write texture container: %s\n", TextureContainer::containerPath(filename, flags).c_str());
+        }
+        image.decodeMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        return image;
+    }
+
+    // queues decode() on the shared worker pool
+    static std::shared_future<DecodedImage> decodeAsync(const string &filename, bool generateMips = true, int flip = -1, bool gamma = false, TextureCompression compression = TEXTURE_UNCOMPRESSED)
+    {
+        return ThreadPool::shared().submit([filename, generateMips, flip, gamma, compression] { return decode(filename, generateMips, flip, gamma, compression); }).share();
+    }
+
+    // whether the context samples what decode() compresses to: BC5 (RGTC) is core since 3.0, BC1 and BC3 need
+    // EXT_texture_compression_s3tc. Must run on the GL context thread.
+    static bool supportsCompression(TextureCompression compression)
+    {
+        if (compression != TEXTURE_COMPRESS_COLOR)
+            return true;
+        static int s3tc = -1;
+        if (s3tc < 0)
+        {
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            s3tc = 0;
+            for (GLint i = 0; i < count && !s3tc; i++)
+            {
+                const char *extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+                s3tc = extension && strcmp(extension, "GL_EXT_texture_compression_s3tc") == 0;
+            }
+        }
+        return s3tc == 1;
+    }
+
+    // uploads every level of a decoded image into the given texture object. Must run on the GL context thread.
+    // With gamma the colour channels are stored as sRGB so sampling returns linear values.
+    static bool upload(unsigned int textureID, const DecodedImage &image, bool gamma = false)
+    {
+        if (!image.valid())
+        {
+            std::cout << "Texture failed to load at path: " << image.path << std::endl;
+            return false;
+        }
+        GLenum format = formatFor(image.components);
+        GLenum internalFormat = internalFormatFor(image, gamma);
+        int levels = static_cast<int>(image.levelOffsets.size());
+
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        // rows of 1 and 3 channel images are not 4 byte aligned
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (int level = 0; level < levels; level++)
+        {
+            if (image.blockFormat != BLOCK_NONE)
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat, image.levelWidth(level), image.levelHeight(level), 0, (GLsizei)image.levelBytes(level), image.levelData(level));
+            else
+                glTexImage2D(GL_TEXTURE_2D, level, internalFormat, image.levelWidth(level), image.levelHeight(level), 0, format, GL_UNSIGNED_BYTE, image.levelData(level));
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        setParameters(0, levels - 1);
+        Profiler::shared().countUpload(image.byteSize());
+        return true;
+    }
+
+    // specifies every level of the texture without any data, for callers that fill the levels in later (coarsest
+    // first, see TextureCache::stream). Only the coarsest level is sampled until GL_TEXTURE_BASE_LEVEL moves down.
+    static void allocate(unsigned int textureID, const DecodedImage &image, bool gamma = false)
+    {
+        // a block compressed internal format with no data is fine for glTexImage2D: there is nothing to convert
+        GLenum format = formatFor(image.components);
+        GLenum internalFormat = internalFormatFor(image, gamma);
+        int levels = static_cast<int>(image.levelOffsets.size());
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        for (int level = 0; level < levels; level++)
+            glTexImage2D(GL_TEXTURE_2D, level, internalFormat, image.levelWidth(level), image.levelHeight(level), 0, format, GL_UNSIGNED_BYTE, NULL);
+        setParameters(levels - 1, levels - 1);
+    }
+
+    // a single mid grey texel, sampled while the real image is still on its way
+    static void uploadPlaceholder(unsigned int textureID)
+    {
+        const unsigned char grey[4] = {128, 128, 128, 255};
+        glBindTexture(GL_TEXTURE_2D, textureID);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        setParameters(0, 0);
+    }
+
+    static GLenum internalFormatFor(const DecodedImage &image, bool gamma)
+    {
+        if (image.blockFormat == BLOCK_BC1)
+            return gamma ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        else if (image.blockFormat == BLOCK_BC3)
+            return gamma ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        else if (image.blockFormat == BLOCK_BC5)
+            return GL_COMPRESSED_RG_RGTC2;
+        return internalFormatFor(image.components, gamma);
+    }
+
+    static GLenum internalFormatFor(int components, bool gamma)
+    {
+        if (gamma && components == 3)
+            return GL_SRGB8;
+        else if (gamma && components == 4)
+            return GL_SRGB8_ALPHA8;
+        return formatFor(components);
+    }
+
+    static GLenum formatFor(int components)
+    {
+        if (components == 1)
+            return GL_RED;
+        else if (components == 2)
+            return GL_RG;
+        else if (components == 3)
+            return GL_RGB;
+        return GL_RGBA;
+    }
+
+private:
+    // sampling state of a bound texture whose levels [baseLevel, maxLevel] are filled in
+    static void setParameters(int baseLevel, int maxLevel)
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, baseLevel);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, maxLevel);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, maxLevel > 0 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    // maps the baked container of filename into image; false if there is none or it is stale
+    static bool openContainer(const string &filename, uint32_t flags, DecodedImage &image)
+    {
+        shared_ptr<MappedFile> file = make_shared<MappedFile>();
+        if (!TextureContainer::open(filename, flags, *file))
+            return false;
+        const TextureContainerHeader *header = TextureContainer::getHeader(*file);
+        image.width = (int)header->width;
+        image.height = (int)header->height;
+        image.components = (int)header->components;
+        image.blockFormat = (BlockFormat)header->blockFormat;
+        for (uint32_t level = 0; level < header->levelCount; level++)
+            image.levelOffsets.push_back((size_t)TextureContainer::getLevels(*file)[level].offset);
+        image.container = file;
+        return true;
+    }
+
+    // replaces every level with its BC1/BC3/BC5 blocks, when BlockCompressor::choose finds a format for the image
+    static void compressLevels(DecodedImage &image, bool normalMap)
+    {
+        PROFILE_ZONE("TextureLoader::compressLevels");
+        BlockFormat format = BlockCompressor::choose(image.pixels.data(), image.width, image.height, image.components, normalMap);
+        if (format == BLOCK_NONE)
+            return;
+        vector<unsigned char> blocks;
+        vector<size_t> offsets;
+        for (size_t level = 0; level < image.levelOffsets.size(); level++)
+        {
+            int width = image.levelWidth((int)level), height = image.levelHeight((int)level);
+            offsets.push_back(blocks.size());
+            blocks.resize(blocks.size() + BlockCompressor::levelSize(format, width, height));
+            BlockCompressor::compress(image.levelData((int)level), width, height, image.components, format, blocks.data() + offsets.back());
+        }
+        image.pixels.swap(blocks);
+        image.levelOffsets.swap(offsets);
+        image.blockFormat = format;
+    }
+
+    // appends 2x2 box filtered levels down to 1x1 (see MipFilter), in linear space for the colour of sRGB images
+    static void buildMipChain(DecodedImage &image, bool gamma)
+    {
+        int c = image.components;
+        int level = 0;
+        while (image.levelWidth(level) > 1 || image.levelHeight(level) > 1)
+        {
+            size_t srcOffset = image.levelOffsets[level];
+            size_t dstOffset = image.pixels.size();
+            image.levelOffsets.push_back(dstOffset);
+            image.pixels.resize(dstOffset + image.levelBytes(level + 1));
+            MipFilter::downsample(image.pixels.data() + srcOffset, image.levelWidth(level), image.levelHeight(level), image.pixels.data() + dstOffset, c, gamma);
+            level++;
+        }
+    }
+};
+#endif
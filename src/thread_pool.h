@@ -0,0 +1,131 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads pulling jobs from a shared FIFO queue. Jobs must not touch OpenGL:
+// the context only lives on the thread that created it.
+class ThreadPool
+{
+public:
+    // threadCount = 0 uses one thread per hardware core, minus the one the render loop runs on
+    explicit ThreadPool(unsigned int threadCount = 0)
+    {
+        if (threadCount == 0)
+        {
+            unsigned int cores = std::thread::hardware_concurrency();
+            threadCount = cores > 1 ? cores - 1 : 1;
+        }
+        for (unsigned int i = 0; i < threadCount; i++)
+            workers.emplace_back([this] { workerLoop(); });
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wakeup.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    unsigned int size() const { return static_cast<unsigned int>(workers.size()); }
+
+    // queues a job and returns a future for its result
+    template <typename F>
+    auto submit(F job) -> std::future<decltype(job())>
+    {
+        using Result = decltype(job());
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::move(job));
+        std::future<Result> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push([task] { (*task)(); });
+        }
+        wakeup.notify_one();
+        return result;
+    }
+
+    // calls fn(i) for every i in [0, count) on the workers and the calling thread and returns once all calls are
+    // done. The caller works through the items as well instead of just waiting, so a job may call this too
+    // without deadlocking when every worker is busy.
+    template <typename F>
+    void parallelFor(size_t count, const F &fn)
+    {
+        if (count == 0)
+            return;
+        struct State {
+            std::atomic<size_t> next{0};
+            size_t done = 0;
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        auto state = std::make_shared<State>();
+        // helpers that only start after the last item was claimed find nothing to do and never touch fn
+        auto run = [state, count, &fn] {
+            for (size_t i; (i = state->next.fetch_add(1)) < count;)
+            {
+                fn(i);
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (++state->done == count)
+                    state->finished.notify_all();
+            }
+        };
+        size_t helpers = std::min<size_t>(workers.size(), count - 1);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < helpers; i++)
+                jobs.push(run);
+        }
+        wakeup.notify_all();
+        run();
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->finished.wait(lock, [&] { return state->done == count; });
+    }
+
+    // the process-wide pool shared by all loaders
+    static ThreadPool &shared()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> jobs;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool stopping = false;
+
+    void workerLoop()
+    {
+        for (;;)
+        {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wakeup.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (stopping && jobs.empty())
+                    return;
+                job = std::move(jobs.front());
+                jobs.pop();
+            }
+            job();
+        }
+    }
+};
+#endif
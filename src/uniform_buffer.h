@@ -0,0 +1,195 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "profiler.h"
+#include "shader.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+// std140 mirrors of the uniform blocks shared by the shaders. Only vec4/mat4 members, so the C++ layout matches
+// std140 without manual padding. Shader blocks must be declared in exactly this order:
+//
+//   layout (std140) uniform FrameUniforms {
+//       mat4 view; mat4 projection; vec4 viewPos;
+//       DirLight dirLight; PointLight pointLights[MAX_POINT_LIGHTS]; ivec4 lightCounts;
+//       mat4 inverseViewProjection;
+//   };
+//   layout (std140) uniform ObjectUniforms { mat4 model; mat4 normalMatrix; };
+// (src/shaders/uniforms.glsl declares both; ShaderPermutations injects MAX_POINT_LIGHTS, so it only changes here)
+#define MAX_POINT_LIGHTS 8
+
+struct GpuDirLight {
+    glm::vec4 direction;
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+};
+
+struct GpuPointLight {
+    glm::vec4 position;
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+    glm::vec4 attenuation;   // constant, linear, quadratic, radius (pointLightRadius)
+};
+
+// how far a point light reaches: past this distance its brightest channel (ambient, diffuse and specular at full
+// strength) attenuates below 1/256, less than one step of an 8-bit target. Infinite without a falling off term.
+inline float pointLightRadius(const GpuPointLight &light)
+{
+    glm::vec3 strongest = glm::vec3(light.ambient + light.diffuse + light.specular);
+    float brightest = std::max(strongest.x, std::max(strongest.y, strongest.z));
+    // solve constant + linear * d + quadratic * d^2 = 256 * brightest
+    float c = light.attenuation.x - 256.0f * brightest, l = light.attenuation.y, q = light.attenuation.z;
+    if (c >= 0.0f)
+        return 0.0f;
+    if (q > 0.0f)
+        return (-l + sqrtf(l * l - 4.0f * q * c)) / (2.0f * q);
+    if (l > 0.0f)
+        return -c / l;
+    return std::numeric_limits<float>::infinity();
+}
+
+struct FrameUniforms {
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 viewPos;
+    GpuDirLight dirLight;
+    GpuPointLight pointLights[MAX_POINT_LIGHTS];
+    int lightCounts[4];      // x: point lights in use
+    glm::mat4 inverseViewProjection; // rebuilds world positions from depth (deferred lighting)
+};
+
+struct ObjectUniforms {
+    glm::mat4 model;
+    glm::mat4 normalMatrix;  // transpose(inverse(model)), computed once on the CPU instead of per vertex
+};
+
+// a uniform buffer holding one FrameUniforms, rewritten once per frame
+class FrameUniformBuffer
+{
+public:
+    FrameUniforms data;
+
+    FrameUniformBuffer()
+    {
+        memset((void *)&data, 0, sizeof(data));
+        glGenBuffers(1, &UBO);
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, UBO);
+    }
+
+    ~FrameUniformBuffer() { release(); }
+
+    FrameUniformBuffer(const FrameUniformBuffer &) = delete;
+    FrameUniformBuffer &operator=(const FrameUniformBuffer &) = delete;
+
+    // uploads data in one call
+    void upload()
+    {
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        Shader::uniformCalls++;
+        Profiler::shared().countUpload(sizeof(FrameUniforms));
+    }
+
+    // deletes the buffer while the context is still current; the destructor does it too
+    void release()
+    {
+        glDeleteBuffers(1, &UBO);
+        UBO = 0;
+    }
+
+private:
+    unsigned int UBO;
+};
+
+// Per-object constants for a whole frame. Objects are pushed while building the frame, uploaded together with a
+// single glBufferData and selected per draw with glBindBufferRange.
+class ObjectUniformBuffer
+{
+public:
+    ObjectUniformBuffer()
+    {
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        stride = (unsigned int)((sizeof(ObjectUniforms) + alignment - 1) / alignment * alignment);
+        glGenBuffers(1, &UBO);
+    }
+
+    ~ObjectUniformBuffer() { release(); }
+
+    ObjectUniformBuffer(const ObjectUniformBuffer &) = delete;
+    ObjectUniformBuffer &operator=(const ObjectUniformBuffer &) = delete;
+
+    // starts a new frame
+    void reset()
+    {
+        staging.clear();
+    }
+
+    // adds an object and returns its slot for bind()
+    unsigned int push(const glm::mat4 &model)
+    {
+        unsigned int slot = (unsigned int)(staging.size() / stride);
+        staging.resize(staging.size() + stride);
+        ObjectUniforms object;
+        object.model = model;
+        object.normalMatrix = glm::transpose(glm::inverse(model));
+        memcpy(staging.data() + (size_t)slot * stride, &object, sizeof(object));
+        return slot;
+    }
+
+    // uploads every object pushed this frame
+    void upload()
+    {
+        if (staging.empty())
+            return;
+        glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+        // orphan and refill, the driver can hand us fresh storage while last frame's draws still read the old one
+        if (staging.size() > capacity)
+        {
+            capacity = staging.size();
+            glBufferData(GL_UNIFORM_BUFFER, capacity, staging.data(), GL_STREAM_DRAW);
+        }
+        else
+        {
+            glBufferData(GL_UNIFORM_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+            glBufferSubData(GL_UNIFORM_BUFFER, 0, staging.size(), staging.data());
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        Shader::uniformCalls++;
+        Profiler::shared().countUpload(staging.size());
+    }
+
+    // makes slot the ObjectUniforms block seen by the following draws
+    void bind(unsigned int slot) const
+    {
+        glBindBufferRange(GL_UNIFORM_BUFFER, OBJECT_UNIFORM_BINDING, UBO, (GLintptr)slot * stride, sizeof(ObjectUniforms));
+        Shader::uniformCalls++;
+    }
+
+    void release()
+    {
+        glDeleteBuffers(1, &UBO);
+        UBO = 0;
+        capacity = 0;
+    }
+
+private:
+    unsigned int UBO;
+    unsigned int stride;
+    size_t capacity = 0;
+    std::vector<unsigned char> staging;
+};
+#endif
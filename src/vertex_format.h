@@ -0,0 +1,250 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Compact GPU vertex layouts. The importer still builds the full 88 byte Vertex (see mesh.h); it is packed into
+// one of these layouts just before upload. Attribute locations keep their meaning so shaders only change decoding:
+//   0 position  vec3   float3, or half4 when half precision is accurate enough for the mesh
+//   1 normal    vec2   octahedral encoded, 2 x snorm16 (decode with octDecode in the vertex shader)
+//   2 uv        vec2   float2, or half2
+//   3 tangent   vec4   octahedral encoded tangent in xy, bitangent sign in z, 4 x snorm8 (bitangent = cross(N, T) * z)
+//   5 bone ids  uvec4  4 x uint8, skinned meshes only
+//   6 weights   vec4   4 x unorm8, skinned meshes only
+// Location 4 (bitangent) is no longer uploaded.
+enum VertexLayoutFlags {
+    VERTEX_POSITION_HALF = 1 << 0,
+    VERTEX_UV_HALF       = 1 << 1,
+    VERTEX_TANGENTS      = 1 << 2,
+    VERTEX_SKINNED       = 1 << 3
+};
+
+// largest position rounding error half floats may introduce, relative to the mesh's bounding box diagonal
+const float VERTEX_HALF_POSITION_TOLERANCE = 1.0f / 4096.0f;
+// largest texture coordinate rounding error half floats may introduce (about half a texel at 1024x1024)
+const float VERTEX_HALF_UV_TOLERANCE = 1.0f / 2048.0f;
+
+struct VertexLayout {
+    uint32_t flags = 0;
+
+    unsigned int positionSize() const { return flags & VERTEX_POSITION_HALF ? 8 : 12; }
+    unsigned int uvSize() const { return flags & VERTEX_UV_HALF ? 4 : 8; }
+
+    unsigned int normalOffset() const { return positionSize(); }
+    unsigned int tangentOffset() const { return normalOffset() + 4; }
+    unsigned int uvOffset() const { return tangentOffset() + (flags & VERTEX_TANGENTS ? 4 : 0); }
+    unsigned int boneOffset() const { return uvOffset() + uvSize(); }
+    unsigned int stride() const { return boneOffset() + (flags & VERTEX_SKINNED ? 8 : 0); }
+
+    // binds the attribute pointers for the currently bound VAO and GL_ARRAY_BUFFER
+    void setupAttributes(size_t baseOffset = 0) const
+    {
+        GLsizei s = stride();
+        // vertex positions
+        glEnableVertexAttribArray(0);
+        if (flags & VERTEX_POSITION_HALF)
+            glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, s, (void *)baseOffset);
+        else
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, s, (void *)baseOffset);
+        // octahedral normals
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, s, (void *)(baseOffset + normalOffset()));
+        // texture coords
+        glEnableVertexAttribArray(2);
+        if (flags & VERTEX_UV_HALF)
+            glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, s, (void *)(baseOffset + uvOffset()));
+        else
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, s, (void *)(baseOffset + uvOffset()));
+        // tangent frame
+        if (flags & VERTEX_TANGENTS)
+        {
+            glEnableVertexAttribArray(3);
+            glVertexAttribPointer(3, 4, GL_BYTE, GL_TRUE, s, (void *)(baseOffset + tangentOffset()));
+        }
+        else
+            glDisableVertexAttribArray(3);
+        glDisableVertexAttribArray(4);
+        // bone ids and weights
+        if (flags & VERTEX_SKINNED)
+        {
+            glEnableVertexAttribArray(5);
+            glVertexAttribIPointer(5, 4, GL_UNSIGNED_BYTE, s, (void *)(baseOffset + boneOffset()));
+            glEnableVertexAttribArray(6);
+            glVertexAttribPointer(6, 4, GL_UNSIGNED_BYTE, GL_TRUE, s, (void *)(baseOffset + boneOffset() + 4));
+        }
+        else
+        {
+            glDisableVertexAttribArray(5);
+            glDisableVertexAttribArray(6);
+        }
+    }
+};
+
+class VertexPacker
+{
+public:
+    // picks the smallest layout that represents the vertices within tolerance
+    template <typename V>
+    static VertexLayout chooseLayout(const std::vector<V> &vertices, bool hasTangents, bool skinned)
+    {
+        VertexLayout layout;
+        if (hasTangents)
+            layout.flags |= VERTEX_TANGENTS;
+        if (skinned)
+            layout.flags |= VERTEX_SKINNED;
+        if (vertices.empty())
+            return layout;
+
+        // bone ids are packed as uint8; a rig past that would silently skin against the wrong bones, and the
+        // shaders take fewer than 256 anyway (MAX_SHADER_BONES), so such meshes go without their bones
+        if (skinned)
+        {
+            int maxBone = 0;
+            for (const V &v : vertices)
+                for (int k = 0; k < 4; k++)
+                    maxBone = std::max(maxBone, v.m_BoneIDs[k]);
+            if (maxBone > 255)
+            {
+                printf("[vertex_format.h] Mesh uses bone %d, bone ids are packed to 8 bits: dropping its bones\n", maxBone);
+                layout.flags &= ~VERTEX_SKINNED;
+            }
+        }
+
+        glm::vec3 minPos = vertices[0].Position, maxPos = vertices[0].Position;
+        float maxPosError = 0.0f, maxUvError = 0.0f;
+        for (const V &v : vertices)
+        {
+            minPos = glm::min(minPos, v.Position);
+            maxPos = glm::max(maxPos, v.Position);
+            for (int k = 0; k < 3; k++)
+                maxPosError = std::max(maxPosError, halfError(v.Position[k]));
+            for (int k = 0; k < 2; k++)
+                maxUvError = std::max(maxUvError, halfError(v.TexCoords[k]));
+        }
+        float diagonal = glm::length(maxPos - minPos);
+        if (maxPosError <= diagonal * VERTEX_HALF_POSITION_TOLERANCE)
+            layout.flags |= VERTEX_POSITION_HALF;
+        if (maxUvError <= VERTEX_HALF_UV_TOLERANCE)
+            layout.flags |= VERTEX_UV_HALF;
+        return layout;
+    }
+
+    // packs vertices into the layout; out receives vertices.size() * layout.stride() bytes
+    template <typename V>
+    static void pack(const std::vector<V> &vertices, const VertexLayout &layout, std::vector<unsigned char> &out)
+    {
+        unsigned int stride = layout.stride();
+        out.assign(vertices.size() * stride, 0);
+        for (size_t i = 0; i < vertices.size(); i++)
+        {
+            const V &v = vertices[i];
+            unsigned char *dst = out.data() + i * stride;
+
+            if (layout.flags & VERTEX_POSITION_HALF)
+            {
+                uint16_t p[4] = {glm::packHalf1x16(v.Position.x), glm::packHalf1x16(v.Position.y), glm::packHalf1x16(v.Position.z), glm::packHalf1x16(1.0f)};
+                memcpy(dst, p, sizeof(p));
+            }
+            else
+                memcpy(dst, &v.Position, 12);
+
+            glm::vec2 n = octEncode(v.Normal);
+            int16_t normal[2] = {toSnorm16(n.x), toSnorm16(n.y)};
+            memcpy(dst + layout.normalOffset(), normal, sizeof(normal));
+
+            if (layout.flags & VERTEX_TANGENTS)
+            {
+                glm::vec2 t = octEncode(v.Tangent);
+                // handedness of the tangent frame, so the shader can rebuild the bitangent
+                float sign = glm::dot(glm::cross(v.Normal, v.Tangent), v.Bitangent) < 0.0f ? -1.0f : 1.0f;
+                int8_t tangent[4] = {toSnorm8(t.x), toSnorm8(t.y), toSnorm8(sign), 0};
+                memcpy(dst + layout.tangentOffset(), tangent, sizeof(tangent));
+            }
+
+            if (layout.flags & VERTEX_UV_HALF)
+            {
+                uint16_t uv[2] = {glm::packHalf1x16(v.TexCoords.x), glm::packHalf1x16(v.TexCoords.y)};
+                memcpy(dst + layout.uvOffset(), uv, sizeof(uv));
+            }
+            else
+                memcpy(dst + layout.uvOffset(), &v.TexCoords, 8);
+
+            if (layout.flags & VERTEX_SKINNED)
+            {
+                uint8_t bones[8];
+                for (int k = 0; k < 4; k++)
+                {
+                    bones[k] = (uint8_t)std::min(std::max(v.m_BoneIDs[k], 0), 255);
+                    bones[4 + k] = (uint8_t)std::lround(std::min(std::max(v.m_Weights[k], 0.0f), 1.0f) * 255.0f);
+                }
+                memcpy(dst + layout.boneOffset(), bones, sizeof(bones));
+            }
+        }
+    }
+
+    // largest bone id of count vertices packed with layout, 0 for layouts without bones
+    static unsigned int maxBoneId(const unsigned char *packed, size_t count, const VertexLayout &layout)
+    {
+        if (!(layout.flags & VERTEX_SKINNED))
+            return 0;
+        unsigned int stride = layout.stride(), result = 0;
+        for (size_t i = 0; i < count; i++)
+        {
+            const unsigned char *bones = packed + i * stride + layout.boneOffset();
+            result = std::max(result, (unsigned int)std::max(std::max(bones[0], bones[1]), std::max(bones[2], bones[3])));
+        }
+        return result;
+    }
+
+    // octahedral mapping of a unit vector onto the [-1, 1] square
+    static glm::vec2 octEncode(glm::vec3 n)
+    {
+        float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+        if (l1 == 0.0f)
+            return glm::vec2(0.0f, 0.0f);
+        n /= l1;
+        glm::vec2 p(n.x, n.y);
+        if (n.z < 0.0f)
+        {
+            p.x = (1.0f - std::fabs(n.y)) * (n.x >= 0.0f ? 1.0f : -1.0f);
+            p.y = (1.0f - std::fabs(n.x)) * (n.y >= 0.0f ? 1.0f : -1.0f);
+        }
+        return p;
+    }
+
+    static glm::vec3 octDecode(glm::vec2 e)
+    {
+        glm::vec3 n(e.x, e.y, 1.0f - std::fabs(e.x) - std::fabs(e.y));
+        float t = std::max(-n.z, 0.0f);
+        n.x += n.x >= 0.0f ? -t : t;
+        n.y += n.y >= 0.0f ? -t : t;
+        return glm::normalize(n);
+    }
+
+private:
+    static float halfError(float value)
+    {
+        return std::fabs(glm::unpackHalf1x16(glm::packHalf1x16(value)) - value);
+    }
+
+    static int16_t toSnorm16(float v)
+    {
+        return (int16_t)std::lround(std::min(std::max(v, -1.0f), 1.0f) * 32767.0f);
+    }
+
+    static int8_t toSnorm8(float v)
+    {
+        return (int8_t)std::lround(std::min(std::max(v, -1.0f), 1.0f) * 127.0f);
+    }
+};
+#endif